@@ -37,13 +37,75 @@
 
 extern int local_flag;
 
+/*
+ * The scan (hdb_foreach(), which also decrypts keys) runs in the main
+ * thread, entries are formatted by a pipeline of worker threads, and the
+ * lines are written out in scan order, so the output is the same as that of
+ * hdb_print_entry().
+ */
+
+struct dump_item {
+    hdb_entry_ex entry;
+    krb5_data line;
+    krb5_error_code ret;
+};
+
+struct dump_ctx {
+    struct pipeline *pipeline;
+    hdb_dump_format_t fmt;
+    FILE *out;
+};
+
+static void
+dump_format(void *ctx, void *arg)
+{
+    struct dump_ctx *d = ctx;
+    struct dump_item *item = arg;
+
+    item->ret = hdb_entry2dump(context, &item->entry.entry, d->fmt,
+                               &item->line);
+    hdb_free_entry(context, &item->entry);
+}
+
+static int
+dump_write(void *ctx, void *arg, int error)
+{
+    struct dump_ctx *d = ctx;
+    struct dump_item *item = arg;
+    krb5_error_code ret = item->ret;
+
+    if (error == 0 && item->line.length > 0 &&
+        fwrite(item->line.data, item->line.length, 1, d->out) != 1 &&
+        ret == 0)
+        ret = errno;
+    krb5_data_free(&item->line);
+    free(item);
+    return error ? 0 : ret;
+}
+
+static krb5_error_code
+dump_entry(krb5_context ctx, HDB *db, hdb_entry_ex *entry, void *data)
+{
+    struct dump_ctx *d = data;
+    struct dump_item *item;
+
+    if ((item = calloc(1, sizeof(*item))) == NULL)
+        return krb5_enomem(ctx);
+
+    /* Take the entry; hdb_foreach() will free what we leave behind */
+    item->entry = *entry;
+    memset(entry, 0, sizeof(*entry));
+    return pipeline_put(d->pipeline, item);
+}
+
 int
 dump(struct dump_options *opt, int argc, char **argv)
 {
     krb5_error_code ret;
     FILE *f;
-    struct hdb_print_entry_arg parg;
+    struct dump_ctx d;
     HDB *db = NULL;
+    int nthreads;
 
     if (!local_flag) {
 	krb5_warnx(context, "dump is only available in local (-l) mode");
@@ -68,16 +130,27 @@ dump(struct dump_options *opt, int argc, char **argv)
     }
 
     if (!opt->format_string || strcmp(opt->format_string, "Heimdal") == 0) {
-        parg.fmt = HDB_DUMP_HEIMDAL;
+        d.fmt = HDB_DUMP_HEIMDAL;
     } else if (opt->format_string && strcmp(opt->format_string, "MIT") == 0) {
-        parg.fmt = HDB_DUMP_MIT;
+        d.fmt = HDB_DUMP_MIT;
         fprintf(f, "kdb5_util load_dump version 5\n"); /* 5||6, either way */
     } else {
         krb5_errx(context, 1, "Supported dump formats: Heimdal and MIT");
     }
-    parg.out = f;
+    d.out = f;
+
+    nthreads = opt->threads_integer;
+    if (nthreads <= 0)
+        nthreads = pipeline_default_workers();
+    ret = pipeline_create(nthreads, dump_format, dump_write, &d, &d.pipeline);
+    if (ret) {
+        krb5_warn(context, ret, "dump");
+        db->hdb_close(context, db);
+        goto out;
+    }
     hdb_foreach(context, db, opt->decrypt_flag ? HDB_F_DECRYPT : 0,
-		hdb_print_entry, &parg);
+		dump_entry, &d);
+    (void) pipeline_finish(d.pipeline);
 
     db->hdb_close(context, db);
 out:
@@ -85,3 +158,31 @@ out:
 	fclose(f);
     return 0;
 }
+
+int
+rebuild_compact(void *opt, int argc, char **argv)
+{
+    krb5_error_code ret;
+    int locked;
+    HDB *db;
+
+    if (!local_flag) {
+	krb5_warnx(context, "rebuild-compact is only available in local (-l) mode");
+	return 0;
+    }
+
+    /* Keep kadmind and other writers out until all the records are in */
+    ret = kadm5_lock(kadm_handle);
+    if (ret && ret != KADM5_ALREADY_LOCKED) {
+	krb5_warn(context, ret, "kadm5_lock");
+	return 1;
+    }
+    locked = (ret == 0);
+    db = _kadm5_s_get_db(kadm_handle);
+    ret = hdb_rebuild_compact(context, db);
+    if (ret)
+	krb5_warn(context, ret, "rebuild-compact");
+    if (locked)
+	(void) kadm5_unlock(kadm_handle);
+    return ret != 0;
+}
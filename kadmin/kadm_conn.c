@@ -37,6 +37,7 @@
 #endif
 
 extern int daemon_child;
+extern int num_workers, worker_connections;
 
 struct kadm_port {
     char *port;
@@ -121,26 +122,32 @@ terminate(int sig)
     SIGRETURN(0);
 }
 
-static int
-spawn_child(krb5_context contextp, int *socks,
-	    unsigned int num_socks, int this_sock)
+/*
+ * accept() a connection on `sock' and log it.  The listening sockets are
+ * non-blocking when they are shared with worker processes, so losing the
+ * race for a connection to another process is not an error.
+ */
+static krb5_socket_t
+accept_connection(krb5_context contextp, krb5_socket_t sock)
 {
     int e;
-    size_t i;
     struct sockaddr_storage __ss;
     struct sockaddr *sa = (struct sockaddr *)&__ss;
     socklen_t sa_size = sizeof(__ss);
     krb5_socket_t s;
-    pid_t pid;
     krb5_address addr;
     char buf[128];
     size_t buf_len;
 
-    s = accept(socks[this_sock], sa, &sa_size);
+    s = accept(sock, sa, &sa_size);
     if(rk_IS_BAD_SOCKET(s)) {
-	krb5_warn(contextp, rk_SOCK_ERRNO, "accept");
-	return 1;
+	e = rk_SOCK_ERRNO;
+	if (e != EAGAIN && e != EWOULDBLOCK && e != EINTR)
+	    krb5_warn(contextp, e, "accept");
+	return s;
     }
+    socket_set_nonblocking(s, 0);
+
     e = krb5_sockaddr2address(contextp, sa, &addr);
     if(e)
 	krb5_warn(contextp, e, "krb5_sockaddr2address");
@@ -153,6 +160,20 @@ spawn_child(krb5_context contextp, int *socks,
 	    krb5_warnx(contextp, "connection from %s", buf);
 	krb5_free_address(contextp, &addr);
     }
+    return s;
+}
+
+static int
+spawn_child(krb5_context contextp, int *socks,
+	    unsigned int num_socks, int this_sock)
+{
+    size_t i;
+    krb5_socket_t s;
+    pid_t pid;
+
+    s = accept_connection(contextp, socks[this_sock]);
+    if(rk_IS_BAD_SOCKET(s))
+	return 1;
 
     pid = fork();
     if(pid == 0) {
@@ -169,9 +190,207 @@ spawn_child(krb5_context contextp, int *socks,
     return 1;
 }
 
+/*
+ * Pre-forked workers.
+ *
+ * Each worker accepts connections on the listening sockets itself and
+ * serves them one at a time, keeping its kadm5 server context from one
+ * connection to the next (see server.c), and exits after
+ * `worker_connections' of them to be replaced by a fresh one.
+ *
+ * Workers tell the master when they become busy or idle by writing a
+ * struct worker to a pipe.  While all the workers are busy the master
+ * accepts new connections itself and forks a process for each, as it
+ * does without workers, so that long-lived sessions cannot keep other
+ * clients waiting.  The workers exit when they see EOF on the `islive'
+ * pipe, that is, when the master is gone.
+ */
+
+struct worker {
+    pid_t pid;
+    int busy;
+};
+
+static RETSIGTYPE
+sigchld_wakeup(int sig)
+{
+    /* Just interrupt select(); the master reaps its children itself */
+    SIGRETURN(0);
+}
+
+static void
+worker_loop(krb5_context contextp, krb5_socket_t *socks,
+	    unsigned int num_socks, krb5_keytab keytab,
+	    int status_fd, int islive)
+{
+    struct worker me;
+    unsigned int i;
+    int e, served = 0;
+    fd_set orig_read_set, read_set;
+    int max_fd = islive;
+    krb5_socket_t s;
+
+    signal(SIGCHLD, SIG_DFL);
+
+    FD_ZERO(&orig_read_set);
+    FD_SET(islive, &orig_read_set);
+    for(i = 0; i < num_socks; i++) {
+	FD_SET(socks[i], &orig_read_set);
+	max_fd = max(max_fd, socks[i]);
+    }
+
+    me.pid = getpid();
+    while (term_flag == 0 &&
+	   (worker_connections <= 0 || served < worker_connections)) {
+	read_set = orig_read_set;
+	e = select(max_fd + 1, &read_set, NULL, NULL, NULL);
+	if(rk_IS_SOCKET_ERROR(e)) {
+	    if(rk_SOCK_ERRNO != EINTR)
+		krb5_warn(contextp, rk_SOCK_ERRNO, "select");
+	    continue;
+	}
+	if (FD_ISSET(islive, &read_set))
+	    break;
+	for(i = 0; i < num_socks; i++) {
+	    if(!FD_ISSET(socks[i], &read_set))
+		continue;
+	    s = accept_connection(contextp, socks[i]);
+	    if(rk_IS_BAD_SOCKET(s))
+		continue;
+
+	    me.busy = 1;
+	    (void) write(status_fd, &me, sizeof(me));
+	    kadmind_loop(contextp, keytab, s);
+	    rk_closesocket(s);
+	    served++;
+	    me.busy = 0;
+	    (void) write(status_fd, &me, sizeof(me));
+	    break;
+	}
+    }
+    exit(0);
+}
+
+static void
+wait_for_connection_workers(krb5_context contextp, krb5_socket_t *socks,
+			    unsigned int num_socks, krb5_keytab keytab)
+{
+    struct worker *workers, st[16];
+    fd_set read_set;
+    struct timeval tv;
+    unsigned int i;
+    int e, n, status, idle, max_fd;
+    int status_pipe[2], islive[2];
+    ssize_t len;
+    pid_t pid;
+
+    workers = calloc(num_workers, sizeof(*workers));
+    if (workers == NULL)
+	krb5_err(contextp, 1, errno, "calloc");
+    for (n = 0; n < num_workers; n++)
+	workers[n].pid = (pid_t)-1;
+
+    if (pipe(status_pipe) == -1 || pipe(islive) == -1)
+	krb5_err(contextp, 1, errno, "pipe");
+
+    max_fd = max(status_pipe[0], islive[0]);
+    for(i = 0; i < num_socks; i++) {
+	socket_set_nonblocking(socks[i], 1);
+	max_fd = max(max_fd, socks[i]);
+    }
+#ifdef FD_SETSIZE
+    if (max_fd >= FD_SETSIZE)
+	errx (1, "fd too large");
+#endif
+
+    signal(SIGCHLD, sigchld_wakeup);
+
+    while (term_flag == 0) {
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	    for (n = 0; n < num_workers; n++) {
+		if (workers[n].pid == pid) {
+		    workers[n].pid = (pid_t)-1;
+		    break;
+		}
+	    }
+	}
+
+	idle = 0;
+	for (n = 0; n < num_workers; n++) {
+	    if (workers[n].pid == (pid_t)-1) {
+		pid = fork();
+		if (pid == 0) {
+		    close(status_pipe[0]);
+		    close(islive[1]);
+		    worker_loop(contextp, socks, num_socks, keytab,
+				status_pipe[1], islive[0]);
+		}
+		if (pid == (pid_t)-1) {
+		    krb5_warn(contextp, errno, "fork");
+		    sleep(1);
+		    break;
+		}
+		workers[n].pid = pid;
+		workers[n].busy = 0;
+	    }
+	    if (!workers[n].busy)
+		idle++;
+	}
+
+	FD_ZERO(&read_set);
+	FD_SET(status_pipe[0], &read_set);
+	if (idle == 0) {
+	    for(i = 0; i < num_socks; i++)
+		FD_SET(socks[i], &read_set);
+	}
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	e = select(max_fd + 1, &read_set, NULL, NULL, &tv);
+	if(rk_IS_SOCKET_ERROR(e)) {
+	    if(rk_SOCK_ERRNO != EINTR)
+		krb5_warn(contextp, rk_SOCK_ERRNO, "select");
+	    continue;
+	}
+
+	if (FD_ISSET(status_pipe[0], &read_set)) {
+	    /* Writes of a struct worker to a pipe are atomic */
+	    len = read(status_pipe[0], st, sizeof(st));
+	    for (e = 0; len > 0 && e < len / (ssize_t)sizeof(st[0]); e++) {
+		for (n = 0; n < num_workers; n++) {
+		    if (workers[n].pid == st[e].pid) {
+			workers[n].busy = st[e].busy;
+			break;
+		    }
+		}
+	    }
+	}
+
+	if (idle > 0)
+	    continue;
+	for(i = 0; i < num_socks; i++) {
+	    if(FD_ISSET(socks[i], &read_set) &&
+	       spawn_child(contextp, socks, num_socks, i) == 0) {
+		close(status_pipe[0]);
+		close(status_pipe[1]);
+		close(islive[0]);
+		close(islive[1]);
+		free(workers);
+		return;
+	    }
+	}
+    }
+    signal(SIGCHLD, SIG_IGN);
+
+    while ((waitpid(-1, &status, WNOHANG)) > 0)
+	;
+
+    exit(0);
+}
+
 static void
 wait_for_connection(krb5_context contextp,
-		    krb5_socket_t *socks, unsigned int num_socks)
+		    krb5_socket_t *socks, unsigned int num_socks,
+		    krb5_keytab keytab)
 {
     unsigned int i;
     int e;
@@ -197,6 +416,12 @@ wait_for_connection(krb5_context contextp,
 
     signal(SIGTERM, terminate);
     signal(SIGINT, terminate);
+
+    if (num_workers > 0) {
+	wait_for_connection_workers(contextp, socks, num_socks, keytab);
+	return;
+    }
+
     signal(SIGCHLD, sigchld);
 
     while (term_flag == 0) {
@@ -225,7 +450,7 @@ wait_for_connection(krb5_context contextp,
 
 
 void
-start_server(krb5_context contextp, const char *port_str)
+start_server(krb5_context contextp, const char *port_str, krb5_keytab keytab)
 {
     int e;
     struct kadm_port *p;
@@ -297,6 +522,6 @@ start_server(krb5_context contextp, const char *port_str)
 
     roken_detach_finish(NULL, daemon_child);
 
-    wait_for_connection(contextp, socks, num_socks);
+    wait_for_connection(contextp, socks, num_socks, keytab);
     free(socks);
 }
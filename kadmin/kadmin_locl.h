@@ -134,6 +134,18 @@ foreach_principal(const char *, int (*)(krb5_principal, void*),
 
 int parse_des_key (const char *, krb5_key_data *, const char **);
 
+/* pipeline.c */
+
+struct pipeline;
+typedef void (*pipeline_work_f)(void *, void *);
+typedef int (*pipeline_out_f)(void *, void *, int);
+
+int pipeline_create(int, pipeline_work_f, pipeline_out_f, void *,
+                    struct pipeline **);
+int pipeline_put(struct pipeline *, void *);
+int pipeline_finish(struct pipeline *);
+int pipeline_default_workers(void);
+
 /* random_password.c */
 
 void
@@ -144,7 +156,7 @@ random_password(char *, size_t);
 extern sig_atomic_t term_flag, doing_useful_work;
 
 void parse_ports(krb5_context, const char*);
-void start_server(krb5_context, const char*);
+void start_server(krb5_context, const char*, krb5_keytab);
 
 /* server.c */
 
@@ -47,6 +47,8 @@ char *realm;
 
 static int detach_from_console = -1;
 int daemon_child = -1;
+int num_workers = 0;
+int worker_connections = 1000;
 
 static struct getargs args[] = {
     {
@@ -81,6 +83,10 @@ static struct getargs args[] = {
     },
     {	"ports",	'p',	arg_string, &port_str,
 	"ports to listen to", "port" },
+    {	"workers",	0,	arg_integer, &num_workers,
+	"number of pre-forked worker processes", "number" },
+    {	"worker-connections", 0, arg_integer, &worker_connections,
+	"connections served by a worker before it is replaced", "number" },
     {	"help",		'h',	arg_flag,   &help_flag, NULL, NULL },
     {	"version",	'v',	arg_flag,   &version_flag, NULL, NULL }
 };
@@ -176,6 +182,9 @@ main(int argc, char **argv)
     if (ret)
 	krb5_err(context, 1, ret, "kadm5_add_passwd_quality_verifier");
 
+    if(realm)
+	krb5_set_default_realm(context, realm); /* XXX */
+
     if(debug_flag) {
 	int debug_port;
 
@@ -187,7 +196,7 @@ main(int argc, char **argv)
 	mini_inetd(debug_port, &sfd);
     } else {
 #ifdef _WIN32
-	start_server(context, port_str);
+	start_server(context, port_str, keytab);
 #else
 	struct sockaddr_storage __ss;
 	struct sockaddr *sa = (struct sockaddr *)&__ss;
@@ -200,15 +209,12 @@ main(int argc, char **argv)
 
 	if(roken_getsockname(STDIN_FILENO, sa, &sa_size) < 0 &&
 	   rk_SOCK_ERRNO == ENOTSOCK) {
-	    start_server(context, port_str);
+	    start_server(context, port_str, keytab);
 	}
 #endif /* _WIN32 */
 	sfd = STDIN_FILENO;
     }
 
-    if(realm)
-	krb5_set_default_realm(context, realm); /* XXX */
-
     kadmind_loop(context, keytab, sfd);
 
     return 0;
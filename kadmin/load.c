@@ -354,22 +354,213 @@ parse_extensions(char *str, HDB_extensions **e)
 }
 
 
+/*
+ * Dump lines are parsed into entries by a pipeline of worker threads, and
+ * the entries (or complaints about the lines) are stored (or printed) in
+ * order by the thread reading the dump, so the result is the same as that
+ * of parsing and storing one line at a time.
+ */
+
+struct load_item {
+    char *line;         /* parsed (and modified) in place */
+    int lineno;
+    hdb_entry_ex ent;
+    char *err;          /* complaint to print instead of storing the entry */
+};
+
+struct load_ctx {
+    struct pipeline *pipeline;
+    const char *filename;
+    HDB *db;
+};
+
+static void
+load_complain(struct load_item *item, const char *fmt, ...)
+    __attribute__ ((__format__ (__printf__, 2, 3)));
+
+static void
+load_complain(struct load_item *item, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (vasprintf(&item->err, fmt, ap) == -1)
+	krb5_errx (context, 1, "malloc: out of memory");
+    va_end(ap);
+    hdb_free_entry (context, &item->ent);
+    memset(&item->ent, 0, sizeof(item->ent));
+}
+
+static void
+load_parse(void *ctx, void *arg)
+{
+    struct load_ctx *l = ctx;
+    struct load_item *item = arg;
+    const char *filename = l->filename;
+    int line = item->lineno;
+    char *s = item->line;
+    char *p;
+    struct entry e;
+    krb5_error_code ret;
+
+    p = s;
+    while (isspace((unsigned char)*p))
+	p++;
+
+    e.principal = p;
+    for(p = s; *p; p++){
+	if(*p == '\\')
+	    p++;
+	else if(isspace((unsigned char)*p)) {
+	    *p = 0;
+	    break;
+	}
+    }
+    p = skip_next(p);
+
+    e.key = p;
+    p = skip_next(p);
+
+    e.created = p;
+    p = skip_next(p);
+
+    e.modified = p;
+    p = skip_next(p);
+
+    e.valid_start = p;
+    p = skip_next(p);
+
+    e.valid_end = p;
+    p = skip_next(p);
+
+    e.pw_end = p;
+    p = skip_next(p);
+
+    e.max_life = p;
+    p = skip_next(p);
+
+    e.max_renew = p;
+    p = skip_next(p);
+
+    e.flags = p;
+    p = skip_next(p);
+
+    e.generation = p;
+    p = skip_next(p);
+
+    e.extensions = p;
+    skip_next(p);
+
+    memset(&item->ent, 0, sizeof(item->ent));
+    ret = krb5_parse_name(context, e.principal, &item->ent.entry.principal);
+    if(ret) {
+	const char *msg = krb5_get_error_message(context, ret);
+	load_complain(item, "%s:%d:%s (%s)\n",
+		      filename, line, msg, e.principal);
+	krb5_free_error_message(context, msg);
+	return;
+    }
+
+    if (parse_keys(&item->ent.entry, e.key)) {
+	load_complain(item, "%s:%d:error parsing keys (%s)\n",
+		      filename, line, e.key);
+	return;
+    }
+
+    if (parse_event(&item->ent.entry.created_by, e.created) == -1) {
+	load_complain(item, "%s:%d:error parsing created event (%s)\n",
+		      filename, line, e.created);
+	return;
+    }
+    if (parse_event_alloc (&item->ent.entry.modified_by, e.modified) == -1) {
+	load_complain(item, "%s:%d:error parsing event (%s)\n",
+		      filename, line, e.modified);
+	return;
+    }
+    if (parse_time_string_alloc (&item->ent.entry.valid_start,
+				 e.valid_start) == -1) {
+	load_complain(item, "%s:%d:error parsing time (%s)\n",
+		      filename, line, e.valid_start);
+	return;
+    }
+    if (parse_time_string_alloc (&item->ent.entry.valid_end,
+				 e.valid_end) == -1) {
+	load_complain(item, "%s:%d:error parsing time (%s)\n",
+		      filename, line, e.valid_end);
+	return;
+    }
+    if (parse_time_string_alloc (&item->ent.entry.pw_end, e.pw_end) == -1) {
+	load_complain(item, "%s:%d:error parsing time (%s)\n",
+		      filename, line, e.pw_end);
+	return;
+    }
+
+    if (parse_integer_alloc (&item->ent.entry.max_life, e.max_life) == -1) {
+	load_complain(item, "%s:%d:error parsing lifetime (%s)\n",
+		      filename, line, e.max_life);
+	return;
+    }
+    if (parse_integer_alloc (&item->ent.entry.max_renew, e.max_renew) == -1) {
+	load_complain(item, "%s:%d:error parsing lifetime (%s)\n",
+		      filename, line, e.max_renew);
+	return;
+    }
+
+    if (parse_hdbflags2int (&item->ent.entry.flags, e.flags) != 1) {
+	load_complain(item, "%s:%d:error parsing flags (%s)\n",
+		      filename, line, e.flags);
+	return;
+    }
+
+    if(parse_generation(e.generation, &item->ent.entry.generation) == -1) {
+	load_complain(item, "%s:%d:error parsing generation (%s)\n",
+		      filename, line, e.generation);
+	return;
+    }
+
+    if(parse_extensions(e.extensions, &item->ent.entry.extensions) == -1) {
+	load_complain(item, "%s:%d:error parsing extension (%s)\n",
+		      filename, line, e.extensions);
+	return;
+    }
+}
+
+static int
+load_store(void *ctx, void *arg, int error)
+{
+    struct load_ctx *l = ctx;
+    struct load_item *item = arg;
+    krb5_error_code ret = 0;
+
+    if (error == 0 && item->err != NULL) {
+	fputs(item->err, stderr);
+    } else if (error == 0) {
+	ret = l->db->hdb_store(context, l->db, HDB_F_REPLACE, &item->ent);
+	if (ret)
+	    krb5_warn(context, ret, "db_store");
+    }
+    hdb_free_entry (context, &item->ent);
+    free(item->err);
+    free(item->line);
+    free(item);
+    return ret;
+}
+
 /*
  * Parse the dump file in `filename' and create the database (merging
  * iff merge)
  */
 
 static int
-doit(const char *filename, int mergep)
+doit(const char *filename, int mergep, int nthreads)
 {
     krb5_error_code ret = 0;
     FILE *f;
     char s[8192]; /* XXX should fix this properly */
-    char *p;
     int line;
     int flags = O_RDWR;
-    struct entry e;
-    hdb_entry_ex ent;
+    struct load_ctx l;
+    struct load_item *item;
     HDB *db = _kadm5_s_get_db(kadm_handle);
 
     f = fopen(filename, "r");
@@ -404,149 +595,32 @@ doit(const char *filename, int mergep)
 	fclose(f);
 	return 1;
     }
+
+    l.filename = filename;
+    l.db = db;
+    if (nthreads <= 0)
+	nthreads = pipeline_default_workers();
+    ret = pipeline_create(nthreads, load_parse, load_store, &l, &l.pipeline);
+    if (ret) {
+	krb5_warn(context, ret, "load");
+	(void) kadm5_log_end(kadm_handle);
+	db->hdb_close(context, db);
+	fclose(f);
+	return 1;
+    }
+
     line = 0;
-    ret = 0;
     while(fgets(s, sizeof(s), f) != NULL) {
 	line++;
 
-	p = s;
-	while (isspace((unsigned char)*p))
-	    p++;
-
-	e.principal = p;
-	for(p = s; *p; p++){
-	    if(*p == '\\')
-		p++;
-	    else if(isspace((unsigned char)*p)) {
-		*p = 0;
-		break;
-	    }
-	}
-	p = skip_next(p);
-
-	e.key = p;
-	p = skip_next(p);
-
-	e.created = p;
-	p = skip_next(p);
-
-	e.modified = p;
-	p = skip_next(p);
-
-	e.valid_start = p;
-	p = skip_next(p);
-
-	e.valid_end = p;
-	p = skip_next(p);
-
-	e.pw_end = p;
-	p = skip_next(p);
-
-	e.max_life = p;
-	p = skip_next(p);
-
-	e.max_renew = p;
-	p = skip_next(p);
-
-	e.flags = p;
-	p = skip_next(p);
-
-	e.generation = p;
-	p = skip_next(p);
-
-	e.extensions = p;
-	skip_next(p);
-
-	memset(&ent, 0, sizeof(ent));
-	ret = krb5_parse_name(context, e.principal, &ent.entry.principal);
-	if(ret) {
-	    const char *msg = krb5_get_error_message(context, ret);
-	    fprintf(stderr, "%s:%d:%s (%s)\n",
-		    filename, line, msg, e.principal);
-	    krb5_free_error_message(context, msg);
-	    continue;
-	}
-
-	if (parse_keys(&ent.entry, e.key)) {
-	    fprintf (stderr, "%s:%d:error parsing keys (%s)\n",
-		     filename, line, e.key);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	if (parse_event(&ent.entry.created_by, e.created) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing created event (%s)\n",
-		     filename, line, e.created);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-	if (parse_event_alloc (&ent.entry.modified_by, e.modified) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing event (%s)\n",
-		     filename, line, e.modified);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-	if (parse_time_string_alloc (&ent.entry.valid_start, e.valid_start) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing time (%s)\n",
-		     filename, line, e.valid_start);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-	if (parse_time_string_alloc (&ent.entry.valid_end,   e.valid_end) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing time (%s)\n",
-		     filename, line, e.valid_end);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-	if (parse_time_string_alloc (&ent.entry.pw_end,      e.pw_end) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing time (%s)\n",
-		     filename, line, e.pw_end);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	if (parse_integer_alloc (&ent.entry.max_life,  e.max_life) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing lifetime (%s)\n",
-		     filename, line, e.max_life);
-	    hdb_free_entry (context, &ent);
-	    continue;
-
-	}
-	if (parse_integer_alloc (&ent.entry.max_renew, e.max_renew) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing lifetime (%s)\n",
-		     filename, line, e.max_renew);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	if (parse_hdbflags2int (&ent.entry.flags, e.flags) != 1) {
-	    fprintf (stderr, "%s:%d:error parsing flags (%s)\n",
-		     filename, line, e.flags);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	if(parse_generation(e.generation, &ent.entry.generation) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing generation (%s)\n",
-		     filename, line, e.generation);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	if(parse_extensions(e.extensions, &ent.entry.extensions) == -1) {
-	    fprintf (stderr, "%s:%d:error parsing extension (%s)\n",
-		     filename, line, e.extensions);
-	    hdb_free_entry (context, &ent);
-	    continue;
-	}
-
-	ret = db->hdb_store(context, db, HDB_F_REPLACE, &ent);
-	hdb_free_entry (context, &ent);
-	if (ret) {
-	    krb5_warn(context, ret, "db_store");
+	item = calloc(1, sizeof(*item));
+	if (item == NULL || (item->line = strdup(s)) == NULL)
+	    krb5_errx (context, 1, "malloc: out of memory");
+	item->lineno = line;
+	if (pipeline_put(l.pipeline, item))
 	    break;
-	}
     }
+    ret = pipeline_finish(l.pipeline);
     (void) kadm5_log_end(kadm_handle);
     db->hdb_close(context, db);
     fclose(f);
@@ -557,24 +631,24 @@ doit(const char *filename, int mergep)
 extern int local_flag;
 
 static int
-loadit(int mergep, const char *name, int argc, char **argv)
+loadit(int mergep, const char *name, int nthreads, int argc, char **argv)
 {
     if(!local_flag) {
 	krb5_warnx(context, "%s is only available in local (-l) mode", name);
 	return 0;
     }
 
-    return doit(argv[0], mergep);
+    return doit(argv[0], mergep, nthreads);
 }
 
 int
-load(void *opt, int argc, char **argv)
+load(struct load_options *opt, int argc, char **argv)
 {
-    return loadit(0, "load", argc, argv);
+    return loadit(0, "load", opt->threads_integer, argc, argv);
 }
 
 int
-merge(void *opt, int argc, char **argv)
+merge(struct merge_options *opt, int argc, char **argv)
 {
-    return loadit(1, "merge", argc, argv);
+    return loadit(1, "merge", opt->threads_integer, argc, argv);
 }
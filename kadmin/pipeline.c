@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * An order-preserving pipeline for dump and load.
+ *
+ * The producer hands items to pipeline_put() in order.  Worker threads run
+ * the `work' function on them (e.g., formatting or parsing entries) in any
+ * order, and the `out' function is called on them in the producer's
+ * thread, in the order they were put (e.g., to write them out or store
+ * them).  So the output of a pipeline is the same as that of the serial
+ * loop of work followed by out, whatever the number of workers.
+ *
+ * Once `out' fails the pipeline's result is that error, and it is called
+ * on the remaining items with the error, so it can just release them.
+ *
+ * Without thread support, or with fewer than two workers, work and out are
+ * simply called from pipeline_put().
+ */
+
+#include "kadmin_locl.h"
+
+#if defined(ENABLE_PTHREAD_SUPPORT) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#define PIPELINE_THREADS 1
+#endif
+
+#define PIPELINE_MAX_WORKERS    64
+#define PIPELINE_DEPTH_PER      64
+
+enum slot_state { SLOT_EMPTY, SLOT_QUEUED, SLOT_DONE };
+
+struct slot {
+    void *item;
+    enum slot_state state;
+};
+
+struct pipeline {
+    pipeline_work_f work;
+    pipeline_out_f out;
+    void *ctx;
+    int error;
+    int nworkers;
+#ifdef PIPELINE_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     /* signaled when items are queued */
+    pthread_cond_t done_cv;     /* signaled when items are done */
+    pthread_t *workers;
+    struct slot *slots;
+    size_t depth;
+    size_t next_put;            /* sequence number of next item put */
+    size_t next_work;           /* sequence number of next item to work */
+    size_t next_out;            /* sequence number of next item out */
+    int closing;
+#endif
+};
+
+#ifdef PIPELINE_THREADS
+
+/* Pass done items to `out' in order; called and returns with lock held */
+static void
+pipeline_drain(struct pipeline *p)
+{
+    struct slot *s;
+    void *item;
+    int ret;
+
+    for (;;) {
+        s = &p->slots[p->next_out % p->depth];
+        if (p->next_out == p->next_put || s->state != SLOT_DONE)
+            break;
+        item = s->item;
+        s->item = NULL;
+        s->state = SLOT_EMPTY;
+        p->next_out++;
+
+        pthread_mutex_unlock(&p->lock);
+        ret = p->out(p->ctx, item, p->error);
+        pthread_mutex_lock(&p->lock);
+        if (ret && p->error == 0)
+            p->error = ret;
+    }
+}
+
+static void *
+pipeline_worker(void *arg)
+{
+    struct pipeline *p = arg;
+    struct slot *s;
+    void *item;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->next_work == p->next_put && !p->closing)
+            pthread_cond_wait(&p->work_cv, &p->lock);
+        if (p->next_work == p->next_put)
+            break;
+        s = &p->slots[p->next_work++ % p->depth];
+        item = s->item;
+
+        pthread_mutex_unlock(&p->lock);
+        p->work(p->ctx, item);
+        pthread_mutex_lock(&p->lock);
+
+        s->state = SLOT_DONE;
+        pthread_cond_signal(&p->done_cv);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+#endif /* PIPELINE_THREADS */
+
+int
+pipeline_create(int nworkers, pipeline_work_f work, pipeline_out_f out,
+                void *ctx, struct pipeline **pp)
+{
+    struct pipeline *p;
+#ifdef PIPELINE_THREADS
+    int i;
+#endif
+
+    *pp = NULL;
+    if ((p = calloc(1, sizeof(*p))) == NULL)
+        return ENOMEM;
+    p->work = work;
+    p->out = out;
+    p->ctx = ctx;
+    if (nworkers > PIPELINE_MAX_WORKERS)
+        nworkers = PIPELINE_MAX_WORKERS;
+
+#ifdef PIPELINE_THREADS
+    if (nworkers > 1) {
+        p->depth = nworkers * PIPELINE_DEPTH_PER;
+        p->slots = calloc(p->depth, sizeof(p->slots[0]));
+        p->workers = calloc(nworkers, sizeof(p->workers[0]));
+        if (p->slots == NULL || p->workers == NULL) {
+            free(p->slots);
+            free(p->workers);
+            free(p);
+            return ENOMEM;
+        }
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->work_cv, NULL);
+        pthread_cond_init(&p->done_cv, NULL);
+        for (i = 0; i < nworkers; i++) {
+            if (pthread_create(&p->workers[i], NULL, pipeline_worker, p) != 0)
+                break;
+        }
+        /* Make do with the workers we could start, if any */
+        p->nworkers = i;
+    }
+#endif
+
+    *pp = p;
+    return 0;
+}
+
+int
+pipeline_put(struct pipeline *p, void *item)
+{
+    int ret;
+
+#ifdef PIPELINE_THREADS
+    if (p->nworkers > 0) {
+        struct slot *s;
+
+        pthread_mutex_lock(&p->lock);
+        for (;;) {
+            pipeline_drain(p);
+            if (p->next_put - p->next_out < p->depth)
+                break;
+            pthread_cond_wait(&p->done_cv, &p->lock);
+        }
+        s = &p->slots[p->next_put++ % p->depth];
+        s->item = item;
+        s->state = SLOT_QUEUED;
+        pthread_cond_signal(&p->work_cv);
+        ret = p->error;
+        pthread_mutex_unlock(&p->lock);
+        return ret;
+    }
+#endif
+
+    p->work(p->ctx, item);
+    ret = p->out(p->ctx, item, p->error);
+    if (ret && p->error == 0)
+        p->error = ret;
+    return p->error;
+}
+
+/*
+ * Wait for all the items put to be passed to `out', stop the workers and
+ * free the pipeline.  Returns the first error returned by `out', if any.
+ */
+int
+pipeline_finish(struct pipeline *p)
+{
+    int ret;
+#ifdef PIPELINE_THREADS
+    int i;
+
+    if (p->nworkers > 0) {
+        pthread_mutex_lock(&p->lock);
+        p->closing = 1;
+        pthread_cond_broadcast(&p->work_cv);
+        for (;;) {
+            pipeline_drain(p);
+            if (p->next_out == p->next_put)
+                break;
+            pthread_cond_wait(&p->done_cv, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        for (i = 0; i < p->nworkers; i++)
+            pthread_join(p->workers[i], NULL);
+        pthread_cond_destroy(&p->work_cv);
+        pthread_cond_destroy(&p->done_cv);
+        pthread_mutex_destroy(&p->lock);
+    }
+    free(p->workers);
+    free(p->slots);
+#endif
+
+    ret = p->error;
+    free(p);
+    return ret;
+}
+
+/* Default number of workers: one per online CPU, within reason */
+int
+pipeline_default_workers(void)
+{
+#if defined(PIPELINE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 8)
+        return 8;
+    if (n > 1)
+        return (int)n;
+#endif
+    return 1;
+}
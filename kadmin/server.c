@@ -723,7 +723,7 @@ v5_loop (krb5_context contextp,
 	    exit(0);
 	ret = krb5_read_priv_message(contextp, ac, &fd, &in);
 	if(ret == HEIM_ERR_EOF)
-	    exit(0);
+	    return;
 	if(ret)
 	    krb5_err(contextp, 1, ret, "krb5_read_priv_message");
 	doing_useful_work = 1;
@@ -746,6 +746,50 @@ match_appl_version(const void *data, const char *appl_version)
     return 1;
 }
 
+/*
+ * A kadmind worker process serves many connections, so it keeps its server
+ * context (configuration, HDB handle, master key and iprop log socket) from
+ * one connection to the next.  Only the caller, and so its ACL, changes,
+ * unless a client asks for different realm parameters.
+ */
+static void *cached_handle;
+static krb5_data cached_params;
+
+static void *
+get_kadm_handle(krb5_context contextp,
+		const char *client,
+		krb5_data *params,
+		kadm5_config_params *realm_params)
+{
+    krb5_error_code ret;
+
+    if (cached_handle != NULL) {
+	if (krb5_data_cmp(params, &cached_params) == 0) {
+	    ret = _kadm5_s_set_caller(cached_handle, client);
+	    if (ret)
+		krb5_err(contextp, 1, ret, "_kadm5_s_set_caller");
+	    return cached_handle;
+	}
+	kadm5_destroy(cached_handle);
+	cached_handle = NULL;
+	krb5_data_free(&cached_params);
+    }
+
+    ret = kadm5_s_init_with_password_ctx(contextp,
+					 client,
+					 NULL,
+					 KADM5_ADMIN_SERVICE,
+					 realm_params,
+					 0, 0,
+					 &cached_handle);
+    if(ret)
+	krb5_err (contextp, 1, ret, "kadm5_init_with_password_ctx");
+    ret = krb5_data_copy(&cached_params, params->data, params->length);
+    if (ret)
+	krb5_err (contextp, 1, ret, "krb5_data_copy");
+    return cached_handle;
+}
+
 static void
 handle_v5(krb5_context contextp,
 	  krb5_keytab keytab,
@@ -761,6 +805,7 @@ handle_v5(krb5_context contextp,
 
     unsigned kadm_version = 1;
     kadm5_config_params realm_params;
+    krb5_data params;
 
     ret = krb5_recvauth_match_version(contextp, &ac, &fd,
 				      match_appl_version, &kadm_version,
@@ -781,9 +826,9 @@ handle_v5(krb5_context contextp,
     free (server_name);
 
     memset(&realm_params, 0, sizeof(realm_params));
+    krb5_data_zero(&params);
 
     if(kadm_version == 1) {
-	krb5_data params;
 	ret = krb5_read_priv_message(contextp, ac, &fd, &params);
 	if(ret)
 	    krb5_err(contextp, 1, ret, "krb5_read_priv_message");
@@ -795,16 +840,12 @@ handle_v5(krb5_context contextp,
     if (ret)
 	krb5_err (contextp, 1, ret, "krb5_unparse_name");
     krb5_free_ticket (contextp, ticket);
-    ret = kadm5_s_init_with_password_ctx(contextp,
-					 client,
-					 NULL,
-					 KADM5_ADMIN_SERVICE,
-					 &realm_params,
-					 0, 0,
-					 &kadm_handlep);
-    if(ret)
-	krb5_err (contextp, 1, ret, "kadm5_init_with_password_ctx");
+    kadm_handlep = get_kadm_handle(contextp, client, &params, &realm_params);
+    free(realm_params.realm);
+    krb5_data_free(&params);
+    free(client);
     v5_loop (contextp, ac, initial, kadm_handlep, fd);
+    krb5_auth_con_free(contextp, ac);
 }
 
 krb5_error_code
@@ -818,7 +859,7 @@ kadmind_loop(krb5_context contextp,
 
     n = krb5_net_read(contextp, &sock, buf, 4);
     if(n == 0)
-	exit(0);
+	return 0;
     if(n < 0)
 	krb5_err(contextp, 1, errno, "read");
     _krb5_get_int(buf, &len, 4);
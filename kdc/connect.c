@@ -199,6 +199,9 @@ struct descr {
     size_t size;
     size_t len;
     time_t timeout;
+    unsigned int nrequests;	/* served on this TCP connection so far */
+    int pk_wait;		/* a public-key helper has its request */
+    int http;
     struct sockaddr_storage __ss;
     struct sockaddr *sa;
     socklen_t sock_len;
@@ -415,6 +418,787 @@ send_reply(krb5_context context,
     }
 }
 
+/*
+ * Public-key requests, PKINIT AS-REQs and kx509 requests, take orders of
+ * magnitude more CPU than the symmetric-key AS and TGS requests.  When
+ * [kdc] pk-worker-processes is set each worker process hands them off to
+ * a few helper processes of its own and keeps serving the cheap requests
+ * meanwhile.
+ *
+ * The worker keeps the public-key requests in a bounded FIFO and sends
+ * each helper one at a time over a socketpair.  Requests that find the
+ * FIFO full, or that wait in it too long, are shed: the client gets a
+ * KDC_ERR_SVC_UNAVAILABLE error and can try another KDC.
+ */
+
+#ifdef HAVE_FORK
+
+/* seconds a request may wait for a helper before it is shed */
+#define PK_QUEUE_TIMEOUT 4
+
+enum pk_kind { PK_REQ_NONE = 0, PK_REQ_PKINIT, PK_REQ_KX509 };
+
+struct pk_job {
+    struct pk_job *next;
+    enum pk_kind kind;
+    krb5_socket_t s;		/* the listener for UDP, the connection for TCP */
+    int type;
+    krb5_boolean prependlength;
+    krb5_boolean served;	/* the reply went out */
+    time_t queued;
+    struct sockaddr_storage __ss;
+    socklen_t sock_len;
+    char addr_string[128];
+    unsigned char *buf;
+    size_t len;
+};
+
+struct pk_helper {
+    pid_t pid;
+    krb5_socket_t fd;		/* our end of the socketpair */
+    time_t started;
+    struct pk_job *job;		/* the request the helper is working on */
+};
+
+struct pk_request_hdr {
+    uint32_t len;
+    int32_t datagram_reply;
+    int32_t prependlength;
+    socklen_t sock_len;
+    struct sockaddr_storage ss;
+    char addr_string[128];
+};
+
+struct pk_reply_hdr {
+    uint32_t len;
+    int32_t ret;
+    int32_t prependlength;
+};
+
+static struct pk_helper *pk_helpers;
+static int num_pk_helpers;
+static struct pk_job *pk_queue_head;
+static struct pk_job **pk_queue_tail = &pk_queue_head;
+static int pk_queue_len;
+static struct pk_job *pk_done;	/* TCP requests to hand back to loop() */
+
+static void clear_descr(struct descr *);
+static void handle_vanilla_tcp(krb5_context, krb5_kdc_configuration *,
+			       struct descr *);
+
+/*
+ * Read the DER element at `*p, *len', leaving its contents in `*data,
+ * *data_len' and `*p, *len' on what follows it.
+ */
+
+static int
+pk_der_next(const unsigned char **p, size_t *len,
+	    Der_class *cls, Der_type *type, unsigned int *tag,
+	    const unsigned char **data, size_t *data_len)
+{
+    size_t tlen, llen;
+
+    if (der_get_tag(*p, *len, cls, type, tag, &tlen) != 0 ||
+	der_get_length(*p + tlen, *len - tlen, data_len, &llen) != 0 ||
+	*data_len == ASN1_INDEFINITE || *data_len > *len - tlen - llen)
+	return -1;
+    *data = *p + tlen + llen;
+    *p = *data + *data_len;
+    *len -= tlen + llen + *data_len;
+    return 0;
+}
+
+/* As pk_der_next(), for an element that must have the given tag */
+static int
+pk_der_enter(const unsigned char **p, size_t *len,
+	     Der_class cls, Der_type type, unsigned int tag,
+	     const unsigned char **data, size_t *data_len)
+{
+    Der_class c;
+    Der_type t;
+    unsigned int n;
+
+    if (pk_der_next(p, len, &c, &t, &n, data, data_len) != 0 ||
+	c != cls || t != type || n != tag)
+	return -1;
+    return 0;
+}
+
+/*
+ * Classify the request in `buf, len' of kind `req_kind' without
+ * processing it.  Of AS-REQs only the padata types are looked at, by
+ * walking the DER rather than decoding the whole request, and only
+ * when PKINIT is enabled.
+ */
+
+static enum pk_kind
+pk_request_kind(krb5_kdc_configuration *config,
+		enum krb5_kdc_request_kind req_kind,
+		const unsigned char *buf, size_t len)
+{
+    const unsigned char *req, *kdc_req, *padata, *seq, *pa, *pa_type, *val;
+    size_t req_len, kdc_req_len, padata_len, seq_len, pa_len, pa_type_len;
+    size_t val_len;
+    Der_class cls;
+    Der_type type;
+    unsigned int tag;
+    int padata_type;
+
+    if (config->enable_kx509 && req_kind == KDC_REQ_KX509)
+	return PK_REQ_KX509;
+
+    if (!config->enable_pkinit || req_kind != KDC_REQ_AS)
+	return PK_REQ_NONE;
+
+    /* AS-REQ ::= [APPLICATION 10] KDC-REQ, a SEQUENCE */
+    if (pk_der_enter(&buf, &len, ASN1_C_APPL, CONS, krb_as_req,
+		     &req, &req_len) != 0 ||
+	pk_der_enter(&req, &req_len, ASN1_C_UNIV, CONS, UT_Sequence,
+		     &kdc_req, &kdc_req_len) != 0)
+	return PK_REQ_NONE;
+
+    /* Skip pvno [1] and msg-type [2] to padata [3] */
+    do {
+	if (pk_der_next(&kdc_req, &kdc_req_len, &cls, &type, &tag,
+			&padata, &padata_len) != 0 ||
+	    cls != ASN1_C_CONTEXT)
+	    return PK_REQ_NONE;
+    } while (tag < 3);
+    if (tag != 3 ||
+	pk_der_enter(&padata, &padata_len, ASN1_C_UNIV, CONS, UT_Sequence,
+		     &seq, &seq_len) != 0)
+	return PK_REQ_NONE;
+
+    /* PA-DATA ::= SEQUENCE { padata-type [1] Int32, ... } */
+    while (seq_len > 0) {
+	if (pk_der_enter(&seq, &seq_len, ASN1_C_UNIV, CONS, UT_Sequence,
+			 &pa, &pa_len) != 0 ||
+	    pk_der_enter(&pa, &pa_len, ASN1_C_CONTEXT, CONS, 1,
+			 &pa_type, &pa_type_len) != 0 ||
+	    pk_der_enter(&pa_type, &pa_type_len, ASN1_C_UNIV, PRIM,
+			 UT_Integer, &val, &val_len) != 0 ||
+	    der_get_integer(val, val_len, &padata_type, NULL) != 0)
+	    return PK_REQ_NONE;
+	switch (padata_type) {
+	case KRB5_PADATA_PK_AS_REQ:
+	case KRB5_PADATA_PK_AS_REQ_WIN:
+	    return PK_REQ_PKINIT;
+	default:
+	    break;
+	}
+    }
+    return PK_REQ_NONE;
+}
+
+static void
+pk_job_descr(struct pk_job *job, struct descr *d)
+{
+    init_descr(d);
+    d->s = job->s;
+    d->type = job->type;
+    memcpy(&d->__ss, &job->__ss, sizeof(d->__ss));
+    d->sock_len = job->sock_len;
+    strlcpy(d->addr_string, job->addr_string, sizeof(d->addr_string));
+}
+
+static void
+pk_job_free(struct pk_job *job)
+{
+    free(job->buf);
+    free(job);
+}
+
+/*
+ * Be done with `job'.  A TCP connection stays with its descr, which
+ * pk_resume() then lets carry on.
+ */
+
+static void
+pk_job_done(struct pk_job *job)
+{
+    if (job->type == SOCK_STREAM) {
+	job->next = pk_done;
+	pk_done = job;
+	return;
+    }
+    pk_job_free(job);
+}
+
+/*
+ * Tell the client of `d' to go elsewhere.  kx509 clients do not speak
+ * KRB-ERROR, they just get nothing.
+ */
+
+static void
+pk_shed(krb5_context context, krb5_kdc_configuration *config,
+	enum pk_kind kind, krb5_boolean prependlength, struct descr *d,
+	const char *why)
+{
+    krb5_data data;
+
+    kdc_log(context, config, 0,
+	    "Shedding public-key request from %s: %s", d->addr_string, why);
+    if (kind != PK_REQ_PKINIT)
+	return;
+    if (krb5_mk_error(context, KRB5KDC_ERR_SVC_UNAVAILABLE,
+		      NULL, NULL, NULL, NULL, NULL, NULL, &data) == 0) {
+	send_reply(context, config, prependlength, d, &data);
+	krb5_data_free(&data);
+    }
+}
+
+static void
+pk_shed_job(krb5_context context, krb5_kdc_configuration *config,
+	    struct pk_job *job, const char *why)
+{
+    struct descr d;
+
+    pk_job_descr(job, &d);
+    pk_shed(context, config, job->kind, job->prependlength, &d, why);
+    pk_job_done(job);
+}
+
+/*
+ * Serve requests from the worker on `fd' until it goes away.
+ */
+
+static void
+pk_helper_loop(krb5_context context, krb5_kdc_configuration *config,
+	       krb5_socket_t fd)
+{
+    struct pk_request_hdr req;
+    struct pk_reply_hdr rep;
+    krb5_boolean prependlength;
+    krb5_data reply;
+    unsigned char *buf;
+#ifdef PKINIT
+    krb5_boolean refill = TRUE;
+#endif
+
+    while (exit_flag == 0) {
+#ifdef PKINIT
+	/* as in loop(), generate DH keys while there is nothing to do */
+	if (refill) {
+	    struct timeval tmout;
+	    fd_set fds;
+
+	    FD_ZERO(&fds);
+	    FD_SET(fd, &fds);
+	    tmout.tv_sec = 0;
+	    tmout.tv_usec = 0;
+	    if (select(fd + 1, &fds, NULL, NULL, &tmout) == 0) {
+		refill = krb5_kdc_pk_refill_key_pools(context, config);
+		continue;
+	    }
+	}
+#endif
+	if (net_read(fd, &req, sizeof(req)) != sizeof(req))
+	    break;
+	if (req.len > max_request_tcp || req.sock_len > sizeof(req.ss))
+	    break;
+	req.addr_string[sizeof(req.addr_string) - 1] = '\0';
+	buf = malloc(req.len + 1);
+	if (buf == NULL)
+	    break;
+	if (net_read(fd, buf, req.len) != (ssize_t)req.len) {
+	    free(buf);
+	    break;
+	}
+
+	krb5_kdc_update_time(NULL);
+
+	krb5_data_zero(&reply);
+	prependlength = req.prependlength;
+	rep.ret = krb5_kdc_process_request(context, config,
+					   buf, req.len, &reply,
+					   &prependlength, req.addr_string,
+					   (struct sockaddr *)&req.ss,
+					   req.datagram_reply);
+	free(buf);
+	rep.len = reply.length;
+	rep.prependlength = prependlength;
+	if (net_write(fd, &rep, sizeof(rep)) != sizeof(rep) ||
+	    net_write(fd, reply.data, reply.length) != (ssize_t)reply.length) {
+	    krb5_data_free(&reply);
+	    break;
+	}
+	krb5_data_free(&reply);
+#ifdef PKINIT
+	refill = TRUE;
+#endif
+    }
+}
+
+/*
+ * Start helper `i', closing in it every descriptor of ours but its end of
+ * the socketpair, so that it sees EOF when we exit.
+ */
+
+static void
+pk_spawn(krb5_context context, krb5_kdc_configuration *config, int i,
+	 struct descr *d, unsigned int ndescr, int islive)
+{
+    struct pk_helper *h = &pk_helpers[i];
+    int sv[2];
+    pid_t pid;
+    unsigned int j;
+
+    h->started = time(NULL);
+    if (socketpair(PF_LOCAL, SOCK_STREAM, 0, sv) == -1) {
+	kdc_log(context, config, 0, "socketpair: %s", strerror(errno));
+	return;
+    }
+#ifdef FD_SETSIZE
+    if (sv[0] >= FD_SETSIZE) {
+	kdc_log(context, config, 0, "socketpair: fd too large");
+	close(sv[0]);
+	close(sv[1]);
+	return;
+    }
+#endif
+
+    pid = fork();
+    switch (pid) {
+    case 0:
+	close(sv[0]);
+	if (islive > -1)
+	    close(islive);
+	for (j = 0; j < ndescr; j++)
+	    if (!rk_IS_BAD_SOCKET(d[j].s))
+		rk_closesocket(d[j].s);
+	for (j = 0; j < (unsigned int)num_pk_helpers; j++)
+	    if (!rk_IS_BAD_SOCKET(pk_helpers[j].fd))
+		close(pk_helpers[j].fd);
+	pk_helper_loop(context, config, sv[1]);
+	exit(0);
+    case -1:
+	kdc_log(context, config, 0,
+		"KDC worker process could not fork public-key helper: %s",
+		strerror(errno));
+	close(sv[0]);
+	close(sv[1]);
+	return;
+    default:
+	close(sv[1]);
+	h->pid = pid;
+	h->fd = sv[0];
+	kdc_log(context, config, 0, "KDC public-key helper process started: %d",
+		(int)pid);
+	return;
+    }
+}
+
+static void
+pk_start(krb5_context context, krb5_kdc_configuration *config,
+	 struct descr *d, unsigned int ndescr, int islive)
+{
+    int i, n = config->pk_worker_processes;
+
+    if (n <= 0 || (!config->enable_pkinit && !config->enable_kx509))
+	return;
+    pk_helpers = calloc(n, sizeof(pk_helpers[0]));
+    if (pk_helpers == NULL) {
+	kdc_log(context, config, 0,
+		"Out of memory, processing public-key requests inline");
+	return;
+    }
+    for (i = 0; i < n; i++) {
+	pk_helpers[i].pid = (pid_t)-1;
+	pk_helpers[i].fd = rk_INVALID_SOCKET;
+    }
+    num_pk_helpers = n;
+    for (i = 0; i < n; i++)
+	pk_spawn(context, config, i, d, ndescr, islive);
+}
+
+/*
+ * Forget helper `i', which exited or stopped making sense, shedding the
+ * request it had.  pk_maintain() starts a new one.
+ */
+
+static void
+pk_helper_died(krb5_context context, krb5_kdc_configuration *config, int i)
+{
+    struct pk_helper *h = &pk_helpers[i];
+    int status;
+
+    close(h->fd);
+    h->fd = rk_INVALID_SOCKET;
+    kill(h->pid, SIGKILL);
+    while (waitpid(h->pid, &status, 0) == -1 && errno == EINTR)
+	;
+    kdc_log(context, config, 0, "KDC public-key helper process %d died",
+	    (int)h->pid);
+    h->pid = (pid_t)-1;
+    if (h->job) {
+	pk_shed_job(context, config, h->job, "helper process died");
+	h->job = NULL;
+    }
+}
+
+/* Hand queued requests to idle helpers */
+static void
+pk_dispatch(krb5_context context, krb5_kdc_configuration *config)
+{
+    struct pk_request_hdr req;
+    struct pk_helper *h;
+    struct pk_job *job;
+    int i;
+
+    for (i = 0; i < num_pk_helpers && pk_queue_head; i++) {
+	h = &pk_helpers[i];
+	if (h->pid == (pid_t)-1 || h->job)
+	    continue;
+
+	job = pk_queue_head;
+	if ((pk_queue_head = job->next) == NULL)
+	    pk_queue_tail = &pk_queue_head;
+	pk_queue_len--;
+	job->next = NULL;
+	h->job = job;
+
+	memset(&req, 0, sizeof(req));
+	req.len = job->len;
+	req.datagram_reply = (job->type == SOCK_DGRAM);
+	req.prependlength = job->prependlength;
+	req.sock_len = job->sock_len;
+	memcpy(&req.ss, &job->__ss, sizeof(req.ss));
+	strlcpy(req.addr_string, job->addr_string, sizeof(req.addr_string));
+	if (net_write(h->fd, &req, sizeof(req)) != sizeof(req) ||
+	    net_write(h->fd, job->buf, job->len) != (ssize_t)job->len)
+	    pk_helper_died(context, config, i);
+    }
+}
+
+/*
+ * Queue the public-key request in `buf, len' from `d' for the helpers.
+ * Returns 0 if there are none and the caller should process it itself.
+ * A TCP connection stays in `d', out of select(), until the reply.
+ */
+
+static int
+pk_queue_request(krb5_context context, krb5_kdc_configuration *config,
+		 enum pk_kind kind, void *buf, size_t len,
+		 krb5_boolean prependlength, struct descr *d)
+{
+    struct pk_job *job;
+    int i;
+
+    for (i = 0; i < num_pk_helpers; i++)
+	if (pk_helpers[i].pid != (pid_t)-1)
+	    break;
+    if (i == num_pk_helpers)
+	return 0;
+
+    if (pk_queue_len >= config->pk_worker_queue_depth) {
+	pk_shed(context, config, kind, prependlength, d, "queue full");
+	return 1;
+    }
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL || (job->buf = malloc(len)) == NULL) {
+	free(job);
+	pk_shed(context, config, kind, prependlength, d, "out of memory");
+	return 1;
+    }
+    memcpy(job->buf, buf, len);
+    job->len = len;
+    job->kind = kind;
+    job->s = d->s;
+    job->type = d->type;
+    job->prependlength = prependlength;
+    job->queued = time(NULL);
+    memcpy(&job->__ss, &d->__ss, sizeof(job->__ss));
+    job->sock_len = d->sock_len;
+    strlcpy(job->addr_string, d->addr_string, sizeof(job->addr_string));
+    if (d->type == SOCK_STREAM)
+	d->pk_wait = 1;
+
+    *pk_queue_tail = job;
+    pk_queue_tail = &job->next;
+    pk_queue_len++;
+
+    kdc_log(context, config, 5, "Queued public-key request from %s (%d queued)",
+	    job->addr_string, pk_queue_len);
+
+    pk_dispatch(context, config);
+    return 1;
+}
+
+/* Read and send on helper `i''s reply */
+static void
+pk_reply(krb5_context context, krb5_kdc_configuration *config, int i)
+{
+    struct pk_helper *h = &pk_helpers[i];
+    struct pk_reply_hdr rep;
+    struct pk_job *job = h->job;
+    struct descr d;
+    krb5_data reply;
+
+    if (job == NULL ||
+	net_read(h->fd, &rep, sizeof(rep)) != sizeof(rep) ||
+	krb5_data_alloc(&reply, rep.len) != 0) {
+	pk_helper_died(context, config, i);
+	return;
+    }
+    if (net_read(h->fd, reply.data, reply.length) != (ssize_t)reply.length) {
+	krb5_data_free(&reply);
+	pk_helper_died(context, config, i);
+	return;
+    }
+    h->job = NULL;
+
+    pk_job_descr(job, &d);
+    if (request_log)
+	krb5_kdc_save_request(context, request_log, job->buf, job->len,
+			      &reply, d.sa);
+    if (reply.length)
+	send_reply(context, config, rep.prependlength, &d, &reply);
+    if (rep.ret)
+	kdc_log(context, config, 0,
+		"Failed processing %lu byte request from %s",
+		(unsigned long)job->len, job->addr_string);
+    krb5_data_free(&reply);
+    job->served = TRUE;
+    pk_job_done(job);
+
+    pk_dispatch(context, config);
+}
+
+/*
+ * Give the TCP connections of finished requests back to the main loop:
+ * served ones are kept like any other (and what the client sent after
+ * the request is handled now), shed ones are closed.
+ */
+
+static void
+pk_resume(krb5_context context, krb5_kdc_configuration *config,
+	  struct descr *d, unsigned int ndescr)
+{
+    struct pk_job *job, *done = pk_done;
+    unsigned int i;
+
+    pk_done = NULL;
+    while ((job = done)) {
+	done = job->next;
+	for (i = 0; i < ndescr; i++)
+	    if (d[i].pk_wait && d[i].s == job->s)
+		break;
+	if (i < ndescr) {
+	    d[i].pk_wait = 0;
+	    if (!job->served || d[i].http || config->tcp_idle_timeout <= 0) {
+		clear_descr(&d[i]);
+	    } else {
+		d[i].nrequests++;
+		d[i].timeout = time(NULL) + config->tcp_idle_timeout;
+		handle_vanilla_tcp(context, config, &d[i]);
+	    }
+	}
+	pk_job_free(job);
+    }
+}
+
+/*
+ * Restart helpers that died (at most once a second each), shed requests
+ * that waited too long and keep the helpers busy.  Returns TRUE if there
+ * is something to come back for soon.
+ */
+
+static krb5_boolean
+pk_maintain(krb5_context context, krb5_kdc_configuration *config,
+	    struct descr *d, unsigned int ndescr, int islive)
+{
+    krb5_boolean again = FALSE;
+    struct pk_job *job;
+    time_t now = time(NULL);
+    int i;
+
+    pk_resume(context, config, d, ndescr);
+
+    for (i = 0; i < num_pk_helpers; i++) {
+	if (pk_helpers[i].pid != (pid_t)-1)
+	    continue;
+	if (pk_helpers[i].started != now)
+	    pk_spawn(context, config, i, d, ndescr, islive);
+	if (pk_helpers[i].pid == (pid_t)-1)
+	    again = TRUE;
+    }
+
+    while ((job = pk_queue_head) && job->queued + PK_QUEUE_TIMEOUT < now) {
+	if ((pk_queue_head = job->next) == NULL)
+	    pk_queue_tail = &pk_queue_head;
+	pk_queue_len--;
+	pk_shed_job(context, config, job, "timed out in queue");
+    }
+
+    pk_dispatch(context, config);
+    return again || pk_queue_head != NULL || pk_done != NULL;
+}
+
+/* Let the helpers go and drop what is queued for them */
+static void
+pk_stop(void)
+{
+    struct pk_job *job;
+    int i, status;
+
+    for (i = 0; i < num_pk_helpers; i++) {
+	if (pk_helpers[i].pid == (pid_t)-1)
+	    continue;
+	close(pk_helpers[i].fd);
+	while (waitpid(pk_helpers[i].pid, &status, 0) == -1 && errno == EINTR)
+	    ;
+	if (pk_helpers[i].job)
+	    pk_job_free(pk_helpers[i].job);
+    }
+    while ((job = pk_queue_head)) {
+	pk_queue_head = job->next;
+	pk_job_free(job);
+    }
+    while ((job = pk_done)) {
+	pk_done = job->next;
+	pk_job_free(job);
+    }
+    pk_queue_tail = &pk_queue_head;
+    pk_queue_len = 0;
+    free(pk_helpers);
+    pk_helpers = NULL;
+    num_pk_helpers = 0;
+}
+
+#endif /* HAVE_FORK */
+
+/*
+ * Per source address prefix token buckets for [kdc] rate-limit, kept
+ * by each process for the requests it gets.  The table is a fixed
+ * size, set-associative hash table: a prefix that finds no free bucket
+ * in its set takes over the least recently used one, tokens and all.
+ * Under a flood from many sources that costs some of them their
+ * history, but never memory, and a source cannot get a fresh burst by
+ * pushing another one out.
+ */
+
+#define RATE_BUCKETS	4096
+#define RATE_WAYS	4
+
+struct rate_bucket {
+    int family;			/* 0 if unused */
+    unsigned char prefix[16];
+    int limited;		/* dropping requests, and said so */
+    int64_t tokens;		/* in thousandths of a request */
+    struct timeval last;
+};
+
+static struct rate_bucket *rate_buckets;
+
+/*
+ * Take a token from the bucket of the source address of `d'.  Returns
+ * 0 if the request is over the limit.
+ */
+
+static int
+rate_limit_ok(krb5_context context, krb5_kdc_configuration *config,
+	      struct descr *d)
+{
+    struct rate_bucket *b, *set;
+    struct timeval now;
+    unsigned char prefix[16];
+    const unsigned char *addr;
+    uint32_t hash = 5381;
+    int64_t elapsed, burst;
+    size_t alen;
+    int bits, i;
+
+    if (config->rate_limit <= 0)
+	return 1;
+
+    switch (d->sa->sa_family) {
+    case AF_INET:
+	addr = (const unsigned char *)
+	    &((const struct sockaddr_in *)d->sa)->sin_addr;
+	alen = 4;
+	bits = config->rate_limit_ipv4_prefix;
+	break;
+#ifdef HAVE_IPV6
+    case AF_INET6:
+	addr = (const unsigned char *)
+	    &((const struct sockaddr_in6 *)d->sa)->sin6_addr;
+	alen = 16;
+	bits = config->rate_limit_ipv6_prefix;
+	break;
+#endif
+    default:
+	return 1;
+    }
+
+    if (rate_buckets == NULL) {
+	rate_buckets = calloc(RATE_BUCKETS, sizeof(rate_buckets[0]));
+	if (rate_buckets == NULL)
+	    return 1;
+    }
+
+    memset(prefix, 0, sizeof(prefix));
+    for (i = 0; i < (int)alen && bits > 0; i++, bits -= 8)
+	prefix[i] = addr[i] & (bits >= 8 ? 0xff : (0xff << (8 - bits)));
+    for (i = 0; i < (int)alen; i++)
+	hash = hash * 33 + prefix[i];
+    hash = hash * 33 + d->sa->sa_family;
+
+    gettimeofday(&now, NULL);
+    burst = (int64_t)config->rate_limit_burst * 1000;
+    set = &rate_buckets[(hash % (RATE_BUCKETS / RATE_WAYS)) * RATE_WAYS];
+    for (b = NULL, i = 0; i < RATE_WAYS; i++) {
+	if (set[i].family == d->sa->sa_family &&
+	    memcmp(set[i].prefix, prefix, sizeof(prefix)) == 0) {
+	    b = &set[i];
+	    break;
+	}
+    }
+    if (b == NULL) {
+	for (b = &set[0], i = 1; i < RATE_WAYS && b->family != 0; i++) {
+	    if (set[i].family == 0 ||
+		set[i].last.tv_sec < b->last.tv_sec ||
+		(set[i].last.tv_sec == b->last.tv_sec &&
+		 set[i].last.tv_usec < b->last.tv_usec))
+		b = &set[i];
+	}
+	if (b->family == 0) {
+	    b->tokens = burst;
+	    b->last = now;
+	}
+	/* else what the evicted prefix had left is refilled below */
+	b->family = d->sa->sa_family;
+	memcpy(b->prefix, prefix, sizeof(prefix));
+	b->limited = 0;
+    }
+
+    /* Refill at [kdc] rate-limit requests per second */
+    elapsed = (int64_t)(now.tv_sec - b->last.tv_sec) * 1000000 +
+	(now.tv_usec - b->last.tv_usec);
+    if (elapsed > 0) {
+	b->tokens += elapsed * config->rate_limit / 1000;
+	if (b->tokens > burst)
+	    b->tokens = burst;
+	b->last = now;
+    }
+
+    if (b->tokens >= 1000) {
+	b->tokens -= 1000;
+	if (b->limited)
+	    kdc_log(context, config, 3,
+		    "No longer rate limiting requests from %s",
+		    d->addr_string);
+	b->limited = 0;
+	return 1;
+    }
+    if (!b->limited)
+	kdc_log(context, config, 3,
+		"Rate limiting requests from %s (and its neighbours)",
+		d->addr_string);
+    b->limited = 1;
+    return 0;
+}
+
 /*
  * Handle the request in `buf, len' to socket `d'
  */
@@ -428,9 +1212,40 @@ do_request(krb5_context context,
     krb5_error_code ret;
     krb5_data reply;
     int datagram_reply = (d->type == SOCK_DGRAM);
+    enum krb5_kdc_request_kind req_kind;
 
     krb5_kdc_update_time(NULL);
 
+    /*
+     * Turn away junk and floods before anything gets decoded: UDP
+     * requests are just dropped, TCP connections closed.
+     */
+    ret = krb5_kdc_classify_request(buf, len, &req_kind);
+    if (ret) {
+	kdc_log(context, config, 5, "Dropping malformed %lu byte request "
+		"from %s", (unsigned long)len, d->addr_string);
+    } else if (!rate_limit_ok(context, config, d)) {
+	ret = KRB5KDC_ERR_SVC_UNAVAILABLE;
+    }
+    if (ret) {
+	if (d->type == SOCK_STREAM) {
+	    rk_closesocket(d->s);
+	    d->s = rk_INVALID_SOCKET;
+	}
+	return;
+    }
+
+#ifdef HAVE_FORK
+    if (num_pk_helpers > 0) {
+	enum pk_kind kind = pk_request_kind(config, req_kind, buf, len);
+
+	if (kind != PK_REQ_NONE &&
+	    pk_queue_request(context, config, kind, buf, len,
+			     prependlength, d))
+	    return;
+    }
+#endif
+
     krb5_data_zero(&reply);
     ret = krb5_kdc_process_request(context, config,
 				   buf, len, &reply, &prependlength,
@@ -504,6 +1319,9 @@ clear_descr(struct descr *d)
     if(d->buf)
 	memset(d->buf, 0, d->size);
     d->len = 0;
+    d->nrequests = 0;
+    d->pk_wait = 0;
+    d->http = 0;
     if(d->s != rk_INVALID_SOCKET)
 	rk_closesocket(d->s);
     d->s = rk_INVALID_SOCKET;
@@ -610,31 +1428,60 @@ grow_descr (krb5_context context,
 }
 
 /*
- * Try to handle the TCP data at `d->buf, d->len'.
- * Return -1 if failed, 0 if succesful, and 1 if data is complete.
+ * Serve the complete requests at `d->buf, d->len', in order, leaving
+ * any partial one in the buffer.  With [kdc] tcp-idle-timeout the
+ * connection is then kept for further requests, so that clients that
+ * reuse their connections need not connect for each one.
  */
 
-static int
+static void
 handle_vanilla_tcp (krb5_context context,
 		    krb5_kdc_configuration *config,
 		    struct descr *d)
 {
-    krb5_storage *sp;
-    uint32_t len;
+    size_t len;
 
-    sp = krb5_storage_from_mem(d->buf, d->len);
-    if (sp == NULL) {
-	kdc_log (context, config, 0, "krb5_storage_from_mem failed");
-	return -1;
-    }
-    krb5_ret_uint32(sp, &len);
-    krb5_storage_free(sp);
-    if(d->len - 4 >= len) {
-	memmove(d->buf, d->buf + 4, d->len - 4);
-	d->len -= 4;
-	return 1;
+    while (d->len >= 4) {
+	len = ((size_t)d->buf[0] << 24) | (d->buf[1] << 16) |
+	    (d->buf[2] << 8) | d->buf[3];
+	if (len > max_request_tcp - 4) {
+	    kdc_log(context, config, 0, "Request of %lu bytes from %s exceeds "
+		    "max request size", (unsigned long)len, d->addr_string);
+	    clear_descr(d);
+	    return;
+	}
+	if (d->len - 4 < len) {
+	    enum krb5_kdc_request_kind kind;
+
+	    /* Don't wait for all of a request that is junk anyway */
+	    if (d->len - 4 >= min(len, KDC_CLASSIFY_LENGTH) &&
+		krb5_kdc_classify_request(d->buf + 4, len, &kind) != 0) {
+		kdc_log(context, config, 5, "Dropping malformed %lu byte "
+			"request from %s", (unsigned long)len, d->addr_string);
+		clear_descr(d);
+	    }
+	    return;
+	}
+
+	do_request(context, config, d->buf + 4, len, TRUE, d);
+	if (rk_IS_BAD_SOCKET(d->s)) {
+	    /* Refused */
+	    clear_descr(d);
+	    return;
+	}
+	d->len -= 4 + len;
+	memmove(d->buf, d->buf + 4 + len, d->len);
+	if (d->pk_wait) {
+	    /* pk_resume() carries on once the helper has replied */
+	    return;
+	}
+	if (config->tcp_idle_timeout <= 0) {
+	    clear_descr(d);
+	    return;
+	}
+	d->nrequests++;
+	d->timeout = time(NULL) + config->tcp_idle_timeout;
     }
-    return 0;
 }
 
 /*
@@ -776,6 +1623,11 @@ handle_tcp(krb5_context context,
 		  ntohs(d[idx].port));
 	return;
     } else if (n == 0) {
+	if (d[idx].len == 0 && d[idx].nrequests > 0) {
+	    /* The client is done with the connection */
+	    clear_descr (d + idx);
+	    return;
+	}
 	krb5_warnx(context, "connection closed before end of data after %lu "
 		   "bytes from %s to %s/%d", (unsigned long)d[idx].len,
 		   d[idx].addr_string, descr_type(d + idx),
@@ -785,10 +1637,14 @@ handle_tcp(krb5_context context,
     }
     if (grow_descr (context, config, &d[idx], n))
 	return;
+    /* A new request on a kept connection has to come in as fast as the first */
+    if (d[idx].len == 0 && d[idx].nrequests > 0)
+	d[idx].timeout = time(NULL) + TCP_TIMEOUT;
     memcpy(d[idx].buf + d[idx].len, buf, n);
     d[idx].len += n;
     if(d[idx].len > 4 && d[idx].buf[0] == 0) {
-	ret = handle_vanilla_tcp (context, config, &d[idx]);
+	handle_vanilla_tcp (context, config, &d[idx]);
+	return;
     } else if(enable_http &&
 	      d[idx].len >= 4 &&
 	      strncmp((char *)d[idx].buf, "GET ", 4) == 0 &&
@@ -798,6 +1654,7 @@ handle_tcp(krb5_context context,
         /* remove the trailing \r\n\r\n so the string is NUL terminated */
         d[idx].buf[d[idx].len - 4] = '\0';
 
+	d[idx].http = 1;
 	ret = handle_http_tcp (context, config, &d[idx]);
 	if (ret < 0)
 	    clear_descr (d + idx);
@@ -833,7 +1690,8 @@ handle_tcp(krb5_context context,
     else if (ret == 1) {
 	do_request(context, config,
 		   d[idx].buf, d[idx].len, TRUE, &d[idx]);
-	clear_descr(d + idx);
+	if (!d[idx].pk_wait)
+	    clear_descr(d + idx);
     }
 }
 
@@ -897,6 +1755,23 @@ loop(krb5_context context, krb5_kdc_configuration *config,
      struct descr *d, unsigned int ndescr, int islive)
 {
 
+#ifdef PKINIT
+    krb5_boolean refill = TRUE;
+#endif
+#ifdef HAVE_FORK
+    krb5_boolean pk_again = FALSE;
+
+    pk_start(context, config, d, ndescr, islive);
+#ifdef PKINIT
+    /* the helpers keep the DH key pools */
+    if (num_pk_helpers > 0)
+	refill = FALSE;
+#endif
+#endif
+
+    /* Have the hot principals before the first request */
+    krb5_kdc_refresh_hot_principals(context, config);
+
     while (exit_flag == 0) {
 	struct timeval tmout;
 	fd_set fds;
@@ -909,13 +1784,25 @@ loop(krb5_context context, krb5_kdc_configuration *config,
             FD_SET(islive, &fds);
             max_fd = islive;
         }
+#ifdef HAVE_FORK
+	if (num_pk_helpers > 0)
+	    pk_again = pk_maintain(context, config, d, ndescr, islive);
+	for (i = 0; i < (size_t)num_pk_helpers; i++) {
+	    if (rk_IS_BAD_SOCKET(pk_helpers[i].fd))
+		continue;
+	    if (max_fd < pk_helpers[i].fd)
+		max_fd = pk_helpers[i].fd;
+	    FD_SET(pk_helpers[i].fd, &fds);
+	}
+#endif
 	for (i = 0; i < ndescr; i++) {
-	    if (!rk_IS_BAD_SOCKET(d[i].s)) {
+	    if (!rk_IS_BAD_SOCKET(d[i].s) && !d[i].pk_wait) {
 		if (d[i].type == SOCK_STREAM &&
 		   d[i].timeout && d[i].timeout < time(NULL)) {
-		    kdc_log(context, config, 1,
-			    "TCP-connection from %s expired after %lu bytes",
-			    d[i].addr_string, (unsigned long)d[i].len);
+		    if (d[i].len > 0 || d[i].nrequests == 0)
+			kdc_log(context, config, 1,
+				"TCP-connection from %s expired after %lu bytes",
+				d[i].addr_string, (unsigned long)d[i].len);
 		    clear_descr(&d[i]);
 		    continue;
 		}
@@ -933,8 +1820,25 @@ loop(krb5_context context, krb5_kdc_configuration *config,
 
 	tmout.tv_sec = TCP_TIMEOUT;
 	tmout.tv_usec = 0;
+#ifdef HAVE_FORK
+	if (pk_again)
+	    tmout.tv_sec = 1;
+#endif
+#ifdef PKINIT
+	/*
+	 * With PKINIT keys to generate, just poll for requests, and
+	 * generate one key per pass that finds none, so that a request
+	 * never waits for more than one key generation.
+	 */
+	if (refill)
+	    tmout.tv_sec = 0;
+#endif
 	switch(select(max_fd + 1, &fds, 0, 0, &tmout)){
 	case 0:
+#ifdef PKINIT
+	    if (refill)
+		refill = krb5_kdc_pk_refill_key_pools(context, config);
+#endif
 	    break;
 	case -1:
 	    if (errno != EINTR)
@@ -944,6 +1848,10 @@ loop(krb5_context context, krb5_kdc_configuration *config,
 #ifdef HAVE_FORK
 	    if (islive > -1 && FD_ISSET(islive, &fds))
 		handle_islive(islive);
+	    for (i = 0; i < (size_t)num_pk_helpers; i++)
+		if (!rk_IS_BAD_SOCKET(pk_helpers[i].fd) &&
+		    FD_ISSET(pk_helpers[i].fd, &fds))
+		    pk_reply(context, config, i);
 #endif
 	    for (i = 0; i < ndescr; i++)
 		if (!rk_IS_BAD_SOCKET(d[i].s) && FD_ISSET(d[i].s, &fds)) {
@@ -954,9 +1862,22 @@ loop(krb5_context context, krb5_kdc_configuration *config,
 		    else if (d[i].type == SOCK_STREAM)
 			handle_tcp(context, config, d, i, min_free);
 		}
+#ifdef PKINIT
+	    refill = TRUE;
+#ifdef HAVE_FORK
+	    if (num_pk_helpers > 0)
+		refill = FALSE;
+#endif
+#endif
 	}
+	krb5_kdc_flush_lockouts(context, config);
+	krb5_kdc_refresh_hot_principals(context, config);
     }
 
+#ifdef HAVE_FORK
+    pk_stop();
+#endif
+
     switch (exit_flag) {
     case -1:
 	kdc_log(context, config, 0,
@@ -49,6 +49,20 @@ krb5_kdc_get_config(krb5_context context, krb5_kdc_configuration **config)
     }
 
     c->num_kdc_processes = -1;
+    c->pk_worker_processes = 0;
+    c->pk_worker_queue_depth = 64;
+    c->tcp_idle_timeout = 0;
+    c->rate_limit = 0;
+    c->rate_limit_burst = 0;
+    c->rate_limit_ipv4_prefix = 24;
+    c->rate_limit_ipv6_prefix = 56;
+    c->lockout_threshold = 0;
+    c->lockout_duration = 600;
+    c->lockout_window = 600;
+    c->lockout_flush_interval = 60;
+    c->lockout_file = NULL;
+    c->hot_principals = NULL;
+    c->hot_principals_refresh = 5;
     c->require_preauth = TRUE;
     c->kdc_warn_pwexpire = 0;
     c->encode_as_rep_as_tgs_rep = FALSE;
@@ -56,6 +70,8 @@ krb5_kdc_get_config(krb5_context context, krb5_kdc_configuration **config)
     c->preauth_use_strongest_session_key = FALSE;
     c->svc_use_strongest_session_key = FALSE;
     c->use_strongest_server_key = TRUE;
+    c->tgs_cache_size = 0;
+    c->tgs_cache_lifetime = 60;
     c->check_ticket_addresses = TRUE;
     c->allow_null_ticket_addresses = TRUE;
     c->allow_anonymous = FALSE;
@@ -72,6 +88,49 @@ krb5_kdc_get_config(krb5_context context, krb5_kdc_configuration **config)
         krb5_config_get_int_default(context, NULL, c->num_kdc_processes,
 				    "kdc", "num-kdc-processes", NULL);
 
+    c->pk_worker_processes =
+        krb5_config_get_int_default(context, NULL, c->pk_worker_processes,
+				    "kdc", "pk-worker-processes", NULL);
+    c->pk_worker_queue_depth =
+        krb5_config_get_int_default(context, NULL, c->pk_worker_queue_depth,
+				    "kdc", "pk-worker-queue-depth", NULL);
+    c->tcp_idle_timeout =
+        krb5_config_get_time_default(context, NULL, c->tcp_idle_timeout,
+				     "kdc", "tcp-idle-timeout", NULL);
+    c->rate_limit =
+        krb5_config_get_int_default(context, NULL, c->rate_limit,
+				    "kdc", "rate-limit", NULL);
+    c->rate_limit_burst =
+        krb5_config_get_int_default(context, NULL, 2 * c->rate_limit,
+				    "kdc", "rate-limit-burst", NULL);
+    if (c->rate_limit_burst < c->rate_limit)
+	c->rate_limit_burst = c->rate_limit;
+    c->rate_limit_ipv4_prefix =
+        krb5_config_get_int_default(context, NULL, c->rate_limit_ipv4_prefix,
+				    "kdc", "rate-limit-ipv4-prefix", NULL);
+    c->rate_limit_ipv6_prefix =
+        krb5_config_get_int_default(context, NULL, c->rate_limit_ipv6_prefix,
+				    "kdc", "rate-limit-ipv6-prefix", NULL);
+    c->lockout_threshold =
+        krb5_config_get_int_default(context, NULL, c->lockout_threshold,
+				    "kdc", "lockout-threshold", NULL);
+    c->lockout_duration =
+        krb5_config_get_time_default(context, NULL, c->lockout_duration,
+				     "kdc", "lockout-duration", NULL);
+    c->lockout_window =
+        krb5_config_get_time_default(context, NULL, c->lockout_window,
+				     "kdc", "lockout-window", NULL);
+    c->lockout_flush_interval =
+        krb5_config_get_time_default(context, NULL, c->lockout_flush_interval,
+				     "kdc", "lockout-flush-interval", NULL);
+    c->lockout_file =
+        krb5_config_get_string(context, NULL, "kdc", "lockout-file", NULL);
+    c->hot_principals =
+        krb5_config_get_strings(context, NULL, "kdc", "hot-principals", NULL);
+    c->hot_principals_refresh =
+        krb5_config_get_time_default(context, NULL, c->hot_principals_refresh,
+				     "kdc", "hot-principals-refresh", NULL);
+
     c->require_preauth =
 	krb5_config_get_bool_default(context, NULL,
 				     c->require_preauth,
@@ -255,6 +314,18 @@ krb5_kdc_get_config(krb5_context context, krb5_kdc_configuration **config)
 	krb5_config_get_int_default(context, NULL,
 				    0,
 				    "kdc", "pkinit_dh_min_bits", NULL);
+    c->pkinit_key_pool_size =
+	krb5_config_get_int_default(context, NULL,
+				    16,
+				    "kdc", "pkinit_key_pool_size", NULL);
+    c->tgs_cache_size =
+	krb5_config_get_int_default(context, NULL,
+				    c->tgs_cache_size,
+				    "kdc", "tgs-cache-size", NULL);
+    c->tgs_cache_lifetime =
+	krb5_config_get_time_default(context, NULL,
+				     c->tgs_cache_lifetime,
+				     "kdc", "tgs-cache-lifetime", NULL);
 
     *config = c;
 
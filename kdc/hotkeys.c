@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include "kdc_locl.h"
+
+/*
+ * Hot principals
+ *
+ * The entries of the few principals that nearly every request needs
+ * -- krbtgt/REALM, the FAST cookie principal, and whatever [kdc]
+ * hot-principals names -- are kept fetched, with the current and the
+ * previous key unsealed.  _kdc_db_fetch() hands out copies of them
+ * instead of going to the database.
+ *
+ * Before an entry is handed out, its record is read, still sealed,
+ * and compared with the one the entry was made from, which costs a
+ * database lookup but no unsealing.  Every hot-principals-refresh the
+ * worker also does that between requests, and fetches the entries
+ * that changed, say because kadmin rolled their keys over, so that
+ * requests seldom have to.  The new entry
+ * replaces the old one in one go, so a request sees either the old or
+ * the new entry, never half of each.
+ *
+ * Requests get copies with only the keys they ask for: the keyset of
+ * the kvno they name, or for those that name none, the current keys
+ * and the key history.
+ *
+ * Only entries without backend private data (ctx, free_entry) are
+ * cached, as copies of those could not be made, and only from
+ * backends that store records (hdb__get), which can be compared
+ * cheaply.  With hot-principals-refresh set to 0, nothing is cached.
+ */
+
+struct hot_principal {
+    krb5_principal principal;
+    HDB *db;
+    hdb_entry_ex *ent;		/* NULL until fetched */
+    krb5_data raw;		/* the record `ent' was made from */
+};
+
+static struct hot_principal *hot;
+static size_t num_hot;
+static int hot_initialized;
+static int refreshing;
+static time_t next_refresh;
+
+static krb5_error_code
+add_hot(krb5_context context, krb5_principal principal)
+{
+    struct hot_principal *tmp;
+    size_t i;
+
+    for (i = 0; i < num_hot; i++) {
+	if (krb5_principal_compare(context, hot[i].principal, principal)) {
+	    krb5_free_principal(context, principal);
+	    return 0;
+	}
+    }
+    tmp = realloc(hot, (num_hot + 1) * sizeof(hot[0]));
+    if (tmp == NULL) {
+	krb5_free_principal(context, principal);
+	return krb5_enomem(context);
+    }
+    hot = tmp;
+    hot[num_hot].principal = principal;
+    hot[num_hot].db = NULL;
+    hot[num_hot].ent = NULL;
+    krb5_data_zero(&hot[num_hot].raw);
+    num_hot++;
+    return 0;
+}
+
+static void
+init_hot(krb5_context context, krb5_kdc_configuration *config)
+{
+    krb5_principal principal;
+    krb5_realm *realms = NULL;
+    char **p;
+    size_t i;
+
+    hot_initialized = 1;
+    if (config->hot_principals_refresh <= 0)
+	return;
+
+    if (config->hot_principals) {
+	for (p = config->hot_principals; *p; p++) {
+	    if (krb5_parse_name(context, *p, &principal) == 0)
+		add_hot(context, principal);
+	    else
+		kdc_log(context, config, 0,
+			"hot-principals: cannot parse %s", *p);
+	}
+	return;
+    }
+
+    if (krb5_get_default_realms(context, &realms) == 0) {
+	for (i = 0; realms[i]; i++) {
+	    if (krb5_make_principal(context, &principal, realms[i],
+				    KRB5_TGS_NAME, realms[i], NULL) == 0)
+		add_hot(context, principal);
+	}
+	krb5_free_host_realm(context, realms);
+    }
+    if (krb5_make_principal(context, &principal,
+			    KRB5_WELLKNOWN_ORG_H5L_REALM,
+			    KRB5_WELLKNOWN_NAME, "org.h5l.fast-cookie",
+			    NULL) == 0)
+	add_hot(context, principal);
+}
+
+/*
+ * Unseal the newest keyset of the history of `ent', the one that was
+ * current before the current one.
+ */
+
+static krb5_error_code
+unseal_previous(krb5_context context, HDB *db, hdb_entry *ent)
+{
+    const HDB_extension *ext;
+    HDB_Ext_KeySet *hist_keys;
+    hdb_keyset *prev = NULL;
+    krb5_error_code ret;
+    size_t i;
+
+    /* Extensions that do not decode would look like no history */
+    ret = hdb_entry_check_mandatory(context, ent);
+    if (ret)
+	return ret;
+    ext = hdb_find_extension(ent, choice_HDB_extension_data_hist_keys);
+    if (ext == NULL)
+	return 0;
+    hist_keys = rk_UNCONST(&ext->data.u.hist_keys);
+    for (i = 0; i < hist_keys->len; i++) {
+	if (hist_keys->val[i].kvno < ent->kvno &&
+	    (prev == NULL || hist_keys->val[i].kvno > prev->kvno))
+	    prev = &hist_keys->val[i];
+    }
+    if (prev == NULL)
+	return 0;
+    for (i = 0; i < prev->keys.len; i++) {
+	ret = hdb_unseal_key(context, db, &prev->keys.val[i]);
+	if (ret)
+	    return ret;
+    }
+    return 0;
+}
+
+/*
+ * Read the record of `principal' from `db' as it is stored.  Returns
+ * HDB_ERR_NOT_FOUND_HERE for backends that do not store records.
+ */
+
+static krb5_error_code
+get_raw(krb5_context context, HDB *db, krb5_const_principal principal,
+	krb5_data *raw)
+{
+    krb5_error_code ret;
+    krb5_data key;
+
+    krb5_data_zero(raw);
+    if (db->hdb__get == NULL)
+	return HDB_ERR_NOT_FOUND_HERE;
+    ret = db->hdb_open(context, db, O_RDONLY, 0);
+    if (ret)
+	return ret;
+    ret = hdb_principal2key(context, principal, &key);
+    if (ret == 0) {
+	ret = db->hdb__get(context, db, key, raw);
+	krb5_data_free(&key);
+    }
+    db->hdb_close(context, db);
+    return ret;
+}
+
+static void
+refresh_one(krb5_context context, krb5_kdc_configuration *config,
+	    struct hot_principal *h)
+{
+    krb5_error_code ret;
+    hdb_entry_ex *ent = NULL;
+    krb5_data raw;
+    HDB *db = NULL;
+    char *name = NULL;
+    int i;
+
+    if (h->ent) {
+	ret = get_raw(context, h->db, h->principal, &raw);
+	if (ret == 0 && krb5_data_cmp(&raw, &h->raw) == 0) {
+	    krb5_data_free(&raw);
+	    return;
+	}
+	krb5_data_free(&raw);
+    }
+
+    (void) krb5_unparse_name(context, h->principal, &name);
+
+    /*
+     * The record is read before the entry, so that a change in between
+     * shows as a stale record next time instead of going unnoticed.
+     */
+    ret = HDB_ERR_NOENTRY;
+    for (i = 0; i < config->num_db && ret == HDB_ERR_NOENTRY; i++)
+	ret = get_raw(context, config->db[i], h->principal, &raw);
+    if (ret == 0) {
+	refreshing = 1;
+	ret = _kdc_db_fetch(context, config, h->principal, HDB_F_GET_ANY,
+			    NULL, &db, &ent);
+	refreshing = 0;
+    }
+    if (ret == 0 &&
+	(db != config->db[i - 1] || ent->ctx != NULL ||
+	 ent->free_entry != NULL ||
+	 !krb5_principal_compare(context, ent->entry.principal,
+				 h->principal)))
+	ret = HDB_ERR_NOENTRY;	/* an alias, or not ours to copy */
+    if (ret == 0)
+	ret = unseal_previous(context, db, &ent->entry);
+
+    if (ret == 0) {
+	if (h->ent && h->ent->entry.kvno != ent->entry.kvno)
+	    kdc_log(context, config, 3,
+		    "hot principal %s rolled over from kvno %u to %u",
+		    name ? name : "<unknown>",
+		    (unsigned)h->ent->entry.kvno, (unsigned)ent->entry.kvno);
+	if (h->ent)
+	    _kdc_free_ent(context, h->ent);
+	krb5_data_free(&h->raw);
+	h->ent = ent;
+	h->db = db;
+	h->raw = raw;
+	ent = NULL;
+	krb5_data_zero(&raw);
+    } else {
+	if (ret != HDB_ERR_NOENTRY && ret != HDB_ERR_NOT_FOUND_HERE) {
+	    const char *msg = krb5_get_error_message(context, ret);
+	    kdc_log(context, config, 0,
+		    "Failed to refresh hot principal %s: %s",
+		    name ? name : "<unknown>", msg);
+	    krb5_free_error_message(context, msg);
+	}
+	/* Stale entries must not be handed out */
+	if (h->ent)
+	    _kdc_free_ent(context, h->ent);
+	krb5_data_free(&h->raw);
+	h->ent = NULL;
+    }
+    krb5_data_free(&raw);
+    if (ent)
+	_kdc_free_ent(context, ent);
+    free(name);
+}
+
+/**
+ * Check the hot principals if it is time to, and swap in the entries
+ * that changed.  Called by the KDC between requests.
+ *
+ * @param context a Kerberos 5 context
+ * @param config the KDC configuration
+ *
+ * @ingroup kdc
+ */
+
+void
+krb5_kdc_refresh_hot_principals(krb5_context context,
+				krb5_kdc_configuration *config)
+{
+    time_t now;
+    size_t i;
+
+    if (!hot_initialized)
+	init_hot(context, config);
+    if (num_hot == 0 || (now = time(NULL)) < next_refresh)
+	return;
+    next_refresh = now + config->hot_principals_refresh;
+    for (i = 0; i < num_hot; i++)
+	refresh_one(context, config, &hot[i]);
+}
+
+/*
+ * Copy the hot entry `src' to `dst' with the keys a request asked
+ * for: the keyset `kvno' (if not 0) as the current one, and the key
+ * history only if `all'.  The extensions of `src' are expanded.
+ */
+
+static krb5_error_code
+copy_hot(krb5_context context, HDB *db, const hdb_entry *src,
+	 krb5_kvno kvno, krb5_boolean all, hdb_entry *dst)
+{
+    const HDB_extension *ext;
+    const hdb_keyset *ks = NULL;
+    HDB_extensions exts;
+    krb5_error_code ret;
+    hdb_entry tmp;
+    size_t i, k;
+
+    /* What `tmp' points to is what gets copied */
+    tmp = *src;
+    ext = hdb_find_extension(src, choice_HDB_extension_data_hist_keys);
+    for (k = 0; ext && kvno != 0 && kvno != src->kvno &&
+		k < ext->data.u.hist_keys.len; k++) {
+	if (ext->data.u.hist_keys.val[k].kvno == kvno)
+	    ks = &ext->data.u.hist_keys.val[k];
+    }
+    /* Present an older keyset as the current one, as hdb_fetch_kvno does */
+    if (ks) {
+	tmp.kvno = ks->kvno;
+	tmp.keys = ks->keys;
+    }
+    exts.len = 0;
+    exts.val = NULL;
+    if (!all && ext) {
+	exts.val = calloc(src->extensions->len, sizeof(exts.val[0]));
+	if (exts.val == NULL)
+	    return krb5_enomem(context);
+	for (i = 0; i < src->extensions->len; i++) {
+	    if (&src->extensions->val[i] != ext)
+		exts.val[exts.len++] = src->extensions->val[i];
+	}
+	tmp.extensions = exts.len ? &exts : NULL;
+    }
+
+    ret = copy_hdb_entry(&tmp, dst);
+    free(exts.val);
+    if (ret)
+	return ret;
+    if (ks && ks->set_time)
+	ret = hdb_entry_set_pw_change_time(context, dst, *ks->set_time);
+    /* Only the current and the previous keys are unsealed already */
+    if (ret == 0)
+	ret = hdb_unseal_keys(context, db, dst);
+    if (ret)
+	free_hdb_entry(dst);
+    return ret;
+}
+
+/*
+ * Find `principal' among the hot principals, and if the cached entry
+ * can answer for `flags' and `kvno', return a copy of it as
+ * _kdc_db_fetch() would.  HDB_ERR_NOENTRY means go to the database.
+ */
+
+krb5_error_code
+_kdc_hot_fetch(krb5_context context,
+	       krb5_kdc_configuration *config,
+	       krb5_const_principal principal,
+	       unsigned flags,
+	       krb5_kvno kvno,
+	       HDB **db,
+	       hdb_entry_ex **h)
+{
+    struct hot_principal *hp = NULL;
+    hdb_entry_ex *ent;
+    krb5_error_code ret;
+    size_t i;
+
+    *h = NULL;
+    if (refreshing || num_hot == 0 ||
+	(flags & (HDB_F_ADMIN_DATA | HDB_F_LIVE_CLNT_KVNOS |
+		  HDB_F_LIVE_SVC_KVNOS)))
+	return HDB_ERR_NOENTRY;
+
+    for (i = 0; i < num_hot; i++) {
+	if (hot[i].ent &&
+	    krb5_principal_compare(context, hot[i].principal, principal)) {
+	    hp = &hot[i];
+	    break;
+	}
+    }
+    if (hp == NULL)
+	return HDB_ERR_NOENTRY;
+
+    /* Catch up with changes made since the last refresh */
+    refresh_one(context, config, hp);
+    if (hp->ent == NULL)
+	return HDB_ERR_NOENTRY;
+
+    if ((flags & HDB_F_KVNO_SPECIFIED) && kvno != hp->ent->entry.kvno &&
+	hdb_kvno2keys(context, &hp->ent->entry, kvno) == NULL)
+	return HDB_ERR_NOENTRY;
+
+    ent = calloc(1, sizeof(*ent));
+    if (ent == NULL)
+	return krb5_enomem(context);
+    ret = copy_hot(context, hp->db, &hp->ent->entry,
+		   (flags & HDB_F_KVNO_SPECIFIED) ? kvno : 0,
+		   (flags & HDB_F_ALL_KVNOS) != 0, &ent->entry);
+    if (ret) {
+	free(ent);
+	return ret;
+    }
+    if (db)
+	*db = hp->db;
+    *h = ent;
+    return 0;
+}
@@ -33,8 +33,27 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Runs JSON scenarios of client operations against an in-process KDC,
+ * with no network involved, and reports the throughput and latency
+ * percentiles of each kind of operation:
+ *
+ *	kdc-tester [kdc options] [-- [--clients=N] [--json]] scenario.json
+ *
+ * With --clients=N the scenario is run by N client processes at once,
+ * each with its own in-process KDC, as the KDC's own worker processes
+ * have (the KDC keeps per-process state that is not meant to be shared
+ * by threads).  Scenarios run concurrently should use MEMORY: ccaches.
+ *
+ * Operations are dicts with an "op" of "repeat", "kinit", "kgetcred" or
+ * "kdestroy", see the eval_*() functions for their parameters.  Any of
+ * them can have a "name" under which its latencies are reported instead
+ * of the default one (e.g., "kinit-fast", "kgetcred-s4u2proxy").
+ */
+
 #include "kdc_locl.h"
 #include "send_to_kdc_plugin.h"
+#include <getarg.h>
 
 struct perf {
     unsigned long as_req;
@@ -44,6 +63,21 @@ struct perf {
     struct perf *next;
 } *ptop;
 
+/* Latency samples, in microseconds, for each kind of operation */
+struct op_stats {
+    char *name;
+    size_t num;
+    size_t alloc;
+    uint32_t *usec;
+    struct op_stats *next;
+};
+
+static struct op_stats *stats;
+
+static int num_clients = 1;
+static int json_flag;
+static int quiet;
+
 int detach_from_console = -1;
 int daemon_child = -1;
 int do_bonjour = -1;
@@ -136,6 +170,8 @@ perf_stop(struct perf *perf)
     }
 
     timevalsub(&perf->stop, &perf->start);
+    if (quiet)
+	return;
     printf("time: %lu.%06lu\n",
 	   (unsigned long)perf->stop.tv_sec,
 	   (unsigned long)perf->stop.tv_usec);
@@ -155,6 +191,62 @@ perf_stop(struct perf *perf)
     }
 }
 
+static struct op_stats *
+get_op_stats(const char *name)
+{
+    struct op_stats *st;
+
+    for (st = stats; st; st = st->next) {
+	if (strcmp(st->name, name) == 0)
+	    return st;
+    }
+    st = calloc(1, sizeof(*st));
+    if (st == NULL || (st->name = strdup(name)) == NULL)
+	krb5_errx(kdc_context, 1, "out of memory");
+
+    /* Keep them in the order they first ran in, for the report */
+    if (stats == NULL) {
+	stats = st;
+    } else {
+	struct op_stats *last = stats;
+
+	while (last->next)
+	    last = last->next;
+	last->next = st;
+    }
+    return st;
+}
+
+static void
+add_sample(struct op_stats *st, uint32_t usec)
+{
+    if (st->num == st->alloc) {
+	size_t n = st->alloc ? st->alloc * 2 : 1024;
+	uint32_t *tmp = realloc(st->usec, n * sizeof(st->usec[0]));
+
+	if (tmp == NULL)
+	    krb5_errx(kdc_context, 1, "out of memory");
+	st->usec = tmp;
+	st->alloc = n;
+    }
+    st->usec[st->num++] = usec;
+}
+
+/* Record the latency of an operation that started at `start' */
+static void
+op_done(heim_dict_t o, const char *name, const struct timeval *start)
+{
+    heim_string_t label = heim_dict_get_value(o, HSTR("name"));
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    timevalsub(&tv, start);
+    if (label)
+	name = heim_string_get_utf8(label);
+    add_sample(get_op_stats(name),
+	       (uint32_t)(tv.tv_sec * 1000000 + tv.tv_usec));
+}
+
 /*
  *
  */
@@ -210,13 +302,16 @@ static void
 eval_kinit(heim_dict_t o)
 {
     heim_string_t user, password, keytab, fast_armor_cc, pk_user_id, ccache;
+    heim_bool_t forwardable;
     krb5_get_init_creds_opt *opt;
     krb5_init_creds_context ctx;
     krb5_principal client;
     krb5_keytab ktmem = NULL;
     krb5_ccache fast_cc = NULL;
     krb5_error_code ret;
+    struct timeval start;
 
+    gettimeofday(&start, NULL);
     if (ptop)
 	ptop->as_req++;
 
@@ -241,6 +336,10 @@ eval_kinit(heim_dict_t o)
     if (ret)
 	krb5_err(kdc_context, 1, ret, "krb5_get_init_creds_opt_alloc");
 
+    forwardable = heim_dict_get_value(o, HSTR("forwardable"));
+    if (forwardable)
+	krb5_get_init_creds_opt_set_forwardable(opt, heim_bool_val(forwardable));
+
     if (pk_user_id) {
 	heim_bool_t rsaobj = heim_dict_get_value(o, HSTR("pkinit-use-rsa"));
 	int use_rsa = rsaobj ? heim_bool_val(rsaobj) : 0;
@@ -331,23 +430,40 @@ eval_kinit(heim_dict_t o)
 	krb5_kt_close(kdc_context, ktmem);
     if (fast_cc)
 	krb5_cc_close(kdc_context, fast_cc);
+    krb5_get_init_creds_opt_free(kdc_context, opt);
+    krb5_free_principal(kdc_context, client);
+
+    op_done(o, pk_user_id ? (fast_armor_cc ? "kinit-pkinit-fast" : "kinit-pkinit")
+		: (fast_armor_cc ? "kinit-fast" : "kinit"), &start);
 }
 
 /*
  *
  */
 
+/*
+ * Get a ticket for "server" with the TGT in "ccache".  With "impersonate"
+ * it is an S4U2Self request for that client, with "delegation-ccache" an
+ * S4U2Proxy request using the ticket for ccache's principal in that
+ * ccache as evidence.  "canonicalize" lets the KDC answer with referrals,
+ * which are followed.  The ticket is stored in "out-ccache", if given, as
+ * with kgetcred --out-cache.
+ */
+
 static void
 eval_kgetcred(heim_dict_t o)
 {
-    heim_string_t server, ccache;
+    heim_string_t server, ccache, impersonate, delegation_cc, out_ccache;
     krb5_get_creds_opt opt;
-    heim_bool_t nostore;
+    heim_bool_t nostore, canonicalize, forwardable;
     krb5_error_code ret;
     krb5_ccache cc = NULL;
     krb5_principal s;
     krb5_creds *out = NULL;
+    const char *name = "kgetcred";
+    struct timeval start;
 
+    gettimeofday(&start, NULL);
     if (ptop)
 	ptop->tgs_req++;
 
@@ -378,14 +494,99 @@ eval_kgetcred(heim_dict_t o)
     if (heim_bool_val(nostore))
 	krb5_get_creds_opt_add_options(kdc_context, opt, KRB5_GC_NO_STORE);
 
+    canonicalize = heim_dict_get_value(o, HSTR("canonicalize"));
+    if (canonicalize && heim_bool_val(canonicalize)) {
+	krb5_get_creds_opt_add_options(kdc_context, opt, KRB5_GC_CANONICALIZE);
+	name = "kgetcred-canonicalize";
+    }
+
+    forwardable = heim_dict_get_value(o, HSTR("forwardable"));
+    if (forwardable && heim_bool_val(forwardable))
+	krb5_get_creds_opt_add_options(kdc_context, opt, KRB5_GC_FORWARDABLE);
+
+    out_ccache = heim_dict_get_value(o, HSTR("out-ccache"));
+    if (out_ccache)
+	krb5_get_creds_opt_add_options(kdc_context, opt, KRB5_GC_NO_STORE);
+
+    impersonate = heim_dict_get_value(o, HSTR("impersonate"));
+    if (impersonate) {
+	krb5_principal p;
+
+	ret = krb5_parse_name(kdc_context, heim_string_get_utf8(impersonate),
+			      &p);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_parse_name");
+	ret = krb5_get_creds_opt_set_impersonate(kdc_context, opt, p);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_get_creds_opt_set_impersonate");
+	krb5_get_creds_opt_add_options(kdc_context, opt, KRB5_GC_NO_STORE);
+	krb5_free_principal(kdc_context, p);
+	name = "kgetcred-s4u2self";
+    }
+
+    delegation_cc = heim_dict_get_value(o, HSTR("delegation-ccache"));
+    if (delegation_cc) {
+	krb5_ccache id;
+	krb5_creds c, mc;
+	Ticket ticket;
+
+	krb5_cc_clear_mcred(&mc);
+	ret = krb5_cc_get_principal(kdc_context, cc, &mc.server);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_cc_get_principal");
+
+	ret = krb5_cc_resolve(kdc_context, heim_string_get_utf8(delegation_cc),
+			      &id);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_cc_resolve");
+
+	ret = krb5_cc_retrieve_cred(kdc_context, id, 0, &mc, &c);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_cc_retrieve_cred");
+
+	ret = decode_Ticket(c.ticket.data, c.ticket.length, &ticket, NULL);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "decode_Ticket");
+	krb5_free_cred_contents(kdc_context, &c);
+
+	ret = krb5_get_creds_opt_set_ticket(kdc_context, opt, &ticket);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_get_creds_opt_set_ticket");
+	free_Ticket(&ticket);
+
+	krb5_cc_close(kdc_context, id);
+	krb5_free_principal(kdc_context, mc.server);
+
+	krb5_get_creds_opt_add_options(kdc_context, opt,
+				       KRB5_GC_CONSTRAINED_DELEGATION);
+	name = "kgetcred-s4u2proxy";
+    }
+
     ret = krb5_get_creds(kdc_context, opt, cc, s, &out);
     if (ret)
 	krb5_err(kdc_context, 1, ret, "krb5_get_creds");
-    
+
+    if (out_ccache) {
+	krb5_ccache oc;
+
+	ret = krb5_cc_resolve(kdc_context, heim_string_get_utf8(out_ccache),
+			      &oc);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "krb5_cc_resolve");
+	ret = krb5_cc_initialize(kdc_context, oc, out->client);
+	if (ret == 0)
+	    ret = krb5_cc_store_cred(kdc_context, oc, out);
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "storing credentials");
+	krb5_cc_close(kdc_context, oc);
+    }
+
     krb5_free_creds(kdc_context, out);
     krb5_free_principal(kdc_context, s);
     krb5_get_creds_opt_free(kdc_context, opt);
     krb5_cc_close(kdc_context, cc);
+
+    op_done(o, name, &start);
 }
 
 
@@ -451,6 +652,205 @@ eval_object(heim_object_t o)
 	errx(1, "unsupported");
 }
 
+/*
+ * Reporting
+ */
+
+static int
+cmp_usec(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Operations per second: the clients each run one operation at a time,
+ * so this is the number of clients over the mean latency.
+ */
+static double
+per_second(const struct op_stats *st)
+{
+    double total = 0;
+    size_t i;
+
+    for (i = 0; i < st->num; i++)
+	total += st->usec[i];
+    return total > 0 ? num_clients * st->num * 1000000.0 / total : 0;
+}
+
+/* Nearest-rank percentile, in hundredths of a percent, of sorted samples */
+static unsigned long
+percentile(const struct op_stats *st, size_t p)
+{
+    size_t i = (st->num * p + 9999) / 10000;
+
+    return st->usec[i > 0 ? i - 1 : 0];
+}
+
+static void
+report(double seconds)
+{
+    struct op_stats *st;
+    size_t total = 0;
+
+    for (st = stats; st; st = st->next) {
+	qsort(st->usec, st->num, sizeof(st->usec[0]), cmp_usec);
+	total += st->num;
+    }
+
+    if (json_flag) {
+	printf("{\n  \"clients\": %d,\n  \"seconds\": %.6f,\n"
+	       "  \"per-second\": %.2f,\n  \"ops\": {",
+	       num_clients, seconds, total / seconds);
+	for (st = stats; st; st = st->next) {
+	    printf("%s\n    \"%s\": { \"count\": %lu, \"per-second\": %.2f, "
+		   "\"p50-usec\": %lu, \"p99-usec\": %lu, "
+		   "\"p999-usec\": %lu }",
+		   st == stats ? "" : ",", st->name, (unsigned long)st->num,
+		   per_second(st), percentile(st, 5000),
+		   percentile(st, 9900), percentile(st, 9990));
+	}
+	printf("\n  }\n}\n");
+	return;
+    }
+
+    printf("clients: %d, time: %.6f, op/s: %.2f\n",
+	   num_clients, seconds, total / seconds);
+    printf("%-24s %8s %10s %10s %10s %10s\n",
+	   "op", "count", "op/s", "p50 us", "p99 us", "p99.9 us");
+    for (st = stats; st; st = st->next) {
+	printf("%-24s %8lu %10.2f %10lu %10lu %10lu\n",
+	       st->name, (unsigned long)st->num, per_second(st),
+	       percentile(st, 5000), percentile(st, 9900),
+	       percentile(st, 9990));
+    }
+}
+
+/*
+ * Concurrent clients: each runs the scenario in a process of its own and
+ * sends its latency samples back to us over a pipe when done.
+ */
+
+static void
+send_stats(int fd)
+{
+    struct op_stats *st;
+    krb5_error_code ret = 0;
+    krb5_storage *sp;
+    krb5_data data;
+    size_t i;
+
+    sp = krb5_storage_emem();
+    if (sp == NULL)
+	krb5_errx(kdc_context, 1, "out of memory");
+    for (st = stats; ret == 0 && st; st = st->next) {
+	ret = krb5_store_string(sp, st->name);
+	if (ret == 0)
+	    ret = krb5_store_uint32(sp, st->num);
+	for (i = 0; ret == 0 && i < st->num; i++)
+	    ret = krb5_store_uint32(sp, st->usec[i]);
+    }
+    if (ret == 0)
+	ret = krb5_storage_to_data(sp, &data);
+    if (ret)
+	krb5_err(kdc_context, 1, ret, "storing latencies");
+    krb5_storage_free(sp);
+
+    if (krb5_net_write(kdc_context, &fd, data.data, data.length) !=
+	(ssize_t)data.length)
+	krb5_err(kdc_context, 1, errno, "write");
+    krb5_data_free(&data);
+}
+
+static void
+recv_stats(int fd)
+{
+    struct op_stats *st;
+    krb5_error_code ret;
+    krb5_storage *sp;
+    uint32_t num, usec;
+    char *name;
+
+    sp = krb5_storage_from_fd(fd);
+    if (sp == NULL)
+	krb5_errx(kdc_context, 1, "out of memory");
+    while (krb5_ret_string(sp, &name) == 0) {
+	st = get_op_stats(name);
+	free(name);
+	ret = krb5_ret_uint32(sp, &num);
+	while (ret == 0 && num-- > 0) {
+	    ret = krb5_ret_uint32(sp, &usec);
+	    if (ret == 0)
+		add_sample(st, usec);
+	}
+	if (ret)
+	    krb5_err(kdc_context, 1, ret, "reading latencies");
+    }
+    krb5_storage_free(sp);
+}
+
+static void
+run_clients(heim_object_t o)
+{
+    struct timeval start, stop;
+    pid_t *pids;
+    int *fds;
+    int i, status, failed = 0;
+
+    pids = calloc(num_clients, sizeof(pids[0]));
+    fds = calloc(num_clients, sizeof(fds[0]));
+    if (pids == NULL || fds == NULL)
+	krb5_errx(kdc_context, 1, "out of memory");
+
+    fflush(stdout);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < num_clients; i++) {
+	int p[2];
+
+	if (pipe(p) == -1)
+	    krb5_err(kdc_context, 1, errno, "pipe");
+	pids[i] = fork();
+	if (pids[i] == -1)
+	    krb5_err(kdc_context, 1, errno, "fork");
+	if (pids[i] == 0) {
+	    close(p[0]);
+	    eval_object(o);
+	    send_stats(p[1]);
+	    exit(0);
+	}
+	close(p[1]);
+	fds[i] = p[0];
+    }
+
+    for (i = 0; i < num_clients; i++) {
+	recv_stats(fds[i]);
+	close(fds[i]);
+	if (waitpid(pids[i], &status, 0) == -1 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    failed++;
+    }
+    gettimeofday(&stop, NULL);
+    free(pids);
+    free(fds);
+
+    if (failed)
+	krb5_errx(kdc_context, 1, "%d of %d clients failed",
+		  failed, num_clients);
+
+    timevalsub(&stop, &start);
+    report(stop.tv_sec + stop.tv_usec / 1000000.0);
+}
+
+static struct getargs tester_args[] = {
+    {	"clients",	0,	arg_integer,	&num_clients,
+	"number of concurrent client processes", "number" },
+    {	"json",		0,	arg_flag,	&json_flag,
+	"report in JSON", NULL }
+};
+
+static int num_tester_args = sizeof(tester_args) / sizeof(tester_args[0]);
 
 int
 main(int argc, char **argv)
@@ -472,6 +872,16 @@ main(int argc, char **argv)
 
     kdc_config = configure(kdc_context, argc, argv, &optidx);
 
+    /* Our own options follow the KDC's, after a "--" */
+    optidx--;
+    if (getarg(tester_args, num_tester_args, argc, argv, &optidx)) {
+	arg_printusage(tester_args, num_tester_args, NULL, "scenario.json");
+	exit(1);
+    }
+    if (num_clients < 1)
+	errx(1, "--clients must be at least 1");
+    quiet = num_clients > 1 || json_flag;
+
     argc -= optidx;
     argv += optidx;
 
@@ -497,8 +907,18 @@ main(int argc, char **argv)
 	/*
 	 * do the work here
 	 */
-	
-	eval_object(o);
+
+	if (num_clients > 1) {
+	    run_clients(o);
+	} else {
+	    struct timeval start, stop;
+
+	    gettimeofday(&start, NULL);
+	    eval_object(o);
+	    gettimeofday(&stop, NULL);
+	    timevalsub(&stop, &start);
+	    report(stop.tv_sec + stop.tv_usec / 1000000.0);
+	}
 
 	heim_release(o);
     }
@@ -58,6 +58,23 @@ typedef struct krb5_kdc_configuration {
     int num_db;
 
     int num_kdc_processes;
+    int pk_worker_processes;
+    int pk_worker_queue_depth;
+    time_t tcp_idle_timeout;
+
+    int rate_limit;		/* requests per second per source prefix */
+    int rate_limit_burst;
+    int rate_limit_ipv4_prefix;
+    int rate_limit_ipv6_prefix;
+
+    int lockout_threshold;	/* failed pre-auth attempts, 0 to disable */
+    time_t lockout_duration;
+    time_t lockout_window;
+    time_t lockout_flush_interval;
+    const char *lockout_file;
+
+    char **hot_principals;	/* NULL for the krbtgts and the FAST cookie */
+    time_t hot_principals_refresh; /* 0 turns the cache off */
 
     krb5_boolean encode_as_rep_as_tgs_rep; /* bug compatibility */
 
@@ -66,6 +83,9 @@ typedef struct krb5_kdc_configuration {
     krb5_boolean svc_use_strongest_session_key;
     krb5_boolean use_strongest_server_key;
 
+    int tgs_cache_size;
+    int tgs_cache_lifetime;
+
     krb5_boolean check_ticket_addresses;
     krb5_boolean allow_null_ticket_addresses;
     krb5_boolean allow_anonymous;
@@ -81,6 +101,7 @@ typedef struct krb5_kdc_configuration {
     char **pkinit_kdc_cert_pool;
     char **pkinit_kdc_revoke;
     int pkinit_dh_min_bits;
+    int pkinit_key_pool_size;
     int pkinit_require_binding;
     int pkinit_allow_proxy_certs;
 
@@ -97,10 +118,22 @@ typedef struct krb5_kdc_configuration {
 
 } krb5_kdc_configuration;
 
+enum krb5_kdc_request_kind {
+    KDC_REQ_UNKNOWN = 0,
+    KDC_REQ_AS,
+    KDC_REQ_TGS,
+    KDC_REQ_DIGEST,
+    KDC_REQ_KX509
+};
+
+/* krb5_kdc_classify_request() looks at no more than this many bytes */
+#define KDC_CLASSIFY_LENGTH	16
+
 struct krb5_kdc_service {
     unsigned int flags;
 #define KS_KRB5		1
 #define KS_NO_LENGTH	2
+    enum krb5_kdc_request_kind kind;
     krb5_error_code (*process)(krb5_context context,
 			       krb5_kdc_configuration *config,
 			       krb5_data *req_buffer,
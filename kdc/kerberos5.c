@@ -553,15 +553,12 @@ pa_enc_chal_validate(kdc_request_t r, const PA_DATA *pa)
 	/*
 	 * Success
 	 */
-	if (r->clientdb->hdb_auth_status)
-	    r->clientdb->hdb_auth_status(r->context, r->clientdb, r->client,
-					 HDB_AUTH_SUCCESS);
+	_kdc_auth_status(r, HDB_AUTH_SUCCESS);
 	goto out;
     }
 
-    if (invalidPassword && r->clientdb->hdb_auth_status) {
-	r->clientdb->hdb_auth_status(r->context, r->clientdb, r->client,
-				     HDB_AUTH_WRONG_PASSWORD);
+    if (invalidPassword) {
+	_kdc_auth_status(r, HDB_AUTH_WRONG_PASSWORD);
 	ret = KRB5KDC_ERR_PREAUTH_FAILED;
     }
  out:
@@ -661,9 +658,7 @@ pa_enc_ts_validate(kdc_request_t r, const PA_DATA *pa)
 
 	free_EncryptedData(&enc_data);
 
-	if (r->clientdb->hdb_auth_status)
-	    r->clientdb->hdb_auth_status(r->context, r->clientdb, r->client,
-					 HDB_AUTH_WRONG_PASSWORD);
+	_kdc_auth_status(r, HDB_AUTH_WRONG_PASSWORD);
 
 	ret = KRB5KDC_ERR_PREAUTH_FAILED;
 	goto out;
@@ -1792,6 +1787,10 @@ _kdc_as_rep(kdc_request_t r,
 	goto out;
     }
 
+    ret = _kdc_lockout_check(r);
+    if (ret)
+	goto out;
+
     /*
      * Pre-auth processing
      */
@@ -1893,10 +1892,7 @@ _kdc_as_rep(kdc_request_t r,
 	    goto out;
     }
 
-    if (r->clientdb->hdb_auth_status) {
-	r->clientdb->hdb_auth_status(context, r->clientdb, r->client, 
-				     HDB_AUTH_SUCCESS);
-    }
+    _kdc_auth_status(r, HDB_AUTH_SUCCESS);
 
     /*
      * Verify flags after the user been required to prove its identity
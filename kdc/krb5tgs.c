@@ -1139,6 +1139,231 @@ need_referral(krb5_context context, krb5_kdc_configuration *config,
     return _krb5_get_host_realm_int(context, name, FALSE, realms) == 0;
 }
 
+/*
+ * Cache of recently seen TGTs.
+ *
+ * A client presents the same TGT in many TGS-REQs, and each one would
+ * have the TGT decrypted and its PAC verified and re-signed -- several
+ * checksums, plus whatever the windc plugin does -- all over again.
+ * The cache maps a TGT's ciphertext to the decrypted EncTicketPart and,
+ * for a few servers, to the PAC as verified and re-signed for each.
+ *
+ * An entry only matches a TGT with the very same ciphertext, decrypted
+ * with the very same krbtgt key, so krbtgt key rollover makes all the
+ * entries miss.  Entries also expire with their TGT or after
+ * tgs-cache-lifetime seconds, whichever comes first.  PACs are not
+ * cached at all when a windc plugin is loaded, as its verdict may
+ * change at any time.
+ *
+ * The cache is off unless tgs-cache-size is set.  It is direct-mapped
+ * and per KDC process, and has no lock: a KDC process handles one
+ * request at a time, and a multi-threaded user of libkdc must leave
+ * the cache off.
+ */
+
+#define TGS_CACHE_PACS 4
+
+struct tgs_cache_pac {
+    char *server;               /* server principal (unparsed) */
+    int have_client;            /* whether the client was in the DB */
+    krb5_keyblock check_key;    /* key the PAC was verified with */
+    krb5_keyblock server_key;   /* keys the PAC was signed with */
+    krb5_keyblock krbtgt_key;
+    krb5_data rspac;
+    int signedpath;
+};
+
+struct tgs_cache_entry {
+    time_t expires;             /* 0 if unused */
+    krb5_enctype etype;
+    krb5_data cipher;           /* the TGT's enc-part ciphertext */
+    krb5_keyblock key;          /* the key that decrypted it */
+    EncTicketPart tgt;
+    struct tgs_cache_pac pacs[TGS_CACHE_PACS];
+    unsigned int npacs;
+    unsigned int next_pac;
+};
+
+static struct tgs_cache_entry *tgs_cache;
+static size_t tgs_cache_size;
+
+static int
+tgs_cache_key_eq(const krb5_keyblock *a, const krb5_keyblock *b)
+{
+    return a->keytype == b->keytype &&
+	krb5_data_ct_cmp(&a->keyvalue, &b->keyvalue) == 0;
+}
+
+static void
+tgs_cache_free_pac(krb5_context context, struct tgs_cache_pac *pac)
+{
+    free(pac->server);
+    krb5_free_keyblock_contents(context, &pac->check_key);
+    krb5_free_keyblock_contents(context, &pac->server_key);
+    krb5_free_keyblock_contents(context, &pac->krbtgt_key);
+    krb5_data_free(&pac->rspac);
+    memset(pac, 0, sizeof(*pac));
+}
+
+static void
+tgs_cache_free_entry(krb5_context context, struct tgs_cache_entry *ent)
+{
+    unsigned int i;
+
+    if (ent->expires == 0)
+	return;
+    for (i = 0; i < ent->npacs; i++)
+	tgs_cache_free_pac(context, &ent->pacs[i]);
+    krb5_data_free(&ent->cipher);
+    krb5_free_keyblock_contents(context, &ent->key);
+    free_EncTicketPart(&ent->tgt);
+    memset(ent, 0, sizeof(*ent));
+}
+
+static struct tgs_cache_entry *
+tgs_cache_slot(krb5_kdc_configuration *config, const EncryptedData *enc)
+{
+    const unsigned char *p = enc->cipher.data;
+    unsigned long h;
+    size_t i;
+
+    if (config->tgs_cache_size <= 0 || config->tgs_cache_lifetime <= 0)
+	return NULL;
+    if (tgs_cache == NULL) {
+	tgs_cache = calloc(config->tgs_cache_size, sizeof(tgs_cache[0]));
+	if (tgs_cache == NULL)
+	    return NULL;
+	tgs_cache_size = config->tgs_cache_size;
+    }
+
+    /* FNV-1a */
+    for (h = 2166136261UL, i = 0; i < enc->cipher.length; i++)
+	h = (h ^ p[i]) * 16777619UL;
+    return &tgs_cache[h % tgs_cache_size];
+}
+
+/*
+ * Find the cache entry for the TGT `ticket' as decrypted with `key', if
+ * there is one.
+ */
+static struct tgs_cache_entry *
+tgs_cache_lookup(krb5_context context, krb5_kdc_configuration *config,
+		 const Ticket *ticket, const krb5_keyblock *key)
+{
+    struct tgs_cache_entry *ent;
+
+    ent = tgs_cache_slot(config, &ticket->enc_part);
+    if (ent == NULL || ent->expires == 0)
+	return NULL;
+    if (ent->expires <= kdc_time) {
+	tgs_cache_free_entry(context, ent);
+	return NULL;
+    }
+    if (ent->etype != ticket->enc_part.etype ||
+	krb5_data_cmp(&ent->cipher, &ticket->enc_part.cipher) != 0)
+	return NULL;
+    if (!tgs_cache_key_eq(&ent->key, key)) {
+	/* The krbtgt key changed without a change of kvno */
+	tgs_cache_free_entry(context, ent);
+	return NULL;
+    }
+    return ent;
+}
+
+static struct tgs_cache_entry *
+tgs_cache_add(krb5_context context, krb5_kdc_configuration *config,
+	      const Ticket *ticket, const krb5_keyblock *key,
+	      const EncTicketPart *tgt)
+{
+    struct tgs_cache_entry *ent;
+    time_t expires;
+
+    expires = kdc_time + config->tgs_cache_lifetime;
+    if (expires > tgt->endtime)
+	expires = tgt->endtime;
+    if (expires <= kdc_time)
+	return NULL;
+
+    ent = tgs_cache_slot(config, &ticket->enc_part);
+    if (ent == NULL)
+	return NULL;
+    tgs_cache_free_entry(context, ent);
+
+    if (krb5_data_copy(&ent->cipher, ticket->enc_part.cipher.data,
+		       ticket->enc_part.cipher.length) ||
+	krb5_copy_keyblock_contents(context, key, &ent->key) ||
+	copy_EncTicketPart(tgt, &ent->tgt)) {
+	krb5_data_free(&ent->cipher);
+	krb5_free_keyblock_contents(context, &ent->key);
+	memset(ent, 0, sizeof(*ent));
+	return NULL;
+    }
+    ent->etype = ticket->enc_part.etype;
+    ent->expires = expires;
+    return ent;
+}
+
+/* Find what check_PAC() produced earlier for this TGT and server */
+static int
+tgs_cache_get_pac(struct tgs_cache_entry *ent, const char *server,
+		  int have_client, const krb5_keyblock *check_key,
+		  const krb5_keyblock *server_key,
+		  const krb5_keyblock *krbtgt_key,
+		  krb5_data *rspac, int *signedpath)
+{
+    struct tgs_cache_pac *pac;
+    unsigned int i;
+
+    for (i = 0; i < ent->npacs; i++) {
+	pac = &ent->pacs[i];
+	if (strcmp(pac->server, server) != 0 ||
+	    pac->have_client != have_client ||
+	    !tgs_cache_key_eq(&pac->check_key, check_key) ||
+	    !tgs_cache_key_eq(&pac->server_key, server_key) ||
+	    !tgs_cache_key_eq(&pac->krbtgt_key, krbtgt_key))
+	    continue;
+	if (krb5_data_copy(rspac, pac->rspac.data, pac->rspac.length))
+	    return 0;
+	if (pac->signedpath)
+	    *signedpath = 1;
+	return 1;
+    }
+    return 0;
+}
+
+static void
+tgs_cache_add_pac(krb5_context context, struct tgs_cache_entry *ent,
+		  const char *server, int have_client,
+		  const krb5_keyblock *check_key,
+		  const krb5_keyblock *server_key,
+		  const krb5_keyblock *krbtgt_key,
+		  const krb5_data *rspac, int signedpath)
+{
+    struct tgs_cache_pac pac;
+
+    memset(&pac, 0, sizeof(pac));
+    pac.have_client = have_client;
+    pac.signedpath = signedpath;
+    pac.server = strdup(server);
+    if (pac.server == NULL ||
+	krb5_copy_keyblock_contents(context, check_key, &pac.check_key) ||
+	krb5_copy_keyblock_contents(context, server_key, &pac.server_key) ||
+	krb5_copy_keyblock_contents(context, krbtgt_key, &pac.krbtgt_key) ||
+	krb5_data_copy(&pac.rspac, rspac->data, rspac->length)) {
+	tgs_cache_free_pac(context, &pac);
+	return;
+    }
+
+    if (ent->npacs < TGS_CACHE_PACS) {
+	ent->pacs[ent->npacs++] = pac;
+    } else {
+	/* Replace the PACs round-robin */
+	tgs_cache_free_pac(context, &ent->pacs[ent->next_pac]);
+	ent->pacs[ent->next_pac] = pac;
+	ent->next_pac = (ent->next_pac + 1) % TGS_CACHE_PACS;
+    }
+}
+
 static krb5_error_code
 tgs_parse_request(krb5_context context,
 		  krb5_kdc_configuration *config,
@@ -1154,7 +1379,8 @@ tgs_parse_request(krb5_context context,
 		  int **cusec,
 		  AuthorizationData **auth_data,
 		  krb5_keyblock **replykey,
-		  int *rk_is_subkey)
+		  int *rk_is_subkey,
+		  struct tgs_cache_entry **tgt_cache)
 {
     static char failed[] = "<unparse_name failed>";
     krb5_ap_req ap_req;
@@ -1167,15 +1393,17 @@ tgs_parse_request(krb5_context context,
     krb5uint32 krbtgt_kvno;     /* kvno used for the PA-TGS-REQ AP-REQ Ticket */
     krb5uint32 krbtgt_kvno_try;
     int kvno_search_tries = 4;  /* number of kvnos to try when tkt_vno == 0 */
-    const Keys *krbtgt_keys;/* keyset for TGT tkt_vno */
+    HDB *krbtgt_db;
     Key *tkey;
     krb5_keyblock *subkey = NULL;
+    struct tgs_cache_entry *cached;
     unsigned usage;
 
     *auth_data = NULL;
     *csec  = NULL;
     *cusec = NULL;
     *replykey = NULL;
+    *tgt_cache = NULL;
 
     memset(&ap_req, 0, sizeof(ap_req));
     ret = krb5_decode_ap_req(context, &tgs_req->padata_value, &ap_req);
@@ -1200,7 +1428,7 @@ tgs_parse_request(krb5_context context,
 
     krbtgt_kvno = ap_req.ticket.enc_part.kvno ? *ap_req.ticket.enc_part.kvno : 0;
     ret = _kdc_db_fetch(context, config, princ, HDB_F_GET_KRBTGT,
-			&krbtgt_kvno, NULL, krbtgt);
+			&krbtgt_kvno, &krbtgt_db, krbtgt);
 
     if (ret == HDB_ERR_NOT_FOUND_HERE) {
 	/* XXX Factor out this unparsing of the same princ all over */
@@ -1262,9 +1490,9 @@ tgs_parse_request(krb5_context context,
     *krbtgt_etype = ap_req.ticket.enc_part.etype;
 
 next_kvno:
-    krbtgt_keys = hdb_kvno2keys(context, &(*krbtgt)->entry, krbtgt_kvno_try);
-    ret = hdb_enctype2key(context, &(*krbtgt)->entry, krbtgt_keys,
-			  ap_req.ticket.enc_part.etype, &tkey);
+    ret = hdb_kvno_enctype2key(context, krbtgt_db, &(*krbtgt)->entry,
+			       krbtgt_kvno_try, ap_req.ticket.enc_part.etype,
+			       &tkey);
     if (ret && krbtgt_kvno == 0 && kvno_search_tries > 0) {
 	kvno_search_tries--;
 	krbtgt_kvno_try--;
@@ -1289,15 +1517,30 @@ next_kvno:
     else
 	verify_ap_req_flags = 0;
 
-    ret = krb5_verify_ap_req2(context,
-			      &ac,
-			      &ap_req,
-			      princ,
-			      &tkey->key,
-			      verify_ap_req_flags,
-			      &ap_req_options,
-			      ticket,
-			      KRB5_KU_TGS_REQ_AUTH);
+    cached = NULL;
+    if (!ap_req.ap_options.use_session_key)
+	cached = tgs_cache_lookup(context, config, &ap_req.ticket, &tkey->key);
+    if (cached) {
+	kdc_log(context, config, 5, "TGT found in the TGS cache");
+	ret = _krb5_verify_ap_req_decrypted(context,
+					    &ac,
+					    &ap_req,
+					    princ,
+					    &cached->tgt,
+					    verify_ap_req_flags,
+					    &ap_req_options,
+					    ticket,
+					    KRB5_KU_TGS_REQ_AUTH);
+    } else
+	ret = krb5_verify_ap_req2(context,
+				  &ac,
+				  &ap_req,
+				  princ,
+				  &tkey->key,
+				  verify_ap_req_flags,
+				  &ap_req_options,
+				  ticket,
+				  KRB5_KU_TGS_REQ_AUTH);
     if (ret == KRB5KRB_AP_ERR_BAD_INTEGRITY && kvno_search_tries > 0) {
 	kvno_search_tries--;
 	krbtgt_kvno_try--;
@@ -1312,6 +1555,11 @@ next_kvno:
 	goto out;
     }
 
+    if (cached == NULL && !ap_req.ap_options.use_session_key)
+	cached = tgs_cache_add(context, config, &ap_req.ticket, &tkey->key,
+			       &(*ticket)->ticket);
+    *tgt_cache = cached;
+
     {
 	krb5_authenticator auth;
 
@@ -1515,7 +1763,8 @@ tgs_build_reply(krb5_context context,
 		const char *from,
 		const char **e_text,
 		AuthorizationData **auth_data,
-		const struct sockaddr *from_addr)
+		const struct sockaddr *from_addr,
+		struct tgs_cache_entry *tgt_cache)
 {
     krb5_error_code ret, ret2;
     krb5_principal cp = NULL, sp = NULL, rsp = NULL, tp = NULL, dp = NULL;
@@ -1936,11 +2185,25 @@ server_lookup:
 	krb5_free_error_message(context, msg);
     }
 
-    ret = check_PAC(context, config, cp, NULL,
-		    client, server, krbtgt,
-		    &tkey_check->key,
-		    ekey, &tkey_sign->key,
-		    tgt, &rspac, &signedpath);
+    /* The windc plugin gets to verify every PAC */
+    if (_kdc_have_windc_plugin())
+	tgt_cache = NULL;
+    if (tgt_cache != NULL &&
+	tgs_cache_get_pac(tgt_cache, spn, client != NULL, &tkey_check->key,
+			  ekey, &tkey_sign->key, &rspac, &signedpath)) {
+	kdc_log(context, config, 5, "PAC for %s found in the TGS cache", spn);
+	ret = 0;
+    } else {
+	ret = check_PAC(context, config, cp, NULL,
+			client, server, krbtgt,
+			&tkey_check->key,
+			ekey, &tkey_sign->key,
+			tgt, &rspac, &signedpath);
+	if (ret == 0 && tgt_cache)
+	    tgs_cache_add_pac(context, tgt_cache, spn, client != NULL,
+			      &tkey_check->key, ekey, &tkey_sign->key,
+			      &rspac, signedpath);
+    }
     if (ret) {
 	const char *msg = krb5_get_error_message(context, ret);
 	kdc_log(context, config, 0,
@@ -2137,10 +2400,9 @@ server_lookup:
 
 	t = &b->additional_tickets->val[0];
 
-	ret = hdb_enctype2key(context, &client->entry,
-			      hdb_kvno2keys(context, &client->entry,
-					    t->enc_part.kvno ? * t->enc_part.kvno : 0),
-			      t->enc_part.etype, &clientkey);
+	ret = hdb_kvno_enctype2key(context, clientdb, &client->entry,
+				   t->enc_part.kvno ? *t->enc_part.kvno : 0,
+				   t->enc_part.etype, &clientkey);
 	if(ret){
 	    ret = KRB5KDC_ERR_ETYPE_NOSUPP; /* XXX */
 	    goto out;
@@ -2409,6 +2671,7 @@ _kdc_tgs_rep(krb5_context context,
     int rk_is_subkey = 0;
     time_t *csec = NULL;
     int *cusec = NULL;
+    struct tgs_cache_entry *tgt_cache = NULL;
 
     if(req->padata == NULL){
 	ret = KRB5KDC_ERR_PREAUTH_REQUIRED; /* XXX ??? */
@@ -2436,7 +2699,8 @@ _kdc_tgs_rep(krb5_context context,
 			    &csec, &cusec,
 			    &auth_data,
 			    &replykey,
-			    &rk_is_subkey);
+			    &rk_is_subkey,
+			    &tgt_cache);
     if (ret == HDB_ERR_NOT_FOUND_HERE) {
 	/* kdc_log() is called in tgs_parse_request() */
 	goto out;
@@ -2467,7 +2731,8 @@ _kdc_tgs_rep(krb5_context context,
 			  from,
 			  &e_text,
 			  &auth_data,
-			  from_addr);
+			  from_addr,
+			  tgt_cache);
     if (ret) {
 	kdc_log(context, config, 0,
 		"Failed building TGS-REP to %s", from);
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "kdc_locl.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/*
+ * In-KDC account lockout
+ *
+ * With [kdc] lockout-threshold set, the KDC counts the failed
+ * pre-authentication attempts of each client itself, and refuses
+ * clients that failed that many times in a row within
+ * lockout-window, for lockout-duration.  The counters live in a
+ * small file, [kdc] lockout-file, mapped into all the KDC processes,
+ * so that they are shared by the workers and survive restarts.
+ *
+ * Backends that do lockout themselves (hdb_auth_status) are then not
+ * told of each attempt as it happens: every lockout-flush-interval
+ * the workers tell them of the failures since the previous time, and
+ * of the last success among them, a few clients per pass of the main
+ * loop.  A success after a success is not news at all, so the common
+ * case costs no database write.
+ *
+ * Without lockout-threshold the backend is told of each attempt, as
+ * it always was.  So are clients whose names do not fit in the table,
+ * and clients that fail while every slot near their hash is in use: a
+ * slot is only reused once its client is not locked out, not in a run
+ * of failures, and has nothing left to tell the backend.
+ */
+
+#define KDC_LOCKOUT_MAGIC	0x4b4c4f43	/* "KLOC" */
+#define KDC_LOCKOUT_VERSION	3
+#define KDC_LOCKOUT_SLOTS	4096
+#define KDC_LOCKOUT_PROBES	8
+#define KDC_LOCKOUT_NAMELEN	232
+#define LOCKOUT_FLUSH_BATCH	16	/* clients per pass of the main loop */
+/* Failure statuses counted, HDB_AUTH_WRONG_PASSWORD and up */
+#define LOCKOUT_NSTATUS		2
+
+struct lockout_slot {
+    uint32_t hash;		/* 0 if the slot is free */
+    uint32_t nfail;		/* failures in a row */
+    /*
+     * What the backend is not told of yet, in this order: failures by
+     * status, then a success, if set, then failures again.
+     */
+    uint32_t fail_before[LOCKOUT_NSTATUS];
+    uint32_t success;
+    uint32_t pad;
+    uint32_t fail_after[LOCKOUT_NSTATUS];
+    int64_t first_fail;		/* start of the current run of failures */
+    int64_t locked_until;
+    int64_t last_used;
+    char name[KDC_LOCKOUT_NAMELEN];
+};
+
+struct lockout_table {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t flush_next;	/* next slot to flush, nslots when done */
+    int64_t last_flush;
+    struct lockout_slot slots[KDC_LOCKOUT_SLOTS];
+};
+
+static struct lockout_table *lockout;
+static int lockout_fd = -1;
+static int lockout_inited;
+
+static struct lockout_table *
+map_lockout_file(krb5_context context, krb5_kdc_configuration *config)
+{
+#if defined(HAVE_MMAP) && !defined(_WIN32)
+    struct lockout_table *t;
+    struct stat st;
+    char *fn = NULL;
+    int fd;
+
+    if (config->lockout_file)
+	fn = strdup(config->lockout_file);
+    else if (asprintf(&fn, "%s/kdc-lockout", hdb_db_dir(context)) == -1)
+	fn = NULL;
+    if (fn == NULL)
+	return NULL;
+
+    fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+	kdc_log(context, config, 0, "lockout: could not open %s: %s",
+		fn, strerror(errno));
+	free(fn);
+	return NULL;
+    }
+    rk_cloexec(fd);
+    free(fn);
+
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 ||
+	(st.st_size < (off_t)sizeof(*t) && ftruncate(fd, sizeof(*t)) != 0)) {
+	close(fd);
+	return NULL;
+    }
+    t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (t == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+    if (t->magic != KDC_LOCKOUT_MAGIC || t->version != KDC_LOCKOUT_VERSION ||
+	t->nslots != KDC_LOCKOUT_SLOTS) {
+	memset(t, 0, sizeof(*t));
+	t->magic = KDC_LOCKOUT_MAGIC;
+	t->version = KDC_LOCKOUT_VERSION;
+	t->nslots = KDC_LOCKOUT_SLOTS;
+	t->flush_next = KDC_LOCKOUT_SLOTS;
+    }
+    flock(fd, LOCK_UN);
+    lockout_fd = fd;
+    return t;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Returns the table locked, or NULL if there is none.  Each worker
+ * opens the file itself, after the fork, so that flock() keeps them
+ * apart.
+ */
+
+static struct lockout_table *
+lock_table(krb5_context context, krb5_kdc_configuration *config)
+{
+    if (config->lockout_threshold <= 0)
+	return NULL;
+
+    if (!lockout_inited) {
+	lockout_inited = 1;
+	lockout = map_lockout_file(context, config);
+	if (lockout == NULL) {
+	    /* Still lock out, if only in this process */
+	    lockout = calloc(1, sizeof(*lockout));
+	    if (lockout)
+		lockout->nslots = lockout->flush_next = KDC_LOCKOUT_SLOTS;
+	}
+    }
+    if (lockout == NULL)
+	return NULL;
+    if (lockout_fd != -1)
+	(void) flock(lockout_fd, LOCK_EX);
+    return lockout;
+}
+
+static void
+unlock_table(void)
+{
+    if (lockout_fd != -1)
+	(void) flock(lockout_fd, LOCK_UN);
+}
+
+static krb5_boolean
+has_pending(const struct lockout_slot *s)
+{
+    size_t i;
+
+    for (i = 0; i < LOCKOUT_NSTATUS; i++)
+	if (s->fail_before[i] || s->fail_after[i])
+	    return TRUE;
+    return s->success != 0;
+}
+
+/*
+ * Whether the slot may be given to another client: not if that would
+ * unlock its client, reset a run of failures, or lose counts the
+ * backend has not been told of yet.
+ */
+
+static krb5_boolean
+evictable(const struct lockout_slot *s, time_t now, time_t window)
+{
+    if (s->hash == 0)
+	return TRUE;
+    if (s->locked_until > now || has_pending(s))
+	return FALSE;
+    return s->nfail == 0 || now - s->first_fail > window;
+}
+
+static struct lockout_slot *
+find_slot(struct lockout_table *t, const char *name, krb5_boolean create,
+	  time_t now, time_t window)
+{
+    struct lockout_slot *s, *victim = NULL;
+    const unsigned char *p;
+    uint32_t hash = 5381;
+    size_t i;
+
+    for (p = (const unsigned char *)name; *p; p++)
+	hash = hash * 33 + *p;
+    if (hash == 0)
+	hash = 1;
+
+    for (i = 0; i < KDC_LOCKOUT_PROBES; i++) {
+	s = &t->slots[(hash + i) % KDC_LOCKOUT_SLOTS];
+	if (s->hash == hash && strcmp(s->name, name) == 0)
+	    return s;
+	if (!evictable(s, now, window))
+	    continue;
+	if (victim == NULL || s->hash == 0 ||
+	    (victim->hash != 0 && s->last_used < victim->last_used))
+	    victim = s;
+    }
+    /* With no slot to spare, the caller tells the backend directly */
+    if (!create || victim == NULL)
+	return NULL;
+
+    /* Take a free slot, or the least recently used idle one */
+    memset(victim, 0, sizeof(*victim));
+    victim->hash = hash;
+    victim->last_used = now;
+    strlcpy(victim->name, name, KDC_LOCKOUT_NAMELEN);
+    return victim;
+}
+
+/*
+ * Names are kept whole or not at all: a truncated one would match
+ * other clients, and could not be fetched again for the flush.
+ */
+
+static krb5_boolean
+fits_table(const char *name)
+{
+    return strlen(name) < KDC_LOCKOUT_NAMELEN;
+}
+
+static void
+tell_backend(kdc_request_t r, int status)
+{
+    if (r->clientdb->hdb_auth_status)
+	r->clientdb->hdb_auth_status(r->context, r->clientdb, r->client,
+				     status);
+}
+
+/*
+ * Return KRB5KDC_ERR_POLICY if the client of `r' is locked out.
+ */
+
+krb5_error_code
+_kdc_lockout_check(kdc_request_t r)
+{
+    struct lockout_table *t;
+    struct lockout_slot *s;
+    krb5_error_code ret = 0;
+    time_t locked_until = 0;
+    char *name;
+
+    if (r->config->lockout_threshold <= 0)
+	return 0;
+    if (krb5_unparse_name(r->context, r->client->entry.principal, &name))
+	return 0;
+    if (fits_table(name) && (t = lock_table(r->context, r->config)) != NULL) {
+	s = find_slot(t, name, FALSE, kdc_time, r->config->lockout_window);
+	if (s && s->locked_until > kdc_time)
+	    locked_until = s->locked_until;
+	unlock_table();
+    }
+    if (locked_until) {
+	kdc_log(r->context, r->config, 0,
+		"Client (%s) is locked out for %lu more seconds",
+		r->client_name, (unsigned long)(locked_until - kdc_time));
+	ret = KRB5KDC_ERR_POLICY;
+    }
+    free(name);
+    return ret;
+}
+
+/*
+ * Record that the client of `r' passed (HDB_AUTH_SUCCESS) or failed
+ * pre-authentication, for the lockout policy and the backend.
+ */
+
+void
+_kdc_auth_status(kdc_request_t r, int status)
+{
+    struct lockout_table *t = NULL;
+    struct lockout_slot *s;
+    char *name = NULL;
+    size_t i;
+
+    if (r->config->lockout_threshold <= 0 ||
+	status < HDB_AUTH_SUCCESS ||
+	status > HDB_AUTH_WRONG_PASSWORD + LOCKOUT_NSTATUS - 1 ||
+	krb5_unparse_name(r->context, r->client->entry.principal, &name) ||
+	!fits_table(name) ||
+	(t = lock_table(r->context, r->config)) == NULL) {
+	tell_backend(r, status);
+	free(name);
+	return;
+    }
+
+    s = find_slot(t, name, status != HDB_AUTH_SUCCESS, kdc_time,
+		  r->config->lockout_window);
+    if (s == NULL) {
+	/*
+	 * Never failed lately, nothing to remember or tell; or a failure
+	 * with no slot to keep it in.
+	 */
+	if (status != HDB_AUTH_SUCCESS) {
+	    kdc_log(r->context, r->config, 5, "lockout: no free slot for "
+		    "client (%s), telling the backend", r->client_name);
+	    tell_backend(r, status);
+	}
+    } else if (status == HDB_AUTH_SUCCESS) {
+	s->last_used = kdc_time;
+	if (s->nfail || has_pending(s)) {
+	    s->nfail = 0;
+	    /* Only the last success matters to the backend */
+	    for (i = 0; i < LOCKOUT_NSTATUS; i++) {
+		s->fail_before[i] += s->fail_after[i];
+		s->fail_after[i] = 0;
+	    }
+	    s->success = 1;
+	}
+    } else {
+	s->last_used = kdc_time;
+	if (s->nfail == 0 || kdc_time - s->first_fail > r->config->lockout_window) {
+	    s->nfail = 0;
+	    s->first_fail = kdc_time;
+	}
+	s->nfail++;
+	i = status - HDB_AUTH_WRONG_PASSWORD;
+	if (s->success)
+	    s->fail_after[i]++;
+	else
+	    s->fail_before[i]++;
+	if (s->nfail >= (uint32_t)r->config->lockout_threshold) {
+	    s->locked_until = kdc_time + r->config->lockout_duration;
+	    s->nfail = 0;
+	    kdc_log(r->context, r->config, 0,
+		    "Client (%s) locked out for %lu seconds after %d "
+		    "failed attempts", r->client_name,
+		    (unsigned long)r->config->lockout_duration,
+		    r->config->lockout_threshold);
+	}
+    }
+    unlock_table();
+    free(name);
+}
+
+/*
+ * Tell the backends what happened to the clients since the last time,
+ * every [kdc] lockout-flush-interval.  Called by the KDC main loop,
+ * outside of request processing; each call tells of at most
+ * LOCKOUT_FLUSH_BATCH clients and leaves the rest to the next calls,
+ * so that the loop does not stall on the database.
+ */
+
+void
+krb5_kdc_flush_lockouts(krb5_context context, krb5_kdc_configuration *config)
+{
+    struct lockout_table *t;
+    struct lockout_slot *s;
+    struct {
+	char name[KDC_LOCKOUT_NAMELEN];
+	uint32_t fail_before[LOCKOUT_NSTATUS];
+	uint32_t success;
+	uint32_t fail_after[LOCKOUT_NSTATUS];
+    } pending[LOCKOUT_FLUSH_BATCH];
+    static time_t next_flush;
+    size_t i, k, n = 0;
+    uint32_t j;
+    time_t now;
+
+    if (config->lockout_threshold <= 0 || (now = time(NULL)) < next_flush)
+	return;
+    next_flush = now + 1;
+    if ((t = lock_table(context, config)) == NULL)
+	return;
+    if (t->flush_next >= KDC_LOCKOUT_SLOTS) {
+	/* Another worker may have done it */
+	if (now - t->last_flush < config->lockout_flush_interval) {
+	    next_flush = t->last_flush + config->lockout_flush_interval;
+	    unlock_table();
+	    return;
+	}
+	t->last_flush = now;
+	t->flush_next = 0;
+    }
+    for (i = t->flush_next; i < KDC_LOCKOUT_SLOTS && n < LOCKOUT_FLUSH_BATCH; i++) {
+	s = &t->slots[i];
+	if (s->hash == 0)
+	    continue;
+	if (has_pending(s)) {
+	    strlcpy(pending[n].name, s->name, sizeof(pending[n].name));
+	    memcpy(pending[n].fail_before, s->fail_before,
+		   sizeof(s->fail_before));
+	    pending[n].success = s->success;
+	    memcpy(pending[n].fail_after, s->fail_after,
+		   sizeof(s->fail_after));
+	    n++;
+	    memset(s->fail_before, 0, sizeof(s->fail_before));
+	    memset(s->fail_after, 0, sizeof(s->fail_after));
+	    s->success = 0;
+	}
+	/* Forget clients that are done failing */
+	if (s->nfail == 0 && s->locked_until <= now)
+	    memset(s, 0, sizeof(*s));
+    }
+    t->flush_next = i;
+    /* Come back on the next pass if there is more */
+    next_flush = i < KDC_LOCKOUT_SLOTS ? 0 :
+	t->last_flush + config->lockout_flush_interval;
+    unlock_table();
+
+    /* The database is only touched with the table unlocked */
+    for (i = 0; i < n; i++) {
+	krb5_principal principal;
+	hdb_entry_ex *client;
+	HDB *clientdb;
+
+	if (krb5_parse_name(context, pending[i].name, &principal))
+	    continue;
+	if (_kdc_db_fetch(context, config, principal, HDB_F_GET_CLIENT,
+			  NULL, &clientdb, &client) == 0) {
+	    /* Each failure counts, for backends that count them */
+	    if (clientdb->hdb_auth_status) {
+		for (k = 0; k < LOCKOUT_NSTATUS; k++)
+		    for (j = 0; j < pending[i].fail_before[k]; j++)
+			clientdb->hdb_auth_status(context, clientdb, client,
+						  HDB_AUTH_WRONG_PASSWORD + k);
+		if (pending[i].success)
+		    clientdb->hdb_auth_status(context, clientdb, client,
+					      HDB_AUTH_SUCCESS);
+		for (k = 0; k < LOCKOUT_NSTATUS; k++)
+		    for (j = 0; j < pending[i].fail_after[k]; j++)
+			clientdb->hdb_auth_status(context, clientdb, client,
+						  HDB_AUTH_WRONG_PASSWORD + k);
+	    }
+	    _kdc_free_ent(context, client);
+	}
+	krb5_free_principal(context, principal);
+    }
+    if (n)
+	kdc_log(context, config, 5, "lockout: told the backend about %lu "
+		"client(s)", (unsigned long)n);
+}
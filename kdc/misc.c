@@ -76,9 +76,13 @@ _kdc_db_fetch(krb5_context context,
 	kvno = *kvno_ptr;
 	flags |= HDB_F_KVNO_SPECIFIED;
     } else {
-	flags |= HDB_F_ALL_KVNOS;
+	flags |= HDB_F_ALL_KVNOS | HDB_F_LAZY_HIST_KEYS;
     }
 
+    ret = _kdc_hot_fetch(context, config, principal, flags, kvno, db, h);
+    if (ret != HDB_ERR_NOENTRY)
+	return ret;
+
     ent = calloc(1, sizeof (*ent));
     if (ent == NULL)
         return krb5_enomem(context);
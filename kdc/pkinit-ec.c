@@ -41,10 +41,10 @@
 /*
  * As with the other *-ec.c files in Heimdal, this is a bit of a hack.
  *
- * The idea is to use OpenSSL for EC because hcrypto doesn't have the
- * required functionality at this time.  To do this we segregate
- * EC-using code into separate source files and then we arrange for them
- * to get the OpenSSL headers and not the conflicting hcrypto ones.
+ * The idea is to use OpenSSL for EC when we are built with it, and
+ * hcrypto's native P-256 otherwise.  To do this we segregate EC-using
+ * code into separate source files and then we arrange for them to get
+ * the OpenSSL headers and not the conflicting hcrypto ones.
  *
  * Because of auto-generated *-private.h headers, we end up needing to
  * make sure various types are defined before we include them, thus the
@@ -57,6 +57,9 @@
 #include <openssl/evp.h>
 #include <openssl/bn.h>
 #define HEIM_NO_CRYPTO_HDRS
+#else
+#include <hcrypto/ec.h>
+#include <hcrypto/ecdh.h>
 #endif /* HAVE_HCRYPTO_W_OPENSSL */
 
 #define NO_HCRYPTO_POLLUTION
@@ -70,7 +73,6 @@
 
 #include <hx509.h>
 
-#ifdef HAVE_HCRYPTO_W_OPENSSL
 static void
 free_client_ec_param(krb5_context context,
                      EC_KEY *ec_key_pk,
@@ -81,21 +83,99 @@ free_client_ec_param(krb5_context context,
     if (ec_key_key != NULL)
         EC_KEY_free(ec_key_key);
 }
-#endif
 
 void
 _kdc_pk_free_client_ec_param(krb5_context context,
                              void *ec_key_pk,
                              void *ec_key_key)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     free_client_ec_param(context, ec_key_pk, ec_key_key);
-#endif
 }
 
-#ifdef HAVE_HCRYPTO_W_OPENSSL
+/*
+ * Pools of ephemeral ECDH keys, one per curve that clients have used;
+ * see the DH key pools in pkinit.c.
+ */
+
+struct ecdh_key_pool {
+    int nid;
+    EC_KEY **keys;
+    size_t nkeys;
+};
+
+static struct {
+    struct ecdh_key_pool *val;
+    size_t len;
+} ecdh_pools;
+
+static EC_KEY *
+ecdh_pool_get(krb5_kdc_configuration *config, const EC_GROUP *group)
+{
+    struct ecdh_key_pool *pool;
+    int nid = EC_GROUP_get_curve_name(group);
+    size_t i;
+    void *ptr;
+
+    if (config->pkinit_key_pool_size <= 0 || nid == NID_undef)
+	return NULL;
+
+    for (i = 0; i < ecdh_pools.len; i++) {
+	pool = &ecdh_pools.val[i];
+	if (pool->nid == nid)
+	    return pool->nkeys ? pool->keys[--pool->nkeys] : NULL;
+    }
+
+    ptr = realloc(ecdh_pools.val,
+		  (ecdh_pools.len + 1) * sizeof(ecdh_pools.val[0]));
+    if (ptr == NULL)
+	return NULL;
+    ecdh_pools.val = ptr;
+    pool = &ecdh_pools.val[ecdh_pools.len];
+    pool->nid = nid;
+    pool->nkeys = 0;
+    pool->keys = calloc(config->pkinit_key_pool_size, sizeof(pool->keys[0]));
+    if (pool->keys != NULL)
+	ecdh_pools.len++;
+    return NULL;
+}
+
+static krb5_boolean
+refill_ecdh_key_pools(krb5_context context, krb5_kdc_configuration *config)
+{
+    struct ecdh_key_pool *pool;
+    EC_KEY *key;
+    size_t i;
+
+    for (i = 0; i < ecdh_pools.len; i++) {
+	pool = &ecdh_pools.val[i];
+	if (pool->nkeys >= (size_t)config->pkinit_key_pool_size)
+	    continue;
+
+	key = EC_KEY_new_by_curve_name(pool->nid);
+	if (key == NULL || EC_KEY_generate_key(key) != 1) {
+	    if (key)
+		EC_KEY_free(key);
+	    kdc_log(context, config, 0,
+		    "PKINIT: failed to generate an ECDH key for curve %d",
+		    pool->nid);
+	    return FALSE;
+	}
+	pool->keys[pool->nkeys++] = key;
+	return TRUE;
+    }
+    return FALSE;
+}
+
+krb5_boolean
+_kdc_refill_ecdh_key_pools(krb5_context context,
+                           krb5_kdc_configuration *config)
+{
+    return refill_ecdh_key_pools(context, config);
+}
+
 static krb5_error_code
 generate_ecdh_keyblock(krb5_context context,
+                       krb5_kdc_configuration *config,
                        EC_KEY *ec_key_pk,    /* the client's public key */
                        EC_KEY **ec_key_key,  /* the KDC's ephemeral private */
                        unsigned char **dh_gen_key, /* shared secret */
@@ -129,15 +209,22 @@ generate_ecdh_keyblock(krb5_context context,
         return ret;
     }
 
-    ephemeral = EC_KEY_new();
-    if (ephemeral == NULL)
-        return krb5_enomem(context);
-
-    EC_KEY_set_group(ephemeral, group);
-
-    if (EC_KEY_generate_key(ephemeral) != 1) {
-	EC_KEY_free(ephemeral);
-        return krb5_enomem(context);
+    ephemeral = ecdh_pool_get(config, group);
+    if (ephemeral) {
+        kdc_log(context, config, 5, "PK-INIT: using a pooled ECDH key");
+    } else {
+        kdc_log(context, config, 5, "PK-INIT: no pooled ECDH key, "
+                "generating one");
+        ephemeral = EC_KEY_new();
+        if (ephemeral == NULL)
+            return krb5_enomem(context);
+
+        EC_KEY_set_group(ephemeral, group);
+
+        if (EC_KEY_generate_key(ephemeral) != 1) {
+            EC_KEY_free(ephemeral);
+            return krb5_enomem(context);
+        }
     }
 
     size = (EC_GROUP_get_degree(group) + 7) / 8;
@@ -165,25 +252,20 @@ generate_ecdh_keyblock(krb5_context context,
 
     return 0;
 }
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 
 krb5_error_code
 _kdc_generate_ecdh_keyblock(krb5_context context,
+                            krb5_kdc_configuration *config,
                             void *ec_key_pk,    /* the client's public key */
                             void **ec_key_key,  /* the KDC's ephemeral private */
                             unsigned char **dh_gen_key, /* shared secret */
                             size_t *dh_gen_keylen)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
-    return generate_ecdh_keyblock(context, ec_key_pk,
+    return generate_ecdh_keyblock(context, config, ec_key_pk,
                                   (EC_KEY **)ec_key_key,
                                   dh_gen_key, dh_gen_keylen);
-#else
-    return ENOTSUP;
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 }
 
-#ifdef HAVE_HCRYPTO_W_OPENSSL
 static krb5_error_code
 get_ecdh_param(krb5_context context,
                krb5_kdc_configuration *config,
@@ -244,7 +326,6 @@ get_ecdh_param(krb5_context context,
     free_ECParameters(&ecp);
     return ret;
 }
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 
 krb5_error_code
 _kdc_get_ecdh_param(krb5_context context,
@@ -252,11 +333,7 @@ _kdc_get_ecdh_param(krb5_context context,
                     SubjectPublicKeyInfo *dh_key_info,
                     void **out)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     return get_ecdh_param(context, config, dh_key_info, (EC_KEY **)out);
-#else
-    return ENOTSUP;
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 }
 
 
@@ -264,7 +341,6 @@ _kdc_get_ecdh_param(krb5_context context,
  *
  */
 
-#ifdef HAVE_HCRYPTO_W_OPENSSL
 static krb5_error_code
 serialize_ecdh_key(krb5_context context,
                    EC_KEY *key,
@@ -300,7 +376,6 @@ serialize_ecdh_key(krb5_context context,
     *out_len = len * 8;
     return ret;
 }
-#endif
 
 krb5_error_code
 _kdc_serialize_ecdh_key(krb5_context context,
@@ -308,11 +383,7 @@ _kdc_serialize_ecdh_key(krb5_context context,
                         unsigned char **out,
                         size_t *out_len)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     return serialize_ecdh_key(context, key, out, out_len);
-#else
-    return ENOTSUP;
-#endif
 }
 
 #endif
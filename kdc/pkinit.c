@@ -85,6 +85,27 @@ static struct {
     time_t next_update;
 } ocsp;
 
+/*
+ * Pools of ephemeral DH keys, one per group (named in the moduli file)
+ * that clients have used, so that requests need not generate a key
+ * while the client waits.  A pool learns its group's parameters from
+ * the first request for it, and is refilled by
+ * krb5_kdc_pk_refill_key_pools() when the KDC is idle.  Each key is
+ * used for one exchange only.
+ */
+
+struct dh_key_pool {
+    char *name;
+    DH *params;
+    DH **keys;
+    size_t nkeys;
+};
+
+static struct {
+    struct dh_key_pool *val;
+    size_t len;
+} dh_pools;
+
 /*
  *
  */
@@ -193,8 +214,130 @@ _kdc_pk_free_client_param(krb5_context context, pk_client_params *cp)
     free(cp);
 }
 
+static DH *
+dh_copy_params(const DH *dh)
+{
+    DH *new;
+
+    new = DH_new();
+    if (new == NULL)
+	return NULL;
+    new->p = BN_dup(dh->p);
+    new->g = BN_dup(dh->g);
+    if (dh->q)
+	new->q = BN_dup(dh->q);
+    if (new->p == NULL || new->g == NULL || (dh->q && new->q == NULL)) {
+	DH_free(new);
+	return NULL;
+    }
+    return new;
+}
+
+static int
+dh_same_params(const DH *a, const DH *b)
+{
+    if (BN_cmp(a->p, b->p) != 0 || BN_cmp(a->g, b->g) != 0)
+	return 0;
+    if (a->q == NULL || b->q == NULL)
+	return a->q == b->q;
+    return BN_cmp(a->q, b->q) == 0;
+}
+
+/*
+ * Take a ready key for the group of `params' from its pool, if there is
+ * one, registering the group for refilling if it's new.
+ */
+
+static DH *
+dh_pool_get(krb5_context context,
+	    krb5_kdc_configuration *config,
+	    const char *name,
+	    const DH *params)
+{
+    struct dh_key_pool *pool = NULL;
+    size_t i;
+    void *ptr;
+
+    if (config->pkinit_key_pool_size <= 0 || name == NULL)
+	return NULL;
+
+    for (i = 0; i < dh_pools.len; i++) {
+	if (strcmp(dh_pools.val[i].name, name) == 0) {
+	    pool = &dh_pools.val[i];
+	    break;
+	}
+    }
+
+    if (pool == NULL) {
+	ptr = realloc(dh_pools.val, (dh_pools.len + 1) * sizeof(dh_pools.val[0]));
+	if (ptr == NULL)
+	    return NULL;
+	dh_pools.val = ptr;
+	pool = &dh_pools.val[dh_pools.len];
+	memset(pool, 0, sizeof(*pool));
+	pool->name = strdup(name);
+	pool->params = dh_copy_params(params);
+	pool->keys = calloc(config->pkinit_key_pool_size,
+			    sizeof(pool->keys[0]));
+	if (pool->name == NULL || pool->params == NULL || pool->keys == NULL) {
+	    free(pool->name);
+	    if (pool->params)
+		DH_free(pool->params);
+	    free(pool->keys);
+	    return NULL;
+	}
+	dh_pools.len++;
+	return NULL;
+    }
+
+    /* the moduli file could have changed under us */
+    if (pool->nkeys == 0 || !dh_same_params(pool->params, params))
+	return NULL;
+
+    return pool->keys[--pool->nkeys];
+}
+
+/*
+ * Generate one key for the first key pool that isn't full.  Returns
+ * TRUE if there is more refilling to do.
+ */
+
+krb5_boolean
+krb5_kdc_pk_refill_key_pools(krb5_context context,
+			     krb5_kdc_configuration *config)
+{
+    struct dh_key_pool *pool;
+    size_t i;
+    DH *dh;
+
+    if (!config->enable_pkinit || config->pkinit_key_pool_size <= 0)
+	return FALSE;
+
+    for (i = 0; i < dh_pools.len; i++) {
+	pool = &dh_pools.val[i];
+	if (pool->nkeys >= (size_t)config->pkinit_key_pool_size)
+	    continue;
+
+	dh = dh_copy_params(pool->params);
+	if (dh == NULL)
+	    return FALSE;
+	if (!DH_generate_key(dh)) {
+	    DH_free(dh);
+	    kdc_log(context, config, 0,
+		    "PKINIT: failed to generate a DH key for group %s",
+		    pool->name);
+	    return FALSE;
+	}
+	pool->keys[pool->nkeys++] = dh;
+	return TRUE;
+    }
+
+    return _kdc_refill_ecdh_key_pools(context, config);
+}
+
 static krb5_error_code
 generate_dh_keyblock(krb5_context context,
+		     krb5_kdc_configuration *config,
 		     pk_client_params *client_params,
                      krb5_enctype enctype)
 {
@@ -202,6 +345,7 @@ generate_dh_keyblock(krb5_context context,
     krb5_keyblock key;
     krb5_error_code ret;
     size_t dh_gen_keylen, size;
+    DH *dh;
 
     memset(&key, 0, sizeof(key));
 
@@ -213,11 +357,21 @@ generate_dh_keyblock(krb5_context context,
 	    goto out;
 	}
 
-	if (!DH_generate_key(client_params->u.dh.key)) {
-	    ret = KRB5KRB_ERR_GENERIC;
-	    krb5_set_error_message(context, ret,
-				   "Can't generate Diffie-Hellman keys");
-	    goto out;
+	dh = dh_pool_get(context, config, client_params->dh_group_name,
+			 client_params->u.dh.key);
+	if (dh) {
+	    kdc_log(context, config, 5, "PK-INIT: using a pooled DH key");
+	    DH_free(client_params->u.dh.key);
+	    client_params->u.dh.key = dh;
+	} else {
+	    kdc_log(context, config, 5, "PK-INIT: no pooled DH key, "
+		    "generating one");
+	    if (!DH_generate_key(client_params->u.dh.key)) {
+		ret = KRB5KRB_ERR_GENERIC;
+		krb5_set_error_message(context, ret,
+				       "Can't generate Diffie-Hellman keys");
+		goto out;
+	    }
 	}
 
 	size = DH_size(client_params->u.dh.key);
@@ -249,7 +403,7 @@ generate_dh_keyblock(krb5_context context,
 	    krb5_set_error_message(context, ret, "missing ECDH public_key");
 	    goto out;
 	}
-        ret = _kdc_generate_ecdh_keyblock(context,
+        ret = _kdc_generate_ecdh_keyblock(context, config,
                                           client_params->u.ecdh.public_key,
                                           &client_params->u.ecdh.key,
                                           &dh_gen_key, &dh_gen_keylen);
@@ -442,6 +596,10 @@ _kdc_pk_rd_padata(krb5_context context,
 
     /* Add any registered certificates for this client as trust anchors */
     ret = hdb_entry_get_pkinit_cert(&client->entry, &pc);
+    if (ret)
+	kdc_log(context, config, 0,
+		"PK-INIT: could not decode the extensions of the client "
+		"entry: %d", ret);
     if (ret == 0 && pc != NULL) {
 	hx509_cert cert;
 	unsigned int i;
@@ -1228,7 +1386,7 @@ _kdc_pk_mk_pa_reply(krb5_context context,
 
 	    rep.element = choice_PA_PK_AS_REP_dhInfo;
 
-	    ret = generate_dh_keyblock(context, cp, enctype);
+	    ret = generate_dh_keyblock(context, config, cp, enctype);
 	    if (ret)
 		return ret;
 
@@ -1699,6 +1857,10 @@ _kdc_pk_check_client(krb5_context context,
 	    *subject_name);
 
     ret = hdb_entry_get_pkinit_cert(&client->entry, &pc);
+    if (ret)
+	kdc_log(context, config, 0,
+		"PK-INIT: could not decode the extensions of the client "
+		"entry: %d", ret);
     if (ret == 0 && pc) {
 	hx509_cert cert;
 	size_t j;
@@ -1744,6 +1906,10 @@ _kdc_pk_check_client(krb5_context context,
     }
 
     ret = hdb_entry_get_pkinit_acl(&client->entry, &acl);
+    if (ret)
+	kdc_log(context, config, 0,
+		"PK-INIT: could not decode the extensions of the client "
+		"entry: %d", ret);
     if (ret == 0 && acl != NULL) {
 	/*
 	 * Cheat here and compare the generated name with the string
@@ -168,17 +168,86 @@ kdc_kx509(krb5_context context,
 
 
 static struct krb5_kdc_service services[] =  {
-    { KS_KRB5,		kdc_as_req },
-    { KS_KRB5,		kdc_tgs_req },
+    { KS_KRB5,	KDC_REQ_AS,	kdc_as_req },
+    { KS_KRB5,	KDC_REQ_TGS,	kdc_tgs_req },
 #ifdef DIGEST
-    { 0,		kdc_digest },
+    { 0,	KDC_REQ_DIGEST,	kdc_digest },
 #endif
 #ifdef KX509
-    { 0,		kdc_kx509 },
+    { 0,	KDC_REQ_KX509,	kdc_kx509 },
 #endif
-    { 0, NULL }
+    { 0, KDC_REQ_UNKNOWN, NULL }
 };
 
+/*
+ * Classify the request in `buf, len' by the outer DER tag and length
+ * only, without decoding or allocating anything: only the first
+ * KDC_CLASSIFY_LENGTH bytes are looked at, kx509 version number
+ * included, so `buf' may hold just the start of a request of `len'
+ * bytes.  Requests that are not of a known kind, or whose
+ * encoding claims more data than there is, are rejected with an ASN.1
+ * error code.
+ */
+
+krb5_error_code
+krb5_kdc_classify_request(const unsigned char *buf, size_t len,
+			  enum krb5_kdc_request_kind *kind)
+{
+    Der_class cls;
+    Der_type type;
+    unsigned int tag;
+    size_t hlen, tlen, llen, length;
+    krb5_error_code ret;
+
+    *kind = KDC_REQ_UNKNOWN;
+
+    hlen = len < KDC_CLASSIFY_LENGTH ? len : KDC_CLASSIFY_LENGTH;
+
+    /* kx509 requests are a version number and a DER SEQUENCE */
+    if (hlen >= 4 && memcmp(buf, "\x00\x00\x02\x00", 4) == 0) {
+	buf += 4;
+	len -= 4;
+	hlen -= 4;
+	*kind = KDC_REQ_KX509;
+    }
+
+    ret = der_get_tag(buf, hlen, &cls, &type, &tag, &tlen);
+    if (ret == 0)
+	ret = der_get_length(buf + tlen, hlen - tlen, &length, &llen);
+    if (ret) {
+	*kind = KDC_REQ_UNKNOWN;
+	return ret;
+    }
+    if (length == ASN1_INDEFINITE || type != CONS) {
+	*kind = KDC_REQ_UNKNOWN;
+	return ASN1_BAD_FORMAT;
+    }
+    if (length > len - tlen - llen) {
+	*kind = KDC_REQ_UNKNOWN;
+	return ASN1_OVERRUN;
+    }
+
+    if (*kind == KDC_REQ_KX509) {
+	if (cls != ASN1_C_UNIV || tag != UT_Sequence)
+	    *kind = KDC_REQ_UNKNOWN;
+    } else if (cls == ASN1_C_APPL) {
+	switch (tag) {
+	case krb_as_req:
+	    *kind = KDC_REQ_AS;
+	    break;
+	case krb_tgs_req:
+	    *kind = KDC_REQ_TGS;
+	    break;
+	case 128:		/* DigestREQ */
+	    *kind = KDC_REQ_DIGEST;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return *kind == KDC_REQ_UNKNOWN ? ASN1_BAD_ID : 0;
+}
+
 /*
  * handle the request in `buf, len', from `addr' (or `from' as a string),
  * sending a reply in `reply'.
@@ -198,13 +267,22 @@ krb5_kdc_process_request(krb5_context context,
     krb5_error_code ret;
     unsigned int i;
     krb5_data req_buffer;
+    enum krb5_kdc_request_kind kind;
     int claim = 0;
-    heim_auto_release_t pool = heim_auto_release_create();
+    heim_auto_release_t pool;
+
+    /* Only the service the request is meant for gets to decode it */
+    if (krb5_kdc_classify_request(buf, len, &kind) != 0)
+	return -1;
+
+    pool = heim_auto_release_create();
 
     req_buffer.data = buf;
     req_buffer.length = len;
 
     for (i = 0; services[i].process != NULL; i++) {
+	if (services[i].kind != kind)
+	    continue;
 	ret = (*services[i].process)(context, config, &req_buffer,
 				     reply, from, addr, datagram_reply,
 				     &claim);
@@ -242,13 +320,17 @@ krb5_kdc_process_krb5_request(krb5_context context,
     krb5_error_code ret;
     unsigned int i;
     krb5_data req_buffer;
+    enum krb5_kdc_request_kind kind;
     int claim = 0;
 
+    if (krb5_kdc_classify_request(buf, len, &kind) != 0)
+	return -1;
+
     req_buffer.data = buf;
     req_buffer.length = len;
 
     for (i = 0; services[i].process != NULL; i++) {
-	if ((services[i].flags & KS_KRB5) == 0)
+	if ((services[i].flags & KS_KRB5) == 0 || services[i].kind != kind)
 	    continue;
 	ret = (*services[i].process)(context, config, &req_buffer,
 				     reply, from, addr, datagram_reply,
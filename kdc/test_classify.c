@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "kdc_locl.h"
+#include <err.h>
+
+/*
+ * Check krb5_kdc_classify_request() against good and bad requests.
+ * Each request is copied to a buffer of just the bytes given, so that
+ * reading past them is caught by memory checkers, while `len' is the
+ * length of the whole request as the classifier is told it.
+ */
+
+struct test {
+    const char *name;
+    const char *data;
+    size_t datalen;
+    size_t len;
+    krb5_error_code ret;
+    enum krb5_kdc_request_kind kind;
+};
+
+#define T(n, d, l, r, k) { n, d, sizeof(d) - 1, l, r, k }
+
+static const struct test tests[] = {
+    T("AS-REQ", "\x6a\x02\x30\x00", 4, 0, KDC_REQ_AS),
+    T("TGS-REQ", "\x6c\x02\x30\x00", 4, 0, KDC_REQ_TGS),
+    T("DigestREQ", "\x7f\x81\x00\x02\x30\x00", 6, 0, KDC_REQ_DIGEST),
+    T("start of a long AS-REQ",
+      "\x6a\x82\x03\xe4\x30\x82\x03\xe0\xa1\x03\x02\x01\x05\xa2\x03\x02",
+      1000, 0, KDC_REQ_AS),
+    T("unknown application tag", "\x61\x02\x30\x00", 4,
+      ASN1_BAD_ID, KDC_REQ_UNKNOWN),
+    T("universal SEQUENCE", "\x30\x02\x30\x00", 4,
+      ASN1_BAD_ID, KDC_REQ_UNKNOWN),
+    T("primitive", "\x4a\x02\x00\x00", 4,
+      ASN1_BAD_FORMAT, KDC_REQ_UNKNOWN),
+    T("indefinite length", "\x6a\x80\x30\x00\x00\x00", 6,
+      ASN1_BAD_FORMAT, KDC_REQ_UNKNOWN),
+    T("length past the request", "\x6a\x10\x30\x00", 4,
+      ASN1_OVERRUN, KDC_REQ_UNKNOWN),
+    T("length past the classified bytes", "\x6a\x84\x00\x00", 4,
+      ASN1_OVERRUN, KDC_REQ_UNKNOWN),
+    T("empty", "", 0, ASN1_OVERRUN, KDC_REQ_UNKNOWN),
+    T("kx509", "\x00\x00\x02\x00\x30\x02\x04\x00", 8, 0, KDC_REQ_KX509),
+    T("start of a long kx509 request",
+      "\x00\x00\x02\x00\x30\x82\x03\xe0\x04\x82\x03\xdc\x00\x00\x00\x00",
+      1000, 0, KDC_REQ_KX509),
+    T("kx509 with no SEQUENCE", "\x00\x00\x02\x00\x6a\x02\x30\x00", 8,
+      ASN1_BAD_ID, KDC_REQ_UNKNOWN),
+    T("kx509 version only", "\x00\x00\x02\x00", 4,
+      ASN1_OVERRUN, KDC_REQ_UNKNOWN),
+};
+
+int
+main(int argc, char **argv)
+{
+    enum krb5_kdc_request_kind kind;
+    krb5_error_code ret;
+    unsigned char *buf;
+    size_t i;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+	const struct test *t = &tests[i];
+
+	if (t->datalen > KDC_CLASSIFY_LENGTH ||
+	    (t->datalen < t->len && t->datalen < KDC_CLASSIFY_LENGTH))
+	    errx(1, "%s: bad test", t->name);
+	if ((buf = malloc(t->datalen ? t->datalen : 1)) == NULL)
+	    errx(1, "out of memory");
+	memcpy(buf, t->data, t->datalen);
+
+	ret = krb5_kdc_classify_request(buf, t->len, &kind);
+	if (ret != t->ret || kind != t->kind) {
+	    warnx("%s: got %d and kind %d, expected %d and kind %d",
+		  t->name, (int)ret, (int)kind, (int)t->ret, (int)t->kind);
+	    failed = 1;
+	}
+	free(buf);
+    }
+    return failed;
+}
@@ -54,6 +54,12 @@ krb5_kdc_windc_init(krb5_context context)
     return 0;
 }
 
+int
+_kdc_have_windc_plugin(void)
+{
+    return have_plugin;
+}
+
 struct generate_uc {
     hdb_entry_ex *client;
     krb5_pac *pac;
@@ -87,10 +87,86 @@ usage(int ret)
     arg_printusage(args,
 		   sizeof(args)/sizeof(*args),
 		   NULL,
-		   "service");
+		   "service ...");
     exit (ret);
 }
 
+static void
+store_out_cache(krb5_context context, krb5_creds **out, size_t num)
+{
+    krb5_error_code ret;
+    krb5_ccache id;
+    size_t i;
+
+    ret = krb5_cc_resolve(context, out_cache_str, &id);
+    if(ret)
+	krb5_err(context, 1, ret, "krb5_cc_resolve");
+
+    ret = krb5_cc_initialize(context, id, out[0]->client);
+    if(ret)
+	krb5_err(context, 1, ret, "krb5_cc_initialize");
+
+    for (i = 0; i < num; i++) {
+	ret = krb5_cc_store_cred(context, id, out[i]);
+	if(ret)
+	    krb5_err(context, 1, ret, "krb5_cc_store_cred");
+    }
+    krb5_cc_close(context, id);
+}
+
+/*
+ * Several principals: get them all at once
+ */
+
+static int
+get_many(krb5_context context, krb5_get_creds_opt opt, krb5_ccache cache,
+	 int argc, char **argv, int32_t nametype)
+{
+    krb5_error_code ret;
+    krb5_principal *servers;
+    krb5_error_code *errors;
+    krb5_creds **out;
+    int i, failed = 0;
+
+    servers = calloc(argc, sizeof(servers[0]));
+    errors = calloc(argc, sizeof(errors[0]));
+    out = calloc(argc, sizeof(out[0]));
+    if (servers == NULL || errors == NULL || out == NULL)
+	krb5_errx(context, 1, "out of memory");
+
+    for (i = 0; i < argc; i++) {
+	ret = krb5_parse_name(context, argv[i], &servers[i]);
+	if (ret)
+	    krb5_err(context, 1, ret, "krb5_parse_name %s", argv[i]);
+	if (nametype != KRB5_NT_UNKNOWN)
+	    servers[i]->name.name_type = (NAME_TYPE)nametype;
+    }
+
+    (void) krb5_get_creds_batch(context, opt, cache, argc,
+				(krb5_const_principal *)servers, out, errors);
+    for (i = 0; i < argc; i++) {
+	if (errors[i]) {
+	    krb5_warn(context, errors[i], "krb5_get_creds %s", argv[i]);
+	    failed = 1;
+	}
+    }
+
+    if (!failed && out_cache_str)
+	store_out_cache(context, out, argc);
+
+    for (i = 0; i < argc; i++) {
+	krb5_free_creds(context, out[i]);
+	krb5_free_principal(context, servers[i]);
+    }
+    free(servers);
+    free(errors);
+    free(out);
+    krb5_get_creds_opt_free(context, opt);
+    krb5_cc_close(context, cache);
+    krb5_free_context(context);
+    return failed;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -325,6 +401,8 @@ main(int argc, char **argv)
 	ret = krb5_parse_name(context, argv[0], &server);
 	if (ret)
 	    krb5_err(context, 1, ret, "krb5_parse_name %s", argv[0]);
+    } else if (argc > 1) {
+	return get_many(context, opt, cache, argc, argv, nametype);
     } else {
 	usage(1);
     }
@@ -336,22 +414,8 @@ main(int argc, char **argv)
     if (ret)
 	krb5_err(context, 1, ret, "krb5_get_creds");
 
-    if (out_cache_str) {
-	krb5_ccache id;
-
-	ret = krb5_cc_resolve(context, out_cache_str, &id);
-	if(ret)
-	    krb5_err(context, 1, ret, "krb5_cc_resolve");
-
-	ret = krb5_cc_initialize(context, id, out->client);
-	if(ret)
-	    krb5_err(context, 1, ret, "krb5_cc_initialize");
-
-	ret = krb5_cc_store_cred(context, id, out);
-	if(ret)
-	    krb5_err(context, 1, ret, "krb5_cc_store_cred");
-	krb5_cc_close(context, id);
-    }
+    if (out_cache_str)
+	store_out_cache(context, &out, 1);
 
     krb5_free_creds(context, out);
     krb5_free_principal(context, server);
@@ -66,11 +66,13 @@ data_hash(void *ptr)
 {
     heim_octet_string *os = ptr;
     const unsigned char *s = os->data;
+    unsigned long n;
+    size_t i;
 
-    if (os->length < 4)
-	return os->length;
-    return s[0] | (s[1] << 8) |
-	(s[os->length - 2] << 16) | (s[os->length - 1] << 24);
+    /* FNV-1a, as for strings; keys often differ only in the middle */
+    for (n = 2166136261UL, i = 0; i < os->length; i++)
+	n = (n ^ s[i]) * 16777619UL;
+    return n;
 }
 
 struct heim_type_data _heim_data_object = {
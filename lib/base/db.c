@@ -83,6 +83,9 @@ static heim_data_t from_base64(heim_string_t, heim_error_t *);
 static int open_file(const char *, int , int, int *, heim_error_t *);
 static int read_json(const char *, heim_object_t *, heim_error_t *);
 static struct heim_db_type json_dbt;
+#ifndef WIN32
+static struct heim_db_type jsonlog_dbt;
+#endif
 
 static void db_dealloc(void *ptr);
 
@@ -292,6 +295,10 @@ dbtype_iter2create_f(heim_object_t dbtype, heim_object_t junk, void *arg)
  * example: "transaction+bdb" might be a Berkeley DB with a layer above
  * that provides transactions.
  *
+ * Two concrete DB types are built in: "json", a JSON file rewritten
+ * whole on every commit, and "jsonlog", a log of JSON records which
+ * commits by appending only the keys that changed (not on Windows).
+ *
  * Options may be provided via a dict (an associative array).  Existing
  * options include:
  *
@@ -345,6 +352,10 @@ heim_db_create(const char *dbtype, const char *dbname,
 	heim_dict_iterate_f(db_plugins, &iter_ctx, dbtype_iter2create_f);
 	heim_release(options);
 	return iter_ctx.db;
+#ifndef WIN32
+    } else if (strstr(dbtype, "jsonlog")) {
+	(void) heim_db_register(dbtype, NULL, &jsonlog_dbt);
+#endif
     } else if (strstr(dbtype, "json")) {
 	(void) heim_db_register(dbtype, NULL, &json_dbt);
     }
@@ -1725,3 +1736,912 @@ static struct heim_db_type json_dbt = {
     json_db_del_key, json_db_iter
 };
 
+
+#ifndef WIN32
+
+/*
+ * The "jsonlog" DB type: a log-structured variant of the JSON DB.
+ *
+ * The "json" DB type rewrites its whole file on every commit and parses
+ * all of it on open, so every update costs O(DB size).  Here a commit
+ * appends one record per key set or deleted:
+ *
+ *     "+ <table-len> <key-len> <value-len>\n" table key JSON-value "\n"
+ *     "- <table-len> <key-len> 0\n" table key "\n"
+ *
+ * following a "heim-jsonlog 1\n" header.  Opening the DB maps the file
+ * and indexes the records by table and key without parsing any values;
+ * a value is parsed from the mapping the first time it is looked up.
+ * Handles pick up records written by others by scanning just the tail
+ * of the log that is new to them.  Once the log is more than half dead
+ * records it is compacted by copying the live records to a new file,
+ * which is then renamed into place.
+ *
+ * Writers hold an exclusive flock() on the log, readers a shared one.
+ * A record is only complete when its trailing newline is in the file;
+ * anything after the last complete record is a torn write, and is
+ * truncated by the next writer.
+ */
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define JSONLOG_MAGIC		"heim-jsonlog 1\n"
+#define JSONLOG_MAGIC_LEN	(sizeof(JSONLOG_MAGIC) - 1)
+#define JSONLOG_COMPACT_MIN	(64 * 1024)
+#define JSONLOG_PENDING		((size_t)-1)
+
+typedef struct jsonlog_rec {
+    size_t off;                 /* offset in log, or JSONLOG_PENDING */
+    size_t len;                 /* length of whole record */
+    size_t voff;                /* offset of value in record */
+    size_t vlen;                /* length of value */
+    heim_object_t value;        /* parsed value, once looked up */
+} *jsonlog_rec_t;
+
+typedef struct jsonlog_db {
+    heim_string_t dbname;
+    heim_string_t tmpname;
+    heim_dict_t index;          /* table -> key -> jsonlog_rec_t */
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    unsigned char *map;
+    size_t maplen;
+    size_t size;                /* length of the log indexed so far */
+    size_t live;                /* length of records in the index */
+    char *pending;              /* records to append at sync time */
+    size_t pending_len;
+    size_t pending_alloc;
+    unsigned int locked:1;
+    unsigned int write_locked:1;
+    unsigned int stale:1;       /* index must be rebuilt from scratch */
+} *jsonlog_db_t;
+
+static void
+jsonlog_rec_dealloc(void *ptr)
+{
+    jsonlog_rec_t rec = ptr;
+
+    heim_release(rec->value);
+}
+
+static jsonlog_rec_t
+jsonlog_rec_create(size_t off, size_t len, size_t voff, size_t vlen)
+{
+    jsonlog_rec_t rec;
+
+    rec = heim_alloc(sizeof(*rec), "jsonlog-rec", jsonlog_rec_dealloc);
+    if (rec == NULL)
+	return NULL;
+    rec->off = off;
+    rec->len = len;
+    rec->voff = voff;
+    rec->vlen = vlen;
+    rec->value = NULL;
+    return rec;
+}
+
+static void
+jsonlog_unmap(jsonlog_db_t db)
+{
+#ifdef HAVE_MMAP
+    if (db->map != NULL)
+	(void) munmap(db->map, db->maplen);
+#else
+    free(db->map);
+#endif
+    db->map = NULL;
+    db->maplen = 0;
+}
+
+static int
+jsonlog_map(jsonlog_db_t db, size_t len, heim_error_t *error)
+{
+    jsonlog_unmap(db);
+    if (len == 0)
+	return 0;
+#ifdef HAVE_MMAP
+    db->map = mmap(NULL, len, PROT_READ, MAP_SHARED, db->fd, 0);
+    if (db->map == MAP_FAILED) {
+	db->map = NULL;
+	return HEIM_ERROR(error, errno,
+			  (errno, N_("Could not map JSON log DB %s: %s", ""),
+			   heim_string_get_utf8(db->dbname), strerror(errno)));
+    }
+#else
+    {
+	size_t done;
+	ssize_t bytes;
+
+	db->map = malloc(len);
+	if (db->map == NULL)
+	    return HEIM_ENOMEM(error);
+	if (lseek(db->fd, 0, SEEK_SET) == -1)
+	    bytes = -1;
+	for (done = 0; done < len; done += bytes) {
+	    bytes = read(db->fd, db->map + done, len - done);
+	    if (bytes <= 0)
+		break;
+	}
+	if (done < len) {
+	    free(db->map);
+	    db->map = NULL;
+	    if (bytes == 0)
+		errno = EINVAL;
+	    return HEIM_ERROR(error, errno,
+			      (errno, N_("Could not read JSON log DB %s: %s", ""),
+			       heim_string_get_utf8(db->dbname),
+			       strerror(errno)));
+	}
+    }
+#endif
+    db->maplen = len;
+    return 0;
+}
+
+static int
+jsonlog_index_set(jsonlog_db_t db, heim_string_t table, heim_data_t key,
+		  jsonlog_rec_t rec)
+{
+    heim_dict_t tdict;
+    jsonlog_rec_t old;
+    int ret;
+
+    tdict = heim_dict_get_value(db->index, table);
+    if (tdict == NULL) {
+	tdict = heim_dict_create(29);
+	if (tdict == NULL)
+	    return ENOMEM;
+	ret = heim_dict_set_value(db->index, table, tdict);
+	heim_release(tdict);
+	if (ret)
+	    return ret;
+    }
+
+    old = heim_dict_get_value(tdict, key);
+    if (old != NULL) {
+	/* Our own record, just written; keep the value we serialized */
+	if (old->off == JSONLOG_PENDING && rec->off != JSONLOG_PENDING &&
+	    rec->value == NULL)
+	    rec->value = heim_retain(old->value);
+	db->live -= old->len;
+    }
+    ret = heim_dict_set_value(tdict, key, rec);
+    if (ret == 0)
+	db->live += rec->len;
+    else if (old != NULL)
+	db->live += old->len;
+    return ret;
+}
+
+static void
+jsonlog_index_del(jsonlog_db_t db, heim_string_t table, heim_data_t key)
+{
+    heim_dict_t tdict;
+    jsonlog_rec_t old;
+
+    tdict = heim_dict_get_value(db->index, table);
+    if (tdict == NULL)
+	return;
+    old = heim_dict_get_value(tdict, key);
+    if (old == NULL)
+	return;
+    db->live -= old->len;
+    heim_dict_delete_key(tdict, key);
+}
+
+static const unsigned char *
+jsonlog_parse_len(const unsigned char *p, const unsigned char *end,
+		  int sep, size_t *n)
+{
+    const unsigned char *start = p;
+
+    for (*n = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+	if (*n > (SIZE_MAX - 9) / 10)
+	    return NULL;
+	*n = *n * 10 + (*p - '0');
+    }
+    if (p == start || p == end || *p != sep)
+	return NULL;
+    return p + 1;
+}
+
+/*
+ * Index the records between what we've indexed so far and the end of
+ * the mapping, stopping at the first incomplete one.
+ */
+static int
+jsonlog_scan(jsonlog_db_t db, heim_error_t *error)
+{
+    const unsigned char *end = db->map + db->maplen;
+    const unsigned char *p;
+    heim_string_t table = NULL;
+    heim_data_t key;
+    jsonlog_rec_t rec;
+    size_t tlen, klen, vlen, hlen, len;
+    int op, ret;
+
+    if (db->size == 0) {
+	if (db->maplen < JSONLOG_MAGIC_LEN)
+	    return 0; /* empty, or the header itself is torn */
+	if (memcmp(db->map, JSONLOG_MAGIC, JSONLOG_MAGIC_LEN) != 0)
+	    return HEIM_ERROR(error, EINVAL,
+			      (EINVAL, N_("Not a JSON log DB: %s", ""),
+			       heim_string_get_utf8(db->dbname)));
+	db->size = JSONLOG_MAGIC_LEN;
+    }
+
+    while (db->size < db->maplen) {
+	p = db->map + db->size;
+	op = *p++;
+	if ((op != '+' && op != '-') || p == end || *p++ != ' ')
+	    break;
+	if ((p = jsonlog_parse_len(p, end, ' ', &tlen)) == NULL ||
+	    (p = jsonlog_parse_len(p, end, ' ', &klen)) == NULL ||
+	    (p = jsonlog_parse_len(p, end, '\n', &vlen)) == NULL)
+	    break;
+	hlen = p - (db->map + db->size);
+	if (tlen > (size_t)(end - p) || klen > (size_t)(end - p) - tlen ||
+	    vlen >= (size_t)(end - p) - tlen - klen ||
+	    p[tlen + klen + vlen] != '\n')
+	    break;
+	len = hlen + tlen + klen + vlen + 1;
+
+	/* Runs of records are usually for the same table */
+	if (table == NULL ||
+	    strlen(heim_string_get_utf8(table)) != tlen ||
+	    memcmp(heim_string_get_utf8(table), p, tlen) != 0) {
+	    heim_release(table);
+	    table = heim_string_create_with_bytes(p, tlen);
+	}
+	key = heim_data_create(p + tlen, klen);
+	if (table == NULL || key == NULL) {
+	    heim_release(table);
+	    heim_release(key);
+	    return HEIM_ENOMEM(error);
+	}
+	if (op == '+') {
+	    rec = jsonlog_rec_create(db->size, len, hlen + tlen + klen, vlen);
+	    ret = rec ? jsonlog_index_set(db, table, key, rec) : ENOMEM;
+	    heim_release(rec);
+	} else {
+	    jsonlog_index_del(db, table, key);
+	    ret = 0;
+	}
+	heim_release(key);
+	if (ret) {
+	    heim_release(table);
+	    return HEIM_ENOMEM(error);
+	}
+	db->size += len;
+    }
+    heim_release(table);
+    return 0;
+}
+
+static int
+jsonlog_reset(jsonlog_db_t db, heim_error_t *error)
+{
+    heim_dict_t index;
+
+    index = heim_dict_create(11);
+    if (index == NULL)
+	return HEIM_ENOMEM(error);
+    heim_release(db->index);
+    db->index = index;
+    db->size = 0;
+    db->live = 0;
+    db->stale = 0;
+    return 0;
+}
+
+/* Index whatever has been appended to the log open on db->fd */
+static int
+jsonlog_catch_up(jsonlog_db_t db, heim_error_t *error)
+{
+    struct stat st;
+    int ret;
+
+    if (fstat(db->fd, &st) == -1)
+	return HEIM_ERROR(error, errno,
+			  (errno, N_("Could not stat JSON log DB %s: %s", ""),
+			   heim_string_get_utf8(db->dbname), strerror(errno)));
+    if (db->stale || (size_t)st.st_size < db->size) {
+	ret = jsonlog_reset(db, error);
+	if (ret)
+	    return ret;
+    }
+    if ((size_t)st.st_size != db->maplen) {
+	ret = jsonlog_map(db, st.st_size, error);
+	if (ret) {
+	    db->stale = 1;
+	    return ret;
+	}
+    }
+    ret = jsonlog_scan(db, error);
+    if (ret)
+	db->stale = 1;
+    return ret;
+}
+
+static int
+jsonlog_open_fd(jsonlog_db_t db, int flags, heim_error_t *error)
+{
+    const char *dbname = heim_string_get_utf8(db->dbname);
+    struct stat st;
+    int fd;
+
+    fd = open(dbname, flags | O_RDWR, 0600);
+    if (fd < 0 && errno == EACCES && !(flags & O_CREAT))
+	fd = open(dbname, O_RDONLY);
+    if (fd < 0)
+	return HEIM_ERROR(error, errno,
+			  (errno, N_("Could not open JSON log DB %s: %s", ""),
+			   dbname, strerror(errno)));
+    if (fstat(fd, &st) == -1) {
+	(void) close(fd);
+	return HEIM_ERROR(error, errno,
+			  (errno, N_("Could not stat JSON log DB %s: %s", ""),
+			   dbname, strerror(errno)));
+    }
+    if (db->fd > -1)
+	(void) close(db->fd);
+    db->fd = fd;
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    db->stale = 1;
+    return 0;
+}
+
+static int
+jsonlog_append(jsonlog_db_t db, const void *data, size_t len)
+{
+    if (len > db->pending_alloc - db->pending_len) {
+	size_t alloc = db->pending_alloc + (db->pending_alloc >> 1) + len;
+	char *p;
+
+	p = realloc(db->pending, alloc);
+	if (p == NULL)
+	    return ENOMEM;
+	db->pending = p;
+	db->pending_alloc = alloc;
+    }
+    memcpy(db->pending + db->pending_len, data, len);
+    db->pending_len += len;
+    return 0;
+}
+
+static int
+jsonlog_write(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    ssize_t bytes;
+
+    while (len > 0) {
+	bytes = write(fd, p, len);
+	if (bytes < 0 && errno == EINTR)
+	    continue;
+	if (bytes <= 0)
+	    return bytes < 0 ? errno : EIO;
+	p += bytes;
+	len -= bytes;
+    }
+    return 0;
+}
+
+static int
+jsonlog_db_open(void *plug, const char *dbtype, const char *dbname,
+		heim_dict_t options, void **db, heim_error_t *error)
+{
+    jsonlog_db_t logdb;
+    char *tmpname;
+    size_t len;
+    int flags = 0;
+    int ret;
+
+    if (error)
+	*error = NULL;
+    if (dbtype && *dbtype && strcmp(dbtype, "jsonlog"))
+	return HEIM_ERROR(error, EINVAL, (EINVAL, N_("Wrong DB type", "")));
+    if (dbname == NULL || *dbname == '\0' || strcmp(dbname, "MEMORY") == 0)
+	return HEIM_ERROR(error, EINVAL,
+			  (EINVAL, N_("JSON log DBs must be files", "")));
+
+    if (options) {
+	if (heim_dict_get_value(options, HSTR("create")))
+	    flags |= O_CREAT;
+	if (heim_dict_get_value(options, HSTR("exclusive")))
+	    flags |= O_CREAT | O_EXCL;
+	if (heim_dict_get_value(options, HSTR("truncate")))
+	    flags |= O_TRUNC;
+	/* As for JSON DBs, cloned handles must not re-create or truncate */
+	heim_dict_delete_key(options, HSTR("create"));
+	heim_dict_delete_key(options, HSTR("exclusive"));
+	heim_dict_delete_key(options, HSTR("truncate"));
+    }
+
+    logdb = heim_alloc(sizeof (*logdb), "jsonlog_db", NULL);
+    if (logdb == NULL)
+	return HEIM_ENOMEM(error);
+    memset(logdb, 0, sizeof (*logdb));
+    logdb->fd = -1;
+
+    len = strlen(dbname);
+    tmpname = malloc(len + 2);
+    if (tmpname != NULL) {
+	(void) snprintf(tmpname, len + 2, "%s~", dbname);
+	logdb->tmpname = heim_string_create(tmpname);
+	free(tmpname);
+    }
+    logdb->dbname = heim_string_create(dbname);
+    if (logdb->dbname == NULL || logdb->tmpname == NULL) {
+	ret = HEIM_ENOMEM(error);
+	goto err;
+    }
+
+    ret = jsonlog_open_fd(logdb, flags, error);
+    if (ret == 0)
+	ret = jsonlog_catch_up(logdb, error);
+    if (ret)
+	goto err;
+
+    *db = logdb;
+    return 0;
+
+err:
+    if (logdb->fd > -1)
+	(void) close(logdb->fd);
+    jsonlog_unmap(logdb);
+    heim_release(logdb->index);
+    heim_release(logdb->dbname);
+    heim_release(logdb->tmpname);
+    heim_release(logdb);
+    return ret;
+}
+
+static int
+jsonlog_db_close(void *db, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+
+    if (error)
+	*error = NULL;
+    jsonlog_unmap(logdb);
+    if (logdb->fd > -1)
+	(void) close(logdb->fd);
+    free(logdb->pending);
+    heim_release(logdb->index);
+    heim_release(logdb->dbname);
+    heim_release(logdb->tmpname);
+    heim_release(logdb);
+    return 0;
+}
+
+static int
+jsonlog_db_lock(void *db, int read_only, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+    struct stat st;
+    int ret;
+
+    heim_assert(!logdb->locked || (!logdb->write_locked && !read_only),
+		"DB locks are not recursive");
+
+    for (;;) {
+	if (flock(logdb->fd, read_only ? LOCK_SH : LOCK_EX) == -1)
+	    return HEIM_ERROR(error, errno,
+			      (errno, N_("Could not lock JSON log DB %s: %s", ""),
+			       heim_string_get_utf8(logdb->dbname),
+			       strerror(errno)));
+	if (stat(heim_string_get_utf8(logdb->dbname), &st) == -1 ||
+	    (st.st_dev == logdb->dev && st.st_ino == logdb->ino))
+	    break;
+	/* Compacted while we waited for the lock; lock the new log */
+	(void) flock(logdb->fd, LOCK_UN);
+	ret = jsonlog_open_fd(logdb, 0, error);
+	if (ret)
+	    return ret;
+    }
+    logdb->locked = 1;
+    logdb->write_locked = !read_only;
+
+    ret = jsonlog_catch_up(logdb, error);
+    if (ret == 0 && !read_only && logdb->maplen > logdb->size) {
+	/* Drop a torn record so that ours get appended after the last one */
+	if (ftruncate(logdb->fd, logdb->size) == -1) {
+	    ret = HEIM_ERROR(error, errno,
+			     (errno, N_("Could not truncate JSON log DB %s: %s", ""),
+			      heim_string_get_utf8(logdb->dbname),
+			      strerror(errno)));
+	} else {
+	    ret = jsonlog_map(logdb, logdb->size, error);
+	}
+    }
+    if (ret) {
+	(void) flock(logdb->fd, LOCK_UN);
+	logdb->locked = 0;
+	logdb->write_locked = 0;
+    }
+    return ret;
+}
+
+static int
+jsonlog_db_unlock(void *db, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+
+    heim_assert(logdb->locked, "DB not locked when unlock attempted");
+    if (logdb->pending_len > 0) {
+	/* Not synced, so the index has changes that aren't in the log */
+	logdb->pending_len = 0;
+	logdb->stale = 1;
+    }
+    logdb->locked = 0;
+    logdb->write_locked = 0;
+    if (flock(logdb->fd, LOCK_UN) == -1)
+	return errno;
+    return 0;
+}
+
+struct jsonlog_compact_ctx {
+    jsonlog_db_t db;
+    int fd;
+    int ret;
+    size_t off;
+    char buf[16384];
+    size_t len;
+};
+
+static void
+jsonlog_compact_key_f(heim_object_t key, heim_object_t value, void *arg)
+{
+    struct jsonlog_compact_ctx *ctx = arg;
+    jsonlog_rec_t rec = (jsonlog_rec_t)value;
+    const unsigned char *p = ctx->db->map + rec->off;
+    size_t len = rec->len;
+
+    if (ctx->ret)
+	return;
+    ctx->off += len;
+    if (len > sizeof(ctx->buf) - ctx->len) {
+	ctx->ret = jsonlog_write(ctx->fd, ctx->buf, ctx->len);
+	ctx->len = 0;
+	if (ctx->ret == 0 && len > sizeof(ctx->buf))
+	    ctx->ret = jsonlog_write(ctx->fd, p, len);
+	if (ctx->ret || len > sizeof(ctx->buf))
+	    return;
+    }
+    memcpy(ctx->buf + ctx->len, p, len);
+    ctx->len += len;
+}
+
+static void
+jsonlog_compact_table_f(heim_object_t table, heim_object_t tdict, void *arg)
+{
+    heim_dict_iterate_f(tdict, arg, jsonlog_compact_key_f);
+}
+
+static void
+jsonlog_relocate_key_f(heim_object_t key, heim_object_t value, void *arg)
+{
+    size_t *off = arg;
+    jsonlog_rec_t rec = (jsonlog_rec_t)value;
+
+    rec->off = *off;
+    *off += rec->len;
+}
+
+static void
+jsonlog_relocate_table_f(heim_object_t table, heim_object_t tdict, void *arg)
+{
+    heim_dict_iterate_f(tdict, arg, jsonlog_relocate_key_f);
+}
+
+/*
+ * Copy the live records to a new log and rename it into place.  Called
+ * with the old log write-locked; returns with the new one write-locked.
+ */
+static int
+jsonlog_compact(jsonlog_db_t db)
+{
+    struct jsonlog_compact_ctx *ctx;
+    const char *tmpname = heim_string_get_utf8(db->tmpname);
+    struct stat st;
+    size_t off;
+    int ret;
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+	return ENOMEM;
+    ctx->db = db;
+    ctx->fd = open(tmpname, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (ctx->fd < 0) {
+	free(ctx);
+	return errno;
+    }
+    memcpy(ctx->buf, JSONLOG_MAGIC, JSONLOG_MAGIC_LEN);
+    ctx->len = ctx->off = JSONLOG_MAGIC_LEN;
+
+    heim_dict_iterate_f(db->index, ctx, jsonlog_compact_table_f);
+    ret = ctx->ret;
+    if (ret == 0)
+	ret = jsonlog_write(ctx->fd, ctx->buf, ctx->len);
+    if (ret == 0 && (flock(ctx->fd, LOCK_EX) == -1 || fsync(ctx->fd) == -1 ||
+		     fstat(ctx->fd, &st) == -1 ||
+		     rename(tmpname, heim_string_get_utf8(db->dbname)) == -1))
+	ret = errno;
+    if (ret) {
+	(void) close(ctx->fd);
+	(void) unlink(tmpname);
+	free(ctx);
+	return ret;
+    }
+
+    /* Closing the old log releases handles waiting to lock it */
+    (void) close(db->fd);
+    db->fd = ctx->fd;
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    off = JSONLOG_MAGIC_LEN;
+    heim_dict_iterate_f(db->index, &off, jsonlog_relocate_table_f);
+    heim_assert(off == ctx->off, "JSON log DB compaction size mismatch");
+    db->size = off;
+    db->live = off - JSONLOG_MAGIC_LEN;
+    free(ctx);
+
+    ret = jsonlog_map(db, db->size, NULL);
+    if (ret)
+	db->stale = 1;
+    return 0;
+}
+
+static int
+jsonlog_db_sync(void *db, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+    int ret;
+
+    heim_assert(logdb->write_locked, "DB not locked when sync attempted");
+
+    if (logdb->pending_len == 0)
+	return 0;
+
+    if (lseek(logdb->fd, logdb->size, SEEK_SET) == -1)
+	ret = errno;
+    else
+	ret = jsonlog_write(logdb->fd, logdb->pending, logdb->pending_len);
+    if (ret == 0 && fsync(logdb->fd) == -1)
+	ret = errno;
+    logdb->pending_len = 0;
+    if (ret) {
+	(void) ftruncate(logdb->fd, logdb->size);
+	logdb->stale = 1;
+	return HEIM_ERROR(error, ret,
+			  (ret, N_("Could not write JSON log DB %s: %s", ""),
+			   heim_string_get_utf8(logdb->dbname), strerror(ret)));
+    }
+
+    ret = jsonlog_catch_up(logdb, error);
+    if (ret)
+	return ret;
+
+    /*
+     * The records are durable now; compaction is only an optimization,
+     * and if it fails we just keep using this log.
+     */
+    if (logdb->size > JSONLOG_COMPACT_MIN && logdb->live < logdb->size / 2 &&
+	jsonlog_compact(logdb) != 0)
+	logdb->stale = 1;
+    return 0;
+}
+
+static int
+jsonlog_db_update(jsonlog_db_t logdb, heim_string_t table, heim_data_t key,
+		  heim_object_t value, heim_error_t *error)
+{
+    const heim_octet_string *key_data = heim_data_get_data(key);
+    heim_string_t json = NULL;
+    const char *json_text = "";
+    const char *table_text;
+    jsonlog_rec_t rec = NULL;
+    char header[80];
+    size_t tlen, vlen = 0;
+    int hlen;
+    int ret;
+
+    if (table == NULL)
+	table = HSTR("");
+    table_text = heim_string_get_utf8(table);
+    tlen = strlen(table_text);
+
+    if (value != NULL) {
+	json = heim_json_copy_serialize(value, HEIM_JSON_F_ONE_LINE, error);
+	if (json == NULL)
+	    return (error && *error) ? heim_error_get_code(*error) : ENOMEM;
+	json_text = heim_string_get_utf8(json);
+	vlen = strlen(json_text);
+	if (vlen > 0 && json_text[vlen - 1] == '\n')
+	    vlen--;
+    }
+
+    hlen = snprintf(header, sizeof(header), "%c %lu %lu %lu\n",
+		    value ? '+' : '-', (unsigned long)tlen,
+		    (unsigned long)key_data->length, (unsigned long)vlen);
+    heim_assert(hlen > 0 && (size_t)hlen < sizeof(header),
+		"JSON log DB record header too long");
+
+    if (value != NULL) {
+	rec = jsonlog_rec_create(JSONLOG_PENDING,
+				 hlen + tlen + key_data->length + vlen + 1,
+				 hlen + tlen + key_data->length, vlen);
+	if (rec == NULL) {
+	    heim_release(json);
+	    return HEIM_ENOMEM(error);
+	}
+	rec->value = heim_retain(value);
+    }
+
+    ret = 0;
+    if (logdb->size == 0 && logdb->pending_len == 0)
+	ret = jsonlog_append(logdb, JSONLOG_MAGIC, JSONLOG_MAGIC_LEN);
+    if (ret == 0)
+	ret = jsonlog_append(logdb, header, hlen);
+    if (ret == 0)
+	ret = jsonlog_append(logdb, table_text, tlen);
+    if (ret == 0)
+	ret = jsonlog_append(logdb, key_data->data, key_data->length);
+    if (ret == 0)
+	ret = jsonlog_append(logdb, json_text, vlen);
+    if (ret == 0)
+	ret = jsonlog_append(logdb, "\n", 1);
+    heim_release(json);
+    if (ret == 0 && rec != NULL)
+	ret = jsonlog_index_set(logdb, table, key, rec);
+    else if (ret == 0)
+	jsonlog_index_del(logdb, table, key);
+    heim_release(rec);
+    if (ret) {
+	/* The pending records and the index no longer agree */
+	logdb->stale = 1;
+	return HEIM_ENOMEM(error);
+    }
+    return 0;
+}
+
+static int
+jsonlog_db_set_value(void *db, heim_string_t table,
+		     heim_data_t key, heim_data_t value, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+    int ret, ret2;
+
+    if (error)
+	*error = NULL;
+
+    if (logdb->write_locked)
+	return jsonlog_db_update(logdb, table, key, value, error);
+
+    /* Not in a transaction (e.g., replaying a journal); make one */
+    ret = jsonlog_db_lock(logdb, 0, error);
+    if (ret)
+	return ret;
+    ret = jsonlog_db_update(logdb, table, key, value, error);
+    if (ret == 0)
+	ret = jsonlog_db_sync(logdb, error);
+    ret2 = jsonlog_db_unlock(logdb, NULL);
+    return ret ? ret : ret2;
+}
+
+static int
+jsonlog_db_del_key(void *db, heim_string_t table, heim_data_t key,
+		   heim_error_t *error)
+{
+    return jsonlog_db_set_value(db, table, key, NULL, error);
+}
+
+static heim_object_t
+jsonlog_rec_value(jsonlog_db_t logdb, jsonlog_rec_t rec, heim_error_t *error)
+{
+    if (rec->value == NULL) {
+	heim_assert(rec->off != JSONLOG_PENDING &&
+		    rec->off + rec->len <= logdb->maplen,
+		    "JSON log DB record not in log");
+	rec->value = heim_json_create_with_bytes(logdb->map + rec->off +
+						 rec->voff, rec->vlen,
+						 10, 0, error);
+    }
+    return rec->value;
+}
+
+static int jsonlog_db_lock(void *, int, heim_error_t *);
+static int jsonlog_db_unlock(void *, heim_error_t *);
+
+static heim_data_t
+jsonlog_db_copy_value(void *db, heim_string_t table, heim_data_t key,
+		      heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+    heim_object_t value = NULL;
+    heim_dict_t tdict;
+    jsonlog_rec_t rec;
+    int locked = logdb->locked;
+
+    if (error)
+	*error = NULL;
+
+    /* Catch up with the log and read it under a shared lock */
+    if (!locked && jsonlog_db_lock(logdb, 1, error) != 0)
+	return NULL;
+
+    if (table == NULL)
+	table = HSTR("");
+
+    tdict = heim_dict_get_value(logdb->index, table);
+    rec = tdict ? heim_dict_get_value(tdict, key) : NULL;
+    if (rec != NULL)
+	value = heim_retain(jsonlog_rec_value(logdb, rec, error));
+
+    if (!locked)
+	(void) jsonlog_db_unlock(logdb, NULL);
+    return value;
+}
+
+struct jsonlog_db_iter_ctx {
+    jsonlog_db_t                db;
+    heim_db_iterator_f_t        iter_f;
+    void                        *iter_ctx;
+};
+
+static void
+jsonlog_db_iter_f(heim_object_t key, heim_object_t value, void *arg)
+{
+    struct jsonlog_db_iter_ctx *ctx = arg;
+    heim_object_t v;
+
+    v = jsonlog_rec_value(ctx->db, (jsonlog_rec_t)value, NULL);
+    if (v != NULL)
+	ctx->iter_f(key, v, ctx->iter_ctx);
+}
+
+static void
+jsonlog_db_iter(void *db, heim_string_t table, void *iter_data,
+		heim_db_iterator_f_t iter_f, heim_error_t *error)
+{
+    jsonlog_db_t logdb = db;
+    struct jsonlog_db_iter_ctx ctx;
+    heim_dict_t tdict;
+    int locked = logdb->locked;
+
+    if (error)
+	*error = NULL;
+
+    /* As for copy_value, but the iteration callbacks run under the lock */
+    if (!locked && jsonlog_db_lock(logdb, 1, error) != 0)
+	return;
+
+    if (table == NULL)
+	table = HSTR("");
+
+    tdict = heim_dict_get_value(logdb->index, table);
+    if (tdict != NULL) {
+	ctx.db = logdb;
+	ctx.iter_ctx = iter_data;
+	ctx.iter_f = iter_f;
+	heim_dict_iterate_f(tdict, &ctx, jsonlog_db_iter_f);
+    }
+
+    if (!locked)
+	(void) jsonlog_db_unlock(logdb, NULL);
+}
+
+static struct heim_db_type jsonlog_dbt = {
+    1, jsonlog_db_open, NULL, jsonlog_db_close,
+    jsonlog_db_lock, jsonlog_db_unlock, jsonlog_db_sync,
+    NULL, NULL, NULL,
+    jsonlog_db_copy_value, jsonlog_db_set_value,
+    jsonlog_db_del_key, jsonlog_db_iter
+};
+
+#endif /* !WIN32 */
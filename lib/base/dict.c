@@ -35,33 +35,50 @@
 
 #include "baselocl.h"
 
-struct hashentry {
-    struct hashentry **prev;
-    struct hashentry *next;
+/*
+ * An open-addressing hash table.  The entries are kept in an array in
+ * the order they were added, which is also the order of iteration, with
+ * their hashes, and `index' is the hash table proper: linear probing,
+ * power-of-two sized, each slot empty, deleted or the number of an
+ * entry plus one.  Deleted entries stay in the array (with a NULL key)
+ * until the next resize compacts it.
+ */
+
+#define DICT_EMPTY	0
+#define DICT_DELETED	0xffffffffU
+#define DICT_MIN_SIZE	8
+
+struct dict_entry {
     heim_object_t key;
     heim_object_t value;
+    unsigned long hash;
 };
 
 struct heim_dict_data {
-    size_t size;
-    struct hashentry **tab;
+    struct dict_entry *entries;
+    size_t nentries;		/* used, deleted ones included */
+    size_t count;		/* live */
+    uint32_t *index;
+    size_t mask;		/* size of index - 1 */
 };
 
+/* Entries the index has room for: keep it at most 3/4 full */
+#define DICT_MAX_ENTRIES(dict) (((dict)->mask + 1) / 4 * 3)
+
 static void
 dict_dealloc(void *ptr)
 {
     heim_dict_t dict = ptr;
-    struct hashentry **h, *g, *i;
-
-    for (h = dict->tab; h < &dict->tab[dict->size]; ++h) {
-	for (g = h[0]; g; g = i) {
-	    i = g->next;
-	    heim_release(g->key);
-	    heim_release(g->value);
-	    free(g);
-	}
+    size_t i;
+
+    for (i = 0; i < dict->nentries; i++) {
+	if (dict->entries[i].key == NULL)
+	    continue;
+	heim_release(dict->entries[i].key);
+	heim_release(dict->entries[i].value);
     }
-    free(dict->tab);
+    free(dict->entries);
+    free(dict->index);
 }
 
 struct heim_type_data dict_object = {
@@ -75,38 +92,76 @@ struct heim_type_data dict_object = {
     NULL
 };
 
+/* Object hashes need not be well distributed in their low bits */
 static size_t
-isprime(size_t p)
+dict_slot(heim_dict_t dict, unsigned long hash)
 {
-    size_t q, i;
+    hash ^= (hash >> 16) >> 16;
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6dUL;
+    hash ^= hash >> 12;
+    hash *= 0x297a2d39UL;
+    hash ^= hash >> 15;
+    return hash & dict->mask;
+}
 
-    for(i = 2 ; i < p; i++) {
-	q = p / i;
+/* Add entry number n to the index, which must have room for it */
+static void
+dict_index_add(heim_dict_t dict, size_t n)
+{
+    size_t i = dict_slot(dict, dict->entries[n].hash);
 
-	if (i * q == p)
-	    return 0;
-	if (i * i > p)
-	    return 1;
-    }
-    return 1;
+    while (dict->index[i] != DICT_EMPTY && dict->index[i] != DICT_DELETED)
+	i = (i + 1) & dict->mask;
+    dict->index[i] = n + 1;
 }
 
-static size_t
-findprime(size_t p)
+/*
+ * Make room for at least `want' entries, dropping the deleted ones
+ * from the array and rebuilding the index.
+ */
+static int
+dict_resize(heim_dict_t dict, size_t want)
 {
-    if (p % 2 == 0)
-	p++;
+    struct dict_entry *entries;
+    uint32_t *index;
+    size_t size = DICT_MIN_SIZE, i, n;
 
-    while (isprime(p) == 0)
-	p += 2;
+    while (size / 4 * 3 < want) {
+	if (size > DICT_DELETED / 2)
+	    return ENOMEM;
+	size *= 2;
+    }
+
+    index = calloc(size, sizeof(index[0]));
+    entries = calloc(size / 4 * 3, sizeof(entries[0]));
+    if (index == NULL || entries == NULL) {
+	free(index);
+	free(entries);
+	return ENOMEM;
+    }
 
-    return p;
+    for (i = 0, n = 0; i < dict->nentries; i++) {
+	if (dict->entries[i].key != NULL)
+	    entries[n++] = dict->entries[i];
+    }
+    free(dict->entries);
+    free(dict->index);
+    dict->entries = entries;
+    dict->nentries = n;
+    dict->index = index;
+    dict->mask = size - 1;
+    for (i = 0; i < n; i++)
+	dict_index_add(dict, i);
+    return 0;
 }
 
 /**
- * Allocate an array
+ * Allocate a dict
+ *
+ * @param size the number of entries expected, the dict grows as needed
  *
- * @return A new allocated array, free with heim_release()
+ * @return A new allocated dict, free with heim_release()
  */
 
 heim_dict_t
@@ -115,16 +170,10 @@ heim_dict_create(size_t size)
     heim_dict_t dict;
 
     dict = _heim_alloc_object(&dict_object, sizeof(*dict));
-
-    dict->size = findprime(size);
-    if (dict->size == 0) {
-	heim_release(dict);
+    if (dict == NULL)
 	return NULL;
-    }
 
-    dict->tab = calloc(dict->size, sizeof(dict->tab[0]));
-    if (dict->tab == NULL) {
-	dict->size = 0;
+    if (dict_resize(dict, size) != 0) {
 	heim_release(dict);
 	return NULL;
     }
@@ -144,17 +193,21 @@ heim_dict_get_type_id(void)
     return HEIM_TID_DICT;
 }
 
-/* Intern search function */
+/* Intern search function, returns the index slot of key or NULL */
 
-static struct hashentry *
-_search(heim_dict_t dict, heim_object_t ptr)
+static uint32_t *
+_search(heim_dict_t dict, heim_object_t key, unsigned long hash)
 {
-    unsigned long v = heim_get_hash(ptr);
-    struct hashentry *p;
-
-    for (p = dict->tab[v % dict->size]; p != NULL; p = p->next)
-	if (heim_cmp(ptr, p->key) == 0)
-	    return p;
+    size_t i = dict_slot(dict, hash);
+    struct dict_entry *e;
+
+    for (; dict->index[i] != DICT_EMPTY; i = (i + 1) & dict->mask) {
+	if (dict->index[i] == DICT_DELETED)
+	    continue;
+	e = &dict->entries[dict->index[i] - 1];
+	if (e->hash == hash && heim_cmp(key, e->key) == 0)
+	    return &dict->index[i];
+    }
 
     return NULL;
 }
@@ -171,12 +224,12 @@ _search(heim_dict_t dict, heim_object_t ptr)
 heim_object_t
 heim_dict_get_value(heim_dict_t dict, heim_object_t key)
 {
-    struct hashentry *p;
-    p = _search(dict, key);
+    uint32_t *p;
+    p = _search(dict, key, heim_get_hash(key));
     if (p == NULL)
 	return NULL;
 
-    return p->value;
+    return dict->entries[*p - 1].value;
 }
 
 /**
@@ -191,12 +244,12 @@ heim_dict_get_value(heim_dict_t dict, heim_object_t key)
 heim_object_t
 heim_dict_copy_value(heim_dict_t dict, heim_object_t key)
 {
-    struct hashentry *p;
-    p = _search(dict, key);
+    uint32_t *p;
+    p = _search(dict, key, heim_get_hash(key));
     if (p == NULL)
 	return NULL;
 
-    return heim_retain(p->value);
+    return heim_retain(dict->entries[*p - 1].value);
 }
 
 /**
@@ -212,32 +265,32 @@ heim_dict_copy_value(heim_dict_t dict, heim_object_t key)
 int
 heim_dict_set_value(heim_dict_t dict, heim_object_t key, heim_object_t value)
 {
-    struct hashentry **tabptr, *h;
-
-    h = _search(dict, key);
-    if (h) {
-	heim_release(h->value);
-	h->value = heim_retain(value);
-    } else {
-	unsigned long v;
-
-	h = malloc(sizeof(*h));
-	if (h == NULL)
-	    return ENOMEM;
-
-	h->key = heim_retain(key);
-	h->value = heim_retain(value);
-
-	v = heim_get_hash(key);
+    unsigned long v = heim_get_hash(key);
+    struct dict_entry *e;
+    uint32_t *p;
+
+    p = _search(dict, key, v);
+    if (p) {
+	e = &dict->entries[*p - 1];
+	heim_release(e->value);
+	e->value = heim_retain(value);
+	return 0;
+    }
 
-	tabptr = &dict->tab[v % dict->size];
-	h->next = *tabptr;
-	*tabptr = h;
-	h->prev = tabptr;
-	if (h->next)
-	    h->next->prev = &h->next;
+    if (dict->nentries >= DICT_MAX_ENTRIES(dict)) {
+	int ret = dict_resize(dict, 2 * (dict->count + 1));
+	if (ret)
+	    return ret;
     }
 
+    e = &dict->entries[dict->nentries];
+    e->key = heim_retain(key);
+    e->value = heim_retain(value);
+    e->hash = v;
+    dict_index_add(dict, dict->nentries);
+    dict->nentries++;
+    dict->count++;
+
     return 0;
 }
 
@@ -251,22 +304,27 @@ heim_dict_set_value(heim_dict_t dict, heim_object_t key, heim_object_t value)
 void
 heim_dict_delete_key(heim_dict_t dict, heim_object_t key)
 {
-    struct hashentry *h = _search(dict, key);
+    uint32_t *p = _search(dict, key, heim_get_hash(key));
+    struct dict_entry *e;
 
-    if (h == NULL)
+    if (p == NULL)
 	return;
 
-    heim_release(h->key);
-    heim_release(h->value);
+    e = &dict->entries[*p - 1];
+    heim_release(e->key);
+    heim_release(e->value);
+    e->key = e->value = NULL;
+    *p = DICT_DELETED;
 
-    if ((*(h->prev) = h->next) != NULL)
-	h->next->prev = h->prev;
-
-    free(h);
+    /* Start afresh when the dict becomes empty */
+    if (--dict->count == 0) {
+	memset(dict->index, 0, (dict->mask + 1) * sizeof(dict->index[0]));
+	dict->nentries = 0;
+    }
 }
 
 /**
- * Do something for each element
+ * Do something for each element, in the order they were added
  *
  * @value dict the dict to interate over
  * @value func the function to search for
@@ -276,16 +334,16 @@ heim_dict_delete_key(heim_dict_t dict, heim_object_t key)
 void
 heim_dict_iterate_f(heim_dict_t dict, void *arg, heim_dict_iterator_f_t func)
 {
-    struct hashentry **h, *g;
+    size_t i;
 
-    for (h = dict->tab; h < &dict->tab[dict->size]; ++h)
-	for (g = *h; g; g = g->next)
-	    func(g->key, g->value, arg);
+    for (i = 0; i < dict->nentries; i++)
+	if (dict->entries[i].key != NULL)
+	    func(dict->entries[i].key, dict->entries[i].value, arg);
 }
 
 #ifdef __BLOCKS__
 /**
- * Do something for each element
+ * Do something for each element, in the order they were added
  *
  * @value dict the dict to interate over
  * @value func the function to search for
@@ -294,10 +352,10 @@ heim_dict_iterate_f(heim_dict_t dict, void *arg, heim_dict_iterator_f_t func)
 void
 heim_dict_iterate(heim_dict_t dict, void (^func)(heim_object_t, heim_object_t))
 {
-    struct hashentry **h, *g;
+    size_t i;
 
-    for (h = dict->tab; h < &dict->tab[dict->size]; ++h)
-	for (g = *h; g; g = g->next)
-	    func(g->key, g->value);
+    for (i = 0; i < dict->nentries; i++)
+	if (dict->entries[i].key != NULL)
+	    func(dict->entries[i].key, dict->entries[i].value);
 }
 #endif
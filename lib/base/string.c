@@ -79,8 +79,17 @@ string_hash(void *ptr)
     const char *s = ptr;
     unsigned long n;
 
-    for (n = 0; *s; ++s)
-	n += *s;
+    /* Hash string refs like the strings they refer to, see string_cmp() */
+    if (*s == '\0') {
+	char **strp = _heim_get_isaextra(ptr, 1);
+
+	if (*strp != NULL)
+	    s = *strp;
+    }
+
+    /* FNV-1a */
+    for (n = 2166136261UL; *s; ++s)
+	n = (n ^ (unsigned char)*s) * 16777619UL;
     return n;
 }
 
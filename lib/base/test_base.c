@@ -140,6 +140,85 @@ test_rwlock(void)
     return 0;
 }
 
+struct test_dict_iter_ctx {
+    int next;
+    int count;
+};
+
+static void
+test_dict_iter(heim_object_t key, heim_object_t value, void *arg)
+{
+    struct test_dict_iter_ctx *ctx = arg;
+    int k = heim_number_get_int(key);
+
+    /* Entries come in the order they were added, deleted ones skipped */
+    heim_assert(k >= ctx->next, "dict iteration order");
+    heim_assert((k - (k / 3) * 3) != 0, "deleted key iterated");
+    heim_assert(heim_number_get_int(value) == k * 2, "dict value");
+    ctx->next = k + 1;
+    ctx->count++;
+}
+
+/* Grow a dict well past its initial size, with deletes in between */
+static int
+test_dict_grow(void)
+{
+    struct test_dict_iter_ctx ctx;
+    heim_dict_t dict;
+    heim_string_t s1, s2;
+    heim_number_t k, v;
+    int i, n = 5000;
+
+    dict = heim_dict_create(3);
+    heim_assert(dict != NULL, "dict");
+
+    for (i = 0; i < n; i++) {
+	k = heim_number_create(i);
+	v = heim_number_create(i * 2);
+	heim_assert(heim_dict_set_value(dict, k, v) == 0, "dict set");
+	heim_release(k);
+	heim_release(v);
+	if (i % 3 == 0 && i > 0) {
+	    k = heim_number_create(i - 3);
+	    heim_dict_delete_key(dict, k);
+	    heim_release(k);
+	}
+    }
+    k = heim_number_create(n - n % 3 - (n % 3 ? 0 : 3));
+    heim_dict_delete_key(dict, k);
+    heim_release(k);
+
+    for (i = 0; i < n; i++) {
+	k = heim_number_create(i);
+	v = heim_dict_get_value(dict, k);
+	if (i % 3 == 0)
+	    heim_assert(v == NULL, "deleted key found");
+	else
+	    heim_assert(v != NULL && heim_number_get_int(v) == i * 2,
+			"dict get");
+	heim_release(k);
+    }
+
+    ctx.next = 0;
+    ctx.count = 0;
+    heim_dict_iterate_f(dict, &ctx, test_dict_iter);
+    heim_assert(ctx.count == n - (n + 2) / 3, "dict iteration count");
+
+    heim_release(dict);
+
+    /* A string ref must find the entry of an equal string */
+    dict = heim_dict_create(11);
+    s1 = heim_string_create("hejsan");
+    s2 = heim_string_ref_create("hejsan", NULL);
+    heim_dict_set_value(dict, s1, s1);
+    heim_assert(heim_dict_get_value(dict, s2) == s1, "dict string ref");
+    heim_release(s1);
+    heim_release(s2);
+    heim_release(dict);
+
+    return 0;
+}
+
 static int
 test_dict(void)
 {
@@ -164,7 +243,7 @@ test_dict(void)
 
     heim_release(dict);
 
-    return 0;
+    return test_dict_grow();
 }
 
 static int
@@ -842,6 +921,111 @@ test_db(const char *dbtype, const char *dbname)
     return 0;
 }
 
+#ifndef WIN32
+static void
+test_jsonlog_iter(heim_data_t k, heim_data_t v, void *arg)
+{
+    (*(int *)arg)++;
+}
+
+static heim_data_t
+test_jsonlog_key(int i)
+{
+    char buf[32];
+
+    (void) snprintf(buf, sizeof(buf), "key-%d", i);
+    return heim_data_create(buf, strlen(buf));
+}
+
+static int
+test_jsonlog(const char *dbname)
+{
+    static const char torn[] = "+ 1 5 10\ntkey-x{\"tor";
+    heim_dict_t options;
+    heim_db_t db, db2;
+    heim_data_t k;
+    heim_object_t v;
+    struct stat st;
+    int count, fd, i, ret;
+
+    options = heim_dict_create(11);
+    heim_assert(options, "...");
+    ret = heim_dict_set_value(options, HSTR("create"), heim_null_create());
+    heim_assert(!ret, "...");
+    ret = heim_dict_set_value(options, HSTR("truncate"), heim_null_create());
+    heim_assert(!ret, "...");
+    db = heim_db_create("jsonlog", dbname, options, NULL);
+    heim_release(options);
+    heim_assert(db, "...");
+    db2 = heim_db_create("jsonlog", dbname, NULL, NULL);
+    heim_assert(db2, "...");
+
+    /* Lots of updates of a few keys; the log must get compacted */
+    for (i = 0; i < 20000; i++) {
+	heim_number_t n = heim_number_create(i);
+
+	k = test_jsonlog_key(i % 100);
+	ret = heim_db_set_value(db, HSTR("t"), k, (heim_data_t)n, NULL);
+	heim_assert(!ret, "...");
+	heim_release(k);
+	heim_release(n);
+    }
+    ret = stat(dbname, &st);
+    heim_assert(ret == 0 && st.st_size < 128 * 1024,
+		"jsonlog DB was not compacted");
+
+    /* A handle opened before compaction follows the log to its new file */
+    for (i = 0; i < 100; i++) {
+	k = test_jsonlog_key(i);
+	v = heim_db_copy_value(db2, HSTR("t"), (heim_data_t)k, NULL);
+	heim_assert(v && !heim_cmp(v, heim_number_create(19900 + i)), "...");
+	heim_release(v);
+	heim_release(k);
+    }
+
+    k = test_jsonlog_key(0);
+    ret = heim_db_delete_key(db, HSTR("t"), k, NULL);
+    heim_assert(!ret, "...");
+    v = heim_db_copy_value(db2, HSTR("t"), k, NULL);
+    heim_assert(v == NULL, "...");
+    heim_release(k);
+    heim_release(db2);
+
+    /* A torn record at the end is ignored, then overwritten */
+    fd = open(dbname, O_WRONLY | O_APPEND);
+    heim_assert(fd >= 0, "...");
+    ret = write(fd, torn, sizeof(torn) - 1) != sizeof(torn) - 1;
+    heim_assert(!ret, "...");
+    (void) close(fd);
+
+    db2 = heim_db_create("jsonlog", dbname, NULL, NULL);
+    heim_assert(db2, "...");
+    k = test_jsonlog_key(1);
+    v = heim_db_copy_value(db2, HSTR("t"), k, NULL);
+    heim_assert(v && !heim_cmp(v, heim_number_create(19901)), "...");
+    heim_release(v);
+    heim_release(k);
+    k = heim_data_create("key-x", strlen("key-x"));
+    v = heim_db_copy_value(db2, HSTR("t"), k, NULL);
+    heim_assert(v == NULL, "...");
+    ret = heim_db_set_value(db2, HSTR("t"), k, (heim_data_t)HSTR("x"), NULL);
+    heim_assert(!ret, "...");
+    heim_release(db2);
+
+    v = heim_db_copy_value(db, HSTR("t"), k, NULL);
+    heim_assert(v && !heim_cmp(v, HSTR("x")), "...");
+    heim_release(v);
+    heim_release(k);
+
+    count = 0;
+    heim_db_iterate_f(db, HSTR("t"), &count, test_jsonlog_iter, NULL);
+    heim_assert(count == 100, "...");
+    heim_release(db);
+
+    return 0;
+}
+#endif
+
 struct test_array_iter_ctx {
     char buf[256];
 };
@@ -955,6 +1139,10 @@ main(int argc, char **argv)
     res |= test_path();
     res |= test_db(NULL, NULL);
     res |= test_db("json", argc > 1 ? argv[1] : "test_db.json");
+#ifndef WIN32
+    res |= test_db("jsonlog", argc > 2 ? argv[2] : "test_db.jsonlog");
+    res |= test_jsonlog(argc > 2 ? argv[2] : "test_db.jsonlog");
+#endif
     res |= test_array();
 
     return res ? 1 : 0;
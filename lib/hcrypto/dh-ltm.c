@@ -35,10 +35,12 @@
 #include <config.h>
 #endif
 #include <roken.h>
+#include <heim_threads.h>
 
 #include <dh.h>
 
 #include "tommath.h"
+#include "mont-ltm.h"
 
 static void
 BN2mpz(mp_int *s, const BIGNUM *bn)
@@ -72,6 +74,70 @@ mpz2BN(mp_int *s)
     return bn;
 }
 
+/*
+ * Montgomery contexts for the groups in use, found by their modulus.
+ * There are only ever a few of them (the well-known MODP groups), so they
+ * are kept for the life of the process; past LTM_DH_GROUPS groups
+ * mp_exptmod() is used.
+ */
+
+#define LTM_DH_GROUPS 8
+
+static struct ltm_dh_group {
+    unsigned char *p;
+    size_t len;
+    struct hc_mont *mont;
+} ltm_dh_groups[LTM_DH_GROUPS];
+
+static HEIMDAL_MUTEX ltm_dh_mutex = HEIMDAL_MUTEX_INITIALIZER;
+
+static const struct hc_mont *
+ltm_dh_mont(const BIGNUM *bn, mp_int *p)
+{
+    struct hc_mont *mont = NULL;
+    unsigned char *buf;
+    size_t len, i;
+
+    len = BN_num_bytes(bn);
+    buf = malloc(len);
+    if (buf == NULL)
+	return NULL;
+    BN_bn2bin(bn, buf);
+
+    HEIMDAL_MUTEX_lock(&ltm_dh_mutex);
+    for (i = 0; i < LTM_DH_GROUPS; i++) {
+	struct ltm_dh_group *g = &ltm_dh_groups[i];
+
+	if (g->p == NULL) {
+	    if ((g->mont = _hc_mont_new(p)) != NULL) {
+		g->p = buf;
+		g->len = len;
+		buf = NULL;
+	    }
+	    mont = g->mont;
+	    break;
+	}
+	if (g->len == len && memcmp(g->p, buf, len) == 0) {
+	    mont = g->mont;
+	    break;
+	}
+    }
+    HEIMDAL_MUTEX_unlock(&ltm_dh_mutex);
+
+    free(buf);
+    return mont;
+}
+
+static int
+ltm_dh_exptmod(const BIGNUM *bn, mp_int *b, mp_int *e, mp_int *p, mp_int *out)
+{
+    const struct hc_mont *mont = ltm_dh_mont(bn, p);
+
+    if (mont)
+	return _hc_mont_exptmod(mont, b, e, out);
+    return mp_exptmod(b, e, p, out);
+}
+
 /*
  *
  */
@@ -116,7 +182,7 @@ ltm_dh_generate_key(DH *dh)
 	BN2mpz(&g, dh->g);
 	BN2mpz(&p, dh->p);
 
-	res = mp_exptmod(&g, &priv_key, &p, &pub);
+	res = ltm_dh_exptmod(dh->p, &g, &priv_key, &p, &pub);
 
 	mp_clear_multi(&priv_key, &g, &p, NULL);
 	if (res != 0)
@@ -172,7 +238,7 @@ ltm_dh_compute_key(unsigned char *shared, const BIGNUM * pub, DH *dh)
 
     BN2mpz(&priv_key, dh->priv_key);
 
-    ret = mp_exptmod(&peer_pub, &priv_key, &p, &s);
+    ret = ltm_dh_exptmod(dh->p, &peer_pub, &priv_key, &p, &s);
 
     if (ret != 0) {
 	ret = -1;
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2009 Kungliga Tekniska Hgskolan
+ * Copyright (c) 2009, 2026 Kungliga Tekniska Hgskolan
  * (Royal Institute of Technology, Stockholm, Sweden).
  * All rights reserved.
  *
@@ -31,148 +31,1431 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Native elliptic curve key agreement and signatures for the NIST P-256
+ * curve and for X25519 (RFC 7748), for builds without OpenSSL.
+ *
+ * All arithmetic on secret values runs in constant time: there are no
+ * branches or table lookups that depend on private keys, nonces or
+ * intermediate points.  Only public values (the fixed inversion and
+ * square-root exponents, the result of verification, etc.) are branched
+ * on.
+ *
+ * P-256 field elements and scalars are eight 32-bit limbs, least
+ * significant first, kept in Montgomery form.  Points are in projective
+ * coordinates and use the complete addition and doubling formulas of
+ * Renes, Costello and Batina ("Complete addition formulas for prime order
+ * elliptic curves", 2015), so there are no special cases for the point
+ * at infinity or for doubling.  Scalar multiplication uses a fixed
+ * 4-bit window with a constant-time table scan.
+ *
+ * X25519 is the usual Montgomery ladder over sixteen 16-bit limbs.
+ *
+ * ECDSA nonces are derived from the private key and the digest as in
+ * RFC 6979, so signing does not depend on the random number generator.
+ */
+
 #include <config.h>
 #include <roken.h>
+#include <krb5-types.h>
+#include <rfc2459_asn1.h>
 
-#include "ec.h"
+#include <der.h>
 
-struct EC_POINT {
-    int inf;
-    mp_int x;
-    mp_int y;
-    mp_int z;
-};
+#include <ec.h>
+#include <ecdh.h>
+#include <ecdsa.h>
+#include <evp.h>
+#include <hmac.h>
+#include <rand.h>
 
 struct EC_GROUP {
-    size_t size;
-    mp_int prime;
-    mp_int order;
-    mp_int Gx;
-    mp_int Gy;
+    int nid;
+    int degree;
+};
+
+struct EC_POINT {
+    const EC_GROUP *group;
+    unsigned char x[32];	/* big-endian x, or the X25519 u coordinate */
+    unsigned char y[32];	/* big-endian y, P-256 only */
 };
 
 struct EC_KEY {
-    int type;
-    EC_GROUP *group;
-    EC_POINT *pubkey;
-    mp_int privkey;
+    const EC_GROUP *group;
+    EC_POINT pub;
+    int have_pub;
+    unsigned char priv[32];
+    int have_priv;
+    BIGNUM *privbn;
+};
+
+static const EC_GROUP p256_group = { NID_X9_62_prime256v1, 256 };
+static const EC_GROUP x25519_group = { NID_X25519, 255 };
+
+/*
+ * Montgomery arithmetic modulo a 256-bit odd modulus, used both for the
+ * P-256 field and for its group order.
+ */
+
+struct mont_mod {
+    uint32_t m[8];
+    uint32_t m0inv;		/* -m^-1 mod 2^32 */
+    uint32_t rr[8];		/* 2^512 mod m */
+    uint32_t inv_exp[8];	/* m - 2 */
+};
+
+static const struct mont_mod p256_p = {
+    { 0xffffffff, 0xffffffff, 0xffffffff, 0x00000000,
+      0x00000000, 0x00000000, 0x00000001, 0xffffffff },
+    0x00000001,
+    { 0x00000003, 0x00000000, 0xffffffff, 0xfffffffb,
+      0xfffffffe, 0xffffffff, 0xfffffffd, 0x00000004 },
+    { 0xfffffffd, 0xffffffff, 0xffffffff, 0x00000000,
+      0x00000000, 0x00000000, 0x00000001, 0xffffffff }
 };
 
+static const struct mont_mod p256_n = {
+    { 0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad,
+      0xffffffff, 0xffffffff, 0x00000000, 0xffffffff },
+    0xee00bc4f,
+    { 0xbe79eea2, 0x83244c95, 0x49bd6fa6, 0x4699799c,
+      0x2b6bec59, 0x2845b239, 0xf3d95620, 0x66e12d94 },
+    { 0xfc63254f, 0xf3b9cac2, 0xa7179e84, 0xbce6faad,
+      0xffffffff, 0xffffffff, 0x00000000, 0xffffffff }
+};
 
-unsigned long
-EC_GROUP_get_degree(EC_GROUP *)
+/* (p + 1) / 4, to take square roots mod p */
+static const uint32_t p256_sqrt_exp[8] = {
+    0x00000000, 0x00000000, 0x40000000, 0x00000000,
+    0x00000000, 0x40000000, 0xc0000000, 0x3fffffff
+};
+
+/* 1, b and the base point, in Montgomery form */
+static const uint32_t p256_one[8] = {
+    0x00000001, 0x00000000, 0x00000000, 0xffffffff,
+    0xffffffff, 0xffffffff, 0xfffffffe, 0x00000000
+};
+static const uint32_t p256_b[8] = {
+    0x29c4bddf, 0xd89cdf62, 0x78843090, 0xacf005cd,
+    0xf7212ed6, 0xe5a220ab, 0x04874834, 0xdc30061d
+};
+static const uint32_t p256_gx[8] = {
+    0x18a9143c, 0x79e730d4, 0x5fedb601, 0x75ba95fc,
+    0x77622510, 0x79fb732b, 0xa53755c6, 0x18905f76
+};
+static const uint32_t p256_gy[8] = {
+    0xce95560a, 0xddf25357, 0xba19e45c, 0x8b4ab8e4,
+    0xdd21f325, 0xd2e88688, 0x25885d85, 0x8571ff18
+};
+
+static const unsigned char p256_order[32] = {
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xbc, 0xe6, 0xfa, 0xad, 0xa7, 0x17, 0x9e, 0x84,
+    0xf3, 0xb9, 0xca, 0xc2, 0xfc, 0x63, 0x25, 0x51
+};
+
+static const unsigned char x25519_order[32] = {
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x14, 0xde, 0xf9, 0xde, 0xa2, 0xf7, 0x9c, 0xd6,
+    0x58, 0x12, 0x63, 0x1a, 0x5c, 0xf5, 0xd3, 0xed
+};
+
+static void
+limbs_from_bytes(uint32_t r[8], const unsigned char *b)
 {
+    const unsigned char *p;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	p = b + 28 - 4 * i;
+	r[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	    ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
 }
 
-EC_GROUP *
-EC_KEY_get0_group(EC_KEY *)
+static void
+limbs_to_bytes(unsigned char *b, const uint32_t a[8])
 {
+    unsigned char *p;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	p = b + 28 - 4 * i;
+	p[0] = (a[i] >> 24) & 0xff;
+	p[1] = (a[i] >> 16) & 0xff;
+	p[2] = (a[i] >> 8) & 0xff;
+	p[3] = a[i] & 0xff;
+    }
 }
 
-int
-EC_GROUP_get_order(EC_GROUP *, BIGNUM *, BN_CTX *)
+/* 1 if a == 0, else 0 */
+static uint32_t
+limbs_is_zero(const uint32_t a[8])
 {
+    uint32_t z = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+	z |= a[i];
+    return ((z | (0 - z)) >> 31) ^ 1;
 }
 
-EC_KEY *
-o2i_ECPublicKey(EC_KEY **key, unsigned char **, size_t)
+/* 1 if a < m, else 0 */
+static uint32_t
+limbs_lt(const uint32_t a[8], const uint32_t m[8])
 {
+    uint32_t borrow = 0;
+    uint64_t w;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	w = (uint64_t)a[i] - m[i] - borrow;
+	borrow = (uint32_t)(w >> 63);
+    }
+    return borrow;
 }
 
-void
-EC_KEY_free(EC_KEY *)
+/* r = t mod m, for t = hi * 2^256 + t < 2m */
+static void
+mod_reduce_once(uint32_t r[8], const uint32_t t[8], uint32_t hi,
+		const uint32_t m[8])
+{
+    uint32_t d[8], borrow = 0, mask;
+    uint64_t w;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	w = (uint64_t)t[i] - m[i] - borrow;
+	d[i] = (uint32_t)w;
+	borrow = (uint32_t)(w >> 63);
+    }
+    /* keep t if it did not overflow and is less than m */
+    mask = 0 - ((~hi & borrow) & 1);
+    for (i = 0; i < 8; i++)
+	r[i] = (t[i] & mask) | (d[i] & ~mask);
+}
+
+static void
+mod_add(uint32_t r[8], const uint32_t a[8], const uint32_t b[8],
+	const struct mont_mod *mod)
+{
+    uint32_t t[8];
+    uint64_t w = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	w += (uint64_t)a[i] + b[i];
+	t[i] = (uint32_t)w;
+	w >>= 32;
+    }
+    mod_reduce_once(r, t, (uint32_t)w, mod->m);
+}
+
+static void
+mod_sub(uint32_t r[8], const uint32_t a[8], const uint32_t b[8],
+	const struct mont_mod *mod)
+{
+    uint32_t t[8], borrow = 0, mask;
+    uint64_t w;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	w = (uint64_t)a[i] - b[i] - borrow;
+	t[i] = (uint32_t)w;
+	borrow = (uint32_t)(w >> 63);
+    }
+    /* add m back if it borrowed */
+    mask = 0 - borrow;
+    w = 0;
+    for (i = 0; i < 8; i++) {
+	w += (uint64_t)t[i] + (mod->m[i] & mask);
+	r[i] = (uint32_t)w;
+	w >>= 32;
+    }
+}
+
+/* r = a * b / 2^256 mod m */
+static void
+mont_mul(uint32_t r[8], const uint32_t a[8], const uint32_t b[8],
+	 const struct mont_mod *mod)
+{
+    uint32_t t[10], u;
+    uint64_t c;
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 8; i++) {
+	c = 0;
+	for (j = 0; j < 8; j++) {
+	    c += (uint64_t)a[j] * b[i] + t[j];
+	    t[j] = (uint32_t)c;
+	    c >>= 32;
+	}
+	c += t[8];
+	t[8] = (uint32_t)c;
+	t[9] = (uint32_t)(c >> 32);
+
+	u = t[0] * mod->m0inv;
+	c = ((uint64_t)u * mod->m[0] + t[0]) >> 32;
+	for (j = 1; j < 8; j++) {
+	    c += (uint64_t)u * mod->m[j] + t[j];
+	    t[j - 1] = (uint32_t)c;
+	    c >>= 32;
+	}
+	c += t[8];
+	t[7] = (uint32_t)c;
+	t[8] = t[9] + (uint32_t)(c >> 32);
+    }
+    mod_reduce_once(r, t, t[8], mod->m);
+}
+
+static void
+mont_to(uint32_t r[8], const uint32_t a[8], const struct mont_mod *mod)
+{
+    mont_mul(r, a, mod->rr, mod);
+}
+
+static void
+mont_from(uint32_t r[8], const uint32_t a[8], const struct mont_mod *mod)
+{
+    static const uint32_t one[8] = { 1 };
+
+    mont_mul(r, a, one, mod);
+}
+
+/* r = a^e, for a in Montgomery form and a public exponent e */
+static void
+mont_pow(uint32_t r[8], const uint32_t a[8], const uint32_t e[8],
+	 const struct mont_mod *mod)
+{
+    static const uint32_t one[8] = { 1 };
+    uint32_t x[8];
+    int i;
+
+    mont_to(x, one, mod);
+    for (i = 255; i >= 0; i--) {
+	mont_mul(x, x, x, mod);
+	if ((e[i / 32] >> (i % 32)) & 1)
+	    mont_mul(x, x, a, mod);
+    }
+    memcpy(r, x, sizeof(x));
+}
+
+static void
+mont_inv(uint32_t r[8], const uint32_t a[8], const struct mont_mod *mod)
+{
+    mont_pow(r, a, mod->inv_exp, mod);
+}
+
+/*
+ * P-256 points
+ */
+
+struct p256_point {
+    uint32_t X[8];
+    uint32_t Y[8];
+    uint32_t Z[8];
+};
+
+#define fe_mul(r, a, b) mont_mul((r), (a), (b), &p256_p)
+#define fe_add(r, a, b) mod_add((r), (a), (b), &p256_p)
+#define fe_sub(r, a, b) mod_sub((r), (a), (b), &p256_p)
+
+static void
+p256_infinity(struct p256_point *r)
+{
+    memset(r, 0, sizeof(*r));
+    memcpy(r->Y, p256_one, sizeof(r->Y));
+}
+
+/* Complete addition for a = -3 (Algorithm 4 of Renes et al.); r may alias */
+static void
+p256_add(struct p256_point *r, const struct p256_point *p,
+	 const struct p256_point *q)
+{
+    uint32_t t0[8], t1[8], t2[8], t3[8], t4[8], x3[8], y3[8], z3[8];
+
+    fe_mul(t0, p->X, q->X);
+    fe_mul(t1, p->Y, q->Y);
+    fe_mul(t2, p->Z, q->Z);
+    fe_add(t3, p->X, p->Y);
+    fe_add(t4, q->X, q->Y);
+    fe_mul(t3, t3, t4);
+    fe_add(t4, t0, t1);
+    fe_sub(t3, t3, t4);
+    fe_add(t4, p->Y, p->Z);
+    fe_add(x3, q->Y, q->Z);
+    fe_mul(t4, t4, x3);
+    fe_add(x3, t1, t2);
+    fe_sub(t4, t4, x3);
+    fe_add(x3, p->X, p->Z);
+    fe_add(y3, q->X, q->Z);
+    fe_mul(x3, x3, y3);
+    fe_add(y3, t0, t2);
+    fe_sub(y3, x3, y3);
+    fe_mul(z3, p256_b, t2);
+    fe_sub(x3, y3, z3);
+    fe_add(z3, x3, x3);
+    fe_add(x3, x3, z3);
+    fe_sub(z3, t1, x3);
+    fe_add(x3, t1, x3);
+    fe_mul(y3, p256_b, y3);
+    fe_add(t1, t2, t2);
+    fe_add(t2, t1, t2);
+    fe_sub(y3, y3, t2);
+    fe_sub(y3, y3, t0);
+    fe_add(t1, y3, y3);
+    fe_add(y3, t1, y3);
+    fe_add(t1, t0, t0);
+    fe_add(t0, t1, t0);
+    fe_sub(t0, t0, t2);
+    fe_mul(t1, t4, y3);
+    fe_mul(t2, t0, y3);
+    fe_mul(y3, x3, z3);
+    fe_add(y3, y3, t2);
+    fe_mul(x3, t3, x3);
+    fe_sub(x3, x3, t1);
+    fe_mul(z3, t4, z3);
+    fe_mul(t1, t3, t0);
+    fe_add(z3, z3, t1);
+
+    memcpy(r->X, x3, sizeof(x3));
+    memcpy(r->Y, y3, sizeof(y3));
+    memcpy(r->Z, z3, sizeof(z3));
+}
+
+/* Complete doubling for a = -3 (Algorithm 6 of Renes et al.); r may alias */
+static void
+p256_double(struct p256_point *r, const struct p256_point *p)
+{
+    uint32_t t0[8], t1[8], t2[8], t3[8], x3[8], y3[8], z3[8];
+
+    fe_mul(t0, p->X, p->X);
+    fe_mul(t1, p->Y, p->Y);
+    fe_mul(t2, p->Z, p->Z);
+    fe_mul(t3, p->X, p->Y);
+    fe_add(t3, t3, t3);
+    fe_mul(z3, p->X, p->Z);
+    fe_add(z3, z3, z3);
+    fe_mul(y3, p256_b, t2);
+    fe_sub(y3, y3, z3);
+    fe_add(x3, y3, y3);
+    fe_add(y3, x3, y3);
+    fe_sub(x3, t1, y3);
+    fe_add(y3, t1, y3);
+    fe_mul(y3, x3, y3);
+    fe_mul(x3, x3, t3);
+    fe_add(t3, t2, t2);
+    fe_add(t2, t2, t3);
+    fe_mul(z3, p256_b, z3);
+    fe_sub(z3, z3, t2);
+    fe_sub(z3, z3, t0);
+    fe_add(t3, z3, z3);
+    fe_add(z3, z3, t3);
+    fe_add(t3, t0, t0);
+    fe_add(t0, t3, t0);
+    fe_sub(t0, t0, t2);
+    fe_mul(t0, t0, z3);
+    fe_add(y3, y3, t0);
+    fe_mul(t0, p->Y, p->Z);
+    fe_add(t0, t0, t0);
+    fe_mul(z3, t0, z3);
+    fe_sub(x3, x3, z3);
+    fe_mul(z3, t0, t1);
+    fe_add(z3, z3, z3);
+    fe_add(z3, z3, z3);
+
+    memcpy(r->X, x3, sizeof(x3));
+    memcpy(r->Y, y3, sizeof(y3));
+    memcpy(r->Z, z3, sizeof(z3));
+}
+
+/* r = table[idx], reading every entry */
+static void
+p256_select(struct p256_point *r, const struct p256_point table[16],
+	    uint32_t idx)
+{
+    uint32_t mask, x;
+    int i, j;
+
+    memset(r, 0, sizeof(*r));
+    for (i = 0; i < 16; i++) {
+	x = (uint32_t)i ^ idx;
+	mask = (((x | (0 - x)) >> 31) & 1) - 1;
+	for (j = 0; j < 8; j++) {
+	    r->X[j] |= table[i].X[j] & mask;
+	    r->Y[j] |= table[i].Y[j] & mask;
+	    r->Z[j] |= table[i].Z[j] & mask;
+	}
+    }
+}
+
+/* r = k * p, for a big-endian scalar k */
+static void
+p256_mul(struct p256_point *r, const unsigned char k[32],
+	 const struct p256_point *p)
+{
+    struct p256_point table[16], t, acc;
+    uint32_t nibble;
+    int i;
+
+    p256_infinity(&table[0]);
+    table[1] = *p;
+    for (i = 2; i < 16; i += 2) {
+	p256_double(&table[i], &table[i / 2]);
+	p256_add(&table[i + 1], &table[i], p);
+    }
+
+    p256_infinity(&acc);
+    for (i = 0; i < 64; i++) {
+	p256_double(&acc, &acc);
+	p256_double(&acc, &acc);
+	p256_double(&acc, &acc);
+	p256_double(&acc, &acc);
+	nibble = (k[i / 2] >> ((i & 1) ? 0 : 4)) & 0xf;
+	p256_select(&t, table, nibble);
+	p256_add(&acc, &acc, &t);
+    }
+    *r = acc;
+
+    memset_s(table, sizeof(table), 0, sizeof(table));
+    memset_s(&t, sizeof(t), 0, sizeof(t));
+    memset_s(&acc, sizeof(acc), 0, sizeof(acc));
+}
+
+static void
+p256_mul_base(struct p256_point *r, const unsigned char k[32])
+{
+    struct p256_point g;
+
+    memcpy(g.X, p256_gx, sizeof(g.X));
+    memcpy(g.Y, p256_gy, sizeof(g.Y));
+    memcpy(g.Z, p256_one, sizeof(g.Z));
+    p256_mul(r, k, &g);
+}
+
+/* Affine big-endian coordinates of p; returns 0 for the point at infinity */
+static int
+p256_to_affine(unsigned char x[32], unsigned char y[32],
+	       const struct p256_point *p)
+{
+    uint32_t zinv[8], t[8];
+
+    if (limbs_is_zero(p->Z))
+	return 0;
+    mont_inv(zinv, p->Z, &p256_p);
+    fe_mul(t, p->X, zinv);
+    mont_from(t, t, &p256_p);
+    limbs_to_bytes(x, t);
+    if (y) {
+	fe_mul(t, p->Y, zinv);
+	mont_from(t, t, &p256_p);
+	limbs_to_bytes(y, t);
+    }
+    return 1;
+}
+
+/* x^3 - 3x + b, in Montgomery form */
+static void
+p256_rhs(uint32_t r[8], const uint32_t x[8])
+{
+    uint32_t t[8];
+
+    fe_mul(t, x, x);
+    fe_mul(t, t, x);
+    fe_sub(t, t, x);
+    fe_sub(t, t, x);
+    fe_sub(t, t, x);
+    fe_add(r, t, p256_b);
+}
+
+/* Load and validate an affine point */
+static int
+p256_from_affine(struct p256_point *r, const unsigned char x[32],
+		 const unsigned char y[32])
+{
+    uint32_t lhs[8], rhs[8];
+
+    limbs_from_bytes(r->X, x);
+    limbs_from_bytes(r->Y, y);
+    if (!limbs_lt(r->X, p256_p.m) || !limbs_lt(r->Y, p256_p.m))
+	return 0;
+    mont_to(r->X, r->X, &p256_p);
+    mont_to(r->Y, r->Y, &p256_p);
+    memcpy(r->Z, p256_one, sizeof(r->Z));
+
+    fe_mul(lhs, r->Y, r->Y);
+    p256_rhs(rhs, r->X);
+    return memcmp(lhs, rhs, sizeof(lhs)) == 0;
+}
+
+/* Recover y from x and its parity */
+static int
+p256_decompress(unsigned char y[32], const unsigned char x[32], int odd)
+{
+    static const uint32_t zero[8];
+    uint32_t xl[8], rhs[8], yl[8], t[8];
+
+    limbs_from_bytes(xl, x);
+    if (!limbs_lt(xl, p256_p.m))
+	return 0;
+    mont_to(xl, xl, &p256_p);
+    p256_rhs(rhs, xl);
+    mont_pow(yl, rhs, p256_sqrt_exp, &p256_p);
+    fe_mul(t, yl, yl);
+    if (memcmp(t, rhs, sizeof(t)) != 0)
+	return 0;
+    mont_from(yl, yl, &p256_p);
+    if ((int)(yl[0] & 1) != odd)
+	mod_sub(yl, zero, yl, &p256_p);
+    limbs_to_bytes(y, yl);
+    return 1;
+}
+
+/* A valid private scalar is in [1, n - 1] */
+static int
+p256_scalar_valid(const unsigned char k[32])
+{
+    uint32_t kl[8];
+
+    limbs_from_bytes(kl, k);
+    return !limbs_is_zero(kl) && limbs_lt(kl, p256_n.m);
+}
+
+/*
+ * X25519
+ */
+
+typedef int64_t gf25519[16];
+
+static const unsigned char x25519_base[32] = { 9 };
+
+static void
+gf_carry(gf25519 o)
+{
+    int64_t c;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+	o[i] += (int64_t)1 << 16;
+	c = o[i] >> 16;
+	if (i < 15)
+	    o[i + 1] += c - 1;
+	else
+	    o[0] += 38 * (c - 1);
+	o[i] -= c * 65536;
+    }
+}
+
+/* Swap p and q if b is 1 */
+static void
+gf_cswap(gf25519 p, gf25519 q, int b)
+{
+    int64_t t, mask = ~((int64_t)b - 1);
+    int i;
+
+    for (i = 0; i < 16; i++) {
+	t = mask & (p[i] ^ q[i]);
+	p[i] ^= t;
+	q[i] ^= t;
+    }
+}
+
+static void
+gf_pack(unsigned char *o, const gf25519 n)
+{
+    gf25519 m, t;
+    int i, j, b;
+
+    memcpy(t, n, sizeof(t));
+    gf_carry(t);
+    gf_carry(t);
+    gf_carry(t);
+    for (j = 0; j < 2; j++) {
+	m[0] = t[0] - 0xffed;
+	for (i = 1; i < 15; i++) {
+	    m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+	    m[i - 1] &= 0xffff;
+	}
+	m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+	b = (m[15] >> 16) & 1;
+	m[14] &= 0xffff;
+	gf_cswap(t, m, 1 - b);
+    }
+    for (i = 0; i < 16; i++) {
+	o[2 * i] = t[i] & 0xff;
+	o[2 * i + 1] = (t[i] >> 8) & 0xff;
+    }
+}
+
+static void
+gf_unpack(gf25519 o, const unsigned char *n)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+	o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+    o[15] &= 0x7fff;
+}
+
+static void
+gf_add(gf25519 o, const gf25519 a, const gf25519 b)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+	o[i] = a[i] + b[i];
+}
+
+static void
+gf_sub(gf25519 o, const gf25519 a, const gf25519 b)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+	o[i] = a[i] - b[i];
+}
+
+static void
+gf_mul(gf25519 o, const gf25519 a, const gf25519 b)
+{
+    int64_t t[31];
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 16; i++)
+	for (j = 0; j < 16; j++)
+	    t[i + j] += a[i] * b[j];
+    for (i = 0; i < 15; i++)
+	t[i] += 38 * t[i + 16];
+    memcpy(o, t, sizeof(gf25519));
+    gf_carry(o);
+    gf_carry(o);
+}
+
+static void
+gf_inv(gf25519 o, const gf25519 i)
+{
+    gf25519 c;
+    int a;
+
+    memcpy(c, i, sizeof(c));
+    for (a = 253; a >= 0; a--) {
+	gf_mul(c, c, c);
+	if (a != 2 && a != 4)
+	    gf_mul(c, c, i);
+    }
+    memcpy(o, c, sizeof(c));
+}
+
+/* q = n * p (RFC 7748 section 5) */
+static void
+x25519(unsigned char q[32], const unsigned char n[32],
+       const unsigned char p[32])
 {
+    static const gf25519 a24 = { 0xdb41, 1 };
+    unsigned char z[32];
+    gf25519 x, a, b, c, d, e, f;
+    int i, r;
 
+    memcpy(z, n, sizeof(z));
+    z[31] = (z[31] & 127) | 64;
+    z[0] &= 248;
+    gf_unpack(x, p);
+    memset(a, 0, sizeof(a));
+    memset(c, 0, sizeof(c));
+    memset(d, 0, sizeof(d));
+    memcpy(b, x, sizeof(b));
+    a[0] = d[0] = 1;
+    for (i = 254; i >= 0; i--) {
+	r = (z[i >> 3] >> (i & 7)) & 1;
+	gf_cswap(a, b, r);
+	gf_cswap(c, d, r);
+	gf_add(e, a, c);
+	gf_sub(a, a, c);
+	gf_add(c, b, d);
+	gf_sub(b, b, d);
+	gf_mul(d, e, e);
+	gf_mul(f, a, a);
+	gf_mul(a, c, a);
+	gf_mul(c, b, e);
+	gf_add(e, a, c);
+	gf_sub(a, a, c);
+	gf_mul(b, a, a);
+	gf_sub(c, d, f);
+	gf_mul(a, c, a24);
+	gf_add(a, a, d);
+	gf_mul(c, c, a);
+	gf_mul(a, d, f);
+	gf_mul(d, b, x);
+	gf_mul(b, e, e);
+	gf_cswap(a, b, r);
+	gf_cswap(c, d, r);
+    }
+    gf_inv(c, c);
+    gf_mul(a, a, c);
+    gf_pack(q, a);
+
+    memset_s(z, sizeof(z), 0, sizeof(z));
+    memset_s(a, sizeof(a), 0, sizeof(a));
+    memset_s(b, sizeof(b), 0, sizeof(b));
+    memset_s(c, sizeof(c), 0, sizeof(c));
+    memset_s(d, sizeof(d), 0, sizeof(d));
+    memset_s(e, sizeof(e), 0, sizeof(e));
+    memset_s(f, sizeof(f), 0, sizeof(f));
 }
 
+/*
+ * EC_GROUP
+ */
+
 EC_GROUP *
 EC_GROUP_new_by_curve_name(int nid)
 {
+    switch (nid) {
+    case NID_X9_62_prime256v1:
+	return rk_UNCONST(&p256_group);
+    case NID_X25519:
+	return rk_UNCONST(&x25519_group);
+    default:
+	return NULL;
+    }
+}
+
+void
+EC_GROUP_free(EC_GROUP *group)
+{
+    /* groups are static */
+}
+
+int
+EC_GROUP_get_curve_name(const EC_GROUP *group)
+{
+    return group->nid;
 }
 
+int
+EC_GROUP_get_degree(const EC_GROUP *group)
+{
+    return group->degree;
+}
+
+int
+EC_GROUP_get_order(const EC_GROUP *group, BIGNUM *order, BN_CTX *ctx)
+{
+    const unsigned char *o;
+
+    o = group->nid == NID_X25519 ? x25519_order : p256_order;
+    return BN_bin2bn(o, 32, order) != NULL;
+}
+
+void
+EC_GROUP_set_asn1_flag(EC_GROUP *group, int flag)
+{
+    /* only named curves are supported */
+}
+
+/*
+ * EC_KEY
+ */
+
 EC_KEY *
-EC_KEY_new_by_curve_name(EC_GROUP_ID nid)
+EC_KEY_new(void)
 {
+    return calloc(1, sizeof(EC_KEY));
+}
+
+EC_KEY *
+EC_KEY_new_by_curve_name(int nid)
+{
+    EC_GROUP *group;
     EC_KEY *key;
 
-    key = calloc(1, sizeof(*key));
+    if ((group = EC_GROUP_new_by_curve_name(nid)) == NULL)
+	return NULL;
+    if ((key = EC_KEY_new()) == NULL)
+	return NULL;
+    key->group = group;
     return key;
 }
 
 void
-EC_POINT_free(EC_POINT *p)
+EC_KEY_free(EC_KEY *key)
+{
+    if (key == NULL)
+	return;
+    if (key->privbn)
+	BN_clear_free(key->privbn);
+    memset_s(key, sizeof(*key), 0, sizeof(*key));
+    free(key);
+}
+
+const EC_GROUP *
+EC_KEY_get0_group(const EC_KEY *key)
+{
+    return key->group;
+}
+
+static void
+ec_key_clear(EC_KEY *key)
 {
-    mp_clear_multi(&p->x, p->y, p->z, NULL);
-    free(p);
+    if (key->privbn)
+	BN_clear_free(key->privbn);
+    key->privbn = NULL;
+    memset_s(key->priv, sizeof(key->priv), 0, sizeof(key->priv));
+    key->have_priv = 0;
+    key->have_pub = 0;
 }
 
+int
+EC_KEY_set_group(EC_KEY *key, const EC_GROUP *group)
+{
+    if (group == NULL ||
+	EC_GROUP_new_by_curve_name(group->nid) == NULL)
+	return 0;
+    if (key->group != NULL && key->group->nid != group->nid)
+	ec_key_clear(key);
+    key->group = EC_GROUP_new_by_curve_name(group->nid);
+    return 1;
+}
+
+/* Set the private key and derive the public key from it */
 static int
-ec_point_mul(EC_POINT *res, const EC_GROUP *group, const mp_int *point)
+ec_key_set_priv(EC_KEY *key, const unsigned char priv[32])
+{
+    struct p256_point pt;
+    int ret;
+
+    if (key->group == NULL)
+	return 0;
+    if (key->group->nid == NID_X9_62_prime256v1) {
+	if (!p256_scalar_valid(priv))
+	    return 0;
+	p256_mul_base(&pt, priv);
+	ret = p256_to_affine(key->pub.x, key->pub.y, &pt);
+	memset_s(&pt, sizeof(pt), 0, sizeof(pt));
+	if (!ret)
+	    return 0;
+    } else {
+	x25519(key->pub.x, priv, x25519_base);
+	memset(key->pub.y, 0, sizeof(key->pub.y));
+    }
+    ec_key_clear(key);
+    key->pub.group = key->group;
+    memcpy(key->priv, priv, sizeof(key->priv));
+    key->have_priv = 1;
+    key->have_pub = 1;
+    return 1;
+}
+
+int
+EC_KEY_generate_key(EC_KEY *key)
 {
+    unsigned char priv[32];
+    int ret;
+
+    if (key->group == NULL)
+	return 0;
+    do {
+	if (RAND_bytes(priv, sizeof(priv)) != 1)
+	    return 0;
+	ret = ec_key_set_priv(key, priv);
+    } while (!ret && key->group->nid == NID_X9_62_prime256v1);
+    memset_s(priv, sizeof(priv), 0, sizeof(priv));
+    return ret;
 }
 
-EC_POINT *
-EC_POINT_new(void)
+const EC_POINT *
+EC_KEY_get0_public_key(const EC_KEY *key)
 {
-    EC_POINT *p;
+    return key->have_pub ? &key->pub : NULL;
+}
 
-    p = calloc(1, sizeof(*p));
+const BIGNUM *
+EC_KEY_get0_private_key(const EC_KEY *key)
+{
+    EC_KEY *k = rk_UNCONST(key);
 
-    if (mp_init_multi(&p->x, &p->y, &p->z, NULL) != 0) {
-	EC_POINT_free(p);
+    if (!key->have_priv)
 	return NULL;
+    if (k->privbn == NULL)
+	k->privbn = BN_bin2bn(key->priv, sizeof(key->priv), NULL);
+    return k->privbn;
+}
+
+int
+EC_KEY_set_private_key(EC_KEY *key, const BIGNUM *bn)
+{
+    unsigned char priv[32];
+    int len, ret;
+
+    len = BN_num_bytes(bn);
+    if (len > (int)sizeof(priv))
+	return 0;
+    memset(priv, 0, sizeof(priv));
+    BN_bn2bin(bn, priv + sizeof(priv) - len);
+    ret = ec_key_set_priv(key, priv);
+    memset_s(priv, sizeof(priv), 0, sizeof(priv));
+    return ret;
+}
+
+int
+EC_KEY_check_key(const EC_KEY *key)
+{
+    struct p256_point pt;
+    EC_KEY *tmp;
+    int ret;
+
+    if (key->group == NULL || !key->have_pub)
+	return 0;
+    if (key->group->nid == NID_X9_62_prime256v1 &&
+	!p256_from_affine(&pt, key->pub.x, key->pub.y))
+	return 0;
+    if (!key->have_priv)
+	return 1;
+
+    if ((tmp = EC_KEY_new_by_curve_name(key->group->nid)) == NULL)
+	return 0;
+    ret = ec_key_set_priv(tmp, key->priv) &&
+	ct_memcmp(&tmp->pub, &key->pub, sizeof(key->pub)) == 0;
+    EC_KEY_free(tmp);
+    return ret;
+}
+
+/*
+ * Public keys in octet string form: the uncompressed or compressed point
+ * of SEC 1 for P-256, the raw u coordinate for X25519.
+ */
+
+static int
+ec_point_decode(const EC_GROUP *group, EC_POINT *pt,
+		const unsigned char *p, size_t len)
+{
+    struct p256_point tmp;
+
+    pt->group = group;
+    if (group->nid == NID_X25519) {
+	if (len != 32)
+	    return 0;
+	memcpy(pt->x, p, 32);
+	memset(pt->y, 0, sizeof(pt->y));
+	return 1;
+    }
+
+    if (len == 65 && p[0] == 0x04) {
+	memcpy(pt->x, p + 1, 32);
+	memcpy(pt->y, p + 33, 32);
+    } else if (len == 33 && (p[0] == 0x02 || p[0] == 0x03)) {
+	memcpy(pt->x, p + 1, 32);
+	if (!p256_decompress(pt->y, pt->x, p[0] & 1))
+	    return 0;
+    } else {
+	return 0;
     }
+    return p256_from_affine(&tmp, pt->x, pt->y);
+}
 
-    return p;
+EC_KEY *
+o2i_ECPublicKey(EC_KEY **key, const unsigned char **in, long len)
+{
+    EC_POINT pt;
+
+    if (key == NULL || *key == NULL || (*key)->group == NULL || len < 0)
+	return NULL;
+    if (!ec_point_decode((*key)->group, &pt, *in, len))
+	return NULL;
+    (*key)->pub = pt;
+    (*key)->have_pub = 1;
+    *in += len;
+    return *key;
 }
 
 int
-EC_KEY_generate_key(EC_KEY *key)
+i2o_ECPublicKey(const EC_KEY *key, unsigned char **out)
 {
-    int ret = 0;
+    unsigned char *p;
+    int len;
 
-    if (key->group == NULL)
+    if (key->group == NULL || !key->have_pub)
 	return 0;
+    len = key->group->nid == NID_X25519 ? 32 : 65;
+    if (out == NULL)
+	return len;
 
-    do {
-	random(key->privkey, key->group->size);
-    } while(mp_cmp(key->privkey, key->group->order) >= 0);
+    if (*out == NULL) {
+	if ((p = malloc(len)) == NULL)
+	    return 0;
+	*out = p;
+    } else {
+	p = *out;
+	*out += len;
+    }
+    if (key->group->nid == NID_X25519) {
+	memcpy(p, key->pub.x, 32);
+    } else {
+	p[0] = 0x04;
+	memcpy(p + 1, key->pub.x, 32);
+	memcpy(p + 33, key->pub.y, 32);
+    }
+    return len;
+}
+
+/* RFC 5915 ECPrivateKey, P-256 only */
+EC_KEY *
+d2i_ECPrivateKey(EC_KEY **key, const unsigned char **in, long len)
+{
+    unsigned char priv[32];
+    ECPrivateKey data;
+    EC_KEY *k = NULL;
+    size_t size;
+    int ret;
+
+    if (len < 0)
+	return NULL;
+    ret = decode_ECPrivateKey(*in, len, &data, &size);
+    if (ret)
+	return NULL;
 
-    if (key->pubkey == NULL)
-	key->pubkey = EC_POINT_new();
+    if (data.version != 1 ||
+	data.privateKey.length == 0 ||
+	data.privateKey.length > sizeof(priv))
+	goto out;
+    if (data.parameters &&
+	(data.parameters->element != choice_ECParameters_namedCurve ||
+	 der_heim_oid_cmp(&data.parameters->u.namedCurve,
+			  &asn1_oid_id_ec_group_secp256r1) != 0))
+	goto out;
 
-    if (ec_point_mul(&key->pubkey, key->group, key->privkey) != 1)
-	goto error;
+    if (key && *key)
+	k = *key;
+    else if ((k = EC_KEY_new()) == NULL)
+	goto out;
+    if (k->group == NULL && data.parameters == NULL)
+	goto out;
+    if (k->group != NULL && k->group->nid != NID_X9_62_prime256v1)
+	goto out;
+    if (!EC_KEY_set_group(k, &p256_group))
+	goto out;
 
-    ret = 1;
- error:
-    ECPOINT_free(&base);
+    memset(priv, 0, sizeof(priv));
+    memcpy(priv + sizeof(priv) - data.privateKey.length,
+	   data.privateKey.data, data.privateKey.length);
+    ret = ec_key_set_priv(k, priv);
+    memset_s(priv, sizeof(priv), 0, sizeof(priv));
+    if (!ret)
+	goto out;
 
+    free_ECPrivateKey(&data);
+    *in += size;
+    if (key)
+	*key = k;
+    return k;
+
+ out:
+    free_ECPrivateKey(&data);
+    if (k && (key == NULL || k != *key))
+	EC_KEY_free(k);
+    return NULL;
+}
+
+/*
+ * ECDH
+ */
+
+int
+ECDH_compute_key(void *out, size_t outlen, const EC_POINT *pub,
+		 const EC_KEY *key,
+		 void *(*KDF)(const void *, size_t, void *, size_t *))
+{
+    struct p256_point pt;
+    unsigned char secret[32];
+    uint32_t zero = 0;
+    size_t i;
+    int ret;
+
+    if (key->group == NULL || !key->have_priv ||
+	pub->group == NULL || pub->group->nid != key->group->nid)
+	return -1;
+
+    if (key->group->nid == NID_X25519) {
+	x25519(secret, key->priv, pub->x);
+	/* reject low-order points (RFC 7748 section 6.1) */
+	for (i = 0; i < sizeof(secret); i++)
+	    zero |= secret[i];
+	ret = zero ? 1 : 0;
+    } else {
+	if (!p256_from_affine(&pt, pub->x, pub->y))
+	    return -1;
+	p256_mul(&pt, key->priv, &pt);
+	ret = p256_to_affine(secret, NULL, &pt);
+	memset_s(&pt, sizeof(pt), 0, sizeof(pt));
+    }
+    if (!ret) {
+	ret = -1;
+    } else if (KDF) {
+	if (KDF(secret, sizeof(secret), out, &outlen) == NULL)
+	    ret = -1;
+	else
+	    ret = (int)outlen;
+    } else {
+	if (outlen > sizeof(secret))
+	    outlen = sizeof(secret);
+	memcpy(out, secret, outlen);
+	ret = (int)outlen;
+    }
+    memset_s(secret, sizeof(secret), 0, sizeof(secret));
     return ret;
 }
 
-void
-EC_KEY_set_group(EC_KEY *, EC_GROUP *)
+/*
+ * ECDSA, P-256 only
+ */
+
+/* The leftmost 256 bits of the digest, reduced mod n */
+static void
+ecdsa_digest(uint32_t e[8], const unsigned char *dgst, int dlen)
 {
+    unsigned char buf[32];
 
+    memset(buf, 0, sizeof(buf));
+    if (dlen >= 32)
+	memcpy(buf, dgst, 32);
+    else if (dlen > 0)
+	memcpy(buf + 32 - dlen, dgst, dlen);
+    limbs_from_bytes(e, buf);
+    mod_reduce_once(e, e, 0, p256_n.m);
 }
 
-void
-EC_GROUP_free(EC_GROUP *)
+static int
+ecdsa_integer(uint32_t r[8], const heim_integer *i)
 {
+    unsigned char buf[32];
+    const unsigned char *p = i->data;
+    size_t len = i->length;
+
+    if (i->negative)
+	return 0;
+    while (len > 0 && *p == 0) {
+	p++;
+	len--;
+    }
+    if (len > sizeof(buf))
+	return 0;
+    memset(buf, 0, sizeof(buf));
+    if (len)
+	memcpy(buf + sizeof(buf) - len, p, len);
+    limbs_from_bytes(r, buf);
+    return !limbs_is_zero(r) && limbs_lt(r, p256_n.m);
+}
+
+static void
+ecdsa_set_integer(heim_integer *i, unsigned char buf[32],
+		  const uint32_t a[8])
+{
+    size_t skip = 0;
+
+    limbs_to_bytes(buf, a);
+    while (skip < 31 && buf[skip] == 0)
+	skip++;
+    i->data = buf + skip;
+    i->length = 32 - skip;
+    i->negative = 0;
+}
+
+/*
+ * Deterministic nonces, RFC 6979 section 3.2.  HMAC-SHA256 is used
+ * whatever digest is signed, as the digest algorithm isn't passed to
+ * ECDSA_sign(), which gives the RFC's nonces for SHA-256 digests.
+ */
+
+struct rfc6979 {
+    unsigned char K[32];
+    unsigned char V[32];
+};
+
+/* out = HMAC_K(V [|| sep [|| x || h1]]), sep < 0 for none */
+static void
+rfc6979_hmac(const unsigned char K[32], unsigned char out[32],
+	     const unsigned char V[32], int sep,
+	     const unsigned char *x, const unsigned char *h1)
+{
+    HMAC_CTX ctx;
+    unsigned char b;
+    unsigned int len;
+
+    HMAC_CTX_init(&ctx);
+    HMAC_Init_ex(&ctx, K, 32, EVP_sha256(), NULL);
+    HMAC_Update(&ctx, V, 32);
+    if (sep >= 0) {
+	b = sep;
+	HMAC_Update(&ctx, &b, 1);
+    }
+    if (x != NULL) {
+	HMAC_Update(&ctx, x, 32);
+	HMAC_Update(&ctx, h1, 32);
+    }
+    HMAC_Final(&ctx, out, &len);
+    HMAC_CTX_cleanup(&ctx);
+}
+
+static void
+rfc6979_init(struct rfc6979 *st, const unsigned char x[32],
+	     const unsigned char h1[32])
+{
+    memset(st->V, 0x01, sizeof(st->V));
+    memset(st->K, 0x00, sizeof(st->K));
+    rfc6979_hmac(st->K, st->K, st->V, 0x00, x, h1);
+    rfc6979_hmac(st->K, st->V, st->V, -1, NULL, NULL);
+    rfc6979_hmac(st->K, st->K, st->V, 0x01, x, h1);
+    rfc6979_hmac(st->K, st->V, st->V, -1, NULL, NULL);
+}
+
+/* The next candidate nonce, retry if the previous one was unsuitable */
+static void
+rfc6979_next(struct rfc6979 *st, unsigned char k[32], int retry)
+{
+    if (retry) {
+	rfc6979_hmac(st->K, st->K, st->V, 0x00, NULL, NULL);
+	rfc6979_hmac(st->K, st->V, st->V, -1, NULL, NULL);
+    }
+    rfc6979_hmac(st->K, st->V, st->V, -1, NULL, NULL);
+    memcpy(k, st->V, 32);
 }
 
 int
-EC_KEY_check_key(const EC_KEY *)
+ECDSA_size(const EC_KEY *key)
 {
+    if (key->group == NULL || key->group->nid != NID_X9_62_prime256v1)
+	return 0;
+    /* SEQUENCE of two INTEGERs of up to 33 octets */
+    return 72;
 }
 
-const BIGNUM *
-EC_KEY_get0_private_key(const EC_KEY *key)
+int
+ECDSA_sign(int type, const unsigned char *dgst, int dlen,
+	   unsigned char *sig, unsigned int *siglen, const EC_KEY *key)
 {
+    struct p256_point pt;
+    struct rfc6979 nonces;
+    unsigned char k[32], h1[32], rbuf[32], sbuf[32];
+    uint32_t e[8], r[8], s[8], t[8], kinv[8], d[8];
+    ECDSA_Sig_Value sv;
+    unsigned char *der;
+    size_t der_len, size;
+    int ret, retry = 0;
+
+    *siglen = 0;
+    if (key->group == NULL || key->group->nid != NID_X9_62_prime256v1 ||
+	!key->have_priv)
+	return 0;
+
+    ecdsa_digest(e, dgst, dlen);
+    limbs_to_bytes(h1, e);
+    rfc6979_init(&nonces, key->priv, h1);
+    mont_to(e, e, &p256_n);
+    limbs_from_bytes(d, key->priv);
+    mont_to(d, d, &p256_n);
+
+    /* A zero s makes the retries below start over */
+    memset(s, 0, sizeof(s));
+    do {
+	do {
+	    rfc6979_next(&nonces, k, retry);
+	    retry = 1;
+	} while (!p256_scalar_valid(k));
+
+	/* r = x(kG) mod n */
+	p256_mul_base(&pt, k);
+	if (!p256_to_affine(rbuf, NULL, &pt))
+	    continue;
+	limbs_from_bytes(r, rbuf);
+	mod_reduce_once(r, r, 0, p256_n.m);
+	if (limbs_is_zero(r))
+	    continue;
+
+	/* s = k^-1 (e + r d) mod n */
+	limbs_from_bytes(kinv, k);
+	mont_to(kinv, kinv, &p256_n);
+	mont_inv(kinv, kinv, &p256_n);
+	mont_to(t, r, &p256_n);
+	mont_mul(t, t, d, &p256_n);
+	mod_add(t, t, e, &p256_n);
+	mont_mul(s, kinv, t, &p256_n);
+	mont_from(s, s, &p256_n);
+    } while (limbs_is_zero(s));
+
+    memset_s(&nonces, sizeof(nonces), 0, sizeof(nonces));
+    memset_s(k, sizeof(k), 0, sizeof(k));
+    memset_s(kinv, sizeof(kinv), 0, sizeof(kinv));
+    memset_s(d, sizeof(d), 0, sizeof(d));
+    memset_s(&pt, sizeof(pt), 0, sizeof(pt));
+
+    ecdsa_set_integer(&sv.r, rbuf, r);
+    ecdsa_set_integer(&sv.s, sbuf, s);
+    ASN1_MALLOC_ENCODE(ECDSA_Sig_Value, der, der_len, &sv, &size, ret);
+    if (ret)
+	return 0;
+    if (der_len > (size_t)ECDSA_size(key)) {
+	free(der);
+	return 0;
+    }
+    memcpy(sig, der, der_len);
+    *siglen = (unsigned int)der_len;
+    free(der);
+    return 1;
 }
 
 int
-EC_KEY_set_private_key(EC_KEY *key, const BIGNUM *bn)
+ECDSA_verify(int type, const unsigned char *dgst, int dlen,
+	     const unsigned char *sig, int siglen, const EC_KEY *key)
 {
+    struct p256_point q, u1q, u2q;
+    unsigned char u1[32], u2[32], x[32];
+    uint32_t e[8], r[8], s[8], w[8], t[8];
+    ECDSA_Sig_Value sv;
+    size_t size;
+    int ret;
+
+    if (key->group == NULL || key->group->nid != NID_X9_62_prime256v1 ||
+	!key->have_pub || siglen < 0)
+	return -1;
+    if (!p256_from_affine(&q, key->pub.x, key->pub.y))
+	return -1;
+
+    ret = decode_ECDSA_Sig_Value(sig, siglen, &sv, &size);
+    if (ret)
+	return -1;
+    if (size != (size_t)siglen) {
+	free_ECDSA_Sig_Value(&sv);
+	return -1;
+    }
+    ret = ecdsa_integer(r, &sv.r) && ecdsa_integer(s, &sv.s);
+    free_ECDSA_Sig_Value(&sv);
+    if (!ret)
+	return 0;
+
+    /* u1 = e / s, u2 = r / s */
+    ecdsa_digest(e, dgst, dlen);
+    mont_to(w, s, &p256_n);
+    mont_inv(w, w, &p256_n);
+    mont_to(t, e, &p256_n);
+    mont_mul(t, t, w, &p256_n);
+    mont_from(t, t, &p256_n);
+    limbs_to_bytes(u1, t);
+    mont_to(t, r, &p256_n);
+    mont_mul(t, t, w, &p256_n);
+    mont_from(t, t, &p256_n);
+    limbs_to_bytes(u2, t);
+
+    /* the signature is valid if x(u1 G + u2 Q) = r mod n */
+    p256_mul_base(&u1q, u1);
+    p256_mul(&u2q, u2, &q);
+    p256_add(&u1q, &u1q, &u2q);
+    if (!p256_to_affine(x, NULL, &u1q))
+	return 0;
+    limbs_from_bytes(t, x);
+    mod_reduce_once(t, t, 0, p256_n.m);
+    return memcmp(t, r, sizeof(t)) == 0 ? 1 : 0;
 }
@@ -31,67 +31,107 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Elliptic curve keys.  The native implementation supports the NIST
+ * P-256 curve and X25519, with constant-time scalar multiplication.
+ */
+
 #ifndef HEIM_EC_H
 #define HEIM_EC_H 1
 
 #define EC_KEY hc_EC_KEY
 #define EC_GROUP hc_EC_GROUP
-#define EC_GROUP_ID hc_EC_GROUP_ID
-#define EC_GROUP_ID_s hc_EC_GROUP_ID_s
+#define EC_POINT hc_EC_POINT
+#define EC_GROUP_get_curve_name hc_EC_GROUP_get_curve_name
 #define EC_GROUP_get_degree hc_EC_GROUP_get_degree
-#define EC_KEY_get0_group hc_EC_KEY_get0_group
 #define EC_GROUP_get_order hc_EC_GROUP_get_order
-#define o2i_ECPublicKey hc_o2i_ECPublicKey
-#define EC_KEY_free hc_EC_KEY_free
+#define EC_GROUP_set_asn1_flag hc_EC_GROUP_set_asn1_flag
 #define EC_GROUP_new_by_curve_name hc_EC_GROUP_new_by_curve_name
-#define EC_KEY_set_group hc_EC_KEY_set_group
 #define EC_GROUP_free hc_EC_GROUP_free
+#define EC_KEY_new hc_EC_KEY_new
+#define EC_KEY_new_by_curve_name hc_EC_KEY_new_by_curve_name
+#define EC_KEY_free hc_EC_KEY_free
+#define EC_KEY_get0_group hc_EC_KEY_get0_group
+#define EC_KEY_set_group hc_EC_KEY_set_group
+#define EC_KEY_generate_key hc_EC_KEY_generate_key
 #define EC_KEY_check_key hc_EC_KEY_check_key
+#define EC_KEY_get0_public_key hc_EC_KEY_get0_public_key
 #define EC_KEY_get0_private_key hc_EC_KEY_get0_private_key
 #define EC_KEY_set_private_key hc_EC_KEY_set_private_key
+#define o2i_ECPublicKey hc_o2i_ECPublicKey
+#define i2o_ECPublicKey hc_i2o_ECPublicKey
+#define d2i_ECPrivateKey hc_d2i_ECPrivateKey
 
 #include <hcrypto/bn.h>
 #include <hcrypto/engine.h>
 
+#ifndef NID_undef
+#define NID_undef			0
+#endif
+#define NID_X9_62_prime256v1		415
+#define NID_X25519			1034
+
+#define OPENSSL_EC_NAMED_CURVE		0x001
+
 typedef struct EC_KEY EC_KEY;
 typedef struct EC_GROUP EC_GROUP;
-typedef struct EC_GROUP_ID_s *EC_GROUP_ID;
+typedef struct EC_POINT EC_POINT;
 
-unsigned long
-EC_GROUP_get_degree(EC_GROUP *);
+int
+EC_GROUP_get_curve_name(const EC_GROUP *);
 
-EC_GROUP *
-EC_KEY_get0_group(EC_KEY *);
+int
+EC_GROUP_get_degree(const EC_GROUP *);
 
 int
-EC_GROUP_get_order(EC_GROUP *, BIGNUM *, BN_CTX *);
+EC_GROUP_get_order(const EC_GROUP *, BIGNUM *, BN_CTX *);
 
-EC_KEY *
-o2i_ECPublicKey(EC_KEY **key, unsigned char **, size_t);
+void
+EC_GROUP_set_asn1_flag(EC_GROUP *, int);
+
+EC_GROUP *
+EC_GROUP_new_by_curve_name(int);
+
+void
+EC_GROUP_free(EC_GROUP *);
 
 EC_KEY *
-EC_KEY_new_by_curve_name(EC_GROUP_ID);
+EC_KEY_new(void);
 
-int
-EC_KEY_generate_key(EC_KEY *);
+EC_KEY *
+EC_KEY_new_by_curve_name(int);
 
 void
 EC_KEY_free(EC_KEY *);
 
-EC_GROUP *
-EC_GROUP_new_by_curve_name(int nid);
+const EC_GROUP *
+EC_KEY_get0_group(const EC_KEY *);
 
-void
-EC_KEY_set_group(EC_KEY *, EC_GROUP *);
+int
+EC_KEY_set_group(EC_KEY *, const EC_GROUP *);
 
-void
-EC_GROUP_free(EC_GROUP *);
+int
+EC_KEY_generate_key(EC_KEY *);
 
 int
 EC_KEY_check_key(const EC_KEY *);
 
-const BIGNUM *EC_KEY_get0_private_key(const EC_KEY *);
+const EC_POINT *
+EC_KEY_get0_public_key(const EC_KEY *);
+
+const BIGNUM *
+EC_KEY_get0_private_key(const EC_KEY *);
+
+int
+EC_KEY_set_private_key(EC_KEY *, const BIGNUM *);
+
+EC_KEY *
+o2i_ECPublicKey(EC_KEY **, const unsigned char **, long);
 
-int EC_KEY_set_private_key(EC_KEY *, const BIGNUM *);
+int
+i2o_ECPublicKey(const EC_KEY *, unsigned char **);
+
+EC_KEY *
+d2i_ECPrivateKey(EC_KEY **, const unsigned char **, long);
 
 #endif /* HEIM_EC_H */
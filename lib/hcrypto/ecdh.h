@@ -39,9 +39,7 @@
 #include <hcrypto/ec.h>
 
 int
-ECDH_compute_key(void *, size_t,
-		 const EC_KEY *, const EC_KEY *,
+ECDH_compute_key(void *, size_t, const EC_POINT *, const EC_KEY *,
 		 void *(*KDF)(const void *, size_t, void *, size_t *));
 
-
 #endif /* HEIM_ECDH_H */
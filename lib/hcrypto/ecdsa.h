@@ -40,13 +40,12 @@
 
 #include <hcrypto/ec.h>
 
-int ECDSA_verify(int, const unsigned char *, unsigned int,
-		 unsigned char *, unsigned int, EC_KEY *);
+int ECDSA_verify(int, const unsigned char *, int,
+		 const unsigned char *, int, const EC_KEY *);
 
-int ECDSA_sign(int, const unsigned char *, unsigned int,
-	       unsigned char *, unsigned int *, EC_KEY *);
-
-int ECDSA_size(EC_KEY *);
+int ECDSA_sign(int, const unsigned char *, int,
+	       unsigned char *, unsigned int *, const EC_KEY *);
 
+int ECDSA_size(const EC_KEY *);
 
 #endif /* HEIM_ECDSA_H */
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Modular exponentiation for the RSA and DH private key operations.
+ *
+ * A Montgomery context is made once per modulus (an RSA prime or a DH
+ * group) and kept by the caller, so each exponentiation only converts its
+ * operands.  The exponentiation uses word-sized limbs, 64 bits where the
+ * compiler has a 128-bit type, and a fixed 5-bit window whose table
+ * entries are read in full each time, so neither the sequence of
+ * multiplications nor the memory access pattern depends on the exponent
+ * bits.  Only the bit length of the exponent shows.
+ */
+
+#include <config.h>
+#include <roken.h>
+#include <krb5-types.h>
+
+#include "tommath.h"
+#include "mont-ltm.h"
+
+#ifdef __SIZEOF_INT128__
+typedef uint64_t mont_limb;
+typedef unsigned __int128 mont_dlimb;
+#define MONT_LIMB_BITS	64
+#else
+typedef uint32_t mont_limb;
+typedef uint64_t mont_dlimb;
+#define MONT_LIMB_BITS	32
+#endif
+
+#define MONT_MAX_BITS	8192
+#define MONT_WINDOW	5
+#define MONT_TABLE	(1 << MONT_WINDOW)
+
+struct hc_mont {
+    size_t n;			/* limbs in the modulus */
+    mont_limb m0inv;		/* -1/m mod 2^MONT_LIMB_BITS */
+    mont_limb *m;		/* the modulus */
+    mont_limb *rr;		/* R^2 mod m */
+    mont_limb *one;		/* R mod m */
+    mp_int mod;
+};
+
+static int
+mp2limbs(mp_int *a, mont_limb *r, size_t n)
+{
+    size_t i, j, len = n * sizeof(r[0]);
+    unsigned char *p;
+    unsigned long size;
+
+    size = mp_unsigned_bin_size(a);
+    if (size > len)
+	return MP_VAL;
+    p = calloc(1, len);
+    if (p == NULL)
+	return MP_MEM;
+    mp_to_unsigned_bin(a, p + len - size);
+    for (i = 0; i < n; i++) {
+	r[i] = 0;
+	for (j = 0; j < sizeof(r[0]); j++)
+	    r[i] |= (mont_limb)p[len - 1 - i * sizeof(r[0]) - j] << (8 * j);
+    }
+    memset_s(p, len, 0, len);
+    free(p);
+    return MP_OKAY;
+}
+
+static int
+limbs2mp(const mont_limb *a, size_t n, mp_int *r)
+{
+    size_t i, j, len = n * sizeof(a[0]);
+    unsigned char *p;
+    int ret;
+
+    p = malloc(len);
+    if (p == NULL)
+	return MP_MEM;
+    for (i = 0; i < n; i++)
+	for (j = 0; j < sizeof(a[0]); j++)
+	    p[len - 1 - i * sizeof(a[0]) - j] = (a[i] >> (8 * j)) & 0xff;
+    ret = mp_read_unsigned_bin(r, p, len);
+    memset_s(p, len, 0, len);
+    free(p);
+    return ret;
+}
+
+/*
+ * r = a * b / R mod m, with `t' scratch space of n + 2 limbs.  `r' may
+ * be `a' or `b'.
+ */
+
+static void
+mont_mul(const struct hc_mont *mm, mont_limb *r,
+	 const mont_limb *a, const mont_limb *b, mont_limb *t)
+{
+    const mont_limb *m = mm->m;
+    size_t i, j, n = mm->n;
+    mont_limb u, borrow, keep, mask;
+    mont_dlimb c;
+
+    memset(t, 0, (n + 2) * sizeof(t[0]));
+    for (i = 0; i < n; i++) {
+	c = 0;
+	for (j = 0; j < n; j++) {
+	    c += (mont_dlimb)a[j] * b[i] + t[j];
+	    t[j] = (mont_limb)c;
+	    c >>= MONT_LIMB_BITS;
+	}
+	c += t[n];
+	t[n] = (mont_limb)c;
+	t[n + 1] = (mont_limb)(c >> MONT_LIMB_BITS);
+
+	u = t[0] * mm->m0inv;
+	c = ((mont_dlimb)u * m[0] + t[0]) >> MONT_LIMB_BITS;
+	for (j = 1; j < n; j++) {
+	    c += (mont_dlimb)u * m[j] + t[j];
+	    t[j - 1] = (mont_limb)c;
+	    c >>= MONT_LIMB_BITS;
+	}
+	c += t[n];
+	t[n - 1] = (mont_limb)c;
+	t[n] = t[n + 1] + (mont_limb)(c >> MONT_LIMB_BITS);
+    }
+
+    /* t < 2m, subtract m unless that goes negative */
+    borrow = 0;
+    for (j = 0; j < n; j++) {
+	c = (mont_dlimb)t[j] - m[j] - borrow;
+	r[j] = (mont_limb)c;
+	borrow = (mont_limb)(c >> MONT_LIMB_BITS) & 1;
+    }
+    keep = borrow & (t[n] ^ 1);
+    mask = (mont_limb)0 - keep;
+    for (j = 0; j < n; j++)
+	r[j] = (t[j] & mask) | (r[j] & ~mask);
+}
+
+/* r = table[idx], reading every entry */
+static void
+mont_select(const struct hc_mont *mm, mont_limb *r,
+	    const mont_limb *table, unsigned int idx)
+{
+    size_t i, j, n = mm->n;
+    mont_limb d, mask;
+
+    memset(r, 0, n * sizeof(r[0]));
+    for (i = 0; i < MONT_TABLE; i++) {
+	d = (mont_limb)(i ^ idx);
+	mask = (mont_limb)0 - ((d - 1) >> (MONT_LIMB_BITS - 1));
+	for (j = 0; j < n; j++)
+	    r[j] |= table[i * n + j] & mask;
+    }
+}
+
+static unsigned int
+exp_window(const unsigned char *e, size_t len, size_t pos)
+{
+    unsigned int w = 0;
+    size_t i, bit;
+
+    for (i = 0; i < MONT_WINDOW; i++) {
+	bit = pos + i;
+	if (bit / 8 < len)
+	    w |= ((e[len - 1 - bit / 8] >> (bit % 8)) & 1) << i;
+    }
+    return w;
+}
+
+/**
+ * Make a Montgomery context for the odd modulus `m'.
+ *
+ * @return the context, or NULL if `m' does not qualify or on malloc
+ * failure.  Free with _hc_mont_free().
+ */
+
+struct hc_mont *
+_hc_mont_new(mp_int *m)
+{
+    struct hc_mont *mm;
+    mont_limb x;
+    mp_int t;
+    int bits, i;
+
+    bits = mp_count_bits(m);
+    if (mp_isneg(m) || mp_iseven(m) || bits < 2 || bits > MONT_MAX_BITS)
+	return NULL;
+
+    mm = calloc(1, sizeof(*mm));
+    if (mm == NULL)
+	return NULL;
+    mm->n = (bits + MONT_LIMB_BITS - 1) / MONT_LIMB_BITS;
+    mm->m = calloc(3 * mm->n, sizeof(mm->m[0]));
+    if (mm->m == NULL || mp_init_copy(&mm->mod, m) != MP_OKAY) {
+	free(mm->m);
+	free(mm);
+	return NULL;
+    }
+    mm->rr = mm->m + mm->n;
+    mm->one = mm->rr + mm->n;
+
+    if (mp_init(&t) != MP_OKAY)
+	goto fail;
+    if (mp2limbs(m, mm->m, mm->n) != MP_OKAY ||
+	mp_2expt(&t, 2 * mm->n * MONT_LIMB_BITS) != MP_OKAY ||
+	mp_mod(&t, m, &t) != MP_OKAY ||
+	mp2limbs(&t, mm->rr, mm->n) != MP_OKAY ||
+	mp_2expt(&t, mm->n * MONT_LIMB_BITS) != MP_OKAY ||
+	mp_mod(&t, m, &t) != MP_OKAY ||
+	mp2limbs(&t, mm->one, mm->n) != MP_OKAY) {
+	mp_clear(&t);
+	goto fail;
+    }
+    mp_clear(&t);
+
+    /* Newton's iteration, each step doubles the correct low bits */
+    x = mm->m[0];
+    for (i = 0; i < 6; i++)
+	x *= 2 - mm->m[0] * x;
+    mm->m0inv = (mont_limb)0 - x;
+
+    return mm;
+
+ fail:
+    _hc_mont_free(mm);
+    return NULL;
+}
+
+void
+_hc_mont_free(struct hc_mont *mm)
+{
+    if (mm == NULL)
+	return;
+    memset_s(mm->m, 3 * mm->n * sizeof(mm->m[0]), 0,
+	     3 * mm->n * sizeof(mm->m[0]));
+    free(mm->m);
+    mp_clear(&mm->mod);
+    free(mm);
+}
+
+/**
+ * out = base ^ exp mod m, for non-negative `exp'.
+ *
+ * @return MP_OKAY or a libtommath error code.
+ */
+
+int
+_hc_mont_exptmod(const struct hc_mont *mm, mp_int *base, mp_int *exp,
+		 mp_int *out)
+{
+    mont_limb *table = NULL, *acc, *x, *t;
+    unsigned char *e = NULL;
+    size_t n = mm->n, tlen = (MONT_TABLE + 3) * n + 2, elen, pos, i;
+    mp_int a;
+    int ret, first = 1;
+
+    if (mp_isneg(exp))
+	return MP_VAL;
+
+    if ((ret = mp_init(&a)) != MP_OKAY)
+	return ret;
+    if ((ret = mp_mod(base, rk_UNCONST(&mm->mod), &a)) != MP_OKAY)
+	goto out;
+
+    elen = mp_unsigned_bin_size(exp);
+    e = malloc(elen + 1);
+    table = malloc(tlen * sizeof(table[0]));
+    if (e == NULL || table == NULL) {
+	ret = MP_MEM;
+	goto out;
+    }
+    mp_to_unsigned_bin(exp, e);
+    acc = table + MONT_TABLE * n;
+    x = acc + n;
+    t = x + n;
+
+    /* table[i] = a^i R mod m */
+    if ((ret = mp2limbs(&a, x, n)) != MP_OKAY)
+	goto out;
+    memcpy(table, mm->one, n * sizeof(table[0]));
+    mont_mul(mm, table + n, x, mm->rr, t);
+    for (i = 2; i < MONT_TABLE; i++)
+	mont_mul(mm, table + i * n, table + (i - 1) * n, table + n, t);
+
+    memcpy(acc, mm->one, n * sizeof(acc[0]));
+    pos = (elen * 8 + MONT_WINDOW - 1) / MONT_WINDOW * MONT_WINDOW;
+    while (pos > 0) {
+	pos -= MONT_WINDOW;
+	if (!first)
+	    for (i = 0; i < MONT_WINDOW; i++)
+		mont_mul(mm, acc, acc, acc, t);
+	first = 0;
+	mont_select(mm, x, table, exp_window(e, elen, pos));
+	mont_mul(mm, acc, acc, x, t);
+    }
+
+    /* out of the Montgomery domain */
+    memset(x, 0, n * sizeof(x[0]));
+    x[0] = 1;
+    mont_mul(mm, acc, acc, x, t);
+    ret = limbs2mp(acc, n, out);
+
+ out:
+    if (table)
+	memset_s(table, tlen * sizeof(table[0]), 0, tlen * sizeof(table[0]));
+    free(table);
+    if (e)
+	memset_s(e, elen, 0, elen);
+    free(e);
+    mp_clear(&a);
+    return ret;
+}
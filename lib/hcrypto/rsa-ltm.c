@@ -33,12 +33,14 @@
 
 #include <config.h>
 #include <roken.h>
+#include <heim_threads.h>
 #include <krb5-types.h>
 #include <assert.h>
 
 #include <rsa.h>
 
 #include "tommath.h"
+#include "mont-ltm.h"
 
 static int
 random_num(mp_int *num, size_t len)
@@ -71,60 +73,217 @@ BN2mpz(mp_int *s, const BIGNUM *bn)
     free(p);
 }
 
+/*
+ * Private key state, made on first use and kept until the key is freed:
+ * the key in libtommath form, Montgomery contexts for the primes (or for
+ * n when there are no CRT parameters) and a blinding pair that is squared
+ * after each use and replaced every LTM_BLINDING_USES uses.  The KDC and
+ * kx509 CAs sign with one long-lived key, so this is all done once.
+ *
+ * The key state hangs off rsa->_method_mod_n and the blinding pair off
+ * rsa->blinding, both protected by ltm_rsa_mutex.
+ */
+
+#define LTM_BLINDING_USES	32
+
+struct ltm_rsa_key {
+    const BIGNUM *n_bn, *d_bn, *p_bn, *q_bn;	/* what it was made from */
+    mp_int n, e, d;
+    int crt;
+    mp_int p, q, dmp1, dmq1, iqmp;
+    struct hc_mont *mont_n, *mont_p, *mont_q;
+};
+
+struct ltm_rsa_blinding {
+    mp_int a;			/* b^e mod n */
+    mp_int ai;			/* 1/b mod n */
+    int uses;
+};
+
+static HEIMDAL_MUTEX ltm_rsa_mutex = HEIMDAL_MUTEX_INITIALIZER;
+
 static void
-setup_blind(mp_int *n, mp_int *b, mp_int *bi)
+ltm_rsa_key_free(struct ltm_rsa_key *k)
 {
-    random_num(b, mp_count_bits(n));
-    mp_mod(b, n, b);
-    mp_invmod(b, n, bi);
+    if (k == NULL)
+	return;
+    _hc_mont_free(k->mont_n);
+    _hc_mont_free(k->mont_p);
+    _hc_mont_free(k->mont_q);
+    mp_clear_multi(&k->n, &k->e, &k->d, &k->p, &k->q,
+		   &k->dmp1, &k->dmq1, &k->iqmp, NULL);
+    free(k);
 }
 
-static void
-blind(mp_int *in, mp_int *b, mp_int *e, mp_int *n)
+static struct ltm_rsa_key *
+ltm_rsa_key_new(RSA *rsa)
 {
-    mp_int t1;
-    mp_init(&t1);
-    /* in' = (in * b^e) mod n */
-    mp_exptmod(b, e, n, &t1);
-    mp_mul(&t1, in, in);
-    mp_mod(in, n, in);
-    mp_clear(&t1);
+    struct ltm_rsa_key *k;
+
+    if (rsa->n == NULL || rsa->e == NULL)
+	return NULL;
+
+    k = calloc(1, sizeof(*k));
+    if (k == NULL)
+	return NULL;
+    if (mp_init_multi(&k->n, &k->e, &k->d, &k->p, &k->q,
+		      &k->dmp1, &k->dmq1, &k->iqmp, NULL) != MP_OKAY) {
+	free(k);
+	return NULL;
+    }
+    k->n_bn = rsa->n;
+    k->d_bn = rsa->d;
+    k->p_bn = rsa->p;
+    k->q_bn = rsa->q;
+
+    BN2mpz(&k->n, rsa->n);
+    BN2mpz(&k->e, rsa->e);
+
+    if (rsa->p && rsa->q && rsa->dmp1 && rsa->dmq1 && rsa->iqmp) {
+	k->crt = 1;
+	BN2mpz(&k->p, rsa->p);
+	BN2mpz(&k->q, rsa->q);
+	BN2mpz(&k->dmp1, rsa->dmp1);
+	BN2mpz(&k->dmq1, rsa->dmq1);
+	BN2mpz(&k->iqmp, rsa->iqmp);
+	k->mont_p = _hc_mont_new(&k->p);
+	k->mont_q = _hc_mont_new(&k->q);
+    } else if (rsa->d) {
+	BN2mpz(&k->d, rsa->d);
+	k->mont_n = _hc_mont_new(&k->n);
+    } else {
+	ltm_rsa_key_free(k);
+	return NULL;
+    }
+
+    return k;
 }
 
 static void
-unblind(mp_int *out, mp_int *bi, mp_int *n)
+ltm_rsa_blinding_free(struct ltm_rsa_blinding *bl)
 {
-    /* out' = (out * 1/b) mod n */
-    mp_mul(out, bi, out);
-    mp_mod(out, n, out);
+    if (bl == NULL)
+	return;
+    mp_clear_multi(&bl->a, &bl->ai, NULL);
+    free(bl);
+}
+
+static struct ltm_rsa_key *
+ltm_rsa_key(RSA *rsa)
+{
+    struct ltm_rsa_key *k;
+
+    HEIMDAL_MUTEX_lock(&ltm_rsa_mutex);
+    k = rsa->_method_mod_n;
+    if (k && (k->n_bn != rsa->n || k->d_bn != rsa->d ||
+	      k->p_bn != rsa->p || k->q_bn != rsa->q)) {
+	/* the key was replaced */
+	ltm_rsa_key_free(k);
+	ltm_rsa_blinding_free(rsa->blinding);
+	rsa->_method_mod_n = k = NULL;
+	rsa->blinding = NULL;
+    }
+    if (k == NULL)
+	rsa->_method_mod_n = k = ltm_rsa_key_new(rsa);
+    HEIMDAL_MUTEX_unlock(&ltm_rsa_mutex);
+
+    return k;
+}
+
+/*
+ * Get a blinding pair (b^e, 1/b) for `k' in `a, ai'.
+ */
+
+static int
+ltm_rsa_blinding(RSA *rsa, struct ltm_rsa_key *k, mp_int *a, mp_int *ai)
+{
+    struct ltm_rsa_blinding *bl;
+    int ret = -1;
+
+    HEIMDAL_MUTEX_lock(&ltm_rsa_mutex);
+    bl = rsa->blinding;
+    if (bl && bl->uses >= LTM_BLINDING_USES) {
+	ltm_rsa_blinding_free(bl);
+	rsa->blinding = bl = NULL;
+    }
+    if (bl == NULL) {
+	bl = calloc(1, sizeof(*bl));
+	if (bl == NULL)
+	    goto out;
+	if (mp_init_multi(&bl->a, &bl->ai, NULL) != MP_OKAY) {
+	    free(bl);
+	    goto out;
+	}
+	if (random_num(&bl->a, mp_count_bits(&k->n)) ||
+	    mp_mod(&bl->a, &k->n, &bl->a) != MP_OKAY ||
+	    mp_invmod(&bl->a, &k->n, &bl->ai) != MP_OKAY ||
+	    mp_exptmod(&bl->a, &k->e, &k->n, &bl->a) != MP_OKAY) {
+	    ltm_rsa_blinding_free(bl);
+	    goto out;
+	}
+	rsa->blinding = bl;
+    }
+
+    if (mp_copy(&bl->a, a) != MP_OKAY || mp_copy(&bl->ai, ai) != MP_OKAY)
+	goto out;
+    ret = 0;
+
+    /* the next one gets (b^2)^e and 1/b^2 */
+    if (mp_sqrmod(&bl->a, &k->n, &bl->a) != MP_OKAY ||
+	mp_sqrmod(&bl->ai, &k->n, &bl->ai) != MP_OKAY)
+	bl->uses = LTM_BLINDING_USES;
+    else
+	bl->uses++;
+
+ out:
+    HEIMDAL_MUTEX_unlock(&ltm_rsa_mutex);
+    return ret;
 }
 
 static int
-ltm_rsa_private_calculate(mp_int * in, mp_int * p,  mp_int * q,
-			  mp_int * dmp1, mp_int * dmq1, mp_int * iqmp,
-			  mp_int * out)
+ltm_exptmod(const struct hc_mont *mont, mp_int *b, mp_int *e, mp_int *m,
+	    mp_int *out)
+{
+    if (mont)
+	return _hc_mont_exptmod(mont, b, e, out);
+    return mp_exptmod(b, e, m, out);
+}
+
+static int
+ltm_rsa_private_calculate(struct ltm_rsa_key *k, mp_int *in, mp_int *out)
 {
     mp_int vp, vq, u;
+    int ret;
+
+    if (!k->crt)
+	return ltm_exptmod(k->mont_n, in, &k->d, &k->n, out) == MP_OKAY ?
+	    0 : -1;
 
     mp_init_multi(&vp, &vq, &u, NULL);
 
     /* vq = c ^ (d mod (q - 1)) mod q */
     /* vp = c ^ (d mod (p - 1)) mod p */
-    mp_mod(in, p, &u);
-    mp_exptmod(&u, dmp1, p, &vp);
-    mp_mod(in, q, &u);
-    mp_exptmod(&u, dmq1, q, &vq);
+    mp_mod(in, &k->p, &u);
+    ret = ltm_exptmod(k->mont_p, &u, &k->dmp1, &k->p, &vp);
+    if (ret == MP_OKAY) {
+	mp_mod(in, &k->q, &u);
+	ret = ltm_exptmod(k->mont_q, &u, &k->dmq1, &k->q, &vq);
+    }
+    if (ret != MP_OKAY) {
+	mp_clear_multi(&vp, &vq, &u, NULL);
+	return -1;
+    }
 
     /* C2 = 1/q mod p  (iqmp) */
     /* u = (vp - vq)C2 mod p. */
     mp_sub(&vp, &vq, &u);
     if (mp_isneg(&u))
-	mp_add(&u, p, &u);
-    mp_mul(&u, iqmp, &u);
-    mp_mod(&u, p, &u);
+	mp_add(&u, &k->p, &u);
+    mp_mul(&u, &k->iqmp, &u);
+    mp_mod(&u, &k->p, &u);
 
     /* c ^ d mod n = vq + u q */
-    mp_mul(&u, q, &u);
+    mp_mul(&u, &k->q, &u);
     mp_add(&u, &vq, out);
 
     mp_clear_multi(&vp, &vq, &u, NULL);
@@ -286,24 +445,26 @@ ltm_rsa_private_encrypt(int flen, const unsigned char* from,
 			unsigned char* to, RSA* rsa, int padding)
 {
     unsigned char *ptr, *ptr0;
-    int res;
     int size;
-    mp_int in, out, n, e;
-    mp_int bi, b;
+    mp_int in, out, bi, b;
+    struct ltm_rsa_key *k;
     int blinding = (rsa->flags & RSA_FLAG_NO_BLINDING) == 0;
-    int do_unblind = 0;
 
     if (padding != RSA_PKCS1_PADDING)
 	return -1;
 
-    mp_init_multi(&e, &n, &in, &out, &b, &bi, NULL);
-
     size = RSA_size(rsa);
 
     if (size < RSA_PKCS1_PADDING_SIZE || size - RSA_PKCS1_PADDING_SIZE < flen)
 	return -2;
 
+    k = ltm_rsa_key(rsa);
+    if (k == NULL || mp_cmp_d(&k->e, 3) == MP_LT)
+	return -3;
+
     ptr0 = ptr = malloc(size);
+    if (ptr0 == NULL)
+	return -3;
     *ptr++ = 0;
     *ptr++ = 1;
     memset(ptr, 0xff, size - flen - 3);
@@ -313,61 +474,33 @@ ltm_rsa_private_encrypt(int flen, const unsigned char* from,
     ptr += flen;
     assert((ptr - ptr0) == size);
 
-    BN2mpz(&n, rsa->n);
-    BN2mpz(&e, rsa->e);
-
-    if (mp_cmp_d(&e, 3) == MP_LT) {
-	size = -3;
-	goto out;
-    }
+    mp_init_multi(&in, &out, &b, &bi, NULL);
 
     mp_read_unsigned_bin(&in, ptr0, size);
     free(ptr0);
 
-    if(mp_isneg(&in) || mp_cmp(&in, &n) >= 0) {
+    if(mp_isneg(&in) || mp_cmp(&in, &k->n) >= 0) {
 	size = -3;
 	goto out;
     }
 
     if (blinding) {
-	setup_blind(&n, &b, &bi);
-	blind(&in, &b, &e, &n);
-	do_unblind = 1;
-    }
-
-    if (rsa->p && rsa->q && rsa->dmp1 && rsa->dmq1 && rsa->iqmp) {
-	mp_int p, q, dmp1, dmq1, iqmp;
-
-	mp_init_multi(&p, &q, &dmp1, &dmq1, &iqmp, NULL);
-
-	BN2mpz(&p, rsa->p);
-	BN2mpz(&q, rsa->q);
-	BN2mpz(&dmp1, rsa->dmp1);
-	BN2mpz(&dmq1, rsa->dmq1);
-	BN2mpz(&iqmp, rsa->iqmp);
-
-	res = ltm_rsa_private_calculate(&in, &p, &q, &dmp1, &dmq1, &iqmp, &out);
-
-	mp_clear_multi(&p, &q, &dmp1, &dmq1, &iqmp, NULL);
-
-	if (res != 0) {
+	if (ltm_rsa_blinding(rsa, k, &b, &bi) != 0) {
 	    size = -4;
 	    goto out;
 	}
-    } else {
-	mp_int d;
+	/* in' = (in * b^e) mod n */
+	mp_mulmod(&in, &b, &k->n, &in);
+    }
 
-	BN2mpz(&d, rsa->d);
-	res = mp_exptmod(&in, &d, &n, &out);
-	mp_clear(&d);
-	if (res != 0) {
-	    size = -5;
-	    goto out;
-	}
+    if (ltm_rsa_private_calculate(k, &in, &out) != 0) {
+	size = -4;
+	goto out;
     }
 
-    if (do_unblind)
-	unblind(&out, &bi, &n);
+    /* out' = (out * 1/b) mod n */
+    if (blinding)
+	mp_mulmod(&out, &bi, &k->n, &out);
 
     if (size > 0) {
 	size_t ssize;
@@ -378,7 +511,7 @@ ltm_rsa_private_encrypt(int flen, const unsigned char* from,
     }
 
  out:
-    mp_clear_multi(&e, &n, &in, &out, &b, &bi, NULL);
+    mp_clear_multi(&in, &out, &b, &bi, NULL);
 
     return size;
 }
@@ -388,10 +521,10 @@ ltm_rsa_private_decrypt(int flen, const unsigned char* from,
 			unsigned char* to, RSA* rsa, int padding)
 {
     unsigned char *ptr;
-    int res, size;
-    mp_int in, out, n, e, b, bi;
+    int size;
+    mp_int in, out, b, bi;
+    struct ltm_rsa_key *k;
     int blinding = (rsa->flags & RSA_FLAG_NO_BLINDING) == 0;
-    int do_unblind = 0;
 
     if (padding != RSA_PKCS1_PADDING)
 	return -1;
@@ -400,66 +533,34 @@ ltm_rsa_private_decrypt(int flen, const unsigned char* from,
     if (flen > size)
 	return -2;
 
-    mp_init_multi(&in, &n, &e, &out, &b, &bi, NULL);
-
-    BN2mpz(&n, rsa->n);
-    BN2mpz(&e, rsa->e);
+    k = ltm_rsa_key(rsa);
+    if (k == NULL || mp_cmp_d(&k->e, 3) == MP_LT)
+	return -2;
 
-    if (mp_cmp_d(&e, 3) == MP_LT) {
-	size = -2;
-	goto out;
-    }
+    mp_init_multi(&in, &out, &b, &bi, NULL);
 
     mp_read_unsigned_bin(&in, rk_UNCONST(from), flen);
 
-    if(mp_isneg(&in) || mp_cmp(&in, &n) >= 0) {
+    if(mp_isneg(&in) || mp_cmp(&in, &k->n) >= 0) {
 	size = -2;
 	goto out;
     }
 
     if (blinding) {
-	setup_blind(&n, &b, &bi);
-	blind(&in, &b, &e, &n);
-	do_unblind = 1;
-    }
-
-    if (rsa->p && rsa->q && rsa->dmp1 && rsa->dmq1 && rsa->iqmp) {
-	mp_int p, q, dmp1, dmq1, iqmp;
-
-	mp_init_multi(&p, &q, &dmp1, &dmq1, &iqmp, NULL);
-
-	BN2mpz(&p, rsa->p);
-	BN2mpz(&q, rsa->q);
-	BN2mpz(&dmp1, rsa->dmp1);
-	BN2mpz(&dmq1, rsa->dmq1);
-	BN2mpz(&iqmp, rsa->iqmp);
-
-	res = ltm_rsa_private_calculate(&in, &p, &q, &dmp1, &dmq1, &iqmp, &out);
-
-	mp_clear_multi(&p, &q, &dmp1, &dmq1, &iqmp, NULL);
-
-	if (res != 0) {
+	if (ltm_rsa_blinding(rsa, k, &b, &bi) != 0) {
 	    size = -3;
 	    goto out;
 	}
+	mp_mulmod(&in, &b, &k->n, &in);
+    }
 
-    } else {
-	mp_int d;
-
-	if(mp_isneg(&in) || mp_cmp(&in, &n) >= 0)
-	    return -4;
-
-	BN2mpz(&d, rsa->d);
-	res = mp_exptmod(&in, &d, &n, &out);
-	mp_clear(&d);
-	if (res != 0) {
-	    size = -5;
-	    goto out;
-	}
+    if (ltm_rsa_private_calculate(k, &in, &out) != 0) {
+	size = -3;
+	goto out;
     }
 
-    if (do_unblind)
-	unblind(&out, &bi, &n);
+    if (blinding)
+	mp_mulmod(&out, &bi, &k->n, &out);
 
     ptr = to;
     {
@@ -479,14 +580,16 @@ ltm_rsa_private_decrypt(int flen, const unsigned char* from,
     while (size && *ptr != 0) {
 	size--; ptr++;
     }
-    if (size == 0)
-	return -7;
+    if (size == 0) {
+	size = -7;
+	goto out;
+    }
     size--; ptr++;
 
     memmove(to, ptr, size);
 
  out:
-    mp_clear_multi(&e, &n, &in, &out, &b, &bi, NULL);
+    mp_clear_multi(&in, &out, &b, &bi, NULL);
 
     return size;
 }
@@ -613,6 +716,10 @@ ltm_rsa_init(RSA *rsa)
 static int
 ltm_rsa_finish(RSA *rsa)
 {
+    ltm_rsa_key_free(rsa->_method_mod_n);
+    ltm_rsa_blinding_free(rsa->blinding);
+    rsa->_method_mod_n = NULL;
+    rsa->blinding = NULL;
     return 1;
 }
 
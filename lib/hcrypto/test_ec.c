@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <config.h>
+#include <roken.h>
+
+#include <ec.h>
+#include <ecdh.h>
+#include <ecdsa.h>
+#include <rand.h>
+#include <hex.h>
+
+static int
+unhex(const char *s, unsigned char *out, size_t len)
+{
+    if (strlen(s) != 2 * len || hex_decode(s, out, len) != (ssize_t)len) {
+	fprintf(stderr, "bad test vector %s\n", s);
+	return 1;
+    }
+    return 0;
+}
+
+static EC_KEY *
+key_from_private(int nid, const char *priv_hex)
+{
+    unsigned char priv[32];
+    BIGNUM *bn;
+    EC_KEY *key;
+    int ok;
+
+    if (unhex(priv_hex, priv, sizeof(priv)))
+	return NULL;
+    if ((key = EC_KEY_new_by_curve_name(nid)) == NULL)
+	return NULL;
+    bn = BN_bin2bn(priv, sizeof(priv), NULL);
+    ok = bn && EC_KEY_set_private_key(key, bn);
+    BN_free(bn);
+    if (!ok) {
+	EC_KEY_free(key);
+	return NULL;
+    }
+    return key;
+}
+
+static int
+check_public(const char *name, const EC_KEY *key, const char *pub_hex)
+{
+    unsigned char expected[65], *p, *buf;
+    int len;
+
+    len = i2o_ECPublicKey(key, NULL);
+    if (len <= 0 || (size_t)len * 2 != strlen(pub_hex))
+	goto fail;
+    if (unhex(pub_hex, expected, len))
+	return 1;
+    buf = p = malloc(len);
+    if (buf == NULL || i2o_ECPublicKey(key, &p) != len || p != buf + len ||
+	memcmp(buf, expected, len) != 0) {
+	free(buf);
+	goto fail;
+    }
+    free(buf);
+    return 0;
+ fail:
+    fprintf(stderr, "%s: public key mismatch\n", name);
+    return 1;
+}
+
+static int
+check_shared(const char *name, const EC_KEY *a, const EC_KEY *b,
+	     const char *shared_hex)
+{
+    unsigned char expected[32], s1[32], s2[32];
+
+    if (shared_hex && unhex(shared_hex, expected, sizeof(expected)))
+	return 1;
+    if (ECDH_compute_key(s1, sizeof(s1), EC_KEY_get0_public_key(b), a,
+			 NULL) != 32 ||
+	ECDH_compute_key(s2, sizeof(s2), EC_KEY_get0_public_key(a), b,
+			 NULL) != 32 ||
+	memcmp(s1, s2, sizeof(s1)) != 0 ||
+	(shared_hex && memcmp(s1, expected, sizeof(s1)) != 0)) {
+	fprintf(stderr, "%s: shared secret mismatch\n", name);
+	return 1;
+    }
+    return 0;
+}
+
+/* RFC 7748, section 6.1 */
+static int
+test_x25519(void)
+{
+    EC_KEY *alice, *bob;
+    int ret = 0;
+
+    alice = key_from_private(NID_X25519,
+	"77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+    bob = key_from_private(NID_X25519,
+	"5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+    if (alice == NULL || bob == NULL)
+	return 1;
+
+    ret += check_public("x25519 alice", alice,
+	"8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+    ret += check_public("x25519 bob", bob,
+	"de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+    ret += check_shared("x25519", alice, bob,
+	"4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+
+    EC_KEY_free(alice);
+    EC_KEY_free(bob);
+    return ret;
+}
+
+/* RFC 5903, section 8.1 */
+static int
+test_p256_ecdh(void)
+{
+    EC_KEY *i, *r;
+    int ret = 0;
+
+    i = key_from_private(NID_X9_62_prime256v1,
+	"c88f01f510d9ac3f70a292daa2316de544e9aab8afe84049c62a9c57862d1433");
+    r = key_from_private(NID_X9_62_prime256v1,
+	"c6ef9c5d78ae012a011164acb397ce2088685d8f06bf9be0b283ab46476bee53");
+    if (i == NULL || r == NULL)
+	return 1;
+
+    ret += check_public("p256 initiator", i,
+	"04"
+	"dad0b65394221cf9b051e1feca5787d098dfe637fc90b9ef945d0c3772581180"
+	"5271a0461cdb8252d61f1c456fa3e59ab1f45b33accf5f58389e0577b8990bb3");
+    ret += check_public("p256 responder", r,
+	"04"
+	"d12dfb5289c8d4f81208b70270398c342296970a0bccb74c736fc7554494bf63"
+	"56fbf3ca366cc23e8157854c13c58d6aac23f046ada30f8353e74f33039872ab");
+    ret += check_shared("p256", i, r,
+	"d6840f6b42f6edafd13116e0e12565202fef8e9ece7dce03812464d04b9442de");
+    if (EC_KEY_check_key(i) != 1 || EC_KEY_check_key(r) != 1) {
+	fprintf(stderr, "p256: EC_KEY_check_key failed\n");
+	ret++;
+    }
+
+    EC_KEY_free(i);
+    EC_KEY_free(r);
+    return ret;
+}
+
+/* Compressed points and points off the curve */
+static int
+test_p256_points(void)
+{
+    unsigned char pt[65];
+    const unsigned char *p;
+    EC_KEY *key;
+    int ret = 0;
+
+    if ((key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)) == NULL)
+	return 1;
+
+    if (unhex("03"
+	"60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6",
+	pt, 33))
+	return 1;
+    p = pt;
+    if (o2i_ECPublicKey(&key, &p, 33) == NULL || p != pt + 33) {
+	fprintf(stderr, "p256: compressed point rejected\n");
+	ret++;
+    } else {
+	ret += check_public("p256 compressed", key,
+	    "04"
+	    "60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6"
+	    "7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462299");
+    }
+
+    if (unhex("04"
+	"60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6"
+	"7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462298",
+	pt, 65))
+	return 1;
+    p = pt;
+    if (o2i_ECPublicKey(&key, &p, 65) != NULL) {
+	fprintf(stderr, "p256: point off the curve accepted\n");
+	ret++;
+    }
+
+    EC_KEY_free(key);
+    return ret;
+}
+
+/*
+ * Sign dgst, check the signature verifies, and that changing the
+ * digest or either half of the signature makes it fail.
+ */
+static int
+check_sign_verify(const char *name, const EC_KEY *key,
+		  unsigned char *dgst, size_t dlen,
+		  unsigned char *sig, unsigned int *siglen)
+{
+    unsigned char sig2[72];
+    unsigned int siglen2;
+    int ret = 0;
+
+    if (ECDSA_sign(0, dgst, dlen, sig, siglen, key) != 1 ||
+	*siglen > (unsigned int)ECDSA_size(key)) {
+	fprintf(stderr, "%s: signing failed\n", name);
+	return 1;
+    }
+    if (ECDSA_verify(0, dgst, dlen, sig, *siglen, key) != 1) {
+	fprintf(stderr, "%s: own signature rejected\n", name);
+	ret++;
+    }
+
+    /* nonces are deterministic, so is the signature */
+    if (ECDSA_sign(0, dgst, dlen, sig2, &siglen2, key) != 1 ||
+	siglen2 != *siglen || memcmp(sig, sig2, siglen2) != 0) {
+	fprintf(stderr, "%s: signing twice gave different signatures\n",
+		name);
+	ret++;
+    }
+
+    dgst[dlen - 1] ^= 1;
+    if (ECDSA_verify(0, dgst, dlen, sig, *siglen, key) == 1) {
+	fprintf(stderr, "%s: signature over wrong digest accepted\n", name);
+	ret++;
+    }
+    dgst[dlen - 1] ^= 1;
+
+    /* the last octet of r, and of s */
+    sig[3 + sig[3]] ^= 1;
+    if (ECDSA_verify(0, dgst, dlen, sig, *siglen, key) == 1) {
+	fprintf(stderr, "%s: signature with wrong r accepted\n", name);
+	ret++;
+    }
+    sig[3 + sig[3]] ^= 1;
+    sig[*siglen - 1] ^= 1;
+    if (ECDSA_verify(0, dgst, dlen, sig, *siglen, key) == 1) {
+	fprintf(stderr, "%s: signature with wrong s accepted\n", name);
+	ret++;
+    }
+    sig[*siglen - 1] ^= 1;
+
+    return ret;
+}
+
+/*
+ * RFC 6979, appendix A.2.5, SHA-256 of "sample" and of "test": the
+ * nonces are deterministic, so the signatures must match the RFC's.
+ */
+static int
+test_p256_ecdsa(void)
+{
+    static const struct {
+	const char *dgst;
+	const char *sig;
+    } tests[] = {
+	{ "af2bdbe1aa9b6ec1e2ade1d694f41fc71a831d0268e9891562113d8a62add1bf",
+	  "3046"
+	  "022100efd48b2aacb6a8fd1140dd9cd45e81d69d2c877b56aaf991c34d0ea84eaf3716"
+	  "022100f7cb1c942d657c41d436c7a1b6e29f65f3e900dbb9aff4064dc4ab2f843acda8" },
+	{ "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08",
+	  "3045"
+	  "022100f1abb023518351cd71d881567b1ea663ed3efcf6c5132b354f28d3b0b7d38367"
+	  "0220019f4113742a2b14bd25926b49c649155f267e60d3814b4c0cc84250e46f0083" }
+    };
+    unsigned char dgst[32], sig[72], sig2[72];
+    unsigned int siglen;
+    size_t i, len;
+    EC_KEY *key;
+    int ret = 0;
+
+    key = key_from_private(NID_X9_62_prime256v1,
+	"c9afa9d845ba75166b5c215767b1d6934e50c3db36e89b127b8a622b120f6721");
+    if (key == NULL)
+	return 1;
+
+    ret += check_public("ecdsa key", key,
+	"04"
+	"60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6"
+	"7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462299");
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+	len = strlen(tests[i].sig) / 2;
+	if (unhex(tests[i].dgst, dgst, sizeof(dgst)) ||
+	    unhex(tests[i].sig, sig, len))
+	    return 1;
+
+	if (ECDSA_verify(0, dgst, sizeof(dgst), sig, len, key) != 1) {
+	    fprintf(stderr, "ecdsa %zu: valid signature rejected\n", i);
+	    ret++;
+	}
+	ret += check_sign_verify("ecdsa vector", key, dgst, sizeof(dgst),
+				 sig2, &siglen);
+	if (siglen != len || memcmp(sig, sig2, len) != 0) {
+	    fprintf(stderr, "ecdsa %zu: signature differs from RFC 6979\n", i);
+	    ret++;
+	}
+    }
+
+    EC_KEY_free(key);
+    return ret;
+}
+
+/* Sign and verify with generated keys and random digests */
+static int
+test_p256_ecdsa_generated(void)
+{
+    unsigned char dgst[32], sig[72];
+    unsigned int siglen;
+    EC_KEY *key;
+    int i, ret = 0;
+
+    for (i = 0; i < 16; i++) {
+	key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	if (key == NULL || EC_KEY_generate_key(key) != 1 ||
+	    RAND_bytes(dgst, sizeof(dgst)) != 1) {
+	    fprintf(stderr, "ecdsa generated: setup failed\n");
+	    EC_KEY_free(key);
+	    return ret + 1;
+	}
+	/* SHA-1 sized digests too */
+	ret += check_sign_verify("ecdsa generated", key, dgst,
+				 (i & 1) ? 20 : sizeof(dgst), sig, &siglen);
+	EC_KEY_free(key);
+    }
+    return ret;
+}
+
+/* Generated keys */
+static int
+test_generate(int nid, const char *name)
+{
+    EC_KEY *a, *b;
+    int ret = 0;
+
+    a = EC_KEY_new_by_curve_name(nid);
+    b = EC_KEY_new_by_curve_name(nid);
+    if (a == NULL || b == NULL ||
+	EC_KEY_generate_key(a) != 1 || EC_KEY_generate_key(b) != 1) {
+	fprintf(stderr, "%s: key generation failed\n", name);
+	return 1;
+    }
+    ret += check_shared(name, a, b, NULL);
+    EC_KEY_free(a);
+    EC_KEY_free(b);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    int ret = 0;
+
+    ret += test_x25519();
+    ret += test_p256_ecdh();
+    ret += test_p256_points();
+    ret += test_p256_ecdsa();
+    ret += test_p256_ecdsa_generated();
+    ret += test_generate(NID_X25519, "x25519 generated");
+    ret += test_generate(NID_X9_62_prime256v1, "p256 generated");
+
+    return ret;
+}
@@ -46,6 +46,8 @@ static int version_flag;
 static int help_flag;
 static int time_keygen;
 static char *time_key;
+static int time_sign;
+static int time_bits = 1024;
 static int key_blinding = 1;
 static char *rsa_key;
 static char *id_flag;
@@ -60,6 +62,10 @@ static struct getargs args[] = {
       "time rsa generation", NULL },
     { "time-key",	0,	arg_string,	&time_key,
       "rsa key file", NULL },
+    { "time-sign",	0,	arg_flag,	&time_sign,
+      "only time signing with the --time-key key", NULL },
+    { "time-bits",	0,	arg_integer,	&time_bits,
+      "size of the key for --time-key=generate", "bits" },
     { "key-blinding",	0,	arg_negative_flag, &key_blinding,
       "key blinding", NULL },
     { "key",	0,	arg_string,	&rsa_key,
@@ -290,12 +296,55 @@ main(int argc, char **argv)
 	    e = BN_new();
 	    BN_set_word(e, 0x10001);
 
-	    if (RSA_generate_key_ex(rsa, 1024, e, NULL) != 1)
+	    if (RSA_generate_key_ex(rsa, time_bits, e, NULL) != 1)
 		errx(1, "RSA_generate_key_ex");
+	    BN_free(e);
 	} else {
 	    rsa = read_key(engine, time_key);
 	}
 
+	if (time_sign) {
+	    unsigned char *sig = emalloc(RSA_size(rsa));
+	    unsigned char *res = emalloc(RSA_size(rsa));
+	    unsigned char digest[32];
+	    unsigned long usec;
+	    int len = 0, siglen;
+
+	    RAND_bytes(digest, sizeof(digest));
+
+	    /* One signature to check, whatever the number of loops */
+	    siglen = RSA_private_encrypt(sizeof(digest), digest, sig, rsa,
+					 RSA_PKCS1_PADDING);
+	    if (siglen <= 0)
+		errx(1, "failed to private encrypt: %d", siglen);
+
+	    gettimeofday(&tv1, NULL);
+	    for (i = 0; i < loops; i++) {
+		len = RSA_private_encrypt(sizeof(digest), digest, sig, rsa,
+					  RSA_PKCS1_PADDING);
+		if (len != siglen)
+		    errx(1, "failed to private encrypt: %d", len);
+	    }
+	    gettimeofday(&tv2, NULL);
+	    timevalsub(&tv2, &tv1);
+
+	    len = RSA_public_decrypt(siglen, sig, res, rsa, RSA_PKCS1_PADDING);
+	    if (len != sizeof(digest) || memcmp(res, digest, len) != 0)
+		errx(1, "signature does not verify");
+
+	    usec = tv2.tv_sec * 1000000UL + tv2.tv_usec;
+	    printf("%d-bit signatures: %d in %lu.%06lu (%lu us each)\n",
+		   RSA_size(rsa) * 8, loops,
+		   (unsigned long)tv2.tv_sec, (unsigned long)tv2.tv_usec,
+		   usec / (loops > 0 ? loops : 1));
+
+	    free(sig);
+	    free(res);
+	    RSA_free(rsa);
+	    ENGINE_finish(engine);
+	    return 0;
+	}
+
 	p = emalloc(loops * size);
 
 	RAND_bytes(p, loops * size);
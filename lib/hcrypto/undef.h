@@ -47,6 +47,35 @@
 #undef RSA_METHOD
 #undef RAND_METHOD
 #undef ENGINE
+#undef EC_KEY
+#undef EC_GROUP
+#undef EC_POINT
+#undef EC_GROUP_get_curve_name
+#undef EC_GROUP_get_degree
+#undef EC_GROUP_get_order
+#undef EC_GROUP_set_asn1_flag
+#undef EC_GROUP_new_by_curve_name
+#undef EC_GROUP_free
+#undef EC_KEY_new
+#undef EC_KEY_new_by_curve_name
+#undef EC_KEY_free
+#undef EC_KEY_get0_group
+#undef EC_KEY_set_group
+#undef EC_KEY_generate_key
+#undef EC_KEY_check_key
+#undef EC_KEY_get0_public_key
+#undef EC_KEY_get0_private_key
+#undef EC_KEY_set_private_key
+#undef o2i_ECPublicKey
+#undef i2o_ECPublicKey
+#undef d2i_ECPrivateKey
+#undef ECDH_compute_key
+#undef ECDSA_verify
+#undef ECDSA_sign
+#undef ECDSA_size
+#undef NID_X9_62_prime256v1
+#undef NID_X25519
+#undef OPENSSL_EC_NAMED_CURVE
 #undef BN_GENCB_call
 #undef BN_GENCB_set
 #undef BN_CTX_new
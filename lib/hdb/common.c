@@ -32,6 +32,7 @@
  */
 
 #include "hdb_locl.h"
+#include <der.h>
 
 int
 hdb_principal2key(krb5_context context, krb5_const_principal p, krb5_data *key)
@@ -64,6 +65,9 @@ hdb_entry2value(krb5_context context, const hdb_entry *ent, krb5_data *value)
     size_t len = 0;
     int ret;
 
+    ret = _hdb_expand_extensions(rk_UNCONST(ent));
+    if (ret)
+	return ret;
     ASN1_MALLOC_ENCODE(hdb_entry, value->data, value->length, ent, &len, ret);
     if (ret == 0 && value->length != len)
 	krb5_abortx(context, "internal asn.1 encoder error");
@@ -76,6 +80,101 @@ hdb_value2entry(krb5_context context, krb5_data *value, hdb_entry *ent)
     return decode_hdb_entry(value->data, value->length, ent, NULL);
 }
 
+/*
+ * Check that `der' is a SEQUENCE OF SEQUENCE, as HDB-extensions is,
+ * with all the lengths adding up.  Extensions that fail this fail the
+ * fetch, as they would decoded at once, and not their first use.
+ */
+
+static int
+extensions_look_right(const unsigned char *der, size_t len)
+{
+    size_t l, hlen, clen, elen, pos;
+    Der_class cls;
+    Der_type type;
+    unsigned int tag;
+
+    if (der_get_tag(der, len, &cls, &type, &tag, &l) != 0 ||
+	cls != ASN1_C_UNIV || type != CONS || tag != UT_Sequence ||
+	der_get_length(der + l, len - l, &clen, &hlen) != 0 ||
+	clen != len - l - hlen)
+	return 0;
+    der += l + hlen;
+
+    for (pos = 0; pos < clen; pos += l + hlen + elen) {
+	if (der_get_tag(der + pos, clen - pos, &cls, &type, &tag, &l) != 0 ||
+	    cls != ASN1_C_UNIV || type != CONS || tag != UT_Sequence ||
+	    der_get_length(der + pos + l, clen - pos - l, &elen, &hlen) != 0 ||
+	    elen == ASN1_INDEFINITE || elen > clen - pos - l - hlen)
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * As hdb_value2entry(), but leave the extensions, the key history
+ * among them, to be decoded when they are first used.  They are the
+ * last field of the entry, so the rest is decoded from a copy of the
+ * SEQUENCE without them.
+ */
+
+static int
+value2entry_lazy(krb5_context context, krb5_data *value, hdb_entry *ent)
+{
+    const unsigned char *p = value->data, *content, *ext = NULL;
+    unsigned char *buf;
+    size_t len = value->length, clen, l, hlen, elen, extlen = 0, pos;
+    Der_class cls;
+    Der_type type;
+    unsigned int tag;
+    int ret;
+
+    if (der_get_tag(p, len, &cls, &type, &tag, &l) != 0 ||
+	cls != ASN1_C_UNIV || type != CONS || tag != UT_Sequence ||
+	der_get_length(p + l, len - l, &clen, &hlen) != 0 ||
+	clen == ASN1_INDEFINITE || clen > len - l - hlen)
+	return hdb_value2entry(context, value, ent);
+    content = p + l + hlen;
+
+    for (pos = 0; pos < clen; pos += l + hlen + elen) {
+	if (der_get_tag(content + pos, clen - pos, &cls, &type, &tag, &l) ||
+	    der_get_length(content + pos + l, clen - pos - l, &elen, &hlen) ||
+	    elen == ASN1_INDEFINITE || elen > clen - pos - l - hlen)
+	    return hdb_value2entry(context, value, ent);
+	if (cls == ASN1_C_CONTEXT && tag == 13) {
+	    if (pos + l + hlen + elen != clen)
+		return hdb_value2entry(context, value, ent);
+	    ext = content + pos + l + hlen;
+	    extlen = elen;
+	    break;
+	}
+    }
+    if (ext == NULL || !extensions_look_right(ext, extlen))
+	return hdb_value2entry(context, value, ent);
+
+    /* The entry without its extensions */
+    hlen = der_length_len(pos);
+    buf = malloc(1 + hlen + pos);
+    if (buf == NULL)
+	return krb5_enomem(context);
+    ret = der_put_length_and_tag(buf + hlen, 1 + hlen, pos,
+				 ASN1_C_UNIV, CONS, UT_Sequence, &l);
+    if (ret == 0) {
+	memcpy(buf + l, content, pos);
+	ret = decode_hdb_entry(buf, l + pos, ent, NULL);
+    }
+    free(buf);
+    if (ret)
+	return ret;
+
+    ret = _hdb_lazy_extensions(ent, ext, extlen);
+    if (ret) {
+	free_hdb_entry(ent);
+	return ret;
+    }
+    return 0;
+}
+
 int
 hdb_entry_alias2value(krb5_context context,
 		      const hdb_entry_alias *alias,
@@ -121,6 +220,16 @@ _hdb_fetch_kvno(krb5_context context, HDB *db, krb5_const_principal principal,
 	principal = enterprise_principal;
     }
 
+    if ((db->hdb_capability_flags & HDB_CAP_F_COMPACT_ENTRIES) &&
+	(flags & HDB_F_ADMIN_DATA) == 0) {
+	ret = _hdb_fetch_compact(context, db, principal, flags, kvno, entry);
+	if (ret != HDB_ERR_NOENTRY) {
+	    if (enterprise_principal)
+		krb5_free_principal(context, enterprise_principal);
+	    return ret;
+	}
+    }
+
     hdb_principal2key(context, principal, &key);
     if (enterprise_principal)
 	krb5_free_principal(context, enterprise_principal);
@@ -128,7 +237,7 @@ _hdb_fetch_kvno(krb5_context context, HDB *db, krb5_const_principal principal,
     krb5_data_free(&key);
     if(ret)
 	return ret;
-    ret = hdb_value2entry(context, &value, &entry->entry);
+    ret = value2entry_lazy(context, &value, &entry->entry);
     if (ret == ASN1_BAD_ID && (flags & HDB_F_CANON) == 0) {
 	krb5_data_free(&value);
 	return HDB_ERR_NOENTRY;
@@ -148,7 +257,7 @@ _hdb_fetch_kvno(krb5_context context, HDB *db, krb5_const_principal principal,
 	krb5_data_free(&key);
 	if (ret)
 	    return ret;
-	ret = hdb_value2entry(context, &value, &entry->entry);
+	ret = value2entry_lazy(context, &value, &entry->entry);
 	if (ret) {
 	    krb5_data_free(&value);
 	    return ret;
@@ -162,8 +271,9 @@ _hdb_fetch_kvno(krb5_context context, HDB *db, krb5_const_principal principal,
 	    hdb_free_entry(context, entry);
 	    return ret;
 	}
-	/* Decrypt the key history too */
-	ret = hdb_unseal_keys_kvno(context, db, 0, flags, &entry->entry);
+	/* Decrypt the key history too, unless hdb_kvno_enctype2key() will */
+	if ((flags & HDB_F_LAZY_HIST_KEYS) == 0)
+	    ret = hdb_unseal_keys_kvno(context, db, 0, flags, &entry->entry);
 	if (ret) {
 	    hdb_free_entry(context, entry);
 	    return ret;
@@ -362,6 +472,17 @@ _hdb_store(krb5_context context, HDB *db, unsigned flags, hdb_entry_ex *entry)
 
     hdb_principal2key(context, entry->entry.principal, &key);
 
+    /*
+     * Drop the compact record first, whether or not this program has
+     * [hdb] compact-entries: a stale one would be served in place of
+     * the new entry.
+     */
+    code = _hdb_remove_compact(context, db, entry->entry.principal);
+    if (code) {
+	krb5_data_free(&key);
+	return code;
+    }
+
     /* remove aliases */
     code = hdb_remove_aliases(context, db, &key);
     if (code) {
@@ -376,6 +497,8 @@ _hdb_store(krb5_context context, HDB *db, unsigned flags, hdb_entry_ex *entry)
 	return code;
 
     code = hdb_add_aliases(context, db, flags, entry);
+    if (code == 0 && (db->hdb_capability_flags & HDB_CAP_F_COMPACT_ENTRIES))
+	code = _hdb_store_compact(context, db, flags, entry);
 
     return code;
 }
@@ -407,7 +530,10 @@ _hdb_remove(krb5_context context, HDB *db,
         return code;
     }
 
-    code = hdb_remove_aliases(context, db, &key);
+    /* The compact record goes first, as in _hdb_store() */
+    code = _hdb_remove_compact(context, db, principal);
+    if (code == 0)
+	code = hdb_remove_aliases(context, db, &key);
     if (code) {
 	krb5_data_free(&key);
 	return code;
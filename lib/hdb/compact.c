@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "hdb_locl.h"
+
+/*
+ * Compact entries
+ *
+ * With [hdb] compact-entries, the classical key/value backends store
+ * next to each hdb_entry a second, flat record of what the KDC needs
+ * of it: the principal, flags, times and the current keys (still
+ * sealed), and the extensions other than the key history.  Reading it
+ * is a bounds check and a few copies, where decoding the hdb_entry
+ * walks the whole DER structure, key history included.
+ *
+ * The record is kept under the key HDB_COMPACT_PREFIX followed by the
+ * principal's key, which no principal key starts with.  It has no DER
+ * tag, so the iteration functions skip it like the db-format entry.
+ *
+ * The canonical hdb_entry stays the reference: fetches that want the
+ * key history or admin data, or that find no compact record, read it.
+ * _hdb_store() and _hdb_remove() delete the record before they touch
+ * the entry, with or without compact-entries, so that it is never
+ * older than the entry; hdb_rebuild_compact() writes the records of a
+ * database that did not have them.
+ *
+ * All integers are in network byte order:
+ *
+ *	 0	magic "HDBc"
+ *	 4	version
+ *	 8	length of the record
+ *	12	present fields
+ *	16	kvno
+ *	20	flags
+ *	24	max-life
+ *	28	max-renew
+ *	32	number of current keys
+ *	36	number of keysets in the key history
+ *	40	valid-start, 64 bits
+ *	48	valid-end, 64 bits
+ *	56	pw-end, 64 bits
+ *	64	created-by time, 64 bits
+ *	72	generation time, 64 bits
+ *	80	generation usec
+ *	84	generation number
+ *	88	principal (DER) offset, length
+ *	96	etypes offset, count
+ *	104	extensions (DER) offset, length
+ *	112	reserved, 64 bits
+ *	120	the keys, HDB_COMPACT_KEYLEN bytes each:
+ *		present, mkvno, keytype, salt type, key offset, length,
+ *		salt offset, length, opaque offset, length
+ *
+ * followed by the variable length data the offsets point to.
+ */
+
+#define HDB_COMPACT_PREFIX	"hdb/compact:"
+#define HDB_COMPACT_MAGIC	"HDBc"
+#define HDB_COMPACT_VERSION	1
+#define HDB_COMPACT_HDRLEN	120
+#define HDB_COMPACT_KEYLEN	40
+
+#define C_VALID_START	0x01
+#define C_VALID_END	0x02
+#define C_PW_END	0x04
+#define C_MAX_LIFE	0x08
+#define C_MAX_RENEW	0x10
+#define C_ETYPES	0x20
+#define C_GENERATION	0x40
+#define C_EXTENSIONS	0x80
+
+#define C_KEY_MKVNO	0x01
+#define C_KEY_SALT	0x02
+#define C_KEY_OPAQUE	0x04
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static void
+put64(unsigned char *p, int64_t v)
+{
+    put32(p, (uint32_t)((uint64_t)v >> 32));
+    put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	((uint32_t)p[2] << 8) | p[3];
+}
+
+static int64_t
+get64(const unsigned char *p)
+{
+    return (int64_t)(((uint64_t)get32(p) << 32) | get32(p + 4));
+}
+
+static int
+in_record(uint32_t off, uint32_t len, size_t total)
+{
+    return off <= total && len <= total - off;
+}
+
+static krb5_error_code
+compact_key(krb5_context context, krb5_const_principal principal,
+	    krb5_data *key)
+{
+    krb5_data pkey;
+    krb5_error_code ret;
+
+    ret = hdb_principal2key(context, principal, &pkey);
+    if (ret)
+	return ret;
+    ret = krb5_data_alloc(key, sizeof(HDB_COMPACT_PREFIX) - 1 + pkey.length);
+    if (ret == 0) {
+	memcpy(key->data, HDB_COMPACT_PREFIX, sizeof(HDB_COMPACT_PREFIX) - 1);
+	memcpy((char *)key->data + sizeof(HDB_COMPACT_PREFIX) - 1,
+	       pkey.data, pkey.length);
+    }
+    krb5_data_free(&pkey);
+    return ret;
+}
+
+/*
+ * Copy `len' bytes of `data' to the data area of `rec', and record
+ * where in the slot at `slot'.
+ */
+
+static void
+put_blob(unsigned char *rec, size_t *pos, unsigned char *slot,
+	 const void *data, size_t len)
+{
+    put32(slot, *pos);
+    put32(slot + 4, len);
+    if (len)
+	memcpy(rec + *pos, data, len);
+    *pos += len;
+}
+
+/**
+ * Encode the compact record of `ent' in `value', to be freed with
+ * krb5_data_free().  The keys are taken as they are, so they should
+ * be sealed.
+ */
+
+krb5_error_code
+hdb_entry2compact(krb5_context context, const hdb_entry *ent,
+		  krb5_data *value)
+{
+    HDB_extensions exts;
+    const HDB_Ext_KeySet *hist = NULL;
+    unsigned char *pder = NULL, *xder = NULL, *rec;
+    size_t plen = 0, xlen = 0, size, pos, i;
+    uint32_t present = 0;
+    krb5_error_code ret;
+
+    krb5_data_zero(value);
+    if (ent->principal == NULL)
+	return HDB_ERR_MISUSE;
+    ret = _hdb_expand_extensions(rk_UNCONST(ent));
+    if (ret)
+	return ret;
+
+    ASN1_MALLOC_ENCODE(Principal, pder, plen, ent->principal, &size, ret);
+    if (ret)
+	return ret;
+
+    /* The extensions, but the key history */
+    exts.len = 0;
+    exts.val = NULL;
+    if (ent->extensions && ent->extensions->len) {
+	exts.val = calloc(ent->extensions->len, sizeof(exts.val[0]));
+	if (exts.val == NULL) {
+	    free(pder);
+	    return krb5_enomem(context);
+	}
+	for (i = 0; i < ent->extensions->len; i++) {
+	    if (ent->extensions->val[i].data.element ==
+		choice_HDB_extension_data_hist_keys)
+		hist = &ent->extensions->val[i].data.u.hist_keys;
+	    else
+		exts.val[exts.len++] = ent->extensions->val[i];
+	}
+    }
+    if (exts.len) {
+	ASN1_MALLOC_ENCODE(HDB_extensions, xder, xlen, &exts, &size, ret);
+	if (ret) {
+	    free(exts.val);
+	    free(pder);
+	    return ret;
+	}
+	present |= C_EXTENSIONS;
+    }
+    free(exts.val);
+
+    size = HDB_COMPACT_HDRLEN + ent->keys.len * HDB_COMPACT_KEYLEN + plen + xlen;
+    if (ent->etypes)
+	size += 4 * ent->etypes->len;
+    for (i = 0; i < ent->keys.len; i++) {
+	const Key *k = &ent->keys.val[i];
+
+	size += k->key.keyvalue.length;
+	if (k->salt) {
+	    size += k->salt->salt.length;
+	    if (k->salt->opaque)
+		size += k->salt->opaque->length;
+	}
+    }
+    if (size > UINT32_MAX) {
+	free(pder);
+	free(xder);
+	return ERANGE;
+    }
+
+    ret = krb5_data_alloc(value, size);
+    if (ret) {
+	free(pder);
+	free(xder);
+	return ret;
+    }
+    rec = value->data;
+    memset(rec, 0, size);
+
+    memcpy(rec, HDB_COMPACT_MAGIC, 4);
+    put32(rec + 4, HDB_COMPACT_VERSION);
+    put32(rec + 8, size);
+    put32(rec + 16, ent->kvno);
+    put32(rec + 20, HDBFlags2int(ent->flags));
+    if (ent->max_life) {
+	present |= C_MAX_LIFE;
+	put32(rec + 24, *ent->max_life);
+    }
+    if (ent->max_renew) {
+	present |= C_MAX_RENEW;
+	put32(rec + 28, *ent->max_renew);
+    }
+    put32(rec + 32, ent->keys.len);
+    put32(rec + 36, hist ? hist->len : 0);
+    if (ent->valid_start) {
+	present |= C_VALID_START;
+	put64(rec + 40, *ent->valid_start);
+    }
+    if (ent->valid_end) {
+	present |= C_VALID_END;
+	put64(rec + 48, *ent->valid_end);
+    }
+    if (ent->pw_end) {
+	present |= C_PW_END;
+	put64(rec + 56, *ent->pw_end);
+    }
+    put64(rec + 64, ent->created_by.time);
+    if (ent->generation) {
+	present |= C_GENERATION;
+	put64(rec + 72, ent->generation->time);
+	put32(rec + 80, ent->generation->usec);
+	put32(rec + 84, ent->generation->gen);
+    }
+
+    pos = HDB_COMPACT_HDRLEN + ent->keys.len * HDB_COMPACT_KEYLEN;
+    put_blob(rec, &pos, rec + 88, pder, plen);
+    if (ent->etypes) {
+	present |= C_ETYPES;
+	put32(rec + 96, pos);
+	put32(rec + 100, ent->etypes->len);
+	for (i = 0; i < ent->etypes->len; i++, pos += 4)
+	    put32(rec + pos, ent->etypes->val[i]);
+    }
+    put_blob(rec, &pos, rec + 104, xder, xlen);
+    put32(rec + 12, present);
+
+    for (i = 0; i < ent->keys.len; i++) {
+	const Key *k = &ent->keys.val[i];
+	unsigned char *slot = rec + HDB_COMPACT_HDRLEN + i * HDB_COMPACT_KEYLEN;
+	uint32_t kp = 0;
+
+	if (k->mkvno) {
+	    kp |= C_KEY_MKVNO;
+	    put32(slot + 4, *k->mkvno);
+	}
+	put32(slot + 8, k->key.keytype);
+	put_blob(rec, &pos, slot + 16, k->key.keyvalue.data,
+		 k->key.keyvalue.length);
+	if (k->salt) {
+	    kp |= C_KEY_SALT;
+	    put32(slot + 12, k->salt->type);
+	    put_blob(rec, &pos, slot + 24, k->salt->salt.data,
+		     k->salt->salt.length);
+	    if (k->salt->opaque) {
+		kp |= C_KEY_OPAQUE;
+		put_blob(rec, &pos, slot + 32, k->salt->opaque->data,
+			 k->salt->opaque->length);
+	    }
+	}
+	put32(slot, kp);
+    }
+    heim_assert(pos == size, "compact hdb entry size mismatch");
+
+    free(pder);
+    free(xder);
+    return 0;
+}
+
+static krb5_error_code
+copy_blob(const unsigned char *rec, const unsigned char *slot,
+	  heim_octet_string *os)
+{
+    os->length = get32(slot + 4);
+    os->data = malloc(os->length ? os->length : 1);
+    if (os->data == NULL)
+	return ENOMEM;
+    memcpy(os->data, rec + get32(slot), os->length);
+    return 0;
+}
+
+static krb5_error_code
+check_compact(const krb5_data *value)
+{
+    const unsigned char *rec = value->data;
+    size_t total = value->length;
+    uint32_t nkeys, i;
+
+    if (total < HDB_COMPACT_HDRLEN || memcmp(rec, HDB_COMPACT_MAGIC, 4) != 0)
+	return HDB_ERR_NOENTRY;
+    if (get32(rec + 4) != HDB_COMPACT_VERSION || get32(rec + 8) != total)
+	return HDB_ERR_NOENTRY;
+
+    nkeys = get32(rec + 32);
+    if (nkeys > (total - HDB_COMPACT_HDRLEN) / HDB_COMPACT_KEYLEN)
+	return ASN1_OVERRUN;
+    if (!in_record(get32(rec + 88), get32(rec + 92), total) ||
+	get32(rec + 100) > total / 4 ||
+	!in_record(get32(rec + 96), get32(rec + 100) * 4, total) ||
+	!in_record(get32(rec + 104), get32(rec + 108), total))
+	return ASN1_OVERRUN;
+    for (i = 0; i < nkeys; i++) {
+	const unsigned char *slot =
+	    rec + HDB_COMPACT_HDRLEN + i * HDB_COMPACT_KEYLEN;
+
+	if (!in_record(get32(slot + 16), get32(slot + 20), total) ||
+	    !in_record(get32(slot + 24), get32(slot + 28), total) ||
+	    !in_record(get32(slot + 32), get32(slot + 36), total))
+	    return ASN1_OVERRUN;
+    }
+    return 0;
+}
+
+#define ALLOC_FIELD(f)	(((f) = calloc(1, sizeof(*(f)))) == NULL)
+
+/**
+ * Decode the compact record in `value' into `ent', to be freed with
+ * free_hdb_entry().  The entry has no modified-by, no created-by
+ * principal and no key history.
+ *
+ * Returns HDB_ERR_NOENTRY if `value' is not a compact record of this
+ * version.
+ */
+
+krb5_error_code
+hdb_compact2entry(krb5_context context, const krb5_data *value,
+		  hdb_entry *ent)
+{
+    const unsigned char *rec = value->data;
+    krb5_error_code ret;
+    uint32_t present, i, n;
+
+    memset(ent, 0, sizeof(*ent));
+    ret = check_compact(value);
+    if (ret)
+	return ret;
+
+    present = get32(rec + 12);
+    ent->kvno = get32(rec + 16);
+    ent->flags = int2HDBFlags(get32(rec + 20));
+    ent->created_by.time = get64(rec + 64);
+
+    if (ALLOC_FIELD(ent->principal))
+	goto enomem;
+    ret = decode_Principal(rec + get32(rec + 88), get32(rec + 92),
+			   ent->principal, NULL);
+    if (ret)
+	goto out;
+
+    if (present & C_MAX_LIFE) {
+	if (ALLOC_FIELD(ent->max_life))
+	    goto enomem;
+	*ent->max_life = get32(rec + 24);
+    }
+    if (present & C_MAX_RENEW) {
+	if (ALLOC_FIELD(ent->max_renew))
+	    goto enomem;
+	*ent->max_renew = get32(rec + 28);
+    }
+    if (present & C_VALID_START) {
+	if (ALLOC_FIELD(ent->valid_start))
+	    goto enomem;
+	*ent->valid_start = get64(rec + 40);
+    }
+    if (present & C_VALID_END) {
+	if (ALLOC_FIELD(ent->valid_end))
+	    goto enomem;
+	*ent->valid_end = get64(rec + 48);
+    }
+    if (present & C_PW_END) {
+	if (ALLOC_FIELD(ent->pw_end))
+	    goto enomem;
+	*ent->pw_end = get64(rec + 56);
+    }
+    if (present & C_GENERATION) {
+	if (ALLOC_FIELD(ent->generation))
+	    goto enomem;
+	ent->generation->time = get64(rec + 72);
+	ent->generation->usec = get32(rec + 80);
+	ent->generation->gen = get32(rec + 84);
+    }
+    if (present & C_ETYPES) {
+	if (ALLOC_FIELD(ent->etypes))
+	    goto enomem;
+	n = get32(rec + 100);
+	ent->etypes->val = calloc(n ? n : 1, sizeof(ent->etypes->val[0]));
+	if (ent->etypes->val == NULL)
+	    goto enomem;
+	ent->etypes->len = n;
+	for (i = 0; i < n; i++)
+	    ent->etypes->val[i] = get32(rec + get32(rec + 96) + 4 * i);
+    }
+    if (present & C_EXTENSIONS) {
+	ret = _hdb_lazy_extensions(ent, rec + get32(rec + 104),
+				   get32(rec + 108));
+	if (ret)
+	    goto out;
+    }
+
+    n = get32(rec + 32);
+    ent->keys.val = calloc(n ? n : 1, sizeof(ent->keys.val[0]));
+    if (ent->keys.val == NULL)
+	goto enomem;
+    for (i = 0; i < n; i++) {
+	const unsigned char *slot =
+	    rec + HDB_COMPACT_HDRLEN + i * HDB_COMPACT_KEYLEN;
+	uint32_t kp = get32(slot);
+	Key *k = &ent->keys.val[i];
+
+	ent->keys.len++;
+	if (kp & C_KEY_MKVNO) {
+	    if (ALLOC_FIELD(k->mkvno))
+		goto enomem;
+	    *k->mkvno = get32(slot + 4);
+	}
+	k->key.keytype = get32(slot + 8);
+	if (copy_blob(rec, slot + 16, &k->key.keyvalue))
+	    goto enomem;
+	if (kp & C_KEY_SALT) {
+	    if (ALLOC_FIELD(k->salt))
+		goto enomem;
+	    k->salt->type = get32(slot + 12);
+	    if (copy_blob(rec, slot + 24, &k->salt->salt))
+		goto enomem;
+	    if (kp & C_KEY_OPAQUE) {
+		if (ALLOC_FIELD(k->salt->opaque) ||
+		    copy_blob(rec, slot + 32, k->salt->opaque))
+		    goto enomem;
+	    }
+	}
+    }
+    return 0;
+
+enomem:
+    ret = krb5_enomem(context);
+out:
+    free_hdb_entry(ent);
+    memset(ent, 0, sizeof(*ent));
+    return ret;
+}
+
+/*
+ * Fetch the compact record of `principal', if it has what the caller
+ * asked for in `flags' and `kvno'.  Returns HDB_ERR_NOENTRY when the
+ * caller should read the hdb_entry instead.
+ */
+
+krb5_error_code
+_hdb_fetch_compact(krb5_context context, HDB *db,
+		   krb5_const_principal principal, unsigned flags,
+		   krb5_kvno kvno, hdb_entry_ex *entry)
+{
+    krb5_data key, value;
+    krb5_error_code ret;
+    uint32_t nhist;
+
+    ret = compact_key(context, principal, &key);
+    if (ret)
+	return ret;
+    ret = db->hdb__get(context, db, key, &value);
+    krb5_data_free(&key);
+    if (ret)
+	return HDB_ERR_NOENTRY;
+
+    /* Anything but the current keys is only in the hdb_entry */
+    nhist = value.length >= HDB_COMPACT_HDRLEN ?
+	get32((unsigned char *)value.data + 36) : 0;
+    if (nhist && (flags & (HDB_F_ALL_KVNOS | HDB_F_LIVE_CLNT_KVNOS |
+			   HDB_F_LIVE_SVC_KVNOS))) {
+	krb5_data_free(&value);
+	return HDB_ERR_NOENTRY;
+    }
+
+    ret = hdb_compact2entry(context, &value, &entry->entry);
+    krb5_data_free(&value);
+    if (ret)
+	return HDB_ERR_NOENTRY;
+
+    if ((flags & HDB_F_KVNO_SPECIFIED) && kvno != entry->entry.kvno) {
+	hdb_free_entry(context, entry);
+	return HDB_ERR_NOENTRY;
+    }
+    if (flags & HDB_F_DECRYPT) {
+	ret = hdb_unseal_keys(context, db, &entry->entry);
+	if (ret)
+	    hdb_free_entry(context, entry);
+    }
+    return ret;
+}
+
+krb5_error_code
+_hdb_store_compact(krb5_context context, HDB *db, unsigned flags,
+		   hdb_entry_ex *entry)
+{
+    krb5_data key, value;
+    krb5_error_code ret;
+
+    ret = hdb_entry2compact(context, &entry->entry, &value);
+    if (ret)
+	return ret;
+    ret = compact_key(context, entry->entry.principal, &key);
+    if (ret == 0) {
+	ret = db->hdb__put(context, db, flags & HDB_F_REPLACE, key, value);
+	krb5_data_free(&key);
+    }
+    krb5_data_free(&value);
+    return ret;
+}
+
+krb5_error_code
+_hdb_remove_compact(krb5_context context, HDB *db,
+		    krb5_const_principal principal)
+{
+    krb5_data key;
+    krb5_error_code ret;
+
+    ret = compact_key(context, principal, &key);
+    if (ret)
+	return ret;
+    ret = db->hdb__del(context, db, key);
+    krb5_data_free(&key);
+    return ret == HDB_ERR_NOENTRY ? 0 : ret;
+}
+
+/*
+ * hdb_rebuild_compact() first collects the keys of the entries, which
+ * are small, then reads, converts and writes one entry at a time:
+ * backends may not allow writes while a scan is under way, and the
+ * whole database need not fit in memory.
+ */
+
+struct rebuild {
+    size_t len;
+    krb5_data *keys;
+};
+
+static krb5_error_code
+rebuild_entry(krb5_context context, HDB *db, hdb_entry_ex *entry, void *data)
+{
+    struct rebuild *r = data;
+    krb5_data *tmp;
+    krb5_error_code ret;
+
+    tmp = realloc(r->keys, (r->len + 1) * sizeof(r->keys[0]));
+    if (tmp == NULL)
+	return krb5_enomem(context);
+    r->keys = tmp;
+    ret = hdb_principal2key(context, entry->entry.principal,
+			    &r->keys[r->len]);
+    if (ret)
+	return ret;
+    r->len++;
+    return 0;
+}
+
+static krb5_error_code
+rebuild_one(krb5_context context, HDB *db, krb5_data key)
+{
+    krb5_data value, ckey, cvalue;
+    krb5_error_code ret;
+    hdb_entry ent;
+
+    ret = db->hdb__get(context, db, key, &value);
+    if (ret)
+	return ret;
+    memset(&ent, 0, sizeof(ent));
+    ret = hdb_value2entry(context, &value, &ent);
+    krb5_data_free(&value);
+    if (ret)
+	return ret;
+    ret = hdb_entry2compact(context, &ent, &cvalue);
+    if (ret == 0) {
+	ret = compact_key(context, ent.principal, &ckey);
+	if (ret == 0) {
+	    ret = db->hdb__put(context, db, HDB_F_REPLACE, ckey, cvalue);
+	    krb5_data_free(&ckey);
+	}
+	krb5_data_free(&cvalue);
+    }
+    free_hdb_entry(&ent);
+    return ret;
+}
+
+/**
+ * Write the compact records of all the entries of `db', which must
+ * be open for writing.  Used after turning on [hdb] compact-entries,
+ * or to restore the records dropped by writers without it.
+ *
+ * The database is write-locked throughout, so that no entry changes
+ * between being read and having its compact record written.
+ */
+
+krb5_error_code
+hdb_rebuild_compact(krb5_context context, HDB *db)
+{
+    struct rebuild r;
+    krb5_error_code ret, ret2;
+    size_t i;
+
+    if (db->hdb__put == NULL || db->hdb_fetch_kvno != _hdb_fetch_kvno) {
+	krb5_set_error_message(context, HDB_ERR_NOT_FOUND_HERE,
+			       "%s does not support compact entries",
+			       db->hdb_name);
+	return HDB_ERR_NOT_FOUND_HERE;
+    }
+
+    ret = db->hdb_lock(context, db, HDB_WLOCK);
+    if (ret)
+	return ret;
+
+    r.len = 0;
+    r.keys = NULL;
+    ret = hdb_foreach(context, db, 0, rebuild_entry, &r);
+    for (i = 0; ret == 0 && i < r.len; i++) {
+	ret = rebuild_one(context, db, r.keys[i]);
+	if (ret == HDB_ERR_NOENTRY)
+	    ret = 0;
+    }
+
+    ret2 = db->hdb_unlock(context, db);
+    for (i = 0; i < r.len; i++)
+	krb5_data_free(&r.keys[i]);
+    free(r.keys);
+    return ret ? ret : ret2;
+}
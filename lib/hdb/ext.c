@@ -34,11 +34,126 @@
 #include "hdb_locl.h"
 #include <der.h>
 
+/*
+ * Entries fetched with _hdb_fetch_kvno() have their extensions left
+ * undecoded: a single unknown, non-mandatory extension holds the DER
+ * of the whole HDB-extensions, and is decoded the first time any of
+ * them is looked at.  Genuine unknown extensions hold the DER of a
+ * CHOICE alternative, which has a context tag, never a SEQUENCE.
+ */
+
+static int
+is_lazy(const HDB_extensions *exts)
+{
+    const heim_octet_string *os;
+
+    if (exts == NULL || exts->len != 1 || exts->val[0].mandatory ||
+	exts->val[0].data.element != choice_HDB_extension_data_asn1_ellipsis)
+	return 0;
+    os = &exts->val[0].data.u.asn1_ellipsis;
+    return os->length > 0 &&
+	((unsigned char *)os->data)[0] == MAKE_TAG(ASN1_C_UNIV, CONS, UT_Sequence);
+}
+
+/*
+ * Set the extensions of `ent' to the HDB-extensions in `der', to be
+ * decoded when first used.
+ */
+
+krb5_error_code
+_hdb_lazy_extensions(hdb_entry *ent, const void *der, size_t len)
+{
+    HDB_extensions *exts;
+
+    exts = calloc(1, sizeof(*exts));
+    if (exts == NULL)
+	return ENOMEM;
+    exts->val = calloc(1, sizeof(exts->val[0]));
+    if (exts->val == NULL ||
+	(exts->val[0].data.u.asn1_ellipsis.data = malloc(len)) == NULL) {
+	free(exts->val);
+	free(exts);
+	return ENOMEM;
+    }
+    exts->len = 1;
+    exts->val[0].data.element = choice_HDB_extension_data_asn1_ellipsis;
+    exts->val[0].data.u.asn1_ellipsis.length = len;
+    memcpy(exts->val[0].data.u.asn1_ellipsis.data, der, len);
+    if (!is_lazy(exts)) {
+	free_HDB_extensions(exts);
+	free(exts);
+	return ASN1_BAD_ID;
+    }
+    ent->extensions = exts;
+    return 0;
+}
+
+/*
+ * Decode the extensions of `ent' if they are not yet.  This is done
+ * in place, so that ent->extensions stays where it was, and an entry
+ * whose extensions turn out empty keeps them, to encode as it did.
+ */
+
+krb5_error_code
+_hdb_expand_extensions(hdb_entry *ent)
+{
+    HDB_extensions exts;
+    heim_octet_string *os;
+    int ret;
+
+    if (!is_lazy(ent->extensions))
+	return 0;
+
+    os = &ent->extensions->val[0].data.u.asn1_ellipsis;
+    ret = decode_HDB_extensions(os->data, os->length, &exts, NULL);
+    if (ret)
+	return ret;
+    free_HDB_extensions(ent->extensions);
+    *ent->extensions = exts;
+    return 0;
+}
+
+/*
+ * As hdb_find_extension(), but extensions that do not decode are an
+ * error, where hdb_find_extension() can only say there is no such
+ * extension.  `context' may be NULL.
+ */
+
+krb5_error_code
+_hdb_find_extension(krb5_context context, const hdb_entry *entry, int type,
+		    HDB_extension **ext)
+{
+    size_t i;
+    int ret;
+
+    *ext = NULL;
+    ret = _hdb_expand_extensions(rk_UNCONST(entry));
+    if (ret) {
+	krb5_set_error_message(context, ret, "hdb: failed to decode "
+			       "hdb extensions");
+	return ret;
+    }
+    if (entry->extensions == NULL)
+	return 0;
+
+    for (i = 0; i < entry->extensions->len; i++) {
+	if (entry->extensions->val[i].data.element == (unsigned)type) {
+	    *ext = &entry->extensions->val[i];
+	    break;
+	}
+    }
+    return 0;
+}
+
 krb5_error_code
 hdb_entry_check_mandatory(krb5_context context, const hdb_entry *ent)
 {
     size_t i;
+    int ret;
 
+    ret = _hdb_expand_extensions(rk_UNCONST(ent));
+    if (ret)
+	return ret;
     if (ent->extensions == NULL)
 	return 0;
 
@@ -63,15 +178,10 @@ hdb_entry_check_mandatory(krb5_context context, const hdb_entry *ent)
 HDB_extension *
 hdb_find_extension(const hdb_entry *entry, int type)
 {
-    size_t i;
-
-    if (entry->extensions == NULL)
-	return NULL;
+    HDB_extension *ext;
 
-    for (i = 0; i < entry->extensions->len; i++)
-	if (entry->extensions->val[i].data.element == (unsigned)type)
-	    return &entry->extensions->val[i];
-    return NULL;
+    (void) _hdb_find_extension(NULL, entry, type, &ext);
+    return ext;
 }
 
 /*
@@ -91,6 +201,12 @@ hdb_replace_extension(krb5_context context,
 
     ext2 = NULL;
 
+    ret = _hdb_expand_extensions(entry);
+    if (ret) {
+	krb5_set_error_message(context, ret, "hdb: failed to decode "
+			       "hdb extensions");
+	return ret;
+    }
     if (entry->extensions == NULL) {
 	entry->extensions = calloc(1, sizeof(*entry->extensions));
 	if (entry->extensions == NULL) {
@@ -181,7 +297,11 @@ hdb_clear_extension(krb5_context context,
 		    int type)
 {
     size_t i;
+    int ret;
 
+    ret = _hdb_expand_extensions(entry);
+    if (ret)
+	return ret;
     if (entry->extensions == NULL)
 	return 0;
 
@@ -207,57 +327,65 @@ hdb_clear_extension(krb5_context context,
 krb5_error_code
 hdb_entry_get_pkinit_acl(const hdb_entry *entry, const HDB_Ext_PKINIT_acl **a)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_pkinit_acl);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_pkinit_acl, &ext);
     if (ext)
 	*a = &ext->data.u.pkinit_acl;
     else
 	*a = NULL;
 
-    return 0;
+    return ret;
 }
 
 krb5_error_code
 hdb_entry_get_pkinit_hash(const hdb_entry *entry, const HDB_Ext_PKINIT_hash **a)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_pkinit_cert_hash);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_pkinit_cert_hash, &ext);
     if (ext)
 	*a = &ext->data.u.pkinit_cert_hash;
     else
 	*a = NULL;
 
-    return 0;
+    return ret;
 }
 
 krb5_error_code
 hdb_entry_get_pkinit_cert(const hdb_entry *entry, const HDB_Ext_PKINIT_cert **a)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_pkinit_cert);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_pkinit_cert, &ext);
     if (ext)
 	*a = &ext->data.u.pkinit_cert;
     else
 	*a = NULL;
 
-    return 0;
+    return ret;
 }
 
 krb5_error_code
 hdb_entry_get_pw_change_time(const hdb_entry *entry, time_t *t)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_last_pw_change);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_last_pw_change, &ext);
     if (ext)
 	*t = ext->data.u.last_pw_change;
     else
 	*t = 0;
 
-    return 0;
+    return ret;
 }
 
 krb5_error_code
@@ -284,7 +412,10 @@ hdb_entry_get_password(krb5_context context, HDB *db,
     char *str;
     int ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_password);
+    ret = _hdb_find_extension(context, entry,
+			      choice_HDB_extension_data_password, &ext);
+    if (ret)
+	return ret;
     if (ext) {
 	heim_utf8_string xstr;
 	heim_octet_string pw;
@@ -407,30 +538,34 @@ krb5_error_code
 hdb_entry_get_ConstrainedDelegACL(const hdb_entry *entry,
 				  const HDB_Ext_Constrained_delegation_acl **a)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry,
-			     choice_HDB_extension_data_allowed_to_delegate_to);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_allowed_to_delegate_to,
+			      &ext);
     if (ext)
 	*a = &ext->data.u.allowed_to_delegate_to;
     else
 	*a = NULL;
 
-    return 0;
+    return ret;
 }
 
 krb5_error_code
 hdb_entry_get_aliases(const hdb_entry *entry, const HDB_Ext_Aliases **a)
 {
-    const HDB_extension *ext;
+    HDB_extension *ext;
+    krb5_error_code ret;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_aliases);
+    ret = _hdb_find_extension(NULL, entry,
+			      choice_HDB_extension_data_aliases, &ext);
     if (ext)
 	*a = &ext->data.u.aliases;
     else
 	*a = NULL;
 
-    return 0;
+    return ret;
 }
 
 unsigned int
@@ -54,8 +54,32 @@ static char *structural_object;
 static const char *default_ldap_url = "ldapi:///";
 static krb5_boolean samba_forwardable;
 
+#define HDB_LDAP_MAX_CONNS	16	/* connections in the pool, at most */
+#define HDB_LDAP_RETRY		2	/* seconds before reconnecting */
+#define HDB_LDAP_CACHE_SIZE	64	/* cached lookups */
+
+struct hdbldapconn {
+    LDAP *lp;
+    time_t retry;		/* don't try to connect before this */
+};
+
+/*
+ * Recently looked up entries, keys still sealed, and principals that
+ * were not found.  Off unless hdb-ldap-cache-ttl is set, and entries
+ * should only be kept for a few seconds, as other servers may change
+ * the directory behind our back.
+ */
+struct hdbldapcache {
+    char *name;
+    unsigned flags;		/* HDB_F_ADMIN_DATA */
+    time_t expires;
+    int found;
+    hdb_entry entry;
+};
+
 struct hdbldapdb {
-    LDAP *h_lp;
+    LDAP *h_lp;			/* connection in use, one of h_conns */
+    LDAP *h_seq_lp;		/* connection of the firstkey/nextkey search */
     int   h_msgid;
     char *h_base;
     char *h_url;
@@ -63,6 +87,13 @@ struct hdbldapdb {
     char *h_bind_password;
     krb5_boolean h_start_tls;
     char *h_createbase;
+    struct hdbldapconn h_conns[HDB_LDAP_MAX_CONNS];
+    size_t h_nconns;
+    size_t h_next;		/* next connection to use */
+    int h_timeout;
+    time_t h_cache_ttl;
+    time_t h_negative_cache_ttl;
+    struct hdbldapcache h_cache[HDB_LDAP_CACHE_SIZE];
 };
 
 #define HDB2LDAP(db) (((struct hdbldapdb *)(db)->hdb_db)->h_lp)
@@ -135,6 +166,30 @@ LDAP_no_size_limit(krb5_context context, LDAP *lp)
     return 0;
 }
 
+/*
+ * Close the connection in use, after it failed; the next LDAP__connect()
+ * reconnects it or moves on to another connection of the pool.
+ */
+static void
+LDAP__drop(krb5_context context, HDB *db)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    size_t i;
+
+    if (h->h_lp == NULL)
+	return;
+    for (i = 0; i < h->h_nconns; i++) {
+	if (h->h_conns[i].lp == h->h_lp)
+	    h->h_conns[i].lp = NULL;
+    }
+    if (h->h_seq_lp == h->h_lp) {
+	h->h_seq_lp = NULL;
+	h->h_msgid = -1;
+    }
+    ldap_unbind_ext(h->h_lp, NULL, NULL);
+    h->h_lp = NULL;
+}
+
 static int
 check_ldap(krb5_context context, HDB *db, int ret)
 {
@@ -142,13 +197,151 @@ check_ldap(krb5_context context, HDB *db, int ret)
     case LDAP_SUCCESS:
 	return 0;
     case LDAP_SERVER_DOWN:
-	LDAP_close(context, db);
+    case LDAP_TIMEOUT:
+	LDAP__drop(context, db);
 	return 1;
     default:
 	return 1;
     }
 }
 
+/*
+ * Wait for all the results of the search msgid on the connection in
+ * use, but no longer than hdb-ldap-timeout; a search that takes longer
+ * is abandoned.  Returns the LDAP result code of the search.
+ */
+static int
+LDAP__result(krb5_context context, HDB *db, int msgid, LDAPMessage **res)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    struct timeval tv;
+    int rc;
+
+    *res = NULL;
+    tv.tv_sec = h->h_timeout;
+    tv.tv_usec = 0;
+
+    rc = ldap_result(h->h_lp, msgid, LDAP_MSG_ALL, &tv, res);
+    if (rc == 0) {
+	ldap_abandon_ext(h->h_lp, msgid, NULL, NULL);
+	return LDAP_TIMEOUT;
+    }
+    if (rc < 0) {
+	if (ldap_get_option(h->h_lp, LDAP_OPT_RESULT_CODE, &rc) != 0 ||
+	    rc == LDAP_SUCCESS)
+	    rc = LDAP_SERVER_DOWN;
+	return rc;
+    }
+    return ldap_result2error(h->h_lp, *res, 0);
+}
+
+/* Search on the connection in use and wait for the results */
+static int
+LDAP__search(krb5_context context, HDB *db, const char *base,
+	     const char *filter, char **attrs, LDAPMessage **res)
+{
+    int rc, msgid;
+
+    *res = NULL;
+    rc = ldap_search_ext(HDB2LDAP(db), base, LDAP_SCOPE_SUBTREE, filter,
+			 attrs, 0, NULL, NULL, NULL, 0, &msgid);
+    if (rc != LDAP_SUCCESS)
+	return rc;
+    return LDAP__result(context, db, msgid, res);
+}
+
+static void
+LDAP__cache_clear(krb5_context context, struct hdbldapcache *c)
+{
+    free(c->name);
+    if (c->found)
+	free_hdb_entry(&c->entry);
+    memset(c, 0, sizeof(*c));
+}
+
+static struct hdbldapcache *
+LDAP__cache_find(krb5_context context, HDB *db, const char *name,
+		 unsigned flags)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    time_t now = time(NULL);
+    size_t i;
+
+    for (i = 0; i < HDB_LDAP_CACHE_SIZE; i++) {
+	struct hdbldapcache *c = &h->h_cache[i];
+
+	if (c->name == NULL || c->flags != flags || strcmp(c->name, name) != 0)
+	    continue;
+	if (c->expires > now)
+	    return c;
+	LDAP__cache_clear(context, c);
+	break;
+    }
+    return NULL;
+}
+
+/* Remember the result of looking up name, entry is NULL if not found */
+static void
+LDAP__cache_add(krb5_context context, HDB *db, const char *name,
+		unsigned flags, const hdb_entry *entry)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    struct hdbldapcache *c = NULL;
+    time_t ttl = entry ? h->h_cache_ttl : h->h_negative_cache_ttl;
+    size_t i;
+
+    if (ttl <= 0)
+	return;
+
+    /* Reuse the same name's slot, else an empty one, else the oldest */
+    for (i = 0; i < HDB_LDAP_CACHE_SIZE; i++) {
+	struct hdbldapcache *t = &h->h_cache[i];
+
+	if (t->name != NULL && t->flags == flags && strcmp(t->name, name) == 0) {
+	    c = t;
+	    break;
+	}
+	if (c == NULL || (c->name != NULL &&
+			  (t->name == NULL || t->expires < c->expires)))
+	    c = t;
+    }
+    LDAP__cache_clear(context, c);
+
+    if ((c->name = strdup(name)) == NULL)
+	return;
+    if (entry != NULL) {
+	if (copy_hdb_entry(entry, &c->entry) != 0) {
+	    LDAP__cache_clear(context, c);
+	    return;
+	}
+	c->found = 1;
+    }
+    c->flags = flags;
+    c->expires = time(NULL) + ttl;
+}
+
+/* Forget what we know about principal, when it is changed or removed */
+static void
+LDAP__cache_forget(krb5_context context, HDB *db,
+		   krb5_const_principal principal)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    char *name;
+    size_t i;
+
+    if (krb5_unparse_name(context, principal, &name) != 0) {
+	/* Can't tell which, so forget everything */
+	for (i = 0; i < HDB_LDAP_CACHE_SIZE; i++)
+	    LDAP__cache_clear(context, &h->h_cache[i]);
+	return;
+    }
+    for (i = 0; i < HDB_LDAP_CACHE_SIZE; i++) {
+	if (h->h_cache[i].name != NULL && strcmp(h->h_cache[i].name, name) == 0)
+	    LDAP__cache_clear(context, &h->h_cache[i]);
+    }
+    free(name);
+}
+
 static krb5_error_code
 LDAP__setmod(LDAPMod *** modlist, int modop, const char *attribute,
 	     int *pIndex)
@@ -518,6 +711,11 @@ LDAP_entry2mods(krb5_context context, HDB * db, hdb_entry_ex * ent,
 	    goto out;
     }
 
+    /* Entries fetched from the other backends may not have them decoded */
+    ret = _hdb_expand_extensions(&ent->entry);
+    if (ret)
+	goto out;
+
     if (is_heimdal_entry && ent->entry.extensions) {
 	if (!is_new_entry) {
 	    vals = ldap_get_values_len(HDB2LDAP(db), msg, "krb5ExtendedAttributes");
@@ -786,13 +984,10 @@ LDAP_dn2principal(krb5_context context, HDB * db, const char *dn,
     if (ret)
 	goto out;
 
-    rc = ldap_search_ext_s(HDB2LDAP(db), dn, LDAP_SCOPE_SUBTREE,
-			   filter, krb5principal_attrs, 0,
-			   NULL, NULL, NULL,
-			   0, &res);
+    rc = LDAP__search(context, db, dn, filter, krb5principal_attrs, &res);
     if (check_ldap(context, db, rc)) {
 	ret = HDB_ERR_NOENTRY;
-	krb5_set_error_message(context, ret, "ldap_search_ext_s: "
+	krb5_set_error_message(context, ret, "ldap_search_ext: "
 			       "filter: %s error: %s",
 			       filter, ldap_err2string(rc));
 	goto out;
@@ -863,6 +1058,46 @@ escape_value(krb5_context context, const char *unquoted, char **quoted)
 }
 
 
+/*
+ * Look for an entry matching filter, or else one matching filter2 if
+ * that is not NULL.  Both searches are sent at once, so that a lookup
+ * that falls back on the second costs one round trip, not two.
+ */
+static int
+LDAP__lookup_filters(krb5_context context, HDB *db, const char *filter,
+		     const char *filter2, LDAPMessage **msg)
+{
+    int rc, msgid, msgid2 = -1;
+
+    *msg = NULL;
+
+    rc = ldap_search_ext(HDB2LDAP(db), HDB2BASE(db), LDAP_SCOPE_SUBTREE,
+			 filter, krb5kdcentry_attrs, 0,
+			 NULL, NULL, NULL, 0, &msgid);
+    if (rc != LDAP_SUCCESS)
+	return rc;
+    if (filter2) {
+	rc = ldap_search_ext(HDB2LDAP(db), HDB2BASE(db), LDAP_SCOPE_SUBTREE,
+			     filter2, krb5kdcentry_attrs, 0,
+			     NULL, NULL, NULL, 0, &msgid2);
+	if (rc != LDAP_SUCCESS) {
+	    ldap_abandon_ext(HDB2LDAP(db), msgid, NULL, NULL);
+	    return rc;
+	}
+    }
+
+    rc = LDAP__result(context, db, msgid, msg);
+    if (rc != LDAP_SUCCESS || msgid2 < 0 ||
+	ldap_count_entries(HDB2LDAP(db), *msg) > 0) {
+	if (msgid2 >= 0)
+	    ldap_abandon_ext(HDB2LDAP(db), msgid2, NULL, NULL);
+	return rc;
+    }
+
+    ldap_msgfree(*msg);
+    return LDAP__result(context, db, msgid2, msg);
+}
+
 static krb5_error_code
 LDAP__lookup_princ(krb5_context context,
 		   HDB *db,
@@ -870,13 +1105,13 @@ LDAP__lookup_princ(krb5_context context,
 		   const char *userid,
 		   LDAPMessage **msg)
 {
+    struct hdbldapdb *h = db->hdb_db;
     krb5_error_code ret;
     int rc;
-    char *quote, *filter = NULL;
+    size_t tries;
+    char *quote, *filter = NULL, *filter2 = NULL;
 
-    ret = LDAP__connect(context, db);
-    if (ret)
-	return ret;
+    *msg = NULL;
 
     /*
      * Quote searches that contain filter language, this quote
@@ -898,34 +1133,12 @@ LDAP__lookup_princ(krb5_context context,
 	goto out;
     }
 
-    ret = LDAP_no_size_limit(context, HDB2LDAP(db));
-    if (ret)
-	goto out;
-
-    rc = ldap_search_ext_s(HDB2LDAP(db), HDB2BASE(db),
-			   LDAP_SCOPE_SUBTREE, filter,
-			   krb5kdcentry_attrs, 0,
-			   NULL, NULL, NULL,
-			   0, msg);
-    if (check_ldap(context, db, rc)) {
-	ret = HDB_ERR_NOENTRY;
-	krb5_set_error_message(context, ret, "ldap_search_ext_s: "
-			      "filter: %s - error: %s",
-			      filter, ldap_err2string(rc));
-	goto out;
-    }
-
-    if (userid && ldap_count_entries(HDB2LDAP(db), *msg) == 0) {
-	free(filter);
-	filter = NULL;
-	ldap_msgfree(*msg);
-	*msg = NULL;
-
+    if (userid) {
 	ret = escape_value(context, userid, &quote);
 	if (ret)
 	    goto out;
 
-	rc = asprintf(&filter,
+	rc = asprintf(&filter2,
 	    "(&(|(objectClass=sambaSamAccount)(objectClass=%s))(uid=%s))",
 		      structural_object, quote);
 	free(quote);
@@ -934,29 +1147,44 @@ LDAP__lookup_princ(krb5_context context,
 	    krb5_set_error_message(context, ret, "asprintf: out of memory");
 	    goto out;
 	}
+    }
 
-	ret = LDAP_no_size_limit(context, HDB2LDAP(db));
+    /*
+     * If the connection turns out to be broken try again on the next
+     * connection of the pool, or a new one.  A server that doesn't
+     * answer in time is not asked again.
+     */
+    for (tries = 0; ; tries++) {
+	ret = LDAP__connect(context, db);
 	if (ret)
 	    goto out;
 
-	rc = ldap_search_ext_s(HDB2LDAP(db), HDB2BASE(db), LDAP_SCOPE_SUBTREE,
-			       filter, krb5kdcentry_attrs, 0,
-			       NULL, NULL, NULL,
-			       0, msg);
-	if (check_ldap(context, db, rc)) {
-	    ret = HDB_ERR_NOENTRY;
-	    krb5_set_error_message(context, ret,
-				   "ldap_search_ext_s: filter: %s error: %s",
-				   filter, ldap_err2string(rc));
+	ret = LDAP_no_size_limit(context, HDB2LDAP(db));
+	if (ret)
 	    goto out;
+
+	rc = LDAP__lookup_filters(context, db, filter, filter2, msg);
+	if (rc == LDAP_SUCCESS)
+	    break;
+	if (*msg) {
+	    ldap_msgfree(*msg);
+	    *msg = NULL;
 	}
+	if (check_ldap(context, db, rc) && rc == LDAP_SERVER_DOWN &&
+	    tries < h->h_nconns)
+	    continue;
+	ret = HDB_ERR_NOENTRY;
+	krb5_set_error_message(context, ret, "ldap_search_ext: "
+			      "filter: %s - error: %s",
+			      filter, ldap_err2string(rc));
+	goto out;
     }
 
     ret = 0;
 
   out:
-    if (filter)
-	free(filter);
+    free(filter);
+    free(filter2);
 
     return ret;
 }
@@ -1470,10 +1698,18 @@ out:
 static krb5_error_code
 LDAP_close(krb5_context context, HDB * db)
 {
-    if (HDB2LDAP(db)) {
-	ldap_unbind_ext(HDB2LDAP(db), NULL, NULL);
-	((struct hdbldapdb *)db->hdb_db)->h_lp = NULL;
+    struct hdbldapdb *h = db->hdb_db;
+    size_t i;
+
+    for (i = 0; i < h->h_nconns; i++) {
+	if (h->h_conns[i].lp) {
+	    ldap_unbind_ext(h->h_conns[i].lp, NULL, NULL);
+	    h->h_conns[i].lp = NULL;
+	}
     }
+    h->h_lp = NULL;
+    h->h_seq_lp = NULL;
+    h->h_msgid = -1;
 
     return 0;
 }
@@ -1501,6 +1737,9 @@ LDAP_seq(krb5_context context, HDB * db, unsigned flags, hdb_entry_ex * entry)
     if (msgid < 0)
 	return HDB_ERR_NOENTRY;
 
+    /* Other lookups may have moved on to other connections meanwhile */
+    HDB2LDAP(db) = ((struct hdbldapdb *)db->hdb_db)->h_seq_lp;
+
     do {
 	rc = ldap_result(HDB2LDAP(db), msgid, LDAP_MSG_ONE, NULL, &e);
 	switch (rc) {
@@ -1529,7 +1768,7 @@ LDAP_seq(krb5_context context, HDB * db, unsigned flags, hdb_entry_ex * entry)
 	    break;
 	case LDAP_SERVER_DOWN:
 	    ldap_msgfree(e);
-	    LDAP_close(context, db);
+	    LDAP__drop(context, db);
 	    HDBSETMSGID(db, -1);
 	    ret = ENETDOWN;
 	    break;
@@ -1578,6 +1817,7 @@ LDAP_firstkey(krb5_context context, HDB *db, unsigned flags,
 	return HDB_ERR_NOENTRY;
 
     HDBSETMSGID(db, msgid);
+    ((struct hdbldapdb *)db->hdb_db)->h_seq_lp = HDB2LDAP(db);
 
     return LDAP_seq(context, db, flags, entry);
 }
@@ -1590,8 +1830,10 @@ LDAP_nextkey(krb5_context context, HDB * db, unsigned flags,
 }
 
 static krb5_error_code
-LDAP__connect(krb5_context context, HDB * db)
+LDAP__connect_one(krb5_context context, HDB * db, struct hdbldapconn *c)
 {
+    struct hdbldapdb *h = db->hdb_db;
+    struct timeval tv;
     int rc, version = LDAP_VERSION3;
     /*
      * Empty credentials to do a SASL bind with LDAP. Note that empty
@@ -1611,61 +1853,106 @@ LDAP__connect(krb5_context context, HDB * db)
 	bv.bv_len = strlen(bv.bv_val);
     }
 
-    if (HDB2LDAP(db)) {
+    if (c->lp) {
 	/* connection has been opened. ping server. */
 	struct sockaddr_un addr;
 	socklen_t len = sizeof(addr);
 	int sd;
 
-	if (ldap_get_option(HDB2LDAP(db), LDAP_OPT_DESC, &sd) == 0 &&
+	if (ldap_get_option(c->lp, LDAP_OPT_DESC, &sd) == 0 &&
 	    getpeername(sd, (struct sockaddr *) &addr, &len) < 0) {
 	    /* the other end has died. reopen. */
-	    LDAP_close(context, db);
+	    ldap_unbind_ext(c->lp, NULL, NULL);
+	    c->lp = NULL;
 	}
     }
 
-    if (HDB2LDAP(db) != NULL) /* server is UP */
+    if (c->lp != NULL) /* server is UP */
 	return 0;
 
-    rc = ldap_initialize(&((struct hdbldapdb *)db->hdb_db)->h_lp, HDB2URL(db));
+    rc = ldap_initialize(&c->lp, HDB2URL(db));
     if (rc != LDAP_SUCCESS) {
 	krb5_set_error_message(context, HDB_ERR_NOENTRY, "ldap_initialize: %s",
 			       ldap_err2string(rc));
 	return HDB_ERR_NOENTRY;
     }
 
-    rc = ldap_set_option(HDB2LDAP(db), LDAP_OPT_PROTOCOL_VERSION,
+    /* Don't let a dead server hold up connecting or binding for long */
+    tv.tv_sec = h->h_timeout;
+    tv.tv_usec = 0;
+    (void) ldap_set_option(c->lp, LDAP_OPT_NETWORK_TIMEOUT, &tv);
+    (void) ldap_set_option(c->lp, LDAP_OPT_TIMEOUT, &tv);
+
+    rc = ldap_set_option(c->lp, LDAP_OPT_PROTOCOL_VERSION,
 			 (const void *)&version);
     if (rc != LDAP_SUCCESS) {
 	krb5_set_error_message(context, HDB_ERR_BADVERSION,
 			       "ldap_set_option: %s", ldap_err2string(rc));
-	LDAP_close(context, db);
+	ldap_unbind_ext(c->lp, NULL, NULL);
+	c->lp = NULL;
 	return HDB_ERR_BADVERSION;
     }
 
     if (((struct hdbldapdb *)db->hdb_db)->h_start_tls) {
-	rc = ldap_start_tls_s(HDB2LDAP(db), NULL, NULL);
+	rc = ldap_start_tls_s(c->lp, NULL, NULL);
 
 	if (rc != LDAP_SUCCESS) {
 	    krb5_set_error_message(context, HDB_ERR_BADVERSION,
 				   "ldap_start_tls_s: %s", ldap_err2string(rc));
-	    LDAP_close(context, db);
+	    ldap_unbind_ext(c->lp, NULL, NULL);
+	    c->lp = NULL;
 	    return HDB_ERR_BADVERSION;
 	}
     }
 
-    rc = ldap_sasl_bind_s(HDB2LDAP(db), bind_dn, sasl_method, &bv,
+    rc = ldap_sasl_bind_s(c->lp, bind_dn, sasl_method, &bv,
 			  NULL, NULL, NULL);
     if (rc != LDAP_SUCCESS) {
 	krb5_set_error_message(context, HDB_ERR_BADVERSION,
 			      "ldap_sasl_bind_s: %s", ldap_err2string(rc));
-	LDAP_close(context, db);
+	ldap_unbind_ext(c->lp, NULL, NULL);
+	c->lp = NULL;
 	return HDB_ERR_BADVERSION;
     }
 
     return 0;
 }
 
+/*
+ * Make the next connection of the pool the one in use, connecting it if
+ * need be.  Lookups go round the pool, so a broken connection is noticed
+ * and replaced while the others carry on.  A connection that could not
+ * be made is not tried again for HDB_LDAP_RETRY seconds.
+ */
+static krb5_error_code
+LDAP__connect(krb5_context context, HDB * db)
+{
+    struct hdbldapdb *h = db->hdb_db;
+    krb5_error_code ret = 0;
+    time_t now = time(NULL);
+    size_t i, n;
+
+    for (i = 0; i < h->h_nconns; i++) {
+	n = (h->h_next + i) % h->h_nconns;
+	if (h->h_conns[n].lp == NULL && h->h_conns[n].retry > now)
+	    continue;
+	ret = LDAP__connect_one(context, db, &h->h_conns[n]);
+	if (ret == 0) {
+	    h->h_lp = h->h_conns[n].lp;
+	    h->h_next = (n + 1) % h->h_nconns;
+	    return 0;
+	}
+	h->h_conns[n].retry = now + HDB_LDAP_RETRY;
+    }
+    h->h_lp = NULL;
+    if (ret == 0) {
+	ret = HDB_ERR_NOENTRY;
+	krb5_set_error_message(context, ret, "hdb-ldap: could not connect "
+			       "recently, not retrying yet");
+    }
+    return ret;
+}
+
 static krb5_error_code
 LDAP_open(krb5_context context, HDB * db, int flags, mode_t mode)
 {
@@ -1689,30 +1976,53 @@ static krb5_error_code
 LDAP_fetch_kvno(krb5_context context, HDB * db, krb5_const_principal principal,
 		unsigned flags, krb5_kvno kvno, hdb_entry_ex * entry)
 {
-    LDAPMessage *msg, *e;
+    LDAPMessage *msg = NULL, *e;
+    struct hdbldapcache *c;
     krb5_error_code ret;
+    char *name;
 
-    ret = LDAP_principal2message(context, db, principal, &msg);
+    ret = krb5_unparse_name(context, principal, &name);
     if (ret)
 	return ret;
 
-    e = ldap_first_entry(HDB2LDAP(db), msg);
-    if (e == NULL) {
+    c = LDAP__cache_find(context, db, name, flags & HDB_F_ADMIN_DATA);
+    if (c != NULL && !c->found) {
 	ret = HDB_ERR_NOENTRY;
 	goto out;
-    }
+    } else if (c != NULL) {
+	memset(entry, 0, sizeof(*entry));
+	ret = copy_hdb_entry(&c->entry, &entry->entry);
+	if (ret)
+	    goto out;
+    } else {
+	ret = LDAP_principal2message(context, db, principal, &msg);
+	if (ret)
+	    goto out;
 
-    ret = LDAP_message2entry(context, db, e, flags, entry);
-    if (ret == 0) {
-	if (db->hdb_master_key_set && (flags & HDB_F_DECRYPT)) {
-	    ret = hdb_unseal_keys(context, db, &entry->entry);
-	    if (ret)
-		hdb_free_entry(context, entry);
+	e = ldap_first_entry(HDB2LDAP(db), msg);
+	if (e == NULL) {
+	    LDAP__cache_add(context, db, name, flags & HDB_F_ADMIN_DATA, NULL);
+	    ret = HDB_ERR_NOENTRY;
+	    goto out;
 	}
+
+	ret = LDAP_message2entry(context, db, e, flags, entry);
+	if (ret)
+	    goto out;
+	LDAP__cache_add(context, db, name, flags & HDB_F_ADMIN_DATA,
+			&entry->entry);
+    }
+
+    if (db->hdb_master_key_set && (flags & HDB_F_DECRYPT)) {
+	ret = hdb_unseal_keys(context, db, &entry->entry);
+	if (ret)
+	    hdb_free_entry(context, entry);
     }
 
   out:
-    ldap_msgfree(msg);
+    if (msg)
+	ldap_msgfree(msg);
+    free(name);
 
     return ret;
 }
@@ -1796,6 +2106,7 @@ LDAP_store(krb5_context context, HDB * db, unsigned flags,
 			      errfn, name, dn, ldap_err2string(rc), ld_error);
     } else
 	ret = 0;
+    LDAP__cache_forget(context, db, entry->entry.principal);
 
   out:
     /* free stuff */
@@ -1854,6 +2165,7 @@ LDAP_remove(krb5_context context, HDB *db,
 			       ldap_err2string(rc));
     } else
 	ret = 0;
+    LDAP__cache_forget(context, db, principal);
 
   out:
     if (dn != NULL)
@@ -1867,9 +2179,13 @@ LDAP_remove(krb5_context context, HDB *db,
 static krb5_error_code
 LDAP_destroy(krb5_context context, HDB * db)
 {
+    struct hdbldapdb *h = db->hdb_db;
     krb5_error_code ret;
+    size_t i;
 
     LDAP_close(context, db);
+    for (i = 0; i < HDB_LDAP_CACHE_SIZE; i++)
+	LDAP__cache_clear(context, &h->h_cache[i]);
 
     ret = hdb_clear_master_key(context, db);
     if (HDB2BASE(db))
@@ -1895,6 +2211,7 @@ hdb_ldap_common(krb5_context context,
     struct hdbldapdb *h;
     const char *create_base = NULL;
     const char *ldap_secret_file = NULL;
+    int nconns;
 
     if (url == NULL || url[0] == '\0') {
 	const char *p;
@@ -1990,6 +2307,27 @@ hdb_ldap_common(krb5_context context,
 	krb5_config_get_bool_default(context, NULL, FALSE,
 				     "kdc", "hdb-ldap-start-tls", NULL);
 
+    h->h_msgid = -1;
+    nconns = krb5_config_get_int_default(context, NULL, 2,
+					 "kdc", "hdb-ldap-connections", NULL);
+    if (nconns < 1)
+	nconns = 1;
+    else if (nconns > HDB_LDAP_MAX_CONNS)
+	nconns = HDB_LDAP_MAX_CONNS;
+    h->h_nconns = nconns;
+    h->h_timeout =
+	krb5_config_get_time_default(context, NULL, 10,
+				     "kdc", "hdb-ldap-timeout", NULL);
+    if (h->h_timeout < 1)
+	h->h_timeout = 1;
+    h->h_cache_ttl =
+	krb5_config_get_time_default(context, NULL, 0,
+				     "kdc", "hdb-ldap-cache-ttl", NULL);
+    h->h_negative_cache_ttl =
+	krb5_config_get_time_default(context, NULL, 0,
+				     "kdc", "hdb-ldap-negative-cache-ttl",
+				     NULL);
+
     create_base = krb5_config_get_string(context, NULL, "kdc",
 					 "hdb-ldap-create-base", NULL);
     if (create_base == NULL)
@@ -378,7 +378,10 @@ dup_similar_keys(krb5_context context, hdb_entry *entry)
     ret = dup_similar_keys_in_keyset(context, &entry->keys);
     if (ret)
 	return ret;
-    extp = hdb_find_extension(entry, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, entry,
+    			      choice_HDB_extension_data_hist_keys, &extp);
+    if (ret)
+    	return ret;
     if (extp == NULL)
 	return 0;
 
@@ -476,6 +476,7 @@ krb5_error_code
 hdb_create(krb5_context context, HDB **db, const char *filename)
 {
     struct cb_s cb_ctx;
+    krb5_error_code ret;
 
     if (filename == NULL)
 	filename = HDB_DEFAULT_DB;
@@ -495,5 +496,11 @@ hdb_create(krb5_context context, HDB **db, const char *filename)
     }
     if (cb_ctx.h == NULL)
 	krb5_errx(context, 1, "No database support for %s", cb_ctx.filename);
-    return (*cb_ctx.h->create)(context, db, cb_ctx.residual);
+    *db = NULL;
+    ret = (*cb_ctx.h->create)(context, db, cb_ctx.residual);
+    if (ret == 0 && *db != NULL && (*db)->hdb_fetch_kvno == _hdb_fetch_kvno &&
+	krb5_config_get_bool_default(context, NULL, FALSE,
+				     "hdb", "compact-entries", NULL))
+	(*db)->hdb_capability_flags |= HDB_CAP_F_COMPACT_ENTRIES;
+    return ret;
 }
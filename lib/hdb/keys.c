@@ -41,6 +41,7 @@ struct AlgorithmIdentifier;
 struct _krb5_krb_auth_data;
 typedef struct krb5_pk_init_ctx_data *krb5_pk_init_ctx;
 struct krb5_dh_moduli;
+struct rk_dns_reply;
 struct _krb5_key_data;
 struct _krb5_encryption_type;
 struct _krb5_key_type;
@@ -223,9 +224,13 @@ hdb_prune_keys(krb5_context context, hdb_entry *entry)
 {
     HDB_extension *ext;
     HDB_Ext_KeySet *keys;
+    krb5_error_code ret;
     size_t nelem;
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, entry,
+    			      choice_HDB_extension_data_hist_keys, &ext);
+    if (ret)
+    	return ret;
     if (ext == NULL)
 	return 0;
     keys = &ext->data.u.hist_keys;
@@ -293,7 +298,10 @@ hdb_add_current_keys_to_history(krb5_context context, hdb_entry *entry)
     if (entry->keys.len == 0)
 	return 0; /* nothing to do */
 
-    ext = hdb_find_extension(entry, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, entry,
+    			      choice_HDB_extension_data_hist_keys, &ext);
+    if (ret)
+    	return ret;
     if (ext == NULL) {
 	replace = TRUE;
 	ext = calloc(1, sizeof (*ext));
@@ -362,7 +370,10 @@ hdb_add_history_key(krb5_context context, hdb_entry *entry, krb5_kvno kvno, Key
     memset(&keyset, 0, sizeof (keyset));
     memset(&ext, 0, sizeof (ext));
 
-    extp = hdb_find_extension(entry, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, entry,
+    			      choice_HDB_extension_data_hist_keys, &extp);
+    if (ret)
+    	return ret;
     if (extp == NULL) {
 	ext.data.element = choice_HDB_extension_data_hist_keys;
 	extp = &ext;
@@ -421,7 +432,10 @@ hdb_change_kvno(krb5_context context, krb5_kvno new_kvno, hdb_entry *entry)
     if (entry->kvno == new_kvno)
 	return 0;
 
-    extp = hdb_find_extension(entry, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, entry,
+    			      choice_HDB_extension_data_hist_keys, &extp);
+    if (ret)
+    	return ret;
     if (extp == NULL) {
 	memset(&ext, 0, sizeof (ext));
 	ext.data.element = choice_HDB_extension_data_hist_keys;
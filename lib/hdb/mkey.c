@@ -507,7 +507,7 @@ krb5_error_code
 hdb_unseal_keys_kvno(krb5_context context, HDB *db, krb5_kvno kvno,
 		     unsigned flags, hdb_entry *ent)
 {
-    krb5_error_code ret = HDB_ERR_NOENTRY;
+    krb5_error_code ret;
     HDB_extension *ext;
     HDB_Ext_KeySet *hist_keys;
     Key *tmp_val;
@@ -519,9 +519,6 @@ hdb_unseal_keys_kvno(krb5_context context, HDB *db, krb5_kvno kvno,
     int exclude_dead = 0;
     KerberosTime now = 0;
 
-    if (kvno == 0)
-	ret = 0;
-
     if ((flags & HDB_F_LIVE_CLNT_KVNOS) || (flags & HDB_F_LIVE_SVC_KVNOS)) {
 	exclude_dead = 1;
 	now = time(NULL);
@@ -531,7 +528,10 @@ hdb_unseal_keys_kvno(krb5_context context, HDB *db, krb5_kvno kvno,
 	    kvno_diff = hdb_entry_get_kvno_diff_svc(ent);
     }
 
-    ext = hdb_find_extension(ent, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, ent,
+			      choice_HDB_extension_data_hist_keys, &ext);
+    if (ret)
+	return ret;
     if (ext == NULL || (&ext->data.u.hist_keys)->len == 0)
 	return hdb_unseal_keys_mkey(context, ent, db->hdb_master_key);
 
@@ -542,6 +542,7 @@ hdb_unseal_keys_kvno(krb5_context context, HDB *db, krb5_kvno kvno,
     (void) hdb_entry_get_pw_change_time(ent, &tmp_set_time);
 
     hist_keys = &ext->data.u.hist_keys;
+    ret = kvno == 0 ? 0 : HDB_ERR_NOENTRY;
 
     for (i = 0; i < hist_keys->len; i++) {
 	if (kvno != 0 && hist_keys->val[i].kvno != kvno)
@@ -632,6 +633,45 @@ hdb_unseal_key(krb5_context context, HDB *db, Key *k)
     return hdb_unseal_key_mkey(context, k, db->hdb_master_key);
 }
 
+/**
+ * Find the key of `enctype' in the keyset `kvno' of `ent' (the current
+ * one if 0), and unseal it if it is not yet, leaving the other keys as
+ * they are.  For entries fetched with HDB_F_LAZY_HIST_KEYS, so that a
+ * request for an old ticket costs one key unsealed, not the whole key
+ * history.
+ */
+
+krb5_error_code
+hdb_kvno_enctype2key(krb5_context context, HDB *db, hdb_entry *ent,
+		     krb5_kvno kvno, krb5_enctype enctype, Key **key)
+{
+    const Keys *keys = NULL;
+    HDB_extension *ext;
+    krb5_error_code ret;
+
+    *key = NULL;
+    if (kvno != 0 && kvno != ent->kvno) {
+	/* Undecodable extensions are not a missing key version */
+	ret = _hdb_find_extension(context, ent,
+				  choice_HDB_extension_data_hist_keys, &ext);
+	if (ret)
+	    return ret;
+	keys = hdb_kvno2keys(context, ent, kvno);
+	if (keys == NULL) {
+	    krb5_set_error_message(context, HDB_ERR_KVNO_NOT_FOUND,
+				   "No key version %u for hdb-entry",
+				   (unsigned)kvno);
+	    return HDB_ERR_KVNO_NOT_FOUND;
+	}
+    }
+    ret = hdb_enctype2key(context, ent, keys, enctype, key);
+    if (ret == 0 && db != NULL)
+	ret = hdb_unseal_key(context, db, *key);
+    if (ret)
+	*key = NULL;
+    return ret;
+}
+
 krb5_error_code
 hdb_seal_key_mkey(krb5_context context, Key *k, hdb_master_key mkey)
 {
@@ -682,7 +722,10 @@ hdb_seal_keys_mkey(krb5_context context, hdb_entry *ent, hdb_master_key mkey)
 	    return ret;
     }
 
-    ext = hdb_find_extension(ent, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, ent,
+			      choice_HDB_extension_data_hist_keys, &ext);
+    if (ret)
+	return ret;
     if (ext == NULL)
 	return 0;
     hist_keys = &ext->data.u.hist_keys;
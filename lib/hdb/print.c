@@ -33,6 +33,7 @@
 #include "hdb_locl.h"
 #include <hex.h>
 #include <ctype.h>
+#include <heim_threads.h>
 
 /*
    This is the present contents of a dump line. This might change at
@@ -110,11 +111,15 @@ append_hex(krb5_context context, krb5_storage *sp,
     return sz;
 }
 
+/* gmtime() isn't re-entrant, and dumps may be formatted by many threads */
+static HEIMDAL_MUTEX time2str_mutex = HEIMDAL_MUTEX_INITIALIZER;
+
 static char *
-time2str(time_t t)
+time2str(time_t t, char *buf, size_t len)
 {
-    static char buf[128];
-    strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", gmtime(&t));
+    HEIMDAL_MUTEX_lock(&time2str_mutex);
+    strftime(buf, len, "%Y%m%d%H%M%S", gmtime(&t));
+    HEIMDAL_MUTEX_unlock(&time2str_mutex);
     return buf;
 }
 
@@ -124,13 +129,15 @@ append_event(krb5_context context, krb5_storage *sp, Event *ev)
     krb5_error_code ret;
     ssize_t sz;
     char *pr = NULL;
+    char buf[128];
     if(ev == NULL)
 	return append_string(context, sp, "- ");
     if (ev->principal != NULL) {
        ret = krb5_unparse_name(context, ev->principal, &pr);
        if (ret) return -1; /* krb5_unparse_name() sets error info */
     }
-    sz = append_string(context, sp, "%s:%s ", time2str(ev->time),
+    sz = append_string(context, sp, "%s:%s ",
+                       time2str(ev->time, buf, sizeof(buf)),
                        pr ? pr : "UNKNOWN");
     free(pr);
     return sz;
@@ -219,6 +226,7 @@ entry2string_int (krb5_context context, krb5_storage *sp, hdb_entry *ent)
     char *p;
     size_t i;
     krb5_error_code ret;
+    char buf[128];
 
     /* --- principal */
     ret = krb5_unparse_name(context, ent->principal, &p);
@@ -256,19 +264,22 @@ entry2string_int (krb5_context context, krb5_storage *sp, hdb_entry *ent)
 
     /* --- valid start */
     if(ent->valid_start)
-	append_string(context, sp, "%s ", time2str(*ent->valid_start));
+	append_string(context, sp, "%s ",
+		      time2str(*ent->valid_start, buf, sizeof(buf)));
     else
 	append_string(context, sp, "- ");
 
     /* --- valid end */
     if(ent->valid_end)
-	append_string(context, sp, "%s ", time2str(*ent->valid_end));
+	append_string(context, sp, "%s ",
+		      time2str(*ent->valid_end, buf, sizeof(buf)));
     else
 	append_string(context, sp, "- ");
 
     /* --- password ends */
     if(ent->pw_end)
-	append_string(context, sp, "%s ", time2str(*ent->pw_end));
+	append_string(context, sp, "%s ",
+		      time2str(*ent->pw_end, buf, sizeof(buf)));
     else
 	append_string(context, sp, "- ");
 
@@ -289,13 +300,17 @@ entry2string_int (krb5_context context, krb5_storage *sp, hdb_entry *ent)
 
     /* --- generation number */
     if(ent->generation) {
-	append_string(context, sp, "%s:%d:%d ", time2str(ent->generation->time),
+	append_string(context, sp, "%s:%d:%d ",
+		      time2str(ent->generation->time, buf, sizeof(buf)),
 		      ent->generation->usec,
 		      ent->generation->gen);
     } else
 	append_string(context, sp, "- ");
 
     /* --- extensions */
+    ret = _hdb_expand_extensions(ent);
+    if (ret)
+	return ret;
     if(ent->extensions && ent->extensions->len > 0) {
 	for(i = 0; i < ent->extensions->len; i++) {
 	    void *d;
@@ -395,7 +410,10 @@ entry2mit_string_int(krb5_context context, krb5_storage *sp, hdb_entry *ent)
     if (last_pw_chg)
         num_tl_data++;
 
-    extp = hdb_find_extension(ent, choice_HDB_extension_data_hist_keys);
+    ret = _hdb_find_extension(context, ent,
+    			      choice_HDB_extension_data_hist_keys, &extp);
+    if (ret)
+    	return ret;
     if (extp)
         hist_keys = &extp->data.u.hist_keys;
 
@@ -553,6 +571,57 @@ hdb_entry2string(krb5_context context, hdb_entry *ent, char **str)
     return 0;
 }
 
+static krb5_error_code
+entry2dump_int(krb5_context context, krb5_storage *sp, hdb_entry *ent,
+               hdb_dump_format_t fmt)
+{
+    krb5_error_code ret;
+
+    switch (fmt) {
+    case HDB_DUMP_HEIMDAL:
+        ret = entry2string_int(context, sp, ent);
+        break;
+    case HDB_DUMP_MIT:
+        ret = entry2mit_string_int(context, sp, ent);
+        break;
+    default:
+        heim_abort("Only two dump formats supported: Heimdal and MIT");
+    }
+    if (ret)
+        return ret;
+
+    krb5_storage_write(sp, "\n", 1);
+    return 0;
+}
+
+/*
+ * Format a hdb_entry as a dump line (with its newline) into `out'.
+ *
+ * This does not use `db' or any other shared state, so entries can be
+ * formatted by several threads at once.  On error `out' holds whatever
+ * hdb_print_entry() would have written before failing.
+ */
+
+krb5_error_code
+hdb_entry2dump(krb5_context context, hdb_entry *ent, hdb_dump_format_t fmt,
+               krb5_data *out)
+{
+    krb5_error_code ret;
+    krb5_storage *sp;
+
+    krb5_data_zero(out);
+    sp = krb5_storage_emem();
+    if (sp == NULL) {
+	krb5_set_error_message(context, ENOMEM, "malloc: out of memory");
+	return ENOMEM;
+    }
+    ret = entry2dump_int(context, sp, ent, fmt);
+    if (krb5_storage_to_data(sp, out) != 0 && ret == 0)
+        ret = ENOMEM;
+    krb5_storage_free(sp);
+    return ret;
+}
+
 /* print a hdb_entry to (FILE*)data; suitable for hdb_foreach */
 
 krb5_error_code
@@ -570,22 +639,7 @@ hdb_print_entry(krb5_context context, HDB *db, hdb_entry_ex *entry,
 	return ENOMEM;
     }
 
-    switch (parg->fmt) {
-    case HDB_DUMP_HEIMDAL:
-        ret = entry2string_int(context, sp, &entry->entry);
-        break;
-    case HDB_DUMP_MIT:
-        ret = entry2mit_string_int(context, sp, &entry->entry);
-        break;
-    default:
-        heim_abort("Only two dump formats supported: Heimdal and MIT");
-    }
-    if (ret) {
-	krb5_storage_free(sp);
-	return ret;
-    }
-
-    krb5_storage_write(sp, "\n", 1);
+    ret = entry2dump_int(context, sp, &entry->entry, parg->fmt);
     krb5_storage_free(sp);
-    return 0;
+    return ret;
 }
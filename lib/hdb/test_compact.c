@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "hdb_locl.h"
+#include <err.h>
+
+/*
+ * Check that compact records (compact.c) decode to what was encoded,
+ * that truncated and corrupt records are refused, and that writers
+ * without [hdb] compact-entries leave no stale record behind.
+ */
+
+static void
+put32(krb5_data *d, size_t off, uint32_t v)
+{
+    unsigned char *p = (unsigned char *)d->data + off;
+
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static unsigned char keydata1[32] = "0123456789abcdef0123456789abcdef";
+static unsigned char keydata2[16] = "fedcba9876543210";
+
+static void
+make_entry(krb5_context context, hdb_entry *ent)
+{
+    krb5_principal alias;
+    HDB_extension ext;
+    krb5_error_code ret;
+    unsigned int mkvno = 1;
+    Key key;
+    Salt salt;
+    heim_octet_string opaque;
+
+    memset(ent, 0, sizeof(*ent));
+    if ((ret = krb5_parse_name(context, "test@EXAMPLE.ORG", &ent->principal)))
+	krb5_err(context, 1, ret, "krb5_parse_name");
+    ent->kvno = 2;
+    ent->flags.client = 1;
+    ent->flags.server = 1;
+    ent->created_by.time = 1000000000;
+    if ((ent->max_life = malloc(sizeof(*ent->max_life))) == NULL ||
+	(ent->valid_end = malloc(sizeof(*ent->valid_end))) == NULL ||
+	(ent->etypes = calloc(1, sizeof(*ent->etypes))) == NULL ||
+	(ent->etypes->val = calloc(2, sizeof(ent->etypes->val[0]))) == NULL ||
+	(ent->generation = calloc(1, sizeof(*ent->generation))) == NULL)
+	errx(1, "out of memory");
+    *ent->max_life = 36000;
+    *ent->valid_end = 2000000000;
+    ent->etypes->len = 2;
+    ent->etypes->val[0] = ETYPE_AES256_CTS_HMAC_SHA1_96;
+    ent->etypes->val[1] = ETYPE_AES128_CTS_HMAC_SHA1_96;
+    ent->generation->time = 1000000001;
+    ent->generation->usec = 42;
+    ent->generation->gen = 7;
+
+    memset(&key, 0, sizeof(key));
+    key.key.keytype = ETYPE_AES256_CTS_HMAC_SHA1_96;
+    key.key.keyvalue.data = keydata1;
+    key.key.keyvalue.length = sizeof(keydata1);
+    if (add_Keys(&ent->keys, &key))
+	errx(1, "out of memory");
+
+    /* The last key has all the optional fields, and ends the record */
+    salt.type = KRB5_PW_SALT;
+    salt.salt.data = "EXAMPLE.ORGtest";
+    salt.salt.length = sizeof("EXAMPLE.ORGtest") - 1;
+    opaque.data = "\x00\x00\x10\x00";
+    opaque.length = 4;
+    salt.opaque = &opaque;
+    key.mkvno = &mkvno;
+    key.salt = &salt;
+    key.key.keytype = ETYPE_AES128_CTS_HMAC_SHA1_96;
+    key.key.keyvalue.data = keydata2;
+    key.key.keyvalue.length = sizeof(keydata2);
+    if (add_Keys(&ent->keys, &key))
+	errx(1, "out of memory");
+
+    /* Key history, which compact records leave out */
+    if ((ret = hdb_add_current_keys_to_history(context, ent)))
+	krb5_err(context, 1, ret, "hdb_add_current_keys_to_history");
+    ent->kvno = 3;
+
+    if ((ret = krb5_parse_name(context, "alias@EXAMPLE.ORG", &alias)))
+	krb5_err(context, 1, ret, "krb5_parse_name");
+    memset(&ext, 0, sizeof(ext));
+    ext.data.element = choice_HDB_extension_data_aliases;
+    ext.data.u.aliases.aliases.len = 1;
+    ext.data.u.aliases.aliases.val = alias;
+    if ((ret = hdb_replace_extension(context, ent, &ext)))
+	krb5_err(context, 1, ret, "hdb_replace_extension");
+    krb5_free_principal(context, alias);
+}
+
+static int
+same_key(const Key *a, const Key *b)
+{
+    if (a->key.keytype != b->key.keytype ||
+	krb5_data_cmp(&a->key.keyvalue, &b->key.keyvalue) ||
+	!a->mkvno != !b->mkvno || (a->mkvno && *a->mkvno != *b->mkvno) ||
+	!a->salt != !b->salt)
+	return 0;
+    if (a->salt == NULL)
+	return 1;
+    return a->salt->type == b->salt->type &&
+	krb5_data_cmp(&a->salt->salt, &b->salt->salt) == 0 &&
+	!a->salt->opaque == !b->salt->opaque &&
+	(a->salt->opaque == NULL ||
+	 krb5_data_cmp(a->salt->opaque, b->salt->opaque) == 0);
+}
+
+static void
+test_roundtrip(krb5_context context, const hdb_entry *ent,
+	       const krb5_data *value)
+{
+    const HDB_Ext_Aliases *aliases;
+    krb5_error_code ret;
+    hdb_entry dec;
+    size_t i;
+
+    if ((ret = hdb_compact2entry(context, value, &dec)))
+	krb5_err(context, 1, ret, "hdb_compact2entry");
+    if (!krb5_principal_compare(context, dec.principal, ent->principal))
+	errx(1, "principal differs");
+    if (dec.kvno != ent->kvno ||
+	HDBFlags2int(dec.flags) != HDBFlags2int(ent->flags) ||
+	dec.created_by.time != ent->created_by.time)
+	errx(1, "kvno, flags or creation time differ");
+    if (dec.max_life == NULL || *dec.max_life != *ent->max_life ||
+	dec.max_renew != NULL || dec.valid_start != NULL ||
+	dec.valid_end == NULL || *dec.valid_end != *ent->valid_end ||
+	dec.pw_end != NULL)
+	errx(1, "lifetimes differ");
+    if (dec.generation == NULL ||
+	dec.generation->time != ent->generation->time ||
+	dec.generation->usec != ent->generation->usec ||
+	dec.generation->gen != ent->generation->gen)
+	errx(1, "generation differs");
+    if (dec.etypes == NULL || dec.etypes->len != ent->etypes->len)
+	errx(1, "etypes differ");
+    for (i = 0; i < dec.etypes->len; i++)
+	if (dec.etypes->val[i] != ent->etypes->val[i])
+	    errx(1, "etype %lu differs", (unsigned long)i);
+    if (dec.keys.len != ent->keys.len)
+	errx(1, "number of keys differs");
+    for (i = 0; i < dec.keys.len; i++)
+	if (!same_key(&dec.keys.val[i], &ent->keys.val[i]))
+	    errx(1, "key %lu differs", (unsigned long)i);
+    if ((ret = hdb_entry_get_aliases(&dec, &aliases)) || aliases == NULL ||
+	aliases->aliases.len != 1)
+	errx(1, "aliases lost");
+    if (hdb_find_extension(&dec, choice_HDB_extension_data_hist_keys))
+	errx(1, "key history in the compact record");
+    free_hdb_entry(&dec);
+}
+
+static void
+test_truncated(krb5_context context, const krb5_data *value)
+{
+    krb5_error_code ret;
+    krb5_data trunc;
+    hdb_entry dec;
+    size_t len;
+
+    for (len = 0; len < value->length; len++) {
+	/* A copy of just `len' bytes, for memory checkers */
+	if ((trunc.data = malloc(len ? len : 1)) == NULL)
+	    errx(1, "out of memory");
+	memcpy(trunc.data, value->data, len);
+	trunc.length = len;
+	if (hdb_compact2entry(context, &trunc, &dec) == 0)
+	    errx(1, "record truncated to %lu bytes accepted",
+		 (unsigned long)len);
+
+	/* Also with the length in the record matching */
+	if (len >= 12) {
+	    put32(&trunc, 8, len);
+	    ret = hdb_compact2entry(context, &trunc, &dec);
+	    if (ret == 0)
+		errx(1, "record cut to %lu bytes accepted",
+		     (unsigned long)len);
+	}
+	free(trunc.data);
+    }
+}
+
+/*
+ * Corrupt 32-bit fields, by offset in the record; the key fields are
+ * those of the first key (120) and of the second (160).
+ */
+
+struct corrupt {
+    const char *name;
+    size_t off;
+    uint32_t val;
+    krb5_error_code ret;	/* 0 for any error */
+};
+
+static const struct corrupt corrupts[] = {
+    { "magic", 0, 0x48444278, HDB_ERR_NOENTRY },
+    { "version", 4, 2, HDB_ERR_NOENTRY },
+    { "length", 8, 0xffffffff, HDB_ERR_NOENTRY },
+    { "number of keys", 32, 0xffffffff, ASN1_OVERRUN },
+    { "principal offset", 88, 0xfffffff0, ASN1_OVERRUN },
+    { "principal length", 92, 0xffffffff, ASN1_OVERRUN },
+    { "principal not DER", 88, 0, 0 },
+    { "etypes count", 100, 0x40000000, ASN1_OVERRUN },
+    { "etypes count wrapping", 100, 0x40000001, ASN1_OVERRUN },
+    { "extensions length", 108, 0xffffffff, ASN1_OVERRUN },
+    { "key offset", 120 + 16, 0xffffffff, ASN1_OVERRUN },
+    { "key length", 120 + 20, 0xfffffffe, ASN1_OVERRUN },
+    { "salt length", 160 + 28, 0x80000000, ASN1_OVERRUN },
+    { "opaque offset", 160 + 32, 0x7fffffff, ASN1_OVERRUN },
+};
+
+static void
+test_corrupt(krb5_context context, const krb5_data *value)
+{
+    krb5_error_code ret;
+    krb5_data bad;
+    hdb_entry dec;
+    size_t i, j;
+
+    if ((bad.data = malloc(value->length)) == NULL)
+	errx(1, "out of memory");
+    bad.length = value->length;
+
+    for (i = 0; i < sizeof(corrupts) / sizeof(corrupts[0]); i++) {
+	const struct corrupt *c = &corrupts[i];
+
+	memcpy(bad.data, value->data, value->length);
+	put32(&bad, c->off, c->val);
+	ret = hdb_compact2entry(context, &bad, &dec);
+	if (ret == 0 || (c->ret && ret != c->ret))
+	    errx(1, "corrupt %s: got %d, expected %d", c->name, (int)ret,
+		 (int)c->ret);
+    }
+
+    /* Whatever a byte says, decoding must not crash or leak */
+    for (i = 0; i < value->length; i++) {
+	for (j = 0; j < 2; j++) {
+	    memcpy(bad.data, value->data, value->length);
+	    ((unsigned char *)bad.data)[i] = j ? 0xff : 0x00;
+	    if (hdb_compact2entry(context, &bad, &dec) == 0)
+		free_hdb_entry(&dec);
+	}
+    }
+    free(bad.data);
+}
+
+/*
+ * The key/value backend the store test runs against, if there is one
+ * in this build, in the order of preference of hdb.c.
+ */
+
+#if defined(HAVE_LMDB)
+#define KV_DB "lmdb:"
+#elif defined(HAVE_DB3) || defined(HAVE_DB1)
+#define KV_DB "db:"
+#elif defined(HAVE_NDBM)
+#define KV_DB "ndbm:"
+#endif
+
+#ifdef KV_DB
+static void
+test_store(krb5_context context)
+{
+    krb5_error_code ret;
+    hdb_entry_ex ent, got;
+    HDB *db;
+
+    if ((ret = hdb_create(context, &db, KV_DB "test_compact-db")))
+	krb5_err(context, 1, ret, "hdb_create");
+    if ((ret = db->hdb_open(context, db, O_RDWR | O_CREAT | O_TRUNC, 0600)))
+	krb5_err(context, 1, ret, "hdb_open");
+
+    memset(&ent, 0, sizeof(ent));
+    make_entry(context, &ent.entry);
+    db->hdb_capability_flags |= HDB_CAP_F_COMPACT_ENTRIES;
+    if ((ret = db->hdb_store(context, db, 0, &ent)))
+	krb5_err(context, 1, ret, "hdb_store");
+
+    /* A writer without compact-entries changes the entry */
+    db->hdb_capability_flags &= ~HDB_CAP_F_COMPACT_ENTRIES;
+    ent.entry.kvno++;
+    if ((ret = db->hdb_store(context, db, HDB_F_REPLACE, &ent)))
+	krb5_err(context, 1, ret, "hdb_store");
+
+    db->hdb_capability_flags |= HDB_CAP_F_COMPACT_ENTRIES;
+    memset(&got, 0, sizeof(got));
+    if ((ret = db->hdb_fetch_kvno(context, db, ent.entry.principal,
+				  HDB_F_GET_ANY, 0, &got)))
+	krb5_err(context, 1, ret, "hdb_fetch_kvno");
+    if (got.entry.kvno != ent.entry.kvno)
+	errx(1, "stale compact record: kvno %u, expected %u",
+	     got.entry.kvno, ent.entry.kvno);
+    hdb_free_entry(context, &got);
+
+    /* ... and removes it */
+    if ((ret = hdb_rebuild_compact(context, db)))
+	krb5_err(context, 1, ret, "hdb_rebuild_compact");
+    db->hdb_capability_flags &= ~HDB_CAP_F_COMPACT_ENTRIES;
+    if ((ret = db->hdb_remove(context, db, 0, ent.entry.principal)))
+	krb5_err(context, 1, ret, "hdb_remove");
+    db->hdb_capability_flags |= HDB_CAP_F_COMPACT_ENTRIES;
+    ret = db->hdb_fetch_kvno(context, db, ent.entry.principal,
+			     HDB_F_GET_ANY, 0, &got);
+    if (ret != HDB_ERR_NOENTRY)
+	errx(1, "removed entry still fetched (%d)", (int)ret);
+
+    hdb_free_entry(context, &ent);
+    db->hdb_close(context, db);
+    db->hdb_destroy(context, db);
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+    krb5_context context;
+    krb5_error_code ret;
+    krb5_data value;
+    hdb_entry ent;
+
+    if ((ret = krb5_init_context(&context)))
+	errx(1, "krb5_init_context: %d", (int)ret);
+
+    make_entry(context, &ent);
+    if ((ret = hdb_entry2compact(context, &ent, &value)))
+	krb5_err(context, 1, ret, "hdb_entry2compact");
+    test_roundtrip(context, &ent, &value);
+    test_truncated(context, &value);
+    test_corrupt(context, &value);
+    krb5_data_free(&value);
+    free_hdb_entry(&ent);
+
+#ifdef KV_DB
+    test_store(context);
+#endif
+
+    krb5_free_context(context);
+    return 0;
+}
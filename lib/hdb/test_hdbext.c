@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "hdb_locl.h"
+#include <err.h>
+
+/*
+ * Check the extensions of entries fetched by _hdb_fetch_kvno(), which
+ * are decoded on first use, and their key history, which is unsealed
+ * on demand with HDB_F_LAZY_HIST_KEYS.  The entries live in a small
+ * in-memory key/value backend, so that this runs whatever databases
+ * the build has.
+ */
+
+struct mem_rec {
+    krb5_data key;
+    krb5_data value;
+};
+
+static struct mem_rec *mem_recs;
+static size_t mem_len;
+
+static struct mem_rec *
+mem_find(krb5_data key)
+{
+    size_t i;
+
+    for (i = 0; i < mem_len; i++)
+	if (krb5_data_cmp(&mem_recs[i].key, &key) == 0)
+	    return &mem_recs[i];
+    return NULL;
+}
+
+static krb5_error_code
+mem__get(krb5_context context, HDB *db, krb5_data key, krb5_data *value)
+{
+    struct mem_rec *r = mem_find(key);
+
+    if (r == NULL)
+	return HDB_ERR_NOENTRY;
+    return krb5_data_copy(value, r->value.data, r->value.length);
+}
+
+static krb5_error_code
+mem__put(krb5_context context, HDB *db, int flags, krb5_data key,
+	 krb5_data value)
+{
+    struct mem_rec *r = mem_find(key), *tmp;
+    krb5_error_code ret;
+
+    if (r && (flags & HDB_F_REPLACE) == 0)
+	return HDB_ERR_EXISTS;
+    if (r == NULL) {
+	tmp = realloc(mem_recs, (mem_len + 1) * sizeof(mem_recs[0]));
+	if (tmp == NULL)
+	    return ENOMEM;
+	mem_recs = tmp;
+	r = &mem_recs[mem_len];
+	if ((ret = krb5_data_copy(&r->key, key.data, key.length)))
+	    return ret;
+	krb5_data_zero(&r->value);
+	mem_len++;
+    }
+    krb5_data_free(&r->value);
+    return krb5_data_copy(&r->value, value.data, value.length);
+}
+
+static krb5_error_code
+mem__del(krb5_context context, HDB *db, krb5_data key)
+{
+    struct mem_rec *r = mem_find(key);
+
+    if (r == NULL)
+	return HDB_ERR_NOENTRY;
+    krb5_data_free(&r->key);
+    krb5_data_free(&r->value);
+    *r = mem_recs[--mem_len];
+    return 0;
+}
+
+static unsigned char oldkey[32] = "old key old key old key old key ";
+static unsigned char newkey[32] = "new key new key new key new key ";
+
+static void
+make_entry(krb5_context context, hdb_entry_ex *ent)
+{
+    HDB_Ext_PKINIT_acl acl;
+    struct HDB_Ext_PKINIT_acl_val aclval;
+    krb5_principal alias;
+    HDB_extension ext;
+    krb5_error_code ret;
+    Key key;
+
+    memset(ent, 0, sizeof(*ent));
+    if ((ret = krb5_parse_name(context, "lazy@EXAMPLE.ORG",
+			       &ent->entry.principal)))
+	krb5_err(context, 1, ret, "krb5_parse_name");
+    ent->entry.flags.client = 1;
+
+    memset(&key, 0, sizeof(key));
+    key.key.keytype = ETYPE_AES256_CTS_HMAC_SHA1_96;
+    key.key.keyvalue.data = oldkey;
+    key.key.keyvalue.length = sizeof(oldkey);
+    ent->entry.kvno = 1;
+    if (add_Keys(&ent->entry.keys, &key))
+	errx(1, "out of memory");
+    if ((ret = hdb_add_current_keys_to_history(context, &ent->entry)))
+	krb5_err(context, 1, ret, "hdb_add_current_keys_to_history");
+    free_Keys(&ent->entry.keys);
+    key.key.keyvalue.data = newkey;
+    ent->entry.kvno = 2;
+    if (add_Keys(&ent->entry.keys, &key))
+	errx(1, "out of memory");
+
+    if ((ret = krb5_parse_name(context, "lazy-alias@EXAMPLE.ORG", &alias)))
+	krb5_err(context, 1, ret, "krb5_parse_name");
+    memset(&ext, 0, sizeof(ext));
+    ext.data.element = choice_HDB_extension_data_aliases;
+    ext.data.u.aliases.aliases.len = 1;
+    ext.data.u.aliases.aliases.val = alias;
+    if ((ret = hdb_replace_extension(context, &ent->entry, &ext)))
+	krb5_err(context, 1, ret, "hdb_replace_extension");
+    krb5_free_principal(context, alias);
+
+    memset(&aclval, 0, sizeof(aclval));
+    aclval.subject = "CN=lazy";
+    acl.len = 1;
+    acl.val = &aclval;
+    ext.data.element = choice_HDB_extension_data_pkinit_acl;
+    ext.data.u.pkinit_acl = acl;
+    if ((ret = hdb_replace_extension(context, &ent->entry, &ext)))
+	krb5_err(context, 1, ret, "hdb_replace_extension");
+}
+
+static void
+fetch(krb5_context context, HDB *db, krb5_const_principal principal,
+      hdb_entry_ex *ent)
+{
+    krb5_error_code ret;
+
+    memset(ent, 0, sizeof(*ent));
+    ret = _hdb_fetch_kvno(context, db, principal,
+			  HDB_F_DECRYPT | HDB_F_ALL_KVNOS |
+			  HDB_F_LAZY_HIST_KEYS | HDB_F_GET_CLIENT, 0, ent);
+    if (ret)
+	krb5_err(context, 1, ret, "_hdb_fetch_kvno");
+}
+
+static void
+check_key(krb5_context context, HDB *db, hdb_entry *ent, krb5_kvno kvno,
+	  const unsigned char *expected)
+{
+    krb5_error_code ret;
+    Key *key;
+
+    ret = hdb_kvno_enctype2key(context, db, ent, kvno,
+			       KRB5_ENCTYPE_AES256_CTS_HMAC_SHA1_96, &key);
+    if (ret)
+	krb5_err(context, 1, ret, "hdb_kvno_enctype2key kvno %u",
+		 (unsigned)kvno);
+    if (key->key.keyvalue.length != 32 ||
+	memcmp(key->key.keyvalue.data, expected, 32) != 0)
+	errx(1, "wrong key for kvno %u", (unsigned)kvno);
+}
+
+int
+main(int argc, char **argv)
+{
+    const HDB_Ext_PKINIT_acl *acl;
+    const HDB_Ext_Aliases *aliases;
+    const HDB_extensions *exts;
+    krb5_context context;
+    krb5_error_code ret;
+    krb5_data key, value;
+    hdb_entry_ex ent, got;
+    struct mem_rec *stored;
+    hdb_entry dec;
+    Key *k;
+    HDB db;
+
+    if ((ret = krb5_init_context(&context)))
+	errx(1, "krb5_init_context: %d", (int)ret);
+
+    memset(&db, 0, sizeof(db));
+    db.hdb_name = "mem";
+    db.hdb__get = mem__get;
+    db.hdb__put = mem__put;
+    db.hdb__del = mem__del;
+
+    make_entry(context, &ent);
+    if ((ret = _hdb_store(context, &db, 0, &ent)))
+	krb5_err(context, 1, ret, "_hdb_store");
+
+    /* The extensions, decoded on first use, where they were */
+    fetch(context, &db, ent.entry.principal, &got);
+    exts = got.entry.extensions;
+    if (exts == NULL)
+	errx(1, "no extensions");
+    if ((ret = hdb_entry_get_aliases(&got.entry, &aliases)))
+	krb5_err(context, 1, ret, "hdb_entry_get_aliases");
+    if (aliases == NULL || aliases->aliases.len != 1)
+	errx(1, "aliases lost");
+    if (got.entry.extensions != exts)
+	errx(1, "extensions moved when decoded");
+    if ((ret = hdb_entry_get_pkinit_acl(&got.entry, &acl)))
+	krb5_err(context, 1, ret, "hdb_entry_get_pkinit_acl");
+    if (acl == NULL || acl->len != 1 || strcmp(acl->val[0].subject, "CN=lazy"))
+	errx(1, "PKINIT ACL lost");
+
+    /* The key history, one key at a time */
+    check_key(context, &db, &got.entry, 2, newkey);
+    check_key(context, &db, &got.entry, 1, oldkey);
+    ret = hdb_kvno_enctype2key(context, &db, &got.entry, 3,
+			       KRB5_ENCTYPE_AES256_CTS_HMAC_SHA1_96, &k);
+    if (ret != HDB_ERR_KVNO_NOT_FOUND)
+	errx(1, "kvno 3 found (%d)", (int)ret);
+    hdb_free_entry(context, &got);
+
+    /* An entry whose extensions were never looked at encodes as stored */
+    fetch(context, &db, ent.entry.principal, &got);
+    if ((ret = hdb_entry2value(context, &got.entry, &value)))
+	krb5_err(context, 1, ret, "hdb_entry2value");
+    if ((ret = hdb_principal2key(context, ent.entry.principal, &key)))
+	krb5_err(context, 1, ret, "hdb_principal2key");
+    stored = mem_find(key);
+    if (stored == NULL || krb5_data_cmp(&stored->value, &value) != 0)
+	errx(1, "entry does not round-trip");
+    if ((ret = hdb_value2entry(context, &value, &dec)))
+	krb5_err(context, 1, ret, "hdb_value2entry");
+    if (hdb_find_extension(&dec, choice_HDB_extension_data_hist_keys) == NULL)
+	errx(1, "key history lost");
+    free_hdb_entry(&dec);
+    krb5_data_free(&key);
+    krb5_data_free(&value);
+    hdb_free_entry(context, &got);
+
+    hdb_free_entry(context, &ent);
+    while (mem_len)
+	mem__del(context, &db, mem_recs[0].key);
+    free(mem_recs);
+    krb5_free_context(context);
+    return 0;
+}
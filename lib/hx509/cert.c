@@ -133,6 +133,7 @@ hx509_context_init(hx509_context *context)
     _hx509_ks_keychain_register(*context);
 
     (*context)->ocsp_time_diff = HX509_DEFAULT_OCSP_TIME_DIFF;
+    (*context)->crl_check_interval = HX509_DEFAULT_CRL_CHECK_INTERVAL;
 
     initialize_hx_error_table_r(&(*context)->et_list);
     initialize_asn1_error_table_r(&(*context)->et_list);
@@ -167,6 +168,23 @@ hx509_context_set_missing_revoke(hx509_context context, int flag)
 	context->flags &= ~HX509_CTX_VERIFY_MISSING_OK;
 }
 
+/**
+ * Set how often hx509_revoke_verify() checks if the CRL files added
+ * to a revokation context have changed and reloads them.  The default
+ * is every 60 seconds, zero means every time a certificate is checked.
+ *
+ * @param context hx509 context to change the interval for.
+ * @param interval seconds between checks.
+ *
+ * @ingroup hx509_verify
+ */
+
+void
+hx509_context_set_crl_check_interval(hx509_context context, time_t interval)
+{
+    context->crl_check_interval = interval < 0 ? 0 : interval;
+}
+
 /**
  * Free the context allocated by hx509_context_init().
  *
@@ -187,6 +205,7 @@ hx509_context_free(hx509_context *context)
     free_error_table ((*context)->et_list);
     if ((*context)->querystat)
 	free((*context)->querystat);
+    free((*context)->sig_cache);
     memset(*context, 0, sizeof(**context));
     free(*context);
     *context = NULL;
@@ -1972,6 +1991,128 @@ free_name_constraints(hx509_name_constraints *nc)
     free(nc->val);
 }
 
+/*
+ * Cache of verified certificate signatures.
+ *
+ * Most certificates presented share the same few intermediate CAs, so
+ * hx509_verify_path() remembers which CA certificate signatures it has
+ * verified, keyed by a digest of the signed certificate (tbsCertificate,
+ * signature algorithm and value) and of its signer's tbsCertificate.
+ * Whether a signature is good does not depend on time or revocation
+ * (those are checked on every call), so entries only expire when either
+ * certificate does.  The cache is direct mapped so it stays bounded.
+ */
+
+struct _hx509_sig_cache_entry {
+    unsigned char key[SHA256_DIGEST_LENGTH];
+    time_t expire;
+};
+
+static void
+sig_cache_update(EVP_MD_CTX *ctx, const void *data, size_t len)
+{
+    unsigned char l[4];
+
+    l[0] = (len >> 24) & 0xff;
+    l[1] = (len >> 16) & 0xff;
+    l[2] = (len >>  8) & 0xff;
+    l[3] = (len >>  0) & 0xff;
+    EVP_DigestUpdate(ctx, l, sizeof(l));
+    EVP_DigestUpdate(ctx, data, len);
+}
+
+static int
+sig_cache_key(const Certificate *c, const Certificate *signer,
+	      unsigned char key[SHA256_DIGEST_LENGTH])
+{
+    EVP_MD_CTX *ctx;
+    void *alg;
+    size_t alg_len, size;
+    int ret;
+
+    ASN1_MALLOC_ENCODE(AlgorithmIdentifier, alg, alg_len,
+		       &c->signatureAlgorithm, &size, ret);
+    if (ret)
+	return ret;
+    if (size != alg_len)
+	_hx509_abort("internal ASN.1 encoder error");
+
+    ctx = EVP_MD_CTX_create();
+    if (ctx == NULL) {
+	free(alg);
+	return ENOMEM;
+    }
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    sig_cache_update(ctx, c->tbsCertificate._save.data,
+		     c->tbsCertificate._save.length);
+    sig_cache_update(ctx, alg, alg_len);
+    sig_cache_update(ctx, c->signatureValue.data,
+		     (c->signatureValue.length + 7) / 8);
+    sig_cache_update(ctx, signer->tbsCertificate._save.data,
+		     signer->tbsCertificate._save.length);
+    EVP_DigestFinal_ex(ctx, key, NULL);
+    EVP_MD_CTX_destroy(ctx);
+    free(alg);
+    return 0;
+}
+
+static struct _hx509_sig_cache_entry *
+sig_cache_slot(hx509_context context, const unsigned char *key)
+{
+    unsigned long h;
+
+    if (context->sig_cache == NULL) {
+	context->sig_cache = calloc(HX509_SIG_CACHE_SIZE,
+				    sizeof(context->sig_cache[0]));
+	if (context->sig_cache == NULL)
+	    return NULL;
+    }
+    h = (key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+    return &context->sig_cache[h % HX509_SIG_CACHE_SIZE];
+}
+
+static int
+sig_cache_lookup(hx509_context context, const unsigned char *key)
+{
+    struct _hx509_sig_cache_entry *e = sig_cache_slot(context, key);
+
+    if (e == NULL || e->expire < time(NULL) ||
+	memcmp(e->key, key, sizeof(e->key)) != 0)
+	return 0;
+    context->sig_cache_hits++;
+    return 1;
+}
+
+static void
+sig_cache_add(hx509_context context, const unsigned char *key,
+	      const Certificate *c, const Certificate *signer)
+{
+    struct _hx509_sig_cache_entry *e = sig_cache_slot(context, key);
+    time_t t1, t2;
+
+    if (e == NULL)
+	return;
+    t1 = _hx509_Time2time_t(&c->tbsCertificate.validity.notAfter);
+    t2 = _hx509_Time2time_t(&signer->tbsCertificate.validity.notAfter);
+    if (t2 < t1)
+	t1 = t2;
+    if (t1 < time(NULL))
+	return;
+    memcpy(e->key, key, sizeof(e->key));
+    e->expire = t1;
+}
+
+/*
+ * Number of signatures hx509_verify_path() found in the cache, for the
+ * tests.
+ */
+
+unsigned long
+_hx509_sig_cache_hits(hx509_context context)
+{
+    return context->sig_cache_hits;
+}
+
 /**
  * Build and verify the path for the certificate to the trust anchor
  * specified in the verify context. The path is constructed from the
@@ -2345,8 +2486,10 @@ hx509_verify_path(hx509_context context,
      */
 
     for (k = path.len; k > 0; k--) {
+	unsigned char key[SHA256_DIGEST_LENGTH];
 	hx509_cert signer;
 	Certificate *c;
+	int cache;
 	i = k - 1;
 
 	c = _hx509_get_cert(path.val[i]);
@@ -2369,16 +2512,28 @@ hx509_verify_path(hx509_context context,
 	    signer = path.val[i + 1];
 	}
 
-	/* verify signatureValue */
-	ret = _hx509_verify_signature_bitstring(context,
-						signer,
-						&c->signatureAlgorithm,
-						&c->tbsCertificate._save,
-						&c->signatureValue);
-	if (ret) {
-	    hx509_set_error_string(context, HX509_ERROR_APPEND, ret,
-				   "Failed to verify signature of certificate");
-	    goto out;
+	/*
+	 * verify signatureValue, unless it's a CA certificate whose
+	 * signature we have already verified; EE certificates are rarely
+	 * seen twice, so don't let them push CAs out of the cache
+	 */
+	cache = (i != 0 &&
+		 sig_cache_key(c, signer->data, key) == 0);
+	if (cache && sig_cache_lookup(context, key)) {
+	    ret = 0;
+	} else {
+	    ret = _hx509_verify_signature_bitstring(context,
+						    signer,
+						    &c->signatureAlgorithm,
+						    &c->tbsCertificate._save,
+						    &c->signatureValue);
+	    if (ret) {
+		hx509_set_error_string(context, HX509_ERROR_APPEND, ret,
+				       "Failed to verify signature of certificate");
+		goto out;
+	    }
+	    if (cache)
+		sig_cache_add(context, key, c, signer->data);
 	}
 	/*
 	 * Verify that the sigature algorithm is not weak. Ignore
@@ -40,6 +40,9 @@
 #include <openssl/bn.h>
 #include <openssl/objects.h>
 #define HEIM_NO_CRYPTO_HDRS
+#else
+#include <hcrypto/ec.h>
+#include <hcrypto/ecdsa.h>
 #endif /* HAVE_HCRYPTO_W_OPENSSL */
 
 #include "hx_locl.h"
@@ -52,12 +55,9 @@ extern const AlgorithmIdentifier _hx509_signature_sha1_data;
 void
 _hx509_private_eckey_free(void *eckey)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     EC_KEY_free(eckey);
-#endif
 }
 
-#ifdef HAVE_HCRYPTO_W_OPENSSL
 static int
 heim_oid2ecnid(heim_oid *oid)
 {
@@ -510,24 +510,15 @@ const struct signature_alg ecdsa_with_sha1_alg = {
     20
 };
 
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 
 const AlgorithmIdentifier *
 hx509_signature_ecPublicKey(void)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     return &_hx509_signature_ecPublicKey;
-#else
-    return NULL;
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 }
 
 const AlgorithmIdentifier *
 hx509_signature_ecdsa_with_sha256(void)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     return &_hx509_signature_ecdsa_with_sha256_data;
-#else
-    return NULL;
-#endif /* HAVE_HCRYPTO_W_OPENSSL */
 }
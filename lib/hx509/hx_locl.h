@@ -196,10 +196,15 @@ struct hx509_context_data {
 #define HX509_CTX_VERIFY_MISSING_OK	1
     int ocsp_time_diff;
 #define HX509_DEFAULT_OCSP_TIME_DIFF	(5*60)
+    time_t crl_check_interval;
+#define HX509_DEFAULT_CRL_CHECK_INTERVAL	60
     heim_error_t error;
     struct et_list *et_list;
     char *querystat;
     hx509_certs default_trust_anchors;
+    struct _hx509_sig_cache_entry *sig_cache;
+#define HX509_SIG_CACHE_SIZE		256
+    unsigned long sig_cache_hits;
 };
 
 /* _hx509_calculate_path flag field */
@@ -1439,7 +1439,7 @@ info(void *opt, int argc, char **argv)
     }
 #else
     {
-	printf("ecdsa: hcrypto null\n");
+	printf("ecdsa: hcrypto native P-256\n");
     }
 #endif
     {
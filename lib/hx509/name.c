@@ -486,6 +486,51 @@ _hx509_name_cmp(const Name *n1, const Name *n2, int *c)
     return 0;
 }
 
+static uint32_t
+name_hash_update(uint32_t h, uint32_t v)
+{
+    int i;
+
+    /* FNV-1a, an octet at a time */
+    for (i = 0; i < 4; i++) {
+	h ^= v & 0xff;
+	h *= 16777619U;
+	v >>= 8;
+    }
+    return h;
+}
+
+/*
+ * Hash a Name such that names that _hx509_name_cmp() finds equal hash
+ * the same, for looking up names without comparing them one by one.
+ */
+
+int
+_hx509_name_hash(const Name *n, uint32_t *hash)
+{
+    uint32_t h = 2166136261U;
+    uint32_t *s;
+    size_t i, j, k, len;
+    int ret;
+
+    h = name_hash_update(h, n->u.rdnSequence.len);
+    for (i = 0 ; i < n->u.rdnSequence.len; i++) {
+	h = name_hash_update(h, n->u.rdnSequence.val[i].len);
+	for (j = 0; j < n->u.rdnSequence.val[i].len; j++) {
+	    ret = dsstringprep(&n->u.rdnSequence.val[i].val[j].value,
+			       &s, &len);
+	    if (ret)
+		return ret;
+	    h = name_hash_update(h, len);
+	    for (k = 0; k < len; k++)
+		h = name_hash_update(h, s[k]);
+	    free(s);
+	}
+    }
+    *hash = h;
+    return 0;
+}
+
 /**
  * Compare to hx509 name object, useful for sorting.
  *
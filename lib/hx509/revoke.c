@@ -51,10 +51,25 @@
 
 #include "hx_locl.h"
 
+/*
+ * Index of a CRL: a hash of its issuer (see _hx509_name_hash()), so that
+ * only the CRLs of the issuer of a certificate are looked at, and an open
+ * addressing hash set of the revoked serial numbers, holding indexes (plus
+ * one) into revokedCertificates, so that looking up a serial number does
+ * not scan the whole list.
+ */
+struct crl_index {
+    uint32_t issuer_hash;
+    size_t *serials;
+    size_t size;		/* power of two, 0 if no revoked certs */
+};
+
 struct revoke_crl {
     char *path;
     time_t last_modfied;
+    time_t last_checked;
     CRLCertificateList crl;
+    struct crl_index index;
     int verified;
     int failed_verify;
 };
@@ -153,6 +168,7 @@ hx509_revoke_free(hx509_revoke_ctx *ctx)
     for (i = 0; i < (*ctx)->crls.len; i++) {
 	free((*ctx)->crls.val[i].path);
 	free_CRLCertificateList(&(*ctx)->crls.val[i].crl);
+	free((*ctx)->crls.val[i].index.serials);
     }
 
     for (i = 0; i < (*ctx)->ocsps.len; i++)
@@ -624,6 +640,71 @@ load_crl(hx509_context context, const char *path, time_t *t, CRLCertificateList
     return ret;
 }
 
+static uint32_t
+serial_hash(const heim_integer *serial)
+{
+    const unsigned char *p = serial->data;
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < serial->length; i++) {
+	h ^= p[i];
+	h *= 16777619U;
+    }
+    if (serial->negative)
+	h = ~h;
+    return h;
+}
+
+static int
+index_crl(hx509_context context,
+	  const CRLCertificateList *crl,
+	  struct crl_index *index)
+{
+    const struct TBSCRLCertList_revokedCertificates *rc =
+	crl->tbsCertList.revokedCertificates;
+    size_t i, n, mask;
+    int ret;
+
+    memset(index, 0, sizeof(*index));
+
+    ret = _hx509_name_hash(&crl->tbsCertList.issuer, &index->issuer_hash);
+    if (ret) {
+	hx509_set_error_string(context, 0, ret, "Failed to hash CRL issuer");
+	return ret;
+    }
+
+    if (rc == NULL || rc->len == 0)
+	return 0;
+
+    /* Keep the load factor at or under one half */
+    for (index->size = 16; index->size < rc->len * 2; index->size <<= 1)
+	if (index->size > SIZE_MAX / 4 / sizeof(index->serials[0])) {
+	    hx509_clear_error_string(context);
+	    return ENOMEM;
+	}
+    index->serials = calloc(index->size, sizeof(index->serials[0]));
+    if (index->serials == NULL) {
+	index->size = 0;
+	hx509_clear_error_string(context);
+	return ENOMEM;
+    }
+
+    /*
+     * Entries with the same serial number land in the chain in the order
+     * they appear in the CRL, and are looked at in that order.
+     */
+    mask = index->size - 1;
+    for (i = 0; i < rc->len; i++) {
+	n = serial_hash(&rc->val[i].userCertificate) & mask;
+	while (index->serials[n])
+	    n = (n + 1) & mask;
+	index->serials[n] = i + 1;
+    }
+    return 0;
+}
+
 /**
  * Add a CRL file to the revokation context.
  *
@@ -683,6 +764,14 @@ hx509_revoke_add_crl(hx509_context context,
 	free(ctx->crls.val[ctx->crls.len].path);
 	return ret;
     }
+    ret = index_crl(context, &ctx->crls.val[ctx->crls.len].crl,
+		    &ctx->crls.val[ctx->crls.len].index);
+    if (ret) {
+	free_CRLCertificateList(&ctx->crls.val[ctx->crls.len].crl);
+	free(ctx->crls.val[ctx->crls.len].path);
+	return ret;
+    }
+    ctx->crls.val[ctx->crls.len].last_checked = time(NULL);
 
     ctx->crls.len++;
 
@@ -717,6 +806,9 @@ hx509_revoke_verify(hx509_context context,
     const Certificate *c = _hx509_get_cert(cert);
     const Certificate *p = _hx509_get_cert(parent_cert);
     unsigned long i, j, k;
+    uint32_t issuer_hash = 0;
+    int issuer_hashed = 0;
+    time_t t0 = 0;
     int ret;
 
     hx509_clear_error_string(context);
@@ -797,27 +889,54 @@ hx509_revoke_verify(hx509_context context,
 	}
     }
 
+    if (ctx->crls.len > 0) {
+	t0 = time(NULL);
+	if (_hx509_name_hash(&c->tbsCertificate.issuer, &issuer_hash) == 0)
+	    issuer_hashed = 1;
+    }
+
     for (i = 0; i < ctx->crls.len; i++) {
 	struct revoke_crl *crl = &ctx->crls.val[i];
 	struct stat sb;
+	size_t n, mask;
 	int diff;
 
 	/* check if cert.issuer == crls.val[i].crl.issuer */
+	if (issuer_hashed && crl->index.issuer_hash != issuer_hash)
+	    continue;
 	ret = _hx509_name_cmp(&c->tbsCertificate.issuer,
 			      &crl->crl.tbsCertList.issuer, &diff);
 	if (ret || diff)
 	    continue;
 
-	ret = stat(crl->path, &sb);
-	if (ret == 0 && crl->last_modfied != sb.st_mtime) {
-	    CRLCertificateList cl;
-
-	    ret = load_crl(context, crl->path, &crl->last_modfied, &cl);
-	    if (ret == 0) {
-		free_CRLCertificateList(&crl->crl);
-		crl->crl = cl;
-		crl->verified = 0;
-		crl->failed_verify = 0;
+	/*
+	 * check if there is a newer version of the file, but not more
+	 * often than every crl_check_interval seconds
+	 */
+	if (t0 - crl->last_checked >= context->crl_check_interval ||
+	    t0 < crl->last_checked) {
+	    crl->last_checked = t0;
+	    ret = stat(crl->path, &sb);
+	    if (ret == 0 && crl->last_modfied != sb.st_mtime) {
+		CRLCertificateList cl;
+		struct crl_index ci;
+		time_t mtime;
+
+		ret = load_crl(context, crl->path, &mtime, &cl);
+		if (ret == 0) {
+		    ret = index_crl(context, &cl, &ci);
+		    if (ret)
+			free_CRLCertificateList(&cl);
+		}
+		if (ret == 0) {
+		    free_CRLCertificateList(&crl->crl);
+		    free(crl->index.serials);
+		    crl->crl = cl;
+		    crl->index = ci;
+		    crl->last_modfied = mtime;
+		    crl->verified = 0;
+		    crl->failed_verify = 0;
+		}
 	    }
 	}
 	if (crl->failed_verify)
@@ -844,13 +963,18 @@ hx509_revoke_verify(hx509_context context,
 	    }
 	}
 
-	if (crl->crl.tbsCertList.revokedCertificates == NULL)
+	if (crl->index.size == 0)
 	    return 0;
 
 	/* check if cert is in crl */
-	for (j = 0; j < crl->crl.tbsCertList.revokedCertificates->len; j++) {
+	mask = crl->index.size - 1;
+	for (n = serial_hash(&c->tbsCertificate.serialNumber) & mask;
+	     crl->index.serials[n] != 0;
+	     n = (n + 1) & mask) {
 	    time_t t;
 
+	    j = crl->index.serials[n] - 1;
+
 	    ret = der_heim_integer_cmp(&crl->crl.tbsCertList.revokedCertificates->val[j].userCertificate,
 				       &c->tbsCertificate.serialNumber);
 	    if (ret != 0)
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests of hx509_revoke_verify() with CRLs: the issuer and serial
+ * number index, reloading changed CRL files, and several CRLs from
+ * the same issuer.
+ */
+
+#include "hx_locl.h"
+
+static const char *srcdir = ".";
+
+static hx509_cert
+load_cert(hx509_context context, const char *file, int private_key)
+{
+    hx509_certs certs = NULL;
+    hx509_cert cert = NULL;
+    hx509_query *q;
+    char *s;
+    int ret;
+
+    if (private_key) {
+	if (asprintf(&s, "FILE:%s/data/%s.crt,%s/data/%s.key",
+		     srcdir, file, srcdir, file) == -1 || s == NULL)
+	    errx(1, "out of memory");
+    } else {
+	if (asprintf(&s, "FILE:%s/data/%s.crt", srcdir, file) == -1 ||
+	    s == NULL)
+	    errx(1, "out of memory");
+    }
+
+    ret = hx509_certs_init(context, s, 0, NULL, &certs);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_certs_init: %s", s);
+
+    ret = hx509_query_alloc(context, &q);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_query_alloc");
+    if (private_key)
+	hx509_query_match_option(q, HX509_QUERY_OPTION_PRIVATE_KEY);
+    ret = hx509_certs_find(context, certs, q, &cert);
+    if (ret)
+	hx509_err(context, 1, ret, "no certificate in %s", s);
+
+    hx509_query_free(context, q);
+    hx509_certs_free(&certs);
+    free(s);
+    return cert;
+}
+
+/* Write a CRL signed by signer, revoking the certs, valid for lifetime */
+static void
+write_crl(hx509_context context, const char *path, hx509_cert signer,
+	  int lifetime, const char * const *revoked)
+{
+    heim_octet_string os;
+    hx509_certs certs;
+    hx509_crl crl;
+    char *s;
+    int ret;
+
+    ret = hx509_crl_alloc(context, &crl);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_crl_alloc");
+    if (lifetime)
+	hx509_crl_lifetime(context, crl, lifetime);
+
+    ret = hx509_certs_init(context, "MEMORY:revoked-certs", 0, NULL, &certs);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_certs_init");
+    for (; revoked && *revoked; revoked++) {
+	if (asprintf(&s, "FILE:%s/data/%s.crt", srcdir, *revoked) == -1 ||
+	    s == NULL)
+	    errx(1, "out of memory");
+	ret = hx509_certs_append(context, certs, NULL, s);
+	if (ret)
+	    hx509_err(context, 1, ret, "hx509_certs_append: %s", s);
+	free(s);
+    }
+    ret = hx509_crl_add_revoked_certs(context, crl, certs);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_crl_add_revoked_certs");
+    hx509_certs_free(&certs);
+
+    ret = hx509_crl_sign(context, signer, crl, &os);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_crl_sign");
+    rk_dumpdata(path, os.data, os.length);
+
+    der_free_octet_string(&os);
+    hx509_crl_free(context, &crl);
+}
+
+static hx509_revoke_ctx
+revoke_ctx(hx509_context context, const char * const *paths)
+{
+    hx509_revoke_ctx ctx;
+    char *s;
+    int ret;
+
+    ret = hx509_revoke_init(context, &ctx);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_revoke_init");
+    for (; *paths; paths++) {
+	if (asprintf(&s, "FILE:%s", *paths) == -1 || s == NULL)
+	    errx(1, "out of memory");
+	ret = hx509_revoke_add_crl(context, ctx, s);
+	if (ret)
+	    hx509_err(context, 1, ret, "hx509_revoke_add_crl: %s", s);
+	free(s);
+    }
+    return ctx;
+}
+
+static int
+check(hx509_context context, const char *what, hx509_revoke_ctx ctx,
+      hx509_cert cert, hx509_cert ca, int expected)
+{
+    int ret;
+
+    ret = hx509_revoke_verify(context, ctx, NULL, time(NULL), cert, ca);
+    if (ret != expected) {
+	warnx("%s: expected %d, got %d", what, expected, ret);
+	return 1;
+    }
+    return 0;
+}
+
+static const char * const many[] = {
+    "kdc", "https", "pkinit", "revoke", "test-ds-only", "test-ke-only",
+    "ocsp-responder", NULL
+};
+static const char * const only_revoke[] = { "revoke", NULL };
+
+int
+main(int argc, char **argv)
+{
+    hx509_context context;
+    hx509_revoke_ctx ctx;
+    hx509_cert ca, other, test, revoke;
+    int ret, errors = 0;
+
+    if (getenv("srcdir"))
+	srcdir = getenv("srcdir");
+
+    ret = hx509_context_init(&context);
+    if (ret)
+	errx(1, "hx509_context_init failed with %d", ret);
+
+    ca = load_cert(context, "ca", 1);
+    other = load_cert(context, "sub-cert", 1);
+    test = load_cert(context, "test", 0);
+    revoke = load_cert(context, "revoke", 0);
+
+    write_crl(context, "test_revoke-empty.crl", ca, 0, NULL);
+    write_crl(context, "test_revoke-many.crl", ca, 0, many);
+    write_crl(context, "test_revoke-expired.crl", ca, -3600, NULL);
+    /* a CRL with another issuer, it should never be consulted */
+    write_crl(context, "test_revoke-other.crl", other, 0, NULL);
+
+    /* revoked serial found, and not found, among many */
+    {
+	const char * const crls[] = {
+	    "test_revoke-other.crl", "test_revoke-many.crl", NULL
+	};
+
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "revoked serial", ctx, revoke, ca,
+			HX509_CERT_REVOKED);
+	errors += check(context, "revoked serial, again", ctx, revoke, ca,
+			HX509_CERT_REVOKED);
+	errors += check(context, "serial not revoked", ctx, test, ca, 0);
+	hx509_revoke_free(&ctx);
+    }
+
+    /* a CRL without revoked certificates */
+    {
+	const char * const crls[] = { "test_revoke-empty.crl", NULL };
+
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "empty CRL", ctx, revoke, ca, 0);
+	hx509_revoke_free(&ctx);
+    }
+
+    /* only a CRL from another issuer */
+    {
+	const char * const crls[] = { "test_revoke-other.crl", NULL };
+
+	hx509_context_set_missing_revoke(context, 0);
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "other issuer", ctx, revoke, ca,
+			HX509_REVOKE_STATUS_MISSING);
+	hx509_revoke_free(&ctx);
+    }
+
+    /*
+     * Several CRLs from the same issuer: the first one that verifies
+     * is used, one that does not is skipped.
+     */
+    {
+	const char * const crls[] = {
+	    "test_revoke-expired.crl", "test_revoke-other.crl",
+	    "test_revoke-many.crl", "test_revoke-empty.crl", NULL
+	};
+
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "same issuer, expired first", ctx, revoke, ca,
+			HX509_CERT_REVOKED);
+	errors += check(context, "same issuer, not revoked", ctx, test, ca, 0);
+	hx509_revoke_free(&ctx);
+    }
+    {
+	const char * const crls[] = {
+	    "test_revoke-empty.crl", "test_revoke-many.crl", NULL
+	};
+
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "same issuer, empty first", ctx, revoke, ca, 0);
+	hx509_revoke_free(&ctx);
+    }
+
+    /*
+     * Reload after the CRL file changes, not before the check interval
+     * has passed.  The sleep makes sure the file gets a new mtime.
+     */
+    {
+	const char * const crls[] = { "test_revoke-reload.crl", NULL };
+
+	write_crl(context, crls[0], ca, 0, NULL);
+	ctx = revoke_ctx(context, crls);
+	errors += check(context, "before reload", ctx, revoke, ca, 0);
+
+	sleep(2);
+	write_crl(context, crls[0], ca, 0, only_revoke);
+	errors += check(context, "changed, within interval", ctx, revoke, ca, 0);
+
+	hx509_context_set_crl_check_interval(context, 0);
+	errors += check(context, "changed, reloaded", ctx, revoke, ca,
+			HX509_CERT_REVOKED);
+	errors += check(context, "reloaded, not revoked", ctx, test, ca, 0);
+
+	sleep(2);
+	write_crl(context, crls[0], ca, 0, NULL);
+	errors += check(context, "changed back, reloaded", ctx, revoke, ca, 0);
+	hx509_revoke_free(&ctx);
+    }
+
+    hx509_cert_free(ca);
+    hx509_cert_free(other);
+    hx509_cert_free(test);
+    hx509_cert_free(revoke);
+    hx509_context_free(&context);
+
+    unlink("test_revoke-empty.crl");
+    unlink("test_revoke-many.crl");
+    unlink("test_revoke-expired.crl");
+    unlink("test_revoke-other.crl");
+    unlink("test_revoke-reload.crl");
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests of the cache of verified CA signatures in hx509_verify_path():
+ * a cached link must not let a changed signature or a different signer
+ * key through, and an expired entry must be verified again.
+ */
+
+#include "hx_locl.h"
+
+static const char *srcdir = ".";
+
+static hx509_cert
+load_key(hx509_context context, const char *file)
+{
+    hx509_certs certs = NULL;
+    hx509_cert cert = NULL;
+    hx509_query *q;
+    char *s;
+    int ret;
+
+    if (asprintf(&s, "FILE:%s/data/%s.crt,%s/data/%s.key",
+		 srcdir, file, srcdir, file) == -1 || s == NULL)
+	errx(1, "out of memory");
+
+    ret = hx509_certs_init(context, s, 0, NULL, &certs);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_certs_init: %s", s);
+
+    ret = hx509_query_alloc(context, &q);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_query_alloc");
+    hx509_query_match_option(q, HX509_QUERY_OPTION_PRIVATE_KEY);
+    ret = hx509_certs_find(context, certs, q, &cert);
+    if (ret)
+	hx509_err(context, 1, ret, "no key in %s", s);
+
+    hx509_query_free(context, q);
+    hx509_certs_free(&certs);
+    free(s);
+    return cert;
+}
+
+/*
+ * Issue a certificate for the key of key, signed by signer or self
+ * signed, and attach the key so it can sign certificates in turn.
+ */
+static hx509_cert
+issue(hx509_context context, const char *subject, hx509_cert key,
+      hx509_cert signer, int ca, time_t lifetime)
+{
+    SubjectPublicKeyInfo spki;
+    heim_octet_string os;
+    hx509_ca_tbs tbs;
+    hx509_cert cert;
+    hx509_name name;
+    int ret;
+
+    ret = hx509_ca_tbs_init(context, &tbs);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_ca_tbs_init");
+
+    ret = hx509_parse_name(context, subject, &name);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_parse_name");
+    ret = hx509_ca_tbs_set_subject(context, tbs, name);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_ca_tbs_set_subject");
+    hx509_name_free(&name);
+
+    ret = hx509_cert_get_SPKI(context, key, &spki);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_cert_get_SPKI");
+    ret = hx509_ca_tbs_set_spki(context, tbs, &spki);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_ca_tbs_set_spki");
+    free_SubjectPublicKeyInfo(&spki);
+
+    if (ca) {
+	ret = hx509_ca_tbs_set_ca(context, tbs, -1);
+	if (ret)
+	    hx509_err(context, 1, ret, "hx509_ca_tbs_set_ca");
+    }
+    if (lifetime)
+	hx509_ca_tbs_set_notAfter_lifetime(context, tbs, lifetime);
+
+    if (signer)
+	ret = hx509_ca_sign(context, tbs, signer, &cert);
+    else
+	ret = hx509_ca_sign_self(context, tbs, _hx509_cert_private_key(key),
+				 &cert);
+    if (ret)
+	hx509_err(context, 1, ret, "failed to sign %s", subject);
+    hx509_ca_tbs_free(&tbs);
+
+    /* as if read from a file, so that the signed data is kept */
+    ret = hx509_cert_binary(context, cert, &os);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_cert_binary");
+    hx509_cert_free(cert);
+    cert = hx509_cert_init_data(context, os.data, os.length, NULL);
+    if (cert == NULL)
+	errx(1, "hx509_cert_init_data failed");
+    der_free_octet_string(&os);
+
+    ret = _hx509_cert_assign_key(cert, _hx509_cert_private_key(key));
+    if (ret)
+	hx509_err(context, 1, ret, "_hx509_cert_assign_key");
+    return cert;
+}
+
+/*
+ * Copy cert, flipping a bit of its signature, or replacing its public
+ * key and issuer with those of key.  The subject and subject key
+ * identifier are kept, so that the copy is still picked as the issuer
+ * of the certificates cert signed, and since it is no longer self
+ * signed, its own signature is not checked when it is a trust anchor.
+ */
+static hx509_cert
+forge(hx509_context context, hx509_cert cert, hx509_cert key)
+{
+    heim_octet_string os;
+    Certificate c;
+    hx509_cert res;
+    size_t size;
+    int ret;
+
+    ret = hx509_cert_binary(context, cert, &os);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_cert_binary");
+    ret = decode_Certificate(os.data, os.length, &c, &size);
+    if (ret)
+	errx(1, "decode_Certificate: %d", ret);
+    der_free_octet_string(&os);
+
+    if (key) {
+	hx509_name issuer;
+
+	free_SubjectPublicKeyInfo(&c.tbsCertificate.subjectPublicKeyInfo);
+	ret = hx509_cert_get_SPKI(context, key,
+				  &c.tbsCertificate.subjectPublicKeyInfo);
+	if (ret)
+	    hx509_err(context, 1, ret, "hx509_cert_get_SPKI");
+	free_Name(&c.tbsCertificate.issuer);
+	ret = hx509_cert_get_issuer(key, &issuer);
+	if (ret == 0)
+	    ret = hx509_name_to_Name(issuer, &c.tbsCertificate.issuer);
+	if (ret)
+	    hx509_err(context, 1, ret, "failed to copy issuer");
+	hx509_name_free(&issuer);
+	der_free_octet_string(&c.tbsCertificate._save);
+    } else {
+	((unsigned char *)c.signatureValue.data)[c.signatureValue.length / 16]
+	    ^= 0x01;
+    }
+
+    ASN1_MALLOC_ENCODE(Certificate, os.data, os.length, &c, &size, ret);
+    if (ret)
+	errx(1, "encode_Certificate: %d", ret);
+    free_Certificate(&c);
+
+    res = hx509_cert_init_data(context, os.data, os.length, NULL);
+    if (res == NULL)
+	errx(1, "hx509_cert_init_data failed");
+    der_free_octet_string(&os);
+    return res;
+}
+
+static int
+verify(hx509_context context, hx509_cert anchor, hx509_cert ca,
+       hx509_cert cert, time_t t)
+{
+    hx509_verify_ctx ctx;
+    hx509_certs anchors, pool;
+    int ret;
+
+    ret = hx509_verify_init_ctx(context, &ctx);
+    if (ret)
+	hx509_err(context, 1, ret, "hx509_verify_init_ctx");
+    ret = hx509_certs_init(context, "MEMORY:anchors", 0, NULL, &anchors);
+    if (ret == 0)
+	ret = hx509_certs_add(context, anchors, anchor);
+    if (ret == 0)
+	ret = hx509_certs_init(context, "MEMORY:pool", 0, NULL, &pool);
+    if (ret == 0)
+	ret = hx509_certs_add(context, pool, ca);
+    if (ret)
+	hx509_err(context, 1, ret, "failed to set up certificates");
+
+    hx509_verify_attach_anchors(ctx, anchors);
+    if (t)
+	hx509_verify_set_time(ctx, t);
+
+    ret = hx509_verify_path(context, ctx, cert, pool);
+
+    hx509_certs_free(&anchors);
+    hx509_certs_free(&pool);
+    hx509_verify_destroy_ctx(ctx);
+    return ret;
+}
+
+#define CHECK(what, expr)					\
+    do {							\
+	if (!(expr)) {						\
+	    warnx("%s: %s failed", what, #expr);		\
+	    errors++;						\
+	}							\
+    } while (0)
+
+int
+main(int argc, char **argv)
+{
+    hx509_context context;
+    hx509_cert rootkey, cakey, eekey, otherkey;
+    hx509_cert root, ca, ee, badsig, fakeroot, shortca, shortee;
+    unsigned long hits;
+    time_t t;
+    int errors = 0;
+
+    if (getenv("srcdir"))
+	srcdir = getenv("srcdir");
+
+    if (hx509_context_init(&context))
+	errx(1, "hx509_context_init failed");
+
+    rootkey = load_key(context, "ca");
+    cakey = load_key(context, "sub-ca");
+    eekey = load_key(context, "sub-cert");
+    otherkey = load_key(context, "test");
+
+    root = issue(context, "CN=Test root,C=SE", rootkey, NULL, 1, 0);
+    ca = issue(context, "CN=Test CA,C=SE", cakey, root, 1, 0);
+    ee = issue(context, "CN=Test EE,C=SE", eekey, ca, 0, 0);
+
+    /* the first verification fills the cache, the second uses it */
+    CHECK("first", verify(context, root, ca, ee, 0) == 0);
+    hits = _hx509_sig_cache_hits(context);
+    CHECK("cached", verify(context, root, ca, ee, 0) == 0);
+    CHECK("cached", _hx509_sig_cache_hits(context) > hits);
+
+    /* a CA certificate with a changed signature */
+    badsig = forge(context, ca, NULL);
+    CHECK("changed signature", verify(context, root, badsig, ee, 0) != 0);
+
+    /* a trust anchor with the same name and key identifier as the root */
+    fakeroot = forge(context, root, otherkey);
+    CHECK("other signer key", verify(context, fakeroot, ca, ee, 0) != 0);
+
+    CHECK("still good", verify(context, root, ca, ee, 0) == 0);
+
+    /*
+     * A CA certificate that expires in two seconds: once it has, its
+     * cached signature must be verified again, checking the chain as
+     * of a time when it was still valid.
+     */
+    t = time(NULL);
+    shortca = issue(context, "CN=Short lived CA,C=SE", cakey, root, 1, 2);
+    shortee = issue(context, "CN=Short lived EE,C=SE", eekey, shortca, 0, 0);
+
+    CHECK("short lived", verify(context, root, shortca, shortee, 0) == 0);
+    hits = _hx509_sig_cache_hits(context);
+    CHECK("short lived, cached",
+	  verify(context, root, shortca, shortee, 0) == 0);
+    /* the CA certificate and the self signed root */
+    CHECK("short lived, cached", _hx509_sig_cache_hits(context) == hits + 2);
+
+    sleep(3);
+    hits = _hx509_sig_cache_hits(context);
+    CHECK("expired", verify(context, root, shortca, shortee, t) == 0);
+    /* only the root */
+    CHECK("expired", _hx509_sig_cache_hits(context) == hits + 1);
+
+    hx509_cert_free(rootkey);
+    hx509_cert_free(cakey);
+    hx509_cert_free(eekey);
+    hx509_cert_free(otherkey);
+    hx509_cert_free(root);
+    hx509_cert_free(ca);
+    hx509_cert_free(ee);
+    hx509_cert_free(badsig);
+    hx509_cert_free(fakeroot);
+    hx509_cert_free(shortca);
+    hx509_cert_free(shortee);
+    hx509_context_free(&context);
+
+    return errors ? 1 : 0;
+}
@@ -294,3 +294,23 @@ _kadm5_s_get_db(void *server_handle)
     kadm5_server_context *context = server_handle;
     return context->db;
 }
+
+/*
+ * Make `server_handle' act for `client_name' from now on, with that
+ * principal's ACL.  This lets a long-lived kadmind process reuse one
+ * server context for the connections of different callers.
+ */
+kadm5_ret_t
+_kadm5_s_set_caller(void *server_handle, const char *client_name)
+{
+    kadm5_server_context *context = server_handle;
+    krb5_principal caller;
+    kadm5_ret_t ret;
+
+    ret = krb5_parse_name(context->context, client_name, &caller);
+    if (ret)
+	return ret;
+    krb5_free_principal(context->context, context->caller);
+    context->caller = caller;
+    return _kadm5_acl_init(context);
+}
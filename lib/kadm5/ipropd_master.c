@@ -121,6 +121,26 @@ make_listen_socket (krb5_context context, const char *port_str)
     return fd;
 }
 
+/*
+ * Slave sockets are non-blocking.  Messages to a slave are encrypted
+ * and queued on `out', and written out as the socket becomes writable,
+ * so that one slow slave cannot hold up the others.  Incoming bytes are
+ * accumulated on `in' until a complete message has arrived.
+ */
+
+struct slave_buf {
+    unsigned char *data;
+    size_t len;		/* bytes in buffer */
+    size_t off;		/* bytes already consumed/written */
+    size_t size;	/* allocated size */
+};
+
+/* Largest message we accept from a slave */
+#define SLAVE_MSG_MAX		(64 * 1024)
+
+/* Refill the output queue from a dump in progress below this size */
+#define SLAVE_DUMP_LOWAT	(256 * 1024)
+
 struct slave {
     krb5_socket_t fd;
     struct sockaddr_in addr;
@@ -132,11 +152,37 @@ struct slave {
     unsigned long flags;
 #define SLAVE_F_DEAD	0x1
 #define SLAVE_F_AYT	0x2
+#define SLAVE_F_READY	0x4	/* slave has told us its version */
+#define SLAVE_F_PENDING	0x8	/* send diffs once the output queue drains */
+    struct slave_buf in;
+    struct slave_buf out;
+    krb5_storage *dump;		/* complete dump being streamed, if any */
+    int dump_fd;
+    uint32_t dump_version;
     struct slave *next;
 };
 
 typedef struct slave slave;
 
+/*
+ * The log entries needed by the slaves are read and split up once per
+ * log version and shared among all slaves: a slave at version V is sent
+ * the bytes from offsets[V + 1 - first] to offsets[current + 1 - first].
+ */
+
+struct diff_cache {
+    uint32_t initial_version;	/* identifies the log the data came from */
+    uint32_t initial_tstamp;
+    uint32_t oldest;		/* version where the backwards scan stopped */
+    uint32_t first;		/* version of the first entry in data */
+    uint32_t last;		/* version of the last entry in data */
+    int at_start;		/* data goes back as far as the log does */
+    size_t *offsets;		/* last - first + 2 entry offsets into data */
+    krb5_data data;
+};
+
+static struct diff_cache diffs;
+
 static int
 check_acl (krb5_context context, const char *name)
 {
@@ -195,6 +241,55 @@ slave_gone_p (slave *s)
     return 0;
 }
 
+static void
+slave_buf_free(struct slave_buf *b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+static int
+slave_buf_reserve(struct slave_buf *b, size_t n)
+{
+    unsigned char *tmp;
+    size_t size;
+
+    /* Reclaim consumed space before growing */
+    if (b->off > 0) {
+	memmove(b->data, b->data + b->off, b->len - b->off);
+	b->len -= b->off;
+	b->off = 0;
+    }
+    if (b->size - b->len >= n)
+	return 0;
+    size = b->size ? b->size : 4096;
+    while (size - b->len < n)
+	size *= 2;
+    tmp = realloc(b->data, size);
+    if (tmp == NULL)
+	return ENOMEM;
+    b->data = tmp;
+    b->size = size;
+    return 0;
+}
+
+static int
+slave_has_output(slave *s)
+{
+    return s->out.off < s->out.len;
+}
+
+static void
+slave_dump_close(slave *s)
+{
+    if (s->dump)
+	krb5_storage_free(s->dump);
+    if (s->dump_fd != -1)
+	close(s->dump_fd);
+    s->dump = NULL;
+    s->dump_fd = -1;
+}
+
 static void
 slave_dead(krb5_context context, slave *s)
 {
@@ -204,10 +299,120 @@ slave_dead(krb5_context context, slave *s)
 	rk_closesocket (s->fd);
 	s->fd = rk_INVALID_SOCKET;
     }
+    slave_dump_close(s);
+    slave_buf_free(&s->in);
+    slave_buf_free(&s->out);
     s->flags |= SLAVE_F_DEAD;
+    s->flags &= ~(SLAVE_F_READY|SLAVE_F_PENDING);
     slave_seen(s);
 }
 
+/*
+ * Write as much of the output queue as the socket will take without
+ * blocking.
+ */
+
+static int
+slave_flush(krb5_context context, slave *s)
+{
+    ssize_t n;
+
+    while (slave_has_output(s)) {
+	n = send(s->fd, s->out.data + s->out.off, s->out.len - s->out.off, 0);
+	if (rk_IS_SOCKET_ERROR(n)) {
+	    int ret = rk_SOCK_ERRNO;
+
+	    if (ret == EINTR)
+		continue;
+	    if (ret == EAGAIN || ret == EWOULDBLOCK)
+		return 0;
+	    krb5_warn(context, ret, "write to slave %s", s->name);
+	    return ret;
+	}
+	s->out.off += n;
+    }
+    s->out.off = s->out.len = 0;
+    return 0;
+}
+
+/*
+ * Encrypt `data' as a KRB-PRIV message and queue it for the slave,
+ * framed the same way as krb5_write_priv_message().
+ */
+
+static int
+slave_enqueue(krb5_context context, slave *s, krb5_data *data)
+{
+    krb5_error_code ret;
+    krb5_data packet;
+    unsigned char *p;
+
+    ret = krb5_mk_priv(context, s->ac, data, &packet, NULL);
+    if (ret)
+	return ret;
+    ret = slave_buf_reserve(&s->out, packet.length + 4);
+    if (ret == 0) {
+	p = s->out.data + s->out.len;
+	p[0] = (packet.length >> 24) & 0xff;
+	p[1] = (packet.length >> 16) & 0xff;
+	p[2] = (packet.length >>  8) & 0xff;
+	p[3] = (packet.length >>  0) & 0xff;
+	memcpy(p + 4, packet.data, packet.length);
+	s->out.len += packet.length + 4;
+    }
+    krb5_data_free(&packet);
+    return ret;
+}
+
+static int
+slave_send(krb5_context context, slave *s, krb5_data *data)
+{
+    int ret;
+
+    ret = slave_enqueue(context, s, data);
+    if (ret == 0)
+	ret = slave_flush(context, s);
+    return ret;
+}
+
+/*
+ * Queue more of a complete dump being streamed to a slave, and finish
+ * up once the end of the dump has been queued.
+ */
+
+static int
+slave_pump_dump(krb5_context context, slave *s)
+{
+    krb5_error_code ret = 0;
+    krb5_data data;
+
+    while (s->dump != NULL && s->out.len - s->out.off < SLAVE_DUMP_LOWAT) {
+	ret = krb5_ret_data(s->dump, &data);
+	if (ret == HEIM_ERR_EOF) {
+	    ret = 0;
+	    slave_dump_close(s);
+	    s->version = s->dump_version;
+	    krb5_warnx(context, "sent complete database (version %lu) to "
+		       "slave %s", (unsigned long)s->version, s->name);
+	    break;
+	}
+	if (ret) {
+	    krb5_warn(context, ret, "krb5_ret_data(dump, &data)");
+	    return ret;
+	}
+	ret = slave_enqueue(context, s, &data);
+	krb5_data_free(&data);
+	if (ret) {
+	    krb5_warn(context, ret, "krb5_mk_priv");
+	    return ret;
+	}
+    }
+    ret = slave_flush(context, s);
+    if (ret == 0)
+	slave_seen(s);
+    return ret;
+}
+
 static void
 remove_slave (krb5_context context, slave *s, slave **root)
 {
@@ -215,6 +420,9 @@ remove_slave (krb5_context context, slave *s, slave **root)
 
     if (!rk_IS_BAD_SOCKET(s->fd))
 	rk_closesocket (s->fd);
+    slave_dump_close(s);
+    slave_buf_free(&s->in);
+    slave_buf_free(&s->out);
     if (s->name)
 	free (s->name);
     if (s->ac)
@@ -239,13 +447,14 @@ add_slave (krb5_context context, krb5_keytab keytab, slave **root,
     krb5_ticket *ticket = NULL;
     char hostname[128];
 
-    s = malloc(sizeof(*s));
+    s = calloc(1, sizeof(*s));
     if (s == NULL) {
 	krb5_warnx (context, "add_slave: no memory");
 	return;
     }
     s->name = NULL;
     s->ac = NULL;
+    s->dump_fd = -1;
 
     addr_len = sizeof(s->addr);
     s->fd = accept (fd, (struct sockaddr *)&s->addr, &addr_len);
@@ -303,6 +512,7 @@ add_slave (krb5_context context, krb5_keytab keytab, slave **root,
 
     krb5_warnx (context, "connection from %s", s->name);
 
+    socket_set_nonblocking(s->fd, 1);
     s->version = 0;
     s->flags = 0;
     slave_seen(s);
@@ -459,7 +669,6 @@ send_complete (krb5_context context, slave *s, const char *database,
     krb5_error_code ret;
     krb5_storage *dump = NULL;
     uint32_t vno = 0;
-    krb5_data data;
     int fd = -1;
     struct stat st;
     char *dfn;
@@ -536,7 +745,19 @@ send_complete (krb5_context context, slave *s, const char *database,
 	 * our lock to a shared one.
 	 */
 
-	ret = flock(fd, LOCK_EX);
+	/*
+	 * Don't block: another slave may be reading the old dump, in
+	 * which case we try again once it's done.
+	 */
+	ret = flock(fd, LOCK_EX | LOCK_NB);
+	if (ret == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+	    if (verbose)
+		krb5_warnx(context, "send_complete: dump file busy, "
+			   "deferring complete dump to slave %s", s->name);
+	    s->flags |= SLAVE_F_PENDING;
+	    ret = 0;
+	    goto done;
+	}
 	if (ret == -1) {
 	    ret = errno;
 	    krb5_warn(context, ret, "flock(fd, LOCK_EX)");
@@ -583,38 +804,22 @@ send_complete (krb5_context context, slave *s, const char *database,
     /*
      * Leaving the above loop, dump should have a ptr right after the initial
      * 4 byte DB version number and we should have a shared lock on the file
-     * (which we may have just created), so we are reading to simply blast
-     * the data down the wire.
+     * (which we may have just created).  The slave takes over the dump and
+     * the records are queued for it as its output queue drains, so other
+     * slaves are served while the complete dump is being sent.
      */
 
-    for (;;) {
-	ret = krb5_ret_data(dump, &data);
-	if (ret == HEIM_ERR_EOF) {
-	    ret = 0;	/* EOF is not an error, it's success */
-	    goto done;
-	}
-
-	if (ret) {
-	    krb5_warn(context, ret, "krb5_ret_data(dump, &data)");
-	    slave_dead(context, s);
-	    goto done;
-	}
-
-	ret = krb5_write_priv_message(context, s->ac, &s->fd, &data);
-	krb5_data_free(&data);
+    s->dump = dump;
+    s->dump_fd = fd;
+    s->dump_version = vno;
+    dump = NULL;
+    fd = -1;
 
-	if (ret) {
-	    krb5_warn (context, ret, "krb5_write_priv_message");
-	    slave_dead(context, s);
-	    goto done;
-	}
-    }
+    ret = slave_pump_dump(context, s);
+    if (ret)
+	slave_dead(context, s);
 
 done:
-    if (!ret) {
-	s->version = vno;
-	slave_seen(s);
-    }
     if (fd != -1)
 	close(fd);
     if (dump)
@@ -633,6 +838,10 @@ send_are_you_there (krb5_context context, slave *s)
     if (s->flags & (SLAVE_F_DEAD|SLAVE_F_AYT))
 	return 0;
 
+    /* Don't interleave with a complete dump, the slave is busy anyway */
+    if (s->dump != NULL)
+	return 0;
+
     krb5_warnx(context, "slave %s missing, sending AYT", s->name);
 
     s->flags |= SLAVE_F_AYT;
@@ -650,10 +859,10 @@ send_are_you_there (krb5_context context, slave *s)
     krb5_storage_free (sp);
 
     if (ret == 0) {
-        ret = krb5_write_priv_message(context, s->ac, &s->fd, &data);
+        ret = slave_send(context, s, &data);
 
         if (ret) {
-            krb5_warn(context, ret, "are_you_there: krb5_write_priv_message");
+            krb5_warn(context, ret, "are_you_there: slave_send");
             slave_dead(context, s);
             return 1;
         }
@@ -662,80 +871,164 @@ send_are_you_there (krb5_context context, slave *s)
     return 0;
 }
 
+static void
+diff_cache_free(void)
+{
+    free(diffs.offsets);
+    krb5_data_free(&diffs.data);
+    memset(&diffs, 0, sizeof(diffs));
+}
+
+/*
+ * Returns true if the diff cache has all the entries a slave at
+ * `version' needs to get to `current_version'.
+ */
+
 static int
-send_diffs (kadm5_server_context *server_context, slave *s, int log_fd,
-	    const char *database, uint32_t current_version,
-	    uint32_t current_tstamp)
+diff_cache_covers(uint32_t version, uint32_t current_version)
+{
+    return diffs.offsets != NULL && version < current_version &&
+	version + 1 >= diffs.first && current_version <= diffs.last;
+}
+
+/*
+ * Make sure the diff cache holds the log entries from version `want'
+ * (or as far back as the log goes) to the end of the log.  The log is
+ * only read if the cached data doesn't cover `want' or the log has
+ * changed since it was read.
+ */
+
+/*
+ * Find the start of each of the log records read into `data', which starts
+ * at offset `left' in the log, listing them last to first as the walk in
+ * diff_cache_fill() does.
+ */
+
+static int
+diff_cache_split(krb5_context context, krb5_data *data, off_t left,
+		 off_t **leftsp, size_t *nleftsp,
+		 uint32_t *firstp, uint32_t *lastp)
 {
-    krb5_context context = server_context->context;
     krb5_storage *sp;
-    uint32_t ver, initial_version, initial_version2;
+    off_t *lefts = NULL, *tmp;
+    size_t nlefts = 0, i;
+    uint32_t ver, len;
+    off_t o = 0;
+    int ret = 0;
+
+    sp = krb5_storage_from_readonly_mem(data->data, data->length);
+    if (sp == NULL)
+        return ENOMEM;
+    while (ret == 0 && o < (off_t)data->length) {
+        if (krb5_storage_seek(sp, o, SEEK_SET) != o)
+            ret = EINVAL;
+        if (ret == 0)
+            ret = krb5_ret_uint32(sp, &ver);
+        if (ret == 0 && krb5_storage_seek(sp, 8, SEEK_CUR) != o + 12)
+            ret = EINVAL;
+        if (ret == 0)
+            ret = krb5_ret_uint32(sp, &len);
+        if (ret == 0 && (off_t)len > (off_t)data->length - o - 24)
+            ret = EINVAL;
+        if (ret == 0 && nlefts > 0 && ver != *lastp + 1)
+            ret = EINVAL;
+        if (ret)
+            break;
+
+        tmp = realloc(lefts, (nlefts + 1) * sizeof(lefts[0]));
+        if (tmp == NULL) {
+            ret = ENOMEM;
+            break;
+        }
+        lefts = tmp;
+        lefts[nlefts++] = left + o;
+        if (nlefts == 1)
+            *firstp = ver;
+        *lastp = ver;
+        o += 24 + len;
+    }
+    krb5_storage_free(sp);
+    if (ret) {
+        krb5_warnx(context, "send_diffs: malformed log entries read");
+        free(lefts);
+        return ret;
+    }
+
+    /* Last to first */
+    for (i = 0; i < nlefts / 2; i++) {
+        o = lefts[i];
+        lefts[i] = lefts[nlefts - 1 - i];
+        lefts[nlefts - 1 - i] = o;
+    }
+    *leftsp = lefts;
+    *nleftsp = nlefts;
+    return 0;
+}
+
+static int
+diff_cache_fill(kadm5_server_context *server_context, int log_fd,
+		uint32_t want, uint32_t current_version)
+{
+    krb5_context context = server_context->context;
+    krb5_storage *sp, *vsp;
+    uint32_t ver = 0, initial_version, initial_version2;
     uint32_t initial_tstamp, initial_tstamp2;
-    enum kadm_ops op;
+    uint32_t first = 0, last = 0;
+    enum kadm_ops op = kadm_nop;
+    int at_start = 0;
+    int indexed = 0;
     uint32_t len;
     off_t right, left;
+    off_t *lefts = NULL;
+    size_t nlefts = 0, i;
     krb5_ssize_t bytes;
     krb5_data data;
+    size_t *offsets;
     int ret = 0;
 
-    if (s->flags & SLAVE_F_DEAD) {
-        krb5_warnx(context, "not sending diffs to dead slave %s", s->name);
-        return 0;
+    if (flock(log_fd, LOCK_SH) == -1) {
+        ret = errno;
+        krb5_warn(context, ret, "could not obtain shared lock on log file");
+        return ret;
+    }
+    ret = kadm5_log_get_version_fd(server_context, log_fd, LOG_VERSION_FIRST,
+                                   &initial_version, &initial_tstamp);
+    if (ret) {
+        flock(log_fd, LOCK_UN);
+        krb5_warn(context, ret, "send_diffs: failed to read log");
+        return ret;
     }
 
-    if (s->version == current_version) {
-	char buf[4];
-
-	sp = krb5_storage_from_mem(buf, 4);
-	if (sp == NULL)
-	    krb5_errx(context, IPROPD_RESTART, "krb5_storage_from_mem");
-	ret = krb5_store_uint32(sp, YOU_HAVE_LAST_VERSION);
-	krb5_storage_free(sp);
-	data.data   = buf;
-	data.length = 4;
-        if (ret == 0) {
-            ret = krb5_write_priv_message(context, s->ac, &s->fd, &data);
-            if (ret) {
-                krb5_warn(context, ret, "send_diffs: failed to send to slave");
-                slave_dead(context, s);
-            }
-            krb5_warnx(context, "slave %s in sync already at version %ld",
-                       s->name, (long)s->version);
-        }
-	return ret;
+    if (diffs.offsets != NULL &&
+        diffs.initial_version == initial_version &&
+        diffs.initial_tstamp == initial_tstamp &&
+        diffs.last >= current_version &&
+        (diffs.first <= want || diffs.at_start)) {
+        /* Cache is current, and has as much of the log as there is */
+        flock(log_fd, LOCK_UN);
+        return 0;
     }
 
-    if (verbose)
-        krb5_warnx(context, "sending diffs to live-seeming slave %s", s->name);
+    sp = kadm5_log_goto_end(server_context, log_fd);
 
     /*
-     * XXX The code that makes the diffs should be made a separate function,
-     * then error handling (send_are_you_there() or slave_dead()) can be done
-     * here.
+     * When the slave's resume point is past the start of the log, look it
+     * up directly (in O(log n) if the log is indexed) and read from there,
+     * rather than walking back to it one record at a time.
      */
-
-    if (flock(log_fd, LOCK_SH) == -1) {
-        krb5_warn(context, errno, "could not obtain shared lock on log file");
-        send_are_you_there(context, s);
-        return errno;
+    if (sp != NULL && want > initial_version &&
+        kadm5_log_goto_version(server_context, log_fd, want, &vsp) == 0) {
+        left = krb5_storage_seek(vsp, 0, SEEK_CUR);
+        krb5_storage_free(vsp);
+        indexed = (left != (off_t)-1);
     }
-    ret = kadm5_log_get_version_fd(server_context, log_fd, LOG_VERSION_FIRST,
-                                   &initial_version, &initial_tstamp);
-    sp = kadm5_log_goto_end(server_context, log_fd);
     flock(log_fd, LOCK_UN);
-    if (ret) {
-        if (sp != NULL)
-            krb5_storage_free(sp);
+    if (sp == NULL) {
+        ret = errno ? errno : EINVAL;
         krb5_warn(context, ret, "send_diffs: failed to read log");
-        send_are_you_there(context, s);
         return ret;
     }
-    if (sp == NULL) {
-        send_are_you_there(context, s);
-        krb5_warn(context, errno ? errno : EINVAL,
-                  "send_diffs: failed to read log");
-        return errno ? errno : EINVAL;
-    }
+
     /*
      * We're not holding any locks here, so we can't prevent truncations.
      *
@@ -744,73 +1037,91 @@ send_diffs (kadm5_server_context *server_context, slave *s, int log_fd,
      */
     right = krb5_storage_seek(sp, 0, SEEK_CUR);
     if (right == (off_t)-1) {
+        ret = errno;
         krb5_storage_free(sp);
-        send_are_you_there(context, s);
-        return errno;
+        return ret;
     }
-    for (;;) {
+    if (!indexed)
+        left = right;
+    while (!indexed) {
+        off_t *tmp;
+
+        if (left == 0) {
+            at_start = 1;
+            break;
+        }
 	ret = kadm5_log_previous (context, sp, &ver, NULL, &op, &len);
 	if (ret)
 	    krb5_err(context, IPROPD_RESTART, ret,
 		     "send_diffs: failed to find previous entry");
 	left = krb5_storage_seek(sp, -16, SEEK_CUR);
         if (left == (off_t)-1) {
+            ret = errno;
             krb5_storage_free(sp);
-            send_are_you_there(context, s);
-            return errno;
+            free(lefts);
+            return ret;
         }
-	if (ver == s->version + 1)
-	    break;
 
-        /*
-         * We don't expect to reach the slave's version, except when it is
-         * starting empty with the uber record.
-         */
-	if (ver == s->version && !(ver == 0 && op == kadm_nop)) {
-            /*
-             * This shouldn't happen, but recall we're not holding a lock on
-             * the log.
-             */
+        /* The uber record is never sent, and stops the scan */
+        if (ver == 0 && op == kadm_nop) {
+            at_start = 1;
+            break;
+        }
+
+        /* Versions in the log are consecutive */
+        if (nlefts > 0 && ver != first - 1) {
+            krb5_warnx(context, "send_diffs: log version %lu follows %lu",
+                       (unsigned long)first, (unsigned long)ver);
+            at_start = 1;
+            break;
+        }
+
+        tmp = realloc(lefts, (nlefts + 1) * sizeof(lefts[0]));
+        if (tmp == NULL) {
             krb5_storage_free(sp);
-            krb5_warnx(context, "iprop log truncated while sending diffs to "
-                       "slave??  ver = %lu", (unsigned long)ver);
-            send_are_you_there(context, s);
-            return 0;
+            free(lefts);
+            return ENOMEM;
         }
+        lefts = tmp;
+        lefts[nlefts++] = left;
+        if (nlefts == 1)
+            last = ver;
+        first = ver;
 
-        /* If we've reached the uber record, send the complete database */
-	if (left == 0 || (ver == 0 && op == kadm_nop)) {
-	    krb5_storage_free(sp);
-	    krb5_warnx(context,
-		       "slave %s (version %lu) out of sync with master "
-		       "(first version in log %lu), sending complete database",
-		       s->name, (unsigned long)s->version, (unsigned long)ver);
-	    return send_complete (context, s, database, current_version, ver,
-                                  initial_tstamp);
-	}
+	if (ver <= want)
+	    break;
     }
 
-    assert(ver == s->version + 1);
-
-    krb5_warnx(context,
-	       "syncing slave %s from version %lu to version %lu",
-	       s->name, (unsigned long)s->version,
-	       (unsigned long)current_version);
+    diff_cache_free();
+    diffs.oldest = indexed ? want : ver;
+    diffs.at_start = at_start;
+    diffs.initial_version = initial_version;
+    diffs.initial_tstamp = initial_tstamp;
+    if (nlefts == 0 && (!indexed || left == right)) {
+        /* Nothing but the uber record */
+        krb5_storage_free(sp);
+        return 0;
+    }
 
-    ret = krb5_data_alloc (&data, right - left + 4);
+    if (!indexed)
+        left = lefts[nlefts - 1];
+    ret = krb5_data_alloc(&data, right - left);
     if (ret) {
-	krb5_storage_free(sp);
-	krb5_warn (context, ret, "send_diffs: krb5_data_alloc");
-        send_are_you_there(context, s);
-	return 1;
+        krb5_storage_free(sp);
+        free(lefts);
+        return ret;
     }
-    bytes = krb5_storage_read(sp, (char *)data.data + 4, data.length - 4);
+    if (krb5_storage_seek(sp, left, SEEK_SET) == left)
+        bytes = krb5_storage_read(sp, data.data, data.length);
+    else
+        bytes = -1;
     krb5_storage_free(sp);
-    if (bytes != data.length - 4) {
-        krb5_warnx(context, "iprop log truncated while sending diffs to "
-                   "slave??  ver = %lu", (unsigned long)ver);
-        send_are_you_there(context, s);
-        return 1;
+    if (bytes != data.length) {
+        krb5_warnx(context, "iprop log truncated while reading diffs?? "
+                   "ver = %lu", (unsigned long)ver);
+        krb5_data_free(&data);
+        free(lefts);
+        return EINVAL;
     }
 
     /*
@@ -819,41 +1130,157 @@ send_diffs (kadm5_server_context *server_context, slave *s, int log_fd,
      * sending garbage to the slave.
      */
     if (flock(log_fd, LOCK_SH) == -1) {
-        krb5_warn(context, errno, "could not obtain shared lock on log file");
-        send_are_you_there(context, s);
-        return 1;
+        ret = errno;
+        krb5_warn(context, ret, "could not obtain shared lock on log file");
+    } else {
+        ret = kadm5_log_get_version_fd(server_context, log_fd,
+                                       LOG_VERSION_FIRST,
+                                       &initial_version2, &initial_tstamp2);
+        flock(log_fd, LOCK_UN);
+        if (ret)
+            krb5_warn(context, ret,
+                      "send_diffs: failed to read log while producing diffs");
+        else if (initial_version != initial_version2 ||
+                 initial_tstamp != initial_tstamp2) {
+            krb5_warnx(context,
+                       "send_diffs: log truncated while producing diffs");
+            ret = EINVAL;
+        }
     }
-    ret = kadm5_log_get_version_fd(server_context, log_fd, LOG_VERSION_FIRST,
-                                   &initial_version2, &initial_tstamp2);
-    flock(log_fd, LOCK_UN);
+    if (ret == 0 && indexed)
+        ret = diff_cache_split(context, &data, left, &lefts, &nlefts,
+                               &first, &last);
+    offsets = NULL;
+    if (ret == 0 && (offsets = calloc(nlefts + 1, sizeof(offsets[0]))) == NULL)
+        ret = ENOMEM;
+    if (ret) {
+        krb5_data_free(&data);
+        free(lefts);
+        return ret;
+    }
+
+    for (i = 0; i < nlefts; i++)
+        offsets[i] = lefts[nlefts - 1 - i] - left;
+    offsets[nlefts] = data.length;
+    free(lefts);
+
+    diffs.first = first;
+    diffs.last = last;
+    diffs.offsets = offsets;
+    diffs.data = data;
+
+    if (verbose)
+        krb5_warnx(context, "read log entries %lu to %lu for slaves",
+                   (unsigned long)first, (unsigned long)last);
+    return 0;
+}
+
+static int
+send_diffs (kadm5_server_context *server_context, slave *s, int log_fd,
+	    const char *database, uint32_t current_version,
+	    uint32_t current_tstamp)
+{
+    krb5_context context = server_context->context;
+    krb5_storage *sp;
+    size_t start, end;
+    krb5_data data;
+    int ret = 0;
+
+    if (s->flags & SLAVE_F_DEAD) {
+        krb5_warnx(context, "not sending diffs to dead slave %s", s->name);
+        return 0;
+    }
+
+    /*
+     * Don't queue up more for a slave that isn't keeping up; it gets
+     * everything it's missing in one go once it has caught up.
+     */
+    if (s->dump != NULL || slave_has_output(s)) {
+        s->flags |= SLAVE_F_PENDING;
+        return 0;
+    }
+    s->flags &= ~SLAVE_F_PENDING;
+
+    if (s->version == current_version) {
+	char buf[4];
+
+	sp = krb5_storage_from_mem(buf, 4);
+	if (sp == NULL)
+	    krb5_errx(context, IPROPD_RESTART, "krb5_storage_from_mem");
+	ret = krb5_store_uint32(sp, YOU_HAVE_LAST_VERSION);
+	krb5_storage_free(sp);
+	data.data   = buf;
+	data.length = 4;
+        if (ret == 0) {
+            ret = slave_send(context, s, &data);
+            if (ret) {
+                krb5_warn(context, ret, "send_diffs: failed to send to slave");
+                slave_dead(context, s);
+            }
+            krb5_warnx(context, "slave %s in sync already at version %ld",
+                       s->name, (long)s->version);
+        }
+	return ret;
+    }
+
+    if (verbose)
+        krb5_warnx(context, "sending diffs to live-seeming slave %s", s->name);
+
+    /* A slave that claims to be ahead of us needs the complete database */
+    ret = diff_cache_fill(server_context, log_fd,
+                          s->version < current_version ? s->version + 1 : 0,
+                          current_version);
     if (ret) {
-        krb5_warn(context, ret,
-                   "send_diffs: failed to read log while producing diffs");
         send_are_you_there(context, s);
-        return 1;
+        return ret;
+    }
+
+    if (!diff_cache_covers(s->version, current_version)) {
+        /*
+         * The slave's version isn't in the log (or the slave claims a
+         * later version than ours), so send the complete database.
+         */
+        krb5_warnx(context,
+                   "slave %s (version %lu) out of sync with master "
+                   "(first version in log %lu), sending complete database",
+                   s->name, (unsigned long)s->version,
+                   (unsigned long)diffs.oldest);
+        return send_complete (context, s, database, current_version,
+                              diffs.oldest, diffs.initial_tstamp);
     }
-    if (initial_version != initial_version2 ||
-        initial_tstamp != initial_tstamp2) {
-        krb5_warn(context, ret,
-                   "send_diffs: log truncated while producing diffs");
+
+    krb5_warnx(context,
+	       "syncing slave %s from version %lu to version %lu",
+	       s->name, (unsigned long)s->version,
+	       (unsigned long)current_version);
+
+    start = diffs.offsets[s->version + 1 - diffs.first];
+    end = diffs.offsets[current_version + 1 - diffs.first];
+
+    ret = krb5_data_alloc (&data, end - start + 4);
+    if (ret) {
+	krb5_warn (context, ret, "send_diffs: krb5_data_alloc");
         send_are_you_there(context, s);
-        return 1;
+	return 1;
     }
+    memcpy((char *)data.data + 4, (char *)diffs.data.data + start,
+           end - start);
 
     sp = krb5_storage_from_data (&data);
     if (sp == NULL) {
 	krb5_warnx (context, "send_diffs: krb5_storage_from_data");
+        krb5_data_free(&data);
         send_are_you_there(context, s);
 	return 1;
     }
     krb5_store_uint32 (sp, FOR_YOU);
     krb5_storage_free(sp);
 
-    ret = krb5_write_priv_message(context, s->ac, &s->fd, &data);
+    ret = slave_send(context, s, &data);
     krb5_data_free(&data);
 
     if (ret) {
-	krb5_warn (context, ret, "send_diffs: krb5_write_priv_message");
+	krb5_warn (context, ret, "send_diffs: slave_send");
 	slave_dead(context, s);
 	return 1;
     }
@@ -867,31 +1294,23 @@ send_diffs (kadm5_server_context *server_context, slave *s, int log_fd,
 }
 
 static int
-process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
-	     const char *database, uint32_t current_version,
-             uint32_t current_tstamp)
+handle_msg (kadm5_server_context *server_context, slave *s, int log_fd,
+	    const char *database, uint32_t current_version,
+	    uint32_t current_tstamp, krb5_data *out)
 {
     krb5_context context = server_context->context;
     int ret = 0;
-    krb5_data out;
     krb5_storage *sp;
     uint32_t tmp;
 
-    ret = krb5_read_priv_message(context, s->ac, &s->fd, &out);
-    if(ret) {
-	krb5_warn(context, ret, "error reading message from %s", s->name);
-	return 1;
-    }
-
-    sp = krb5_storage_from_mem(out.data, out.length);
+    sp = krb5_storage_from_mem(out->data, out->length);
     if (sp == NULL) {
 	krb5_warnx(context, "process_msg: no memory");
-	krb5_data_free(&out);
 	return 1;
     }
     if (krb5_ret_uint32(sp, &tmp) != 0) {
 	krb5_warnx(context, "process_msg: client send too short command");
-	krb5_data_free(&out);
+	krb5_storage_free(sp);
 	return 1;
     }
     switch (tmp) {
@@ -901,6 +1320,11 @@ process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
 	    krb5_warnx(context, "process_msg: client send too little I_HAVE data");
 	    break;
 	}
+	if (s->dump != NULL) {
+	    krb5_warnx(context, "slave %s sent I_HAVE while receiving "
+		       "complete database", s->name);
+	    break;
+	}
 	/* new started slave that have old log */
 	if (s->version == 0 && tmp != 0) {
 	    if (current_version < tmp) {
@@ -918,6 +1342,7 @@ process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
                        "version we already sent to it", s->name);
             s->version = tmp;
 	}
+	s->flags |= SLAVE_F_READY;
         ret = send_diffs(server_context, s, log_fd, database, current_version,
                          current_tstamp);
         break;
@@ -932,7 +1357,6 @@ process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
 	break;
     }
 
-    krb5_data_free(&out);
     krb5_storage_free(sp);
 
     slave_seen(s);
@@ -940,6 +1364,103 @@ process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
     return ret;
 }
 
+/*
+ * Read whatever the slave has sent us and handle any complete messages.
+ */
+
+static int
+process_msg (kadm5_server_context *server_context, slave *s, int log_fd,
+	     const char *database, uint32_t current_version,
+             uint32_t current_tstamp)
+{
+    krb5_context context = server_context->context;
+    krb5_data packet, out;
+    unsigned char *p;
+    ssize_t n;
+    uint32_t len;
+    int ret;
+
+    ret = slave_buf_reserve(&s->in, 4096);
+    if (ret) {
+	krb5_warn(context, ret, "process_msg");
+	return 1;
+    }
+    n = recv(s->fd, s->in.data + s->in.len, s->in.size - s->in.len, 0);
+    if (rk_IS_SOCKET_ERROR(n)) {
+	ret = rk_SOCK_ERRNO;
+	if (ret == EINTR || ret == EAGAIN || ret == EWOULDBLOCK)
+	    return 0;
+	krb5_warn(context, ret, "error reading message from %s", s->name);
+	return 1;
+    }
+    if (n == 0) {
+	krb5_warnx(context, "error reading message from %s: "
+		   "connection closed", s->name);
+	return 1;
+    }
+    s->in.len += n;
+
+    while (s->in.len - s->in.off >= 4) {
+	p = s->in.data + s->in.off;
+	len = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	if (len > SLAVE_MSG_MAX) {
+	    krb5_warnx(context, "message from %s too large (%lu bytes)",
+		       s->name, (unsigned long)len);
+	    return 1;
+	}
+	if (s->in.len - s->in.off - 4 < len)
+	    break;
+	packet.data = p + 4;
+	packet.length = len;
+	s->in.off += len + 4;
+
+	ret = krb5_rd_priv(context, s->ac, &packet, &out, NULL);
+	if (ret) {
+	    krb5_warn(context, ret, "error reading message from %s", s->name);
+	    return 1;
+	}
+	ret = handle_msg(server_context, s, log_fd, database, current_version,
+			 current_tstamp, &out);
+	krb5_data_free(&out);
+	if (ret || (s->flags & SLAVE_F_DEAD))
+	    return ret;
+    }
+    if (s->in.off == s->in.len)
+	s->in.off = s->in.len = 0;
+
+    return 0;
+}
+
+/*
+ * Bring all live slaves up to `current_version'.  The log entries they
+ * need are read once, up front, for all of them.
+ */
+
+static void
+update_slaves (kadm5_server_context *server_context, slave *slaves,
+	       int log_fd, const char *database, uint32_t current_version,
+	       uint32_t current_tstamp)
+{
+    uint32_t want = current_version;
+    slave *p;
+
+    for (p = slaves; p != NULL; p = p->next) {
+	if ((p->flags & (SLAVE_F_DEAD|SLAVE_F_READY)) != SLAVE_F_READY)
+	    continue;
+	if (p->version < want)
+	    want = p->version + 1;
+    }
+    if (want < current_version)
+	(void) diff_cache_fill(server_context, log_fd, want, current_version);
+
+    for (p = slaves; p != NULL; p = p->next) {
+	if ((p->flags & (SLAVE_F_DEAD|SLAVE_F_READY)) != SLAVE_F_READY)
+	    continue;
+	send_diffs (server_context, p, log_fd, database,
+		    current_version, current_tstamp);
+    }
+}
+
 #define SLAVE_NAME	"Name"
 #define SLAVE_ADDRESS	"Address"
 #define SLAVE_VERSION	"Version"
@@ -1212,7 +1733,7 @@ main(int argc, char **argv)
 
     while (exit_flag == 0){
 	slave *p;
-	fd_set readset;
+	fd_set readset, writeset;
 	int max_fd = 0;
 	struct timeval to = {30, 0};
 	uint32_t vers;
@@ -1225,6 +1746,7 @@ main(int argc, char **argv)
 #endif
 
 	FD_ZERO(&readset);
+	FD_ZERO(&writeset);
 	FD_SET(signal_fd, &readset);
 	max_fd = max(max_fd, signal_fd);
 	FD_SET(listen_fd, &readset);
@@ -1237,12 +1759,22 @@ main(int argc, char **argv)
 	for (p = slaves; p != NULL; p = p->next) {
 	    if (p->flags & SLAVE_F_DEAD)
 		continue;
+#ifndef NO_LIMIT_FD_SETSIZE
+	    if (p->fd >= FD_SETSIZE) {
+		slave_dead(context, p);
+		continue;
+	    }
+#endif
 	    FD_SET(p->fd, &readset);
+	    if (p->dump != NULL || slave_has_output(p))
+		FD_SET(p->fd, &writeset);
+	    else if (p->flags & SLAVE_F_PENDING)
+		to.tv_sec = 1;	/* retry a deferred complete dump soon */
 	    max_fd = max(max_fd, p->fd);
 	}
 
 	ret = select (max_fd + 1,
-		      &readset, NULL, NULL, &to);
+		      &readset, &writeset, NULL, &to);
 	if (ret < 0) {
 	    if (errno == EINTR)
 		continue;
@@ -1292,12 +1824,8 @@ main(int argc, char **argv)
 			   "Missed a signal, updating slaves %lu to %lu",
 			   (unsigned long)old_version,
 			   (unsigned long)current_version);
-		for (p = slaves; p != NULL; p = p->next) {
-		    if (p->flags & SLAVE_F_DEAD)
-			continue;
-		    send_diffs (server_context, p, log_fd, database,
-                                current_version, current_tstamp);
-		}
+		update_slaves(server_context, slaves, log_fd, database,
+			      current_version, current_tstamp);
                 old_version = current_version;
 	    }
 	}
@@ -1346,12 +1874,8 @@ main(int argc, char **argv)
 			   "Got a signal, updating slaves %lu to %lu",
 			   (unsigned long)old_version,
 			   (unsigned long)current_version);
-		for (p = slaves; p != NULL; p = p->next) {
-		    if (p->flags & SLAVE_F_DEAD)
-			continue;
-		    send_diffs (server_context, p, log_fd, database,
-                                current_version, current_tstamp);
-		}
+		update_slaves(server_context, slaves, log_fd, database,
+			      current_version, current_tstamp);
 	    } else {
 		krb5_warnx(context,
 			   "Got a signal, but no update in log version %lu",
@@ -1362,6 +1886,14 @@ main(int argc, char **argv)
 	for(p = slaves; p != NULL; p = p->next) {
 	    if (p->flags & SLAVE_F_DEAD)
 	        continue;
+	    /* A dump being streamed is pumped whenever the slave can take more */
+	    if (ret && FD_ISSET(p->fd, &writeset)) {
+		if (slave_flush(context, p) ||
+		    (p->dump != NULL && slave_pump_dump(context, p))) {
+		    slave_dead(context, p);
+		    continue;
+		}
+	    }
 	    if (ret && FD_ISSET(p->fd, &readset)) {
 		--ret;
 		assert(ret >= 0);
@@ -1372,6 +1904,12 @@ main(int argc, char **argv)
 		slave_dead(context, p);
 	    else if (slave_missing_p (p))
 		send_are_you_there (context, p);
+
+	    /* Catch up a slave whose queue has drained */
+	    if ((p->flags & (SLAVE_F_DEAD|SLAVE_F_PENDING)) == SLAVE_F_PENDING &&
+		p->dump == NULL && !slave_has_output(p))
+		send_diffs(server_context, p, log_fd, database,
+			   current_version, current_tstamp);
 	}
 
 	if (ret && FD_ISSET(listen_fd, &readset)) {
@@ -463,6 +463,228 @@ get_max_log_size(krb5_context context)
     return 0;
 }
 
+/*
+ * The log may have a sidecar index, named after the log with an ".index"
+ * suffix, enabled with [kdc] log-index = true.  It holds one entry for
+ * each record in the log past the uber record:
+ *
+ * version number               4 bytes
+ * offset of record's header    8 bytes
+ *
+ * Versions in the log are consecutive, so the index is sorted and
+ * kadm5_log_goto_version() can binary search it rather than walk the log.
+ *
+ * The index is only a hint.  It is not fsync()ed, and lookups check the
+ * log itself before trusting an entry, falling back on walking the log.
+ * Writers (holding the log's exclusive lock) bring it up to date from its
+ * last entry that still matches the log, or rebuild it from scratch.
+ */
+#define LOG_INDEX_ENTRY_SZ  ((off_t)(sizeof(uint32_t) + sizeof(uint64_t)))
+
+static int
+log_index_enabled(krb5_context context)
+{
+    return krb5_config_get_bool_default(context, NULL, FALSE,
+                                        "kdc",
+                                        "log-index",
+                                        NULL);
+}
+
+static char *
+log_index_file(kadm5_log_context *log_context)
+{
+    char *fn;
+
+    if (asprintf(&fn, "%s.index", log_context->log_file) == -1)
+        return NULL;
+    return fn;
+}
+
+/* Read the `n'th entry of the index */
+static kadm5_ret_t
+log_index_get(krb5_storage *isp, off_t n, uint32_t *verp, off_t *offp)
+{
+    kadm5_ret_t ret;
+    uint64_t off;
+
+    if (krb5_storage_seek(isp, n * LOG_INDEX_ENTRY_SZ, SEEK_SET) == -1)
+        return errno;
+    ret = krb5_ret_uint32(isp, verp);
+    if (ret == 0)
+        ret = krb5_ret_uint64(isp, &off);
+    if (ret == 0 && ((off_t)off < 0 || (uint64_t)(off_t)off != off))
+        ret = KADM5_LOG_CORRUPT;
+    if (ret == 0)
+        *offp = off;
+    return ret;
+}
+
+/*
+ * Check that a whole record with version `ver' starts at `off'.  On success
+ * leaves sp at the start of the next record.
+ */
+static int
+log_record_at(krb5_storage *sp, off_t off, uint32_t ver)
+{
+    uint32_t ver2;
+
+    if (off < LOG_UBER_SZ || krb5_storage_seek(sp, off, SEEK_SET) != off)
+        return 0;
+    if (get_header(sp, LOG_DOPEEK, &ver2, NULL, NULL, NULL) != 0 ||
+        ver2 != ver)
+        return 0;
+    return seek_next(sp) != -1;
+}
+
+/*
+ * Bring the log index up to date, appending entries for any records
+ * following its last valid entry, or, if `rebuild', for the whole log.
+ *
+ * Failures are logged but not returned: the index is just a hint.
+ */
+static void
+log_index_sync(kadm5_server_context *context, int rebuild)
+{
+    kadm5_log_context *log_context = &context->log_context;
+    krb5_storage *sp = NULL;
+    krb5_storage *isp = NULL;
+    kadm5_ret_t ret = 0;
+    struct stat st;
+    uint32_t ver;
+    off_t n = 0;
+    off_t off = 0;
+    off_t next;
+    char *fn;
+    int fd;
+
+    if (log_context->log_fd == -1 || log_context->read_only ||
+        strcmp(log_context->log_file, "/dev/null") == 0 ||
+        !log_index_enabled(context->context))
+        return;
+
+    fn = log_index_file(log_context);
+    if (fn == NULL) {
+        krb5_warnx(context->context, "Out of memory updating log index");
+        return;
+    }
+    fd = open(fn, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        krb5_warn(context->context, errno, "open %s", fn);
+        free(fn);
+        return;
+    }
+    if (fstat(fd, &st) == -1)
+        ret = errno;
+    if (ret == 0 && (isp = krb5_storage_from_fd(fd)) == NULL)
+        ret = ENOMEM;
+    (void) close(fd);
+    if (ret == 0 &&
+        (sp = krb5_storage_from_fd(log_context->log_fd)) == NULL)
+        ret = ENOMEM;
+    if (ret)
+        goto out;
+
+    /* Resume after the last entry if it still describes the log */
+    if (!rebuild && (n = st.st_size / LOG_INDEX_ENTRY_SZ) > 0) {
+        if (log_index_get(isp, n - 1, &ver, &off) == 0 &&
+            log_record_at(sp, off, ver)) {
+            off = krb5_storage_seek(sp, 0, SEEK_CUR);
+        } else {
+            n = 0;
+            off = 0;
+        }
+    }
+    if (off == -1 ||
+        krb5_storage_truncate(isp, n * LOG_INDEX_ENTRY_SZ) != 0 ||
+        krb5_storage_seek(isp, n * LOG_INDEX_ENTRY_SZ, SEEK_SET) == -1 ||
+        krb5_storage_seek(sp, off, SEEK_SET) == -1) {
+        ret = errno;
+        goto out;
+    }
+
+    /* Index whole records up to the physical end of the log */
+    for (;;) {
+        ret = get_header(sp, LOG_DOPEEK, &ver, NULL, NULL, NULL);
+        if (ret)
+            break;
+        next = seek_next(sp);
+        if (next == -1)
+            break;
+        if (off != 0) {
+            ret = krb5_store_uint32(isp, ver);
+            if (ret == 0)
+                ret = krb5_store_uint64(isp, off);
+            if (ret)
+                break;
+        }
+        off = next;
+    }
+    if (ret == HEIM_ERR_EOF || ret == KADM5_LOG_CORRUPT)
+        ret = 0;
+
+out:
+    if (ret)
+        krb5_warn(context->context, ret, "Could not update log index %s", fn);
+    krb5_storage_free(isp);
+    krb5_storage_free(sp);
+    free(fn);
+}
+
+/*
+ * Look up the confirmed record with version `ver' in the index, checking
+ * that the log has it at the offset found.  Returns ENOENT if there's no
+ * index, or it doesn't (correctly) have `ver'.
+ */
+static kadm5_ret_t
+log_index_lookup(kadm5_server_context *context, krb5_storage *sp,
+                 off_t end, uint32_t ver, off_t *offp)
+{
+    krb5_storage *isp;
+    kadm5_ret_t ret = ENOENT;
+    struct stat st;
+    uint32_t v;
+    off_t lo, hi, mid, off;
+    char *fn;
+    int fd;
+
+    if (!log_index_enabled(context->context))
+        return ENOENT;
+
+    fn = log_index_file(&context->log_context);
+    if (fn == NULL)
+        return ENOMEM;
+    fd = open(fn, O_RDONLY, 0);
+    free(fn);
+    if (fd < 0)
+        return ENOENT;
+    if (fstat(fd, &st) == -1 || (isp = krb5_storage_from_fd(fd)) == NULL) {
+        (void) close(fd);
+        return ENOENT;
+    }
+    (void) close(fd);
+
+    lo = 0;
+    hi = st.st_size / LOG_INDEX_ENTRY_SZ;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (log_index_get(isp, mid, &v, &off) != 0)
+            break;
+        if (v == ver) {
+            if (off < end && log_record_at(sp, off, ver)) {
+                *offp = off;
+                ret = 0;
+            }
+            break;
+        }
+        if (v < ver)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    krb5_storage_free(isp);
+    return ret;
+}
+
 static kadm5_ret_t truncate_if_needed(kadm5_server_context *);
 static krb5_storage *log_goto_first(kadm5_server_context *, int);
 
@@ -731,7 +953,10 @@ kadm5_log_reinit(kadm5_server_context *server_context, uint32_t vno)
 
     /* Write uber entry and truncation nop with version `vno` */
     log_context->version = vno;
-    return kadm5_log_nop(server_context, kadm_nop_plain);
+    ret = kadm5_log_nop(server_context, kadm_nop_plain);
+    if (ret == 0)
+        log_index_sync(server_context, 1);
+    return ret;
 }
 
 /* Close the server_context->log_context. */
@@ -928,8 +1153,10 @@ kadm5_log_flush(kadm5_server_context *context, krb5_storage *sp)
         return ret;
 
     /* Retain the nominal database version when flushing the uber record */
-    if (new_ver != 0)
+    if (new_ver != 0) {
         log_context->version = new_ver;
+        log_index_sync(context, 0);
+    }
     return 0;
 }
 
@@ -1841,6 +2068,8 @@ kadm5_log_recover(kadm5_server_context *context, enum kadm_recover_mode mode)
                             NULL, recover_replay, &replay_data);
     if (ret == 0 && mode == kadm_recover_commit && replay_data.count != 1)
         ret = KADM5_LOG_CORRUPT;
+    if (ret == 0 && mode == kadm_recover_replay)
+        log_index_sync(context, 0);
     krb5_storage_free(sp);
     return ret;
 }
@@ -2181,6 +2410,62 @@ fail:
     return NULL;
 }
 
+/*
+ * Find the confirmed record with version `ver' in the log open on `fd' and
+ * output a storage positioned at the start of its header.
+ *
+ * Uses the log index if there is one, else walks back from the end of the
+ * log.  Returns ENOENT if the log has no such confirmed record.
+ */
+kadm5_ret_t
+kadm5_log_goto_version(kadm5_server_context *server_context, int fd,
+                       uint32_t ver, krb5_storage **spp)
+{
+    kadm5_ret_t ret;
+    krb5_storage *sp;
+    uint32_t ver2;
+    off_t end, off;
+
+    *spp = NULL;
+
+    sp = kadm5_log_goto_end(server_context, fd);
+    if (sp == NULL)
+        return errno ? errno : EIO;
+    end = krb5_storage_seek(sp, 0, SEEK_CUR);
+    if (end == -1) {
+        ret = errno;
+        krb5_storage_free(sp);
+        return ret;
+    }
+
+    ret = log_index_lookup(server_context, sp, end, ver, &off);
+    if (ret == ENOENT) {
+        /* No (usable) index; do it the slow way */
+        if (krb5_storage_seek(sp, end, SEEK_SET) == -1)
+            ret = errno;
+        while (ret == ENOENT) {
+            off = seek_prev(sp, &ver2, NULL);
+            if (off == -1) {
+                ret = errno;
+                break;
+            }
+            /* The uber record (at offset 0) is not a real record */
+            if (off == 0 || ver2 < ver)
+                break;
+            if (ver2 == ver)
+                ret = 0;
+        }
+    }
+    if (ret == 0 && krb5_storage_seek(sp, off, SEEK_SET) == -1)
+        ret = errno;
+    if (ret) {
+        krb5_storage_free(sp);
+        return ret;
+    }
+    *spp = sp;
+    return 0;
+}
+
 /*
  * Return previous log entry.
  *
@@ -2558,6 +2843,8 @@ kadm5_log_truncate(kadm5_server_context *context, size_t keep, size_t maxbytes)
     ret = get_version_prev(sp, &context->log_context.version, &last_tstamp);
     context->log_context.last_time = last_tstamp;
     krb5_storage_free(sp);
+    if (ret == 0)
+        log_index_sync(context, 1);
     return ret;
 }
 
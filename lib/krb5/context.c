@@ -107,6 +107,14 @@ init_context_from_config_file(krb5_context context)
     INIT_FIELD(context, time, kdc_timeout, 30, "kdc_timeout");
     INIT_FIELD(context, time, host_timeout, 3, "host_timeout");
     INIT_FIELD(context, int, max_retries, 3, "max_retries");
+    INIT_FIELD(context, bool, kdc_health, TRUE, "kdc_health");
+    INIT_FIELD(context, time, kdc_health_backoff, 5 * 60, "kdc_health_backoff");
+    INIT_FIELD(context, string, kdc_health_file, NULL, "kdc_health_file");
+    INIT_FIELD(context, bool, kdc_tcp_reuse, FALSE, "kdc_tcp_reuse");
+    INIT_FIELD(context, time, kdc_tcp_idle_timeout, 5, "kdc_tcp_idle_timeout");
+    INIT_FIELD(context, bool, dns_cache, TRUE, "dns_cache");
+    INIT_FIELD(context, time, dns_cache_max_ttl, 60 * 60, "dns_cache_max_ttl");
+    INIT_FIELD(context, time, dns_cache_negative_ttl, 60, "dns_cache_negative_ttl");
 
     INIT_FIELD(context, string, http_proxy, NULL, "http_proxy");
 
@@ -636,6 +644,7 @@ krb5_free_context(krb5_context context)
     krb5_set_extra_addresses(context, NULL);
     krb5_set_ignore_addresses(context, NULL);
     krb5_set_send_to_kdc_func(context, NULL, NULL);
+    _krb5_kdc_conns_free(context);
 
 #ifdef PKINIT
     if (context->hx509ctx)
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "krb5_locl.h"
+#include <resolve.h>
+
+/**
+ * @section dns_cache Caching of DNS SRV and TXT lookups
+ *
+ * Finding the KDCs of a realm, and the realm of a host, takes a DNS
+ * query each time, and a failed one often takes several.  The answers
+ * are kept here for as long as their TTL says, and the lack of one for
+ * [libdefaults] dns_cache_negative_ttl, so that a process asking over
+ * and over does not wait on the resolver each time.  Only answers that
+ * the name or the records do not exist (NXDOMAIN and NODATA) count as
+ * a lack of one: when the resolver got no answer at all, a timeout or
+ * SERVFAIL, the next lookup asks again.
+ *
+ * The cache is shared by all the contexts of a process.  Each lookup
+ * gets its own copy of the answer, so rk_dns_srv_order() still spreads
+ * the load over SRV records of equal priority.
+ */
+
+#define DNS_CACHE_ENTRIES	64
+
+struct dns_cache_entry {
+    char *domain;
+    int type;
+    time_t expire;
+    struct rk_dns_reply *reply;	/* NULL if there was no answer */
+    struct dns_cache_entry *next;
+};
+
+/*
+ * Look `domain' up, setting `negative' if the lookup failed because
+ * the DNS said there is no such name or no such records.
+ */
+
+static struct rk_dns_reply *
+resolve(const char *domain, const char *type_name, int *negative)
+{
+    struct rk_dns_reply *r;
+
+#ifndef _WIN32
+    h_errno = 0;
+#endif
+    r = rk_dns_lookup(domain, type_name);
+    *negative = r == NULL && (h_errno == HOST_NOT_FOUND || h_errno == NO_DATA);
+    return r;
+}
+
+static HEIMDAL_MUTEX dns_cache_mutex = HEIMDAL_MUTEX_INITIALIZER;
+static struct dns_cache_entry *dns_cache;
+static size_t dns_cache_num;
+static struct rk_dns_reply *(*dns_cache_resolve)(const char *, const char *,
+						 int *) = resolve;
+
+static void
+free_entry(struct dns_cache_entry *e)
+{
+    if (e->reply)
+	rk_dns_free_data(e->reply);
+    free(e->domain);
+    free(e);
+}
+
+/*
+ * Copy the records of type `type' in `r', returning the smallest TTL
+ * among them in `ttl'.  Other records, like the addresses of SRV
+ * targets that come along in the additional section, are not kept.
+ */
+
+static struct rk_dns_reply *
+copy_reply(const struct rk_dns_reply *r, int type, unsigned *ttl)
+{
+    struct rk_dns_reply *c;
+    struct rk_resource_record *rr, *n, **tail;
+    size_t size;
+
+    *ttl = UINT_MAX;
+    if ((c = calloc(1, sizeof(*c))) == NULL)
+	return NULL;
+    c->h = r->h;
+    c->q.type = r->q.type;
+    c->q.class = r->q.class;
+    if (r->q.domain && (c->q.domain = strdup(r->q.domain)) == NULL)
+	goto fail;
+
+    tail = &c->head;
+    for (rr = r->head; rr; rr = rr->next) {
+	if ((int)rr->type != type || rr->u.data == NULL)
+	    continue;
+	if (type == rk_ns_t_srv)
+	    size = sizeof(*rr->u.srv) + strlen(rr->u.srv->target);
+	else
+	    size = strlen(rr->u.txt) + 1;
+
+	if ((n = calloc(1, sizeof(*n))) == NULL)
+	    goto fail;
+	*tail = n;
+	tail = &n->next;
+	n->type = rr->type;
+	n->class = rr->class;
+	n->ttl = rr->ttl;
+	n->size = rr->size;
+	if ((rr->domain && (n->domain = strdup(rr->domain)) == NULL) ||
+	    (n->u.data = malloc(size)) == NULL)
+	    goto fail;
+	memcpy(n->u.data, rr->u.data, size);
+	if (rr->ttl < *ttl)
+	    *ttl = rr->ttl;
+    }
+    return c;
+
+fail:
+    rk_dns_free_data(c);
+    return NULL;
+}
+
+static void
+cache_reply(krb5_context context, const char *domain, int type,
+	    const struct rk_dns_reply *r)
+{
+    struct dns_cache_entry *e, **ep, **victim;
+    time_t now = time(NULL);
+    unsigned ttl = UINT_MAX;
+
+    if ((e = calloc(1, sizeof(*e))) == NULL)
+	return;
+    e->type = type;
+    if ((e->domain = strdup(domain)) == NULL ||
+	(r && (e->reply = copy_reply(r, type, &ttl)) == NULL)) {
+	free_entry(e);
+	return;
+    }
+    if (e->reply == NULL || e->reply->head == NULL)
+	ttl = context->dns_cache_negative_ttl;
+    if (ttl > (unsigned)context->dns_cache_max_ttl)
+	ttl = context->dns_cache_max_ttl;
+    if (ttl == 0) {
+	free_entry(e);
+	return;
+    }
+    e->expire = now + ttl;
+
+    HEIMDAL_MUTEX_lock(&dns_cache_mutex);
+    victim = NULL;
+    for (ep = &dns_cache; *ep; ) {
+	struct dns_cache_entry *o = *ep;
+
+	/* Drop what has expired, and what this replaces */
+	if (o->expire <= now ||
+	    (o->type == type && strcasecmp(o->domain, domain) == 0)) {
+	    *ep = o->next;
+	    free_entry(o);
+	    dns_cache_num--;
+	    continue;
+	}
+	if (victim == NULL || o->expire < (*victim)->expire)
+	    victim = ep;
+	ep = &o->next;
+    }
+    if (dns_cache_num >= DNS_CACHE_ENTRIES && victim) {
+	struct dns_cache_entry *o = *victim;
+
+	*victim = o->next;
+	free_entry(o);
+	dns_cache_num--;
+    }
+    e->next = dns_cache;
+    dns_cache = e;
+    dns_cache_num++;
+    HEIMDAL_MUTEX_unlock(&dns_cache_mutex);
+}
+
+/*
+ * Returns 1 and sets `reply' (to NULL for a cached failure) if there
+ * is a live entry for the query.
+ */
+
+static int
+cached_reply(const char *domain, int type, struct rk_dns_reply **reply)
+{
+    struct dns_cache_entry *e;
+    time_t now = time(NULL);
+    unsigned ttl;
+    int found = 0;
+
+    *reply = NULL;
+    HEIMDAL_MUTEX_lock(&dns_cache_mutex);
+    for (e = dns_cache; e; e = e->next) {
+	if (e->type != type || e->expire <= now ||
+	    strcasecmp(e->domain, domain) != 0)
+	    continue;
+	if (e->reply)
+	    *reply = copy_reply(e->reply, type, &ttl);
+	/* If the copy could not be made, ask the resolver instead */
+	found = e->reply == NULL || *reply != NULL;
+	break;
+    }
+    HEIMDAL_MUTEX_unlock(&dns_cache_mutex);
+    return found;
+}
+
+/**
+ * Look up the records of type `type_name' for `domain', like
+ * rk_dns_lookup(), from the cache when possible.  Only SRV and TXT
+ * lookups are cached, and only records of the type asked for are
+ * returned from the cache.  The result is freed with rk_dns_free_data().
+ */
+
+KRB5_LIB_FUNCTION struct rk_dns_reply * KRB5_LIB_CALL
+_krb5_dns_lookup(krb5_context context, const char *domain,
+		 const char *type_name)
+{
+    struct rk_dns_reply *r;
+    int type = rk_dns_string_to_type(type_name);
+    int negative;
+
+    if (!context->dns_cache || (type != rk_ns_t_srv && type != rk_ns_t_txt))
+	return rk_dns_lookup(domain, type_name);
+
+    if (cached_reply(domain, type, &r)) {
+	_krb5_debug(context, 5, "DNS %s lookup of %s answered from cache%s",
+		    type_name, domain, r ? "" : " (no answer)");
+	return r;
+    }
+
+    r = dns_cache_resolve(domain, type_name, &negative);
+    if (r != NULL || negative)
+	cache_reply(context, domain, type, r);
+    return r;
+}
+
+/**
+ * For tests: empty the cache and have lookups that miss it go to
+ * `resolver' (or the DNS again, if NULL).  `resolver' is like
+ * rk_dns_lookup(), and sets its last argument if it failed with
+ * NXDOMAIN or NODATA.
+ */
+
+KRB5_LIB_FUNCTION void KRB5_LIB_CALL
+_krb5_dns_cache_set_resolver(struct rk_dns_reply *(*resolver)(const char *,
+							      const char *,
+							      int *))
+{
+    struct dns_cache_entry *e;
+
+    HEIMDAL_MUTEX_lock(&dns_cache_mutex);
+    while ((e = dns_cache)) {
+	dns_cache = e->next;
+	free_entry(e);
+    }
+    dns_cache_num = 0;
+    dns_cache_resolve = resolver ? resolver : resolve;
+    HEIMDAL_MUTEX_unlock(&dns_cache_mutex);
+}
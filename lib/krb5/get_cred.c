@@ -406,8 +406,14 @@ decrypt_tkt_with_subkey (krb5_context context,
     return ret;
 }
 
+/*
+ * Make the TGS-REQ asking for `in_creds' with `krbtgt' and encode it
+ * into `enc', returning the nonce and the subkey to read the reply
+ * with.
+ */
+
 static krb5_error_code
-get_cred_kdc(krb5_context context,
+make_tgs_req(krb5_context context,
 	     krb5_ccache id,
 	     krb5_kdc_flags flags,
 	     krb5_addresses *addresses,
@@ -415,27 +421,23 @@ get_cred_kdc(krb5_context context,
 	     krb5_creds *krbtgt,
 	     krb5_principal impersonate_principal,
 	     Ticket *second_ticket,
-	     krb5_creds *out_creds)
+	     unsigned *nonce,
+	     krb5_keyblock **subkey,
+	     krb5_data *enc)
 {
     TGS_REQ req;
-    krb5_data enc;
-    krb5_data resp;
-    krb5_kdc_rep rep;
-    KRB_ERROR error;
     krb5_error_code ret;
-    unsigned nonce;
-    krb5_keyblock *subkey = NULL;
     size_t len = 0;
     Ticket second_ticket_data;
     METHOD_DATA padata;
 
-    krb5_data_zero(&resp);
-    krb5_data_zero(&enc);
+    krb5_data_zero(enc);
+    *subkey = NULL;
     padata.val = NULL;
     padata.len = 0;
 
-    krb5_generate_random_block(&nonce, sizeof(nonce));
-    nonce &= 0xffffffff;
+    krb5_generate_random_block(nonce, sizeof(*nonce));
+    *nonce &= 0xffffffff;
 
     if(flags.b.enc_tkt_in_skey && second_ticket == NULL){
 	ret = decode_Ticket(in_creds->second_ticket.data,
@@ -505,43 +507,57 @@ get_cred_kdc(krb5_context context,
 			second_ticket,
 			in_creds,
 			krbtgt,
-			nonce,
+			*nonce,
 			&padata,
-			&subkey,
+			subkey,
 			&req);
     if (ret)
 	goto out;
 
-    ASN1_MALLOC_ENCODE(TGS_REQ, enc.data, enc.length, &req, &len, ret);
+    ASN1_MALLOC_ENCODE(TGS_REQ, enc->data, enc->length, &req, &len, ret);
     if (ret)
 	goto out;
-    if(enc.length != len)
+    if(enc->length != len)
 	krb5_abortx(context, "internal error in ASN.1 encoder");
 
     /* don't free addresses */
     req.req_body.addresses = NULL;
     free_TGS_REQ(&req);
 
-    /*
-     * Send and receive
-     */
-    {
-	krb5_sendto_ctx stctx;
-	ret = krb5_sendto_ctx_alloc(context, &stctx);
-	if (ret)
-	    return ret;
-	krb5_sendto_ctx_set_func(stctx, _krb5_kdc_retry, NULL);
-
-	ret = krb5_sendto_context (context, stctx, &enc,
-				   krbtgt->server->name.name_string.val[1],
-				   &resp);
-	krb5_sendto_ctx_free(context, stctx);
+out:
+    if (second_ticket == &second_ticket_data)
+	free_Ticket(&second_ticket_data);
+    free_METHOD_DATA(&padata);
+    if (ret && *subkey) {
+	krb5_free_keyblock(context, *subkey);
+	*subkey = NULL;
     }
-    if(ret)
-	goto out;
+    return ret;
+}
+
+/*
+ * Read the KDC's reply `resp' to a TGS-REQ made by make_tgs_req(), and
+ * extract the ticket into `out_creds'.
+ */
+
+static krb5_error_code
+read_tgs_rep(krb5_context context,
+	     krb5_kdc_flags flags,
+	     krb5_data *resp,
+	     krb5_creds *in_creds,
+	     krb5_creds *krbtgt,
+	     krb5_principal impersonate_principal,
+	     unsigned nonce,
+	     krb5_keyblock *subkey,
+	     krb5_creds *out_creds)
+{
+    krb5_kdc_rep rep;
+    KRB_ERROR error;
+    krb5_error_code ret;
+    size_t len = 0;
 
     memset(&rep, 0, sizeof(rep));
-    if(decode_TGS_REP(resp.data, resp.length, &rep.kdc_rep, &len) == 0) {
+    if(decode_TGS_REP(resp->data, resp->length, &rep.kdc_rep, &len) == 0) {
 	unsigned eflags = 0;
 
 	ret = krb5_copy_principal(context,
@@ -575,21 +591,66 @@ get_cred_kdc(krb5_context context,
 				   subkey);
     out2:
 	krb5_free_kdc_rep(context, &rep);
-    } else if(krb5_rd_error(context, &resp, &error) == 0) {
+    } else if(krb5_rd_error(context, resp, &error) == 0) {
 	ret = krb5_error_from_rd_error(context, &error, in_creds);
 	krb5_free_error_contents(context, &error);
-    } else if(resp.length > 0 && ((char*)resp.data)[0] == 4) {
+    } else if(resp->length > 0 && ((char*)resp->data)[0] == 4) {
 	ret = KRB5KRB_AP_ERR_V4_REPLY;
 	krb5_clear_error_message(context);
     } else {
 	ret = KRB5KRB_AP_ERR_MSG_TYPE;
 	krb5_clear_error_message(context);
     }
+    return ret;
+}
+
+static krb5_error_code
+get_cred_kdc(krb5_context context,
+	     krb5_ccache id,
+	     krb5_kdc_flags flags,
+	     krb5_addresses *addresses,
+	     krb5_creds *in_creds,
+	     krb5_creds *krbtgt,
+	     krb5_principal impersonate_principal,
+	     Ticket *second_ticket,
+	     krb5_creds *out_creds)
+{
+    krb5_data enc;
+    krb5_data resp;
+    krb5_error_code ret;
+    unsigned nonce;
+    krb5_keyblock *subkey = NULL;
+
+    krb5_data_zero(&resp);
+
+    ret = make_tgs_req(context, id, flags, addresses, in_creds, krbtgt,
+		       impersonate_principal, second_ticket,
+		       &nonce, &subkey, &enc);
+    if (ret)
+	return ret;
+
+    /*
+     * Send and receive
+     */
+    {
+	krb5_sendto_ctx stctx;
+	ret = krb5_sendto_ctx_alloc(context, &stctx);
+	if (ret)
+	    goto out;
+	krb5_sendto_ctx_set_func(stctx, _krb5_kdc_retry, NULL);
+
+	ret = krb5_sendto_context (context, stctx, &enc,
+				   krbtgt->server->name.name_string.val[1],
+				   &resp);
+	krb5_sendto_ctx_free(context, stctx);
+    }
+    if(ret)
+	goto out;
+
+    ret = read_tgs_rep(context, flags, &resp, in_creds, krbtgt,
+		       impersonate_principal, nonce, subkey, out_creds);
 
 out:
-    if (second_ticket == &second_ticket_data)
-	free_Ticket(&second_ticket_data);
-    free_METHOD_DATA(&padata);
     krb5_data_free(&resp);
     krb5_data_free(&enc);
     if(subkey)
@@ -940,6 +1001,27 @@ get_cred_kdc_capath(krb5_context context,
     return ret;
 }
 
+/*
+ * The realm of the TGT we got initially: referrals start from there.
+ */
+
+static krb5_realm
+get_start_realm(krb5_context context, krb5_ccache ccache,
+		krb5_const_principal client)
+{
+    krb5_data config_start_realm;
+    krb5_realm start_realm;
+
+    if (krb5_cc_get_config(context, ccache, NULL, "start_realm",
+			   &config_start_realm) == 0) {
+        start_realm = strndup(config_start_realm.data, config_start_realm.length);
+	krb5_data_free(&config_start_realm);
+    } else {
+        start_realm = strdup(krb5_principal_get_realm(context, client));
+    }
+    return start_realm;
+}
+
 /*
  * Get a service ticket from a KDC by chasing referrals from a start realm.
  *
@@ -957,7 +1039,6 @@ get_cred_kdc_referral(krb5_context context,
 		      krb5_creds **out_creds)
 {
     krb5_realm start_realm = NULL;
-    krb5_data config_start_realm;
     krb5_error_code ret;
     krb5_creds tgt, referral, ticket;
     krb5_creds **referral_tgts = NULL;  /* used for loop detection */
@@ -980,13 +1061,7 @@ get_cred_kdc_referral(krb5_context context,
     *out_creds = NULL;
 
 
-    ret = krb5_cc_get_config(context, ccache, NULL, "start_realm", &config_start_realm);
-    if (ret == 0) {
-        start_realm = strndup(config_start_realm.data, config_start_realm.length);
-	krb5_data_free(&config_start_realm);
-    } else {
-        start_realm = strdup(krb5_principal_get_realm(context, in_creds->client));
-    }
+    start_realm = get_start_realm(context, ccache, in_creds->client);
     if (start_realm == NULL)
         return krb5_enomem(context);
 
@@ -1512,6 +1587,46 @@ krb5_get_creds_opt_set_ticket(krb5_context context,
 }
 
 
+/*
+ * The KDC options to ask for `princ' with, as krb5_get_creds() options
+ * `*options' say.
+ */
+
+static krb5_kdc_flags
+get_creds_flags(krb5_context context,
+		krb5_const_principal princ,
+		krb5_name_canon_rule_options rule_opts,
+		krb5_flags *options)
+{
+    krb5_kdc_flags flags;
+    const char *comp;
+    int type;
+
+    flags.i = 0;
+    type = krb5_principal_get_type(context, princ);
+    comp = krb5_principal_get_comp_string(context, princ, 0);
+    if ((type == KRB5_NT_SRV_HST || type == KRB5_NT_UNKNOWN) &&
+        comp != NULL && strcmp(comp, "host") == 0)
+	flags.b.canonicalize = 1;
+    if (rule_opts & KRB5_NCRO_NO_REFERRALS)
+	flags.b.canonicalize = 0;
+    else
+	flags.b.canonicalize = (*options & KRB5_GC_CANONICALIZE) ? 1 : 0;
+    if (*options & KRB5_GC_USER_USER) {
+	flags.b.enc_tkt_in_skey = 1;
+	*options |= KRB5_GC_NO_STORE;
+    }
+    if (*options & KRB5_GC_FORWARDABLE)
+	flags.b.forwardable = 1;
+    if (*options & KRB5_GC_NO_TRANSIT_CHECK)
+	flags.b.disable_transited_check = 1;
+    if (*options & KRB5_GC_CONSTRAINED_DELEGATION) {
+	flags.b.request_anonymous = 1; /* XXX ARGH confusion */
+	flags.b.constrained_delegation = 1;
+    }
+    return flags;
+}
+
 KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
 krb5_get_creds(krb5_context context,
 	       krb5_get_creds_opt opt,
@@ -1529,8 +1644,6 @@ krb5_get_creds(krb5_context context,
     krb5_name_canon_iterator name_canon_iter = NULL;
     krb5_name_canon_rule_options rule_opts;
     int i;
-    int type;
-    const char *comp;
 
     memset(&in_creds, 0, sizeof(in_creds));
     in_creds.server = rk_UNCONST(inprinc);
@@ -1608,27 +1721,7 @@ next_rule:
     if (options & KRB5_GC_CACHED)
 	goto next_rule;
 
-    type = krb5_principal_get_type(context, try_princ);
-    comp = krb5_principal_get_comp_string(context, try_princ, 0);
-    if ((type == KRB5_NT_SRV_HST || type == KRB5_NT_UNKNOWN) &&
-        comp != NULL && strcmp(comp, "host") == 0)
-	flags.b.canonicalize = 1;
-    if (rule_opts & KRB5_NCRO_NO_REFERRALS)
-	flags.b.canonicalize = 0;
-    else
-	flags.b.canonicalize = (options & KRB5_GC_CANONICALIZE) ? 1 : 0;
-    if (options & KRB5_GC_USER_USER) {
-	flags.b.enc_tkt_in_skey = 1;
-	options |= KRB5_GC_NO_STORE;
-    }
-    if (options & KRB5_GC_FORWARDABLE)
-	flags.b.forwardable = 1;
-    if (options & KRB5_GC_NO_TRANSIT_CHECK)
-	flags.b.disable_transited_check = 1;
-    if (options & KRB5_GC_CONSTRAINED_DELEGATION) {
-	flags.b.request_anonymous = 1; /* XXX ARGH confusion */
-	flags.b.constrained_delegation = 1;
-    }
+    flags = get_creds_flags(context, try_princ, rule_opts, &options);
 
     tgts = NULL;
     ret = _krb5_get_cred_kdc_any(context, flags, ccache,
@@ -1673,6 +1766,396 @@ out:
     return ret;
 }
 
+/*
+ * State of one request of krb5_get_creds_batch()
+ */
+
+struct batch_req {
+    krb5_creds referral;		/* what we ask the KDC for next */
+    krb5_creds tgt;			/* ... and with */
+    krb5_creds **referral_tgts;		/* used for loop detection */
+    krb5_kdc_flags flags;
+    krb5_flags options;
+    int ok_as_delegate;
+    unsigned nonce;
+    krb5_keyblock *subkey;
+    krb5_data req;
+    krb5_creds *out;
+    size_t dup;				/* index of the same principal */
+    int state;
+#define BATCH_DUP	0		/* same as an earlier one */
+#define BATCH_DONE	1		/* got a ticket, or failed for good */
+#define BATCH_SERIAL	2		/* left to krb5_get_creds() */
+#define BATCH_SEND	3		/* a TGS-REQ is to be sent */
+#define BATCH_GOT	4		/* got a ticket from the KDC */
+};
+
+/*
+ * Set up `r' to ask for `server': straight to its realm if we have a
+ * TGT for it, or by chasing referrals from the start realm as
+ * get_cred_kdc_referral() does.
+ */
+
+static krb5_error_code
+batch_init(krb5_context context, krb5_ccache ccache,
+	   krb5_const_realm start_realm, struct batch_req *r)
+{
+    krb5_principal tgtname;
+    krb5_const_realm realm;
+    krb5_error_code ret;
+
+    realm = r->referral.server->realm;
+    if (krb5_principal_is_krbtgt(context, r->referral.server) ||
+	(r->options & KRB5_GC_USER_USER) ||
+	r->referral.server->name.name_type == KRB5_NT_SRV_HST_NEEDS_CANON)
+	return KRB5KDC_ERR_PATH_NOT_ACCEPTED;
+
+    ret = KRB5_CC_END;
+    if (realm[0] != '\0') {
+	ret = krb5_make_principal(context, &tgtname, start_realm,
+				  KRB5_TGS_NAME, realm, NULL);
+	if (ret)
+	    return ret;
+	ret = find_cred(context, ccache, tgtname, NULL, &r->tgt);
+	krb5_free_principal(context, tgtname);
+    }
+    if (ret) {
+	if (r->referral.server->name.name_string.len < 2 &&
+	    !r->flags.b.canonicalize)
+	    return KRB5KDC_ERR_PATH_NOT_ACCEPTED;
+	r->flags.b.canonicalize = 1;
+
+	ret = krb5_make_principal(context, &tgtname, start_realm,
+				  KRB5_TGS_NAME, start_realm, NULL);
+	if (ret)
+	    return ret;
+	ret = find_cred(context, ccache, tgtname, NULL, &r->tgt);
+	krb5_free_principal(context, tgtname);
+	if (ret)
+	    return ret;
+	ret = krb5_principal_set_realm(context, r->referral.server,
+				       start_realm);
+	if (ret)
+	    return ret;
+    }
+
+    /* get_cred_kdc_address() would have to ask for our addresses */
+    if (r->tgt.addresses.len != 0)
+	return KRB5KDC_ERR_PATH_NOT_ACCEPTED;
+    return 0;
+}
+
+/*
+ * Take the ticket the KDC sent for `r': the one we want, or a referral
+ * to follow in the next round.
+ */
+
+static krb5_error_code
+batch_reply(krb5_context context, struct batch_req *r, krb5_creds *ticket)
+{
+    krb5_creds **tickets;
+    krb5_creds mcreds;
+    char *referral_realm;
+    krb5_error_code ret;
+
+    if (krb5_principal_compare(context, r->referral.server, ticket->server)) {
+	if ((r->out = malloc(sizeof(*r->out))) == NULL)
+	    return krb5_enomem(context);
+	*r->out = *ticket;
+	memset(ticket, 0, sizeof(*ticket));
+	r->state = BATCH_GOT;
+	return 0;
+    }
+
+    if (!krb5_principal_is_krbtgt(context, ticket->server)) {
+	krb5_set_error_message(context, KRB5KRB_AP_ERR_NOT_US,
+			       N_("Got back an non krbtgt "
+				  "ticket referrals", ""));
+	return KRB5KRB_AP_ERR_NOT_US;
+    }
+
+    referral_realm = ticket->server->name.name_string.val[1];
+
+    /* check that there are no referrals loops */
+    krb5_cc_clear_mcred(&mcreds);
+    mcreds.server = ticket->server;
+    for (tickets = r->referral_tgts; tickets && *tickets; tickets++) {
+	if (krb5_compare_creds(context, KRB5_TC_DONT_MATCH_REALM,
+			       &mcreds, *tickets)) {
+	    krb5_set_error_message(context, KRB5_GET_IN_TKT_LOOP,
+				   N_("Referral from %s "
+				      "loops back to realm %s", ""),
+				   r->tgt.server->realm, referral_realm);
+	    return KRB5_GET_IN_TKT_LOOP;
+	}
+    }
+
+    if (r->ok_as_delegate == 0 || ticket->flags.b.ok_as_delegate == 0) {
+	r->ok_as_delegate = 0;
+	ticket->flags.b.ok_as_delegate = 0;
+    }
+
+    _krb5_debug(context, 6, "krb5_get_creds_batch: got referral "
+		"to %s from %s", referral_realm, r->referral.server->realm);
+    ret = add_cred(context, ticket, &r->referral_tgts);
+    if (ret)
+	return ret;
+    ret = krb5_principal_set_realm(context, r->referral.server,
+				   referral_realm);
+    krb5_free_cred_contents(context, &r->tgt);
+    r->tgt = *ticket;
+    memset(ticket, 0, sizeof(*ticket));
+    return ret;
+}
+
+/**
+ * Get service tickets for the `num' principals `servers' at once, as
+ * krb5_get_creds() would for each of them.
+ *
+ * The TGS-REQs for all the principals that are not in the credential
+ * cache yet are sent in parallel, and so are the ones that follow the
+ * referrals the KDCs answer with.  A principal that is listed several
+ * times is asked for only once.  The tickets, and the TGTs of the
+ * referrals followed for them, are stored in the credential cache once
+ * they are all in, unless KRB5_GC_NO_STORE is set.  Principals that
+ * cannot be had that way, because they need capaths, name
+ * canonicalization rules or user-to-user, are left to krb5_get_creds().
+ *
+ * @param context Kerberos 5 context
+ * @param opt options as for krb5_get_creds(), or NULL
+ * @param ccache credential cache with the TGT to use
+ * @param num number of principals
+ * @param servers the service principals
+ * @param out_creds the tickets, to free with krb5_free_creds(), or NULL
+ * @param errors why there is no ticket in out_creds
+ *
+ * @return 0 if all tickets were obtained, or the error of the first
+ * principal that was not
+ *
+ * @ingroup krb5_credential
+ */
+
+KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
+krb5_get_creds_batch(krb5_context context,
+		     krb5_get_creds_opt opt,
+		     krb5_ccache ccache,
+		     size_t num,
+		     krb5_const_principal *servers,
+		     krb5_creds **out_creds,
+		     krb5_error_code *errors)
+{
+    struct krb5_get_creds_opt_data cached;
+    struct batch_req *reqs = NULL;
+    krb5_sendto_ctx *ctxs = NULL;
+    krb5_data *send = NULL, *resp = NULL;
+    krb5_const_realm *realms = NULL;
+    krb5_error_code *rets = NULL;
+    size_t *idx = NULL;
+    krb5_principal client = NULL;
+    krb5_realm start_realm = NULL;
+    krb5_principal self = opt ? opt->self : NULL;
+    Ticket *second_ticket = opt ? opt->ticket : NULL;
+    krb5_error_code ret;
+    krb5_deltat offset;
+    size_t i, j, n;
+    int loop;
+
+    for (i = 0; i < num; i++) {
+	out_creds[i] = NULL;
+	errors[i] = 0;
+    }
+    if (num == 0)
+	return 0;
+
+    ret = krb5_cc_get_principal(context, ccache, &client);
+    if (ret)
+	goto fail;
+    start_realm = get_start_realm(context, ccache, client);
+    reqs = calloc(num, sizeof(reqs[0]));
+    ctxs = calloc(num, sizeof(ctxs[0]));
+    send = calloc(num, sizeof(send[0]));
+    resp = calloc(num, sizeof(resp[0]));
+    realms = calloc(num, sizeof(realms[0]));
+    rets = calloc(num, sizeof(rets[0]));
+    idx = calloc(num, sizeof(idx[0]));
+    if (start_realm == NULL || reqs == NULL || ctxs == NULL ||
+	send == NULL || resp == NULL || realms == NULL || rets == NULL ||
+	idx == NULL) {
+	ret = krb5_enomem(context);
+	goto fail;
+    }
+
+    ret = krb5_cc_get_kdc_offset(context, ccache, &offset);
+    if (ret == 0) {
+	context->kdc_sec_offset = offset;
+	context->kdc_usec_offset = 0;
+    }
+
+    /* Collapse duplicates, and take what the ccache has already */
+    if (opt)
+	cached = *opt;
+    else
+	memset(&cached, 0, sizeof(cached));
+    cached.options |= KRB5_GC_CACHED;
+    for (i = 0; i < num; i++) {
+	struct batch_req *r = &reqs[i];
+
+	for (j = 0; j < i; j++) {
+	    if (krb5_principal_compare(context, servers[i], servers[j]))
+		break;
+	}
+	if (j < i) {
+	    r->dup = j;
+	    r->state = BATCH_DUP;
+	    continue;
+	}
+
+	r->state = BATCH_DONE;
+	errors[i] = krb5_get_creds(context, &cached, ccache, servers[i],
+				   &r->out);
+	if (errors[i] == 0 || (opt && (opt->options & KRB5_GC_CACHED)))
+	    continue;
+
+	r->state = BATCH_SERIAL;
+	r->ok_as_delegate = 1;
+	r->options = opt ? opt->options : 0;
+	r->flags = get_creds_flags(context, servers[i], 0, &r->options);
+	r->referral.client = client;
+	if (opt && opt->enctype)
+	    r->referral.session.keytype = opt->enctype;
+	ret = krb5_copy_principal(context, servers[i], &r->referral.server);
+	if (ret)
+	    goto fail;
+	if (batch_init(context, ccache, start_realm, r) == 0)
+	    r->state = BATCH_SEND;
+    }
+
+    /* Send all the TGS-REQs of a round at once, and read the replies */
+    for (loop = 0; loop < 17; loop++) {
+	for (n = 0, i = 0; i < num; i++) {
+	    struct batch_req *r = &reqs[i];
+
+	    if (r->state != BATCH_SEND)
+		continue;
+	    ret = make_tgs_req(context, ccache, r->flags, NULL, &r->referral,
+			       &r->tgt, self, second_ticket, &r->nonce,
+			       &r->subkey, &r->req);
+	    if (ret == 0)
+		ret = krb5_sendto_ctx_alloc(context, &ctxs[n]);
+	    if (ret) {
+		krb5_data_free(&r->req);
+		krb5_free_keyblock(context, r->subkey);
+		r->subkey = NULL;
+		errors[i] = ret;
+		r->state = BATCH_SERIAL;
+		continue;
+	    }
+	    krb5_sendto_ctx_set_func(ctxs[n], _krb5_kdc_retry, NULL);
+	    send[n] = r->req;
+	    realms[n] = r->tgt.server->name.name_string.val[1];
+	    idx[n++] = i;
+	}
+	if (n == 0)
+	    break;
+
+	_krb5_debug(context, 5, "krb5_get_creds_batch: sending %lu "
+		    "request(s)", (unsigned long)n);
+	_krb5_sendto_many(context, n, ctxs, send, realms, resp, rets);
+
+	for (j = 0; j < n; j++) {
+	    struct batch_req *r = &reqs[idx[j]];
+	    krb5_creds ticket;
+
+	    krb5_sendto_ctx_free(context, ctxs[j]);
+	    ctxs[j] = NULL;
+	    memset(&ticket, 0, sizeof(ticket));
+	    ret = rets[j];
+	    if (ret == 0)
+		ret = read_tgs_rep(context, r->flags, &resp[j], &r->referral,
+				   &r->tgt, self, r->nonce, r->subkey,
+				   &ticket);
+	    if (ret == 0)
+		ret = batch_reply(context, r, &ticket);
+	    if (ret) {
+		errors[idx[j]] = ret;
+		r->state = BATCH_SERIAL;
+	    }
+	    krb5_free_cred_contents(context, &ticket);
+	    krb5_data_free(&resp[j]);
+	    krb5_data_free(&r->req);
+	    krb5_free_keyblock(context, r->subkey);
+	    r->subkey = NULL;
+	}
+    }
+
+    for (i = 0; i < num; i++) {
+	struct batch_req *r = &reqs[i];
+
+	/* As krb5_get_creds() does, keep the TGTs the referrals got us */
+	for (j = 0; r->referral_tgts && r->referral_tgts[j]; j++) {
+	    if ((r->options & KRB5_GC_NO_STORE) == 0)
+		krb5_cc_store_cred(context, ccache, r->referral_tgts[j]);
+	}
+
+	if (r->state == BATCH_SEND) {
+	    /* Too many referrals */
+	    errors[i] = KRB5_GET_IN_TKT_LOOP;
+	    r->state = BATCH_SERIAL;
+	}
+	if (r->state == BATCH_GOT) {
+	    errors[i] = 0;
+	    if ((r->options & KRB5_GC_NO_STORE) == 0)
+		store_cred(context, ccache, servers[i], r->out);
+	} else if (r->state == BATCH_SERIAL) {
+	    /* Maybe capaths or name canonicalization rules get us there */
+	    errors[i] = krb5_get_creds(context, opt, ccache, servers[i],
+				       &r->out);
+	}
+	if (r->state == BATCH_DUP) {
+	    errors[i] = errors[r->dup];
+	    if (errors[i] == 0)
+		errors[i] = krb5_copy_creds(context, reqs[r->dup].out,
+					    &out_creds[i]);
+	}
+    }
+    for (i = 0; i < num; i++) {
+	if (reqs[i].state != BATCH_DUP) {
+	    out_creds[i] = reqs[i].out;
+	    reqs[i].out = NULL;
+	}
+    }
+
+    ret = 0;
+    for (i = 0; i < num && ret == 0; i++)
+	ret = errors[i];
+
+ fail:
+    for (i = 0; ret && i < num; i++) {
+	if (out_creds[i] == NULL && errors[i] == 0)
+	    errors[i] = ret;
+    }
+    for (i = 0; reqs && i < num; i++) {
+	struct batch_req *r = &reqs[i];
+
+	for (j = 0; r->referral_tgts && r->referral_tgts[j]; j++)
+	    krb5_free_creds(context, r->referral_tgts[j]);
+	free(r->referral_tgts);
+	krb5_free_principal(context, r->referral.server);
+	krb5_free_cred_contents(context, &r->tgt);
+	krb5_free_creds(context, r->out);
+    }
+    free(reqs);
+    free(ctxs);
+    free(send);
+    free(resp);
+    free(realms);
+    free(rets);
+    free(idx);
+    free(start_realm);
+    krb5_free_principal(context, client);
+    return ret;
+}
+
 /*
  *
  */
@@ -130,7 +130,7 @@ dns_find_realm(krb5_context context,
 	    ret = krb5_enomem(context);
 	    goto out;
 	}
-    	r = rk_dns_lookup(dom, "TXT");
+    	r = _krb5_dns_lookup(context, dom, "TXT");
     	if(r != NULL) {
 	    ret = copy_txt_to_realms(context, domain, r->head, realms);
 	    rk_dns_free_data(r);
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "krb5_locl.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/**
+ * @section kdc_health KDC liveness and round trip times
+ *
+ * krb5_sendto_context() records here how each KDC it talked to fared:
+ * a smoothed round trip time for the ones that answered, and a count
+ * of consecutive failures for the ones that did not.  A KDC that failed
+ * is backed off for a while, exponentially longer for each failure in
+ * a row, up to [libdefaults] kdc_health_backoff.
+ *
+ * The krbhst code uses this to order the KDCs it hands out: KDCs that
+ * are backed off go last, and the others are grouped by the order of
+ * magnitude of their round trip time, keeping the configuration or SRV
+ * order within a group.  So a dead KDC costs a timeout once, not once
+ * per request.
+ *
+ * The table is shared by all the contexts in a process.  With [libdefaults]
+ * kdc_health_file it is a small file mapped into each process that uses
+ * it, so that short-lived processes learn from each other as well.
+ *
+ * KDCs are identified by protocol, host name and port, as the krbhst
+ * code knows them before they are resolved.
+ */
+
+#define KDC_HEALTH_MAGIC	0x4b484c54	/* "KHLT" */
+#define KDC_HEALTH_VERSION	1
+#define KDC_HEALTH_SLOTS	128
+#define KDC_HEALTH_KEYLEN	96
+#define KDC_HEALTH_MIN_BACKOFF	5
+
+struct kdc_health_slot {
+    uint32_t hash;		/* 0 if the slot is free */
+    uint32_t nfail;		/* consecutive failures */
+    uint32_t srtt;		/* smoothed round trip time in usec */
+    uint32_t pad;
+    int64_t last_used;
+    int64_t backoff_until;
+    char key[KDC_HEALTH_KEYLEN];
+};
+
+struct kdc_health_table {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t pad;
+    struct kdc_health_slot slots[KDC_HEALTH_SLOTS];
+};
+
+static HEIMDAL_MUTEX kdc_health_mutex = HEIMDAL_MUTEX_INITIALIZER;
+static struct kdc_health_table *kdc_health;
+static int kdc_health_fd = -1;
+static char *kdc_health_filename;
+static int kdc_health_inited;
+
+static struct kdc_health_table *
+map_health_file(krb5_context context, const char *fn)
+{
+#if defined(HAVE_MMAP) && !defined(_WIN32)
+    struct kdc_health_table *t;
+    struct stat st;
+    int fd;
+
+    fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+	_krb5_debug(context, 2, "kdc health: could not open %s: %s",
+		    fn, strerror(errno));
+	return NULL;
+    }
+    rk_cloexec(fd);
+
+    if (_krb5_xlock(context, fd, TRUE, fn) != 0) {
+	close(fd);
+	return NULL;
+    }
+    if (fstat(fd, &st) != 0 ||
+	(st.st_size < (off_t)sizeof(*t) && ftruncate(fd, sizeof(*t)) != 0)) {
+	_krb5_xunlock(context, fd);
+	close(fd);
+	return NULL;
+    }
+    t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (t == MAP_FAILED) {
+	_krb5_xunlock(context, fd);
+	close(fd);
+	return NULL;
+    }
+    if (t->magic != KDC_HEALTH_MAGIC || t->version != KDC_HEALTH_VERSION ||
+	t->nslots != KDC_HEALTH_SLOTS) {
+	memset(t, 0, sizeof(*t));
+	t->magic = KDC_HEALTH_MAGIC;
+	t->version = KDC_HEALTH_VERSION;
+	t->nslots = KDC_HEALTH_SLOTS;
+    }
+    _krb5_xunlock(context, fd);
+    if ((kdc_health_filename = strdup(fn)) == NULL) {
+	munmap(t, sizeof(*t));
+	close(fd);
+	return NULL;
+    }
+    kdc_health_fd = fd;
+    return t;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Returns with kdc_health_mutex held, and the file locked if there is
+ * one, or NULL if the table is disabled.
+ */
+
+static struct kdc_health_table *
+lock_table(krb5_context context, krb5_boolean exclusive)
+{
+    if (!context->kdc_health)
+	return NULL;
+
+    HEIMDAL_MUTEX_lock(&kdc_health_mutex);
+    if (!kdc_health_inited) {
+	kdc_health_inited = 1;
+	if (context->kdc_health_file)
+	    kdc_health = map_health_file(context, context->kdc_health_file);
+	if (kdc_health == NULL)
+	    kdc_health = calloc(1, sizeof(*kdc_health));
+    }
+    if (kdc_health == NULL) {
+	HEIMDAL_MUTEX_unlock(&kdc_health_mutex);
+	return NULL;
+    }
+    if (kdc_health_fd != -1)
+	(void) _krb5_xlock(context, kdc_health_fd, exclusive,
+			   kdc_health_filename);
+    return kdc_health;
+}
+
+static void
+unlock_table(krb5_context context)
+{
+    if (kdc_health_fd != -1)
+	(void) _krb5_xunlock(context, kdc_health_fd);
+    HEIMDAL_MUTEX_unlock(&kdc_health_mutex);
+}
+
+static uint32_t
+make_key(const krb5_krbhst_info *hi, char key[KDC_HEALTH_KEYLEN])
+{
+    static const char *protos[] = { "udp", "tcp", "http" };
+    const unsigned char *p;
+    uint32_t hash = 5381;
+    char buf[KDC_HEALTH_KEYLEN + 256];
+
+    snprintf(buf, sizeof(buf), "%s/%s:%u",
+	     hi->proto < 3 ? protos[hi->proto] : "?", hi->hostname,
+	     (unsigned)hi->port);
+    for (p = (const unsigned char *)buf; *p; p++)
+	hash = hash * 33 + *p;
+    strlcpy(key, buf, KDC_HEALTH_KEYLEN);
+    return hash ? hash : 1;
+}
+
+static struct kdc_health_slot *
+find_slot(struct kdc_health_table *t, uint32_t hash, const char *key,
+	  krb5_boolean create, time_t now)
+{
+    struct kdc_health_slot *s, *victim = NULL;
+    size_t i;
+
+    for (i = 0; i < KDC_HEALTH_SLOTS; i++) {
+	s = &t->slots[i];
+	if (s->hash == hash && strncmp(s->key, key, KDC_HEALTH_KEYLEN) == 0)
+	    return s;
+	if (victim == NULL || s->hash == 0 ||
+	    (victim->hash != 0 && s->last_used < victim->last_used))
+	    victim = s;
+    }
+    if (!create)
+	return NULL;
+
+    /* Take a free slot, or the least recently used one */
+    memset(victim, 0, sizeof(*victim));
+    victim->hash = hash;
+    victim->last_used = now;
+    strlcpy(victim->key, key, KDC_HEALTH_KEYLEN);
+    return victim;
+}
+
+/**
+ * Record that the KDC `hi' answered after `rtt' microseconds.
+ */
+
+KRB5_LIB_FUNCTION void KRB5_LIB_CALL
+_krb5_kdc_health_success(krb5_context context,
+			 const krb5_krbhst_info *hi,
+			 unsigned long rtt)
+{
+    struct kdc_health_table *t;
+    struct kdc_health_slot *s;
+    char key[KDC_HEALTH_KEYLEN];
+    uint32_t hash = make_key(hi, key);
+    time_t now = time(NULL);
+
+    if ((t = lock_table(context, TRUE)) == NULL)
+	return;
+    s = find_slot(t, hash, key, TRUE, now);
+    s->last_used = now;
+    s->nfail = 0;
+    s->backoff_until = 0;
+    if (rtt > UINT32_MAX)
+	rtt = UINT32_MAX;
+    if (rtt == 0)
+	rtt = 1;
+    if (s->srtt == 0)
+	s->srtt = rtt;
+    else
+	s->srtt = (uint32_t)(((uint64_t)s->srtt * 7 + rtt) / 8);
+    unlock_table(context);
+}
+
+/**
+ * Record that the KDC `hi' did not answer, or refused the connection.
+ */
+
+KRB5_LIB_FUNCTION void KRB5_LIB_CALL
+_krb5_kdc_health_failure(krb5_context context,
+			 const krb5_krbhst_info *hi)
+{
+    struct kdc_health_table *t;
+    struct kdc_health_slot *s;
+    char key[KDC_HEALTH_KEYLEN];
+    uint32_t hash = make_key(hi, key);
+    time_t now = time(NULL);
+    time_t backoff = KDC_HEALTH_MIN_BACKOFF;
+    uint32_t i;
+
+    if ((t = lock_table(context, TRUE)) == NULL)
+	return;
+    s = find_slot(t, hash, key, TRUE, now);
+    s->last_used = now;
+    if (s->nfail < UINT32_MAX)
+	s->nfail++;
+    for (i = 1; i < s->nfail && backoff < context->kdc_health_backoff; i++)
+	backoff *= 2;
+    if (backoff > context->kdc_health_backoff)
+	backoff = context->kdc_health_backoff;
+    s->backoff_until = now + backoff;
+    _krb5_debug(context, 2, "kdc health: %s failed %u time(s), "
+		"backing off for %ds", key, (unsigned)s->nfail, (int)backoff);
+    unlock_table(context);
+}
+
+/**
+ * Return how desirable the KDC `hi' is, lower is better.  KDCs that
+ * have not been heard of yet rank with the fastest ones.
+ */
+
+KRB5_LIB_FUNCTION int64_t KRB5_LIB_CALL
+_krb5_kdc_health_rank(krb5_context context,
+		      const krb5_krbhst_info *hi)
+{
+    struct kdc_health_table *t;
+    struct kdc_health_slot *s;
+    char key[KDC_HEALTH_KEYLEN];
+    uint32_t hash = make_key(hi, key);
+    time_t now = time(NULL);
+    int64_t rank = 0;
+    uint32_t ms;
+
+    if ((t = lock_table(context, FALSE)) == NULL)
+	return 0;
+    s = find_slot(t, hash, key, FALSE, now);
+    if (s == NULL) {
+	rank = 0;
+    } else if (s->backoff_until > now) {
+	/* After the live ones, in the order they come back */
+	rank = ((int64_t)1 << 40) + s->backoff_until;
+    } else {
+	/* Order of magnitude of the round trip time in milliseconds */
+	for (ms = s->srtt / 1000; ms; ms >>= 1)
+	    rank++;
+    }
+    unlock_table(context);
+    return rank;
+}
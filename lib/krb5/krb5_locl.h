@@ -125,6 +125,7 @@ struct mbuf;
 #include <pkinit_asn1.h>
 
 struct send_to_kdc;
+struct rk_dns_reply;
 
 /* XXX glue for pkinit */
 struct hx509_certs_data;
@@ -276,6 +277,15 @@ typedef struct krb5_context_data {
 #endif
     unsigned int num_kdc_requests;
     krb5_name_canon_rule name_canon_rules;
+    krb5_boolean kdc_health;		/* track KDC liveness and RTT */
+    time_t kdc_health_backoff;		/* longest backoff of a dead KDC */
+    const char *kdc_health_file;	/* share it with other processes */
+    krb5_boolean kdc_tcp_reuse;		/* keep TCP connections to KDCs */
+    time_t kdc_tcp_idle_timeout;	/* for this long when unused */
+    struct kdc_conn *kdc_conns;		/* the idle ones, under mutex */
+    krb5_boolean dns_cache;		/* cache SRV and TXT lookups */
+    time_t dns_cache_max_ttl;		/* longest time an answer is kept */
+    time_t dns_cache_negative_ttl;	/* how long a failure is kept */
 } krb5_context_data;
 
 #ifndef KRB5_USE_PATH_TOKENS
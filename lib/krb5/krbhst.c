@@ -95,7 +95,7 @@ srv_find_realm(krb5_context context, krb5_krbhst_info ***res, int *count,
 
     snprintf(domain, sizeof(domain), "_%s._%s.%s.", service, proto, realm);
 
-    r = rk_dns_lookup(domain, dns_type);
+    r = _krb5_dns_lookup(context, domain, dns_type);
     if(r == NULL) {
 	_krb5_debug(context, 0,
 		    "DNS lookup failed domain: %s", domain);
@@ -176,6 +176,7 @@ struct krb5_krbhst_data {
 #define KD_LARGE_MSG		64
 #define KD_PLUGIN	       128
 #define KD_HOSTNAMES	       256
+#define KD_UNORDERED	       512
     krb5_error_code (*get_next)(krb5_context, struct krb5_krbhst_data *,
 				krb5_krbhst_info**);
 
@@ -328,6 +329,7 @@ append_host_hostinfo(struct krb5_krbhst_data *kd, struct krb5_krbhst_info *host)
 	}
     *kd->end = host;
     kd->end = &host->next;
+    kd->flags |= KD_UNORDERED;
 }
 
 static krb5_error_code
@@ -418,10 +420,66 @@ krb5_krbhst_get_addrinfo(krb5_context context, krb5_krbhst_info *host,
     return ret;
 }
 
+/*
+ * Order the hosts not handed out yet by what the KDC health table knows
+ * of them.  The sort is stable, so hosts it ranks the same keep the
+ * order they were found in.
+ */
+
+static void
+order_hosts(krb5_context context, struct krb5_krbhst_data *kd)
+{
+    struct krb5_krbhst_info *hi, **hosts, **link;
+    int64_t *rank, r;
+    size_t i, j, n = 0;
+
+    kd->flags &= ~KD_UNORDERED;
+    if (!context->kdc_health)
+	return;
+
+    for (hi = *kd->index; hi != NULL; hi = hi->next)
+	n++;
+    if (n < 2)
+	return;
+
+    hosts = malloc(n * sizeof(hosts[0]));
+    rank = malloc(n * sizeof(rank[0]));
+    if (hosts == NULL || rank == NULL) {
+	free(hosts);
+	free(rank);
+	return;
+    }
+
+    for (i = 0, hi = *kd->index; hi != NULL; hi = hi->next, i++) {
+	r = _krb5_kdc_health_rank(context, hi);
+	for (j = i; j > 0 && rank[j - 1] > r; j--) {
+	    hosts[j] = hosts[j - 1];
+	    rank[j] = rank[j - 1];
+	}
+	hosts[j] = hi;
+	rank[j] = r;
+    }
+
+    for (link = kd->index, i = 0; i < n; i++) {
+	*link = hosts[i];
+	link = &hosts[i]->next;
+    }
+    *link = NULL;
+    kd->end = link;
+    free(hosts);
+    free(rank);
+}
+
 static krb5_boolean
-get_next(struct krb5_krbhst_data *kd, krb5_krbhst_info **host)
+get_next(krb5_context context, struct krb5_krbhst_data *kd,
+	 krb5_krbhst_info **host)
 {
-    struct krb5_krbhst_info *hi = *kd->index;
+    struct krb5_krbhst_info *hi;
+
+    if (kd->flags & KD_UNORDERED)
+	order_hosts(context, kd);
+
+    hi = *kd->index;
     if(hi != NULL) {
 	*host = hi;
 	kd->index = &(*kd->index)->next;
@@ -717,21 +775,21 @@ kdc_get_next(krb5_context context,
 
     if ((kd->flags & KD_HOSTNAMES) == 0) {
 	hostnames_get_hosts(context, kd, "kdc");
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
     if ((kd->flags & KD_PLUGIN) == 0) {
 	plugin_get_hosts(context, kd, locate_service_kdc);
 	kd->flags |= KD_PLUGIN;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
     if((kd->flags & KD_CONFIG) == 0) {
 	config_get_hosts(context, kd, "kdc");
 	kd->flags |= KD_CONFIG;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
@@ -746,20 +804,20 @@ kdc_get_next(krb5_context context,
 	if((kd->flags & KD_SRV_UDP) == 0 && (kd->flags & KD_LARGE_MSG) == 0) {
 	    srv_get_hosts(context, kd, "udp", "kerberos");
 	    kd->flags |= KD_SRV_UDP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
 
 	if((kd->flags & KD_SRV_TCP) == 0) {
 	    srv_get_hosts(context, kd, "tcp", "kerberos");
 	    kd->flags |= KD_SRV_TCP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
 	if((kd->flags & KD_SRV_HTTP) == 0) {
 	    srv_get_hosts(context, kd, "http", "kerberos");
 	    kd->flags |= KD_SRV_HTTP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
     }
@@ -770,7 +828,7 @@ kdc_get_next(krb5_context context,
 				 krbhst_get_default_proto(kd));
 	if(ret)
 	    return ret;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
@@ -789,14 +847,14 @@ admin_get_next(krb5_context context,
     if ((kd->flags & KD_PLUGIN) == 0) {
 	plugin_get_hosts(context, kd, locate_service_kadmin);
 	kd->flags |= KD_PLUGIN;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
     if((kd->flags & KD_CONFIG) == 0) {
 	config_get_hosts(context, kd, "admin_server");
 	kd->flags |= KD_CONFIG;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
@@ -811,7 +869,7 @@ admin_get_next(krb5_context context,
 	if((kd->flags & KD_SRV_TCP) == 0) {
 	    srv_get_hosts(context, kd, "tcp", "kerberos-adm");
 	    kd->flags |= KD_SRV_TCP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
     }
@@ -824,7 +882,7 @@ admin_get_next(krb5_context context,
 	if(ret)
 	    return ret;
 	kd->flags |= KD_FALLBACK;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
@@ -843,14 +901,14 @@ kpasswd_get_next(krb5_context context,
     if ((kd->flags & KD_PLUGIN) == 0) {
 	plugin_get_hosts(context, kd, locate_service_kpasswd);
 	kd->flags |= KD_PLUGIN;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
     if((kd->flags & KD_CONFIG) == 0) {
 	config_get_hosts(context, kd, "kpasswd_server");
 	kd->flags |= KD_CONFIG;
-	if(get_next(kd, host))
+	if(get_next(context, kd, host))
 	    return 0;
     }
 
@@ -865,13 +923,13 @@ kpasswd_get_next(krb5_context context,
 	if((kd->flags & KD_SRV_UDP) == 0) {
 	    srv_get_hosts(context, kd, "udp", "kpasswd");
 	    kd->flags |= KD_SRV_UDP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
 	if((kd->flags & KD_SRV_TCP) == 0) {
 	    srv_get_hosts(context, kd, "tcp", "kpasswd");
 	    kd->flags |= KD_SRV_TCP;
-	    if(get_next(kd, host))
+	    if(get_next(context, kd, host))
 		return 0;
 	}
     }
@@ -1006,7 +1064,7 @@ krb5_krbhst_next(krb5_context context,
 		 krb5_krbhst_handle handle,
 		 krb5_krbhst_info **host)
 {
-    if(get_next(handle, host))
+    if(get_next(context, handle, host))
 	return 0;
 
     return (*handle->get_next)(context, handle, host);
@@ -41,10 +41,10 @@
 /*
  * As with the other *-ec.c files in Heimdal, this is a bit of a hack.
  *
- * The idea is to use OpenSSL for EC because hcrypto doesn't have the
- * required functionality at this time.  To do this we segregate
- * EC-using code into separate source files and then we arrange for them
- * to get the OpenSSL headers and not the conflicting hcrypto ones.
+ * The idea is to use OpenSSL for EC when we are built with it, and
+ * hcrypto's native P-256 otherwise.  To do this we segregate EC-using
+ * code into separate source files and then we arrange for them to get
+ * the OpenSSL headers and not the conflicting hcrypto ones.
  *
  * Because of auto-generated *-private.h headers, we end up needing to
  * make sure various types are defined before we include them, thus the
@@ -57,6 +57,9 @@
 #include <openssl/evp.h>
 #include <openssl/bn.h>
 #define HEIM_NO_CRYPTO_HDRS
+#else
+#include <hcrypto/ec.h>
+#include <hcrypto/ecdh.h>
 #endif
 
 /*
@@ -88,7 +91,6 @@ _krb5_build_authpack_subjectPK_EC(krb5_context context,
                                   krb5_pk_init_ctx ctx,
                                   AuthPack *a)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     krb5_error_code ret;
     ECParameters ecp;
     unsigned char *p;
@@ -155,11 +157,6 @@ _krb5_build_authpack_subjectPK_EC(krb5_context context,
     return 0;
 
     /* XXX verify that this is right with RFC3279 */
-#else
-    krb5_set_error_message(context, ENOTSUP,
-                           N_("PKINIT: ECDH not supported", ""));
-    return ENOTSUP;
-#endif
 }
 
 krb5_error_code
@@ -170,7 +167,6 @@ _krb5_pk_rd_pa_reply_ecdh_compute_key(krb5_context context,
                                       unsigned char **out,
                                       int *out_sz)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     krb5_error_code ret = 0;
     int dh_gen_keylen;
 
@@ -219,19 +215,12 @@ _krb5_pk_rd_pa_reply_ecdh_compute_key(krb5_context context,
     *out_sz = dh_gen_keylen;
 
     return ret;
-#else
-    krb5_set_error_message(context, ENOTSUP,
-                           N_("PKINIT: ECDH not supported", ""));
-    return ENOTSUP;
-#endif
 }
 
 void
 _krb5_pk_eckey_free(void *eckey)
 {
-#ifdef HAVE_HCRYPTO_W_OPENSSL
     EC_KEY_free(eckey);
-#endif
 }
 
 #else
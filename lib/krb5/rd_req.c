@@ -187,6 +187,28 @@ find_etypelist(krb5_context context,
     return ret;
 }
 
+static krb5_error_code
+check_ticket_times(krb5_context context, EncTicketPart *t, krb5_flags flags)
+{
+    krb5_timestamp now;
+    time_t start = t->authtime;
+
+    krb5_timeofday (context, &now);
+    if(t->starttime)
+	start = *t->starttime;
+    if(start - now > context->max_skew
+       || (t->flags.invalid
+	   && !(flags & KRB5_VERIFY_AP_REQ_IGNORE_INVALID))) {
+	krb5_clear_error_message (context);
+	return KRB5KRB_AP_ERR_TKT_NYV;
+    }
+    if(now - t->endtime > context->max_skew) {
+	krb5_clear_error_message (context);
+	return KRB5KRB_AP_ERR_TKT_EXPIRED;
+    }
+    return 0;
+}
+
 KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
 krb5_decrypt_ticket(krb5_context context,
 		    Ticket *ticket,
@@ -200,33 +222,12 @@ krb5_decrypt_ticket(krb5_context context,
     if (ret)
 	return ret;
 
-    {
-	krb5_timestamp now;
-	time_t start = t.authtime;
-
-	krb5_timeofday (context, &now);
-	if(t.starttime)
-	    start = *t.starttime;
-	if(start - now > context->max_skew
-	   || (t.flags.invalid
-	       && !(flags & KRB5_VERIFY_AP_REQ_IGNORE_INVALID))) {
-	    free_EncTicketPart(&t);
-	    krb5_clear_error_message (context);
-	    return KRB5KRB_AP_ERR_TKT_NYV;
-	}
-	if(now - t.endtime > context->max_skew) {
-	    free_EncTicketPart(&t);
-	    krb5_clear_error_message (context);
-	    return KRB5KRB_AP_ERR_TKT_EXPIRED;
-	}
-
-	if(!t.flags.transited_policy_checked) {
-	    ret = check_transited(context, ticket, &t);
-	    if(ret) {
-		free_EncTicketPart(&t);
-		return ret;
-	    }
-	}
+    ret = check_ticket_times(context, &t, flags);
+    if (ret == 0 && !t.flags.transited_policy_checked)
+	ret = check_transited(context, ticket, &t);
+    if (ret) {
+	free_EncTicketPart(&t);
+	return ret;
     }
 
     if(out)
@@ -292,6 +293,18 @@ krb5_verify_ap_req(krb5_context context,
 				KRB5_KU_AP_REQ_AUTH);
 }
 
+static krb5_error_code
+verify_ap_req(krb5_context context,
+	      krb5_auth_context *auth_context,
+	      krb5_ap_req *ap_req,
+	      krb5_const_principal server,
+	      krb5_keyblock *keyblock,
+	      const EncTicketPart *decrypted,
+	      krb5_flags flags,
+	      krb5_flags *ap_req_options,
+	      krb5_ticket **ticket,
+	      krb5_key_usage usage);
+
 KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
 krb5_verify_ap_req2(krb5_context context,
 		    krb5_auth_context *auth_context,
@@ -302,6 +315,49 @@ krb5_verify_ap_req2(krb5_context context,
 		    krb5_flags *ap_req_options,
 		    krb5_ticket **ticket,
 		    krb5_key_usage usage)
+{
+    return verify_ap_req(context, auth_context, ap_req, server, keyblock,
+			 NULL, flags, ap_req_options, ticket, usage);
+}
+
+/*
+ * Like krb5_verify_ap_req2(), but with the AP-REQ's ticket already
+ * decrypted by the caller, who is responsible for `decrypted' really
+ * being the decryption of ap_req->ticket (e.g., by having decrypted it
+ * earlier and remembered the ciphertext).  The ticket's times are
+ * checked again, and the authenticator is decrypted and checked as
+ * usual.  Used by the KDC to avoid decrypting the same TGT over and
+ * over.
+ */
+
+KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
+_krb5_verify_ap_req_decrypted(krb5_context context,
+			      krb5_auth_context *auth_context,
+			      krb5_ap_req *ap_req,
+			      krb5_const_principal server,
+			      const EncTicketPart *decrypted,
+			      krb5_flags flags,
+			      krb5_flags *ap_req_options,
+			      krb5_ticket **ticket,
+			      krb5_key_usage usage)
+{
+    if (ap_req->ap_options.use_session_key)
+	return EINVAL;
+    return verify_ap_req(context, auth_context, ap_req, server, NULL,
+			 decrypted, flags, ap_req_options, ticket, usage);
+}
+
+static krb5_error_code
+verify_ap_req(krb5_context context,
+	      krb5_auth_context *auth_context,
+	      krb5_ap_req *ap_req,
+	      krb5_const_principal server,
+	      krb5_keyblock *keyblock,
+	      const EncTicketPart *decrypted,
+	      krb5_flags flags,
+	      krb5_flags *ap_req_options,
+	      krb5_ticket **ticket,
+	      krb5_key_usage usage)
 {
     krb5_ticket *t;
     krb5_auth_context ac;
@@ -327,7 +383,11 @@ krb5_verify_ap_req2(krb5_context context,
 	goto out;
     }
 
-    if (ap_req->ap_options.use_session_key && ac->keyblock){
+    if (decrypted) {
+	ret = copy_EncTicketPart(decrypted, &t->ticket);
+	if (ret == 0)
+	    ret = check_ticket_times(context, &t->ticket, flags);
+    } else if (ap_req->ap_options.use_session_key && ac->keyblock){
 	ret = krb5_decrypt_ticket(context, &ap_req->ticket,
 				  ac->keyblock,
 				  &t->ticket,
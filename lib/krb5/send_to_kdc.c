@@ -164,6 +164,14 @@ struct krb5_sendto_ctx_data {
 	unsigned long num_hosts;
     } stats;
     unsigned int stid;
+
+    /* state of a request in flight */
+    krb5_const_realm realm;
+    krb5_krbhst_handle handle;
+    int hsttype;
+    int action;
+    int numreset;
+    time_t quiet_since;
 };
 
 static void
@@ -304,6 +312,10 @@ struct host {
     time_t timeout;
     krb5_data data;
     unsigned int tid;
+    struct timeval start;	/* when we first tried to connect */
+    int answered;
+    int reused;			/* connection kept from an earlier request */
+    int reusable;		/* nothing is left to read on it */
 };
 
 static void
@@ -364,6 +376,140 @@ host_dead(krb5_context context, struct host *host, const char *msg)
     host->state = DEAD;
 }
 
+/*
+ * The host is dead because of the KDC (or the network to it), as
+ * opposed to us, remember that for next time.
+ */
+
+static void
+host_failed(krb5_context context, struct host *host, const char *msg)
+{
+    _krb5_kdc_health_failure(context, host->hi);
+    host_dead(context, host, msg);
+}
+
+/*
+ * With [libdefaults] kdc_tcp_reuse, the TCP connection a KDC answered
+ * on is kept in the context for kdc_tcp_idle_timeout, and the next
+ * request to that address goes over it.  A connection is only used by
+ * one request at a time: krb5_sendto_context() waits for its reply,
+ * concurrent requests on a context each take their own connection.
+ */
+
+#define KDC_CONN_MAX 8
+
+struct kdc_conn {
+    struct kdc_conn *next;
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    rk_socket_t fd;
+    pid_t pid;
+    time_t idle_until;
+};
+
+/* The KDC may have closed it meanwhile, which we can see without blocking */
+static int
+conn_alive(rk_socket_t fd)
+{
+    char c;
+
+    if (recv(fd, &c, 1, MSG_PEEK) < 0 &&
+	(rk_SOCK_ERRNO == EAGAIN || rk_SOCK_ERRNO == EWOULDBLOCK))
+	return 1;
+    return 0;
+}
+
+static rk_socket_t
+conn_get(krb5_context context, const struct addrinfo *ai)
+{
+    struct kdc_conn **cp, *c, *stale = NULL;
+    rk_socket_t fd = rk_INVALID_SOCKET;
+    time_t now = time(NULL);
+    pid_t pid = getpid();
+
+    HEIMDAL_MUTEX_lock(&context->mutex);
+    for (cp = &context->kdc_conns; (c = *cp) != NULL; ) {
+	if (c->idle_until <= now || c->pid != pid) {
+	    /* Expired, or inherited over fork() */
+	    *cp = c->next;
+	    c->next = stale;
+	    stale = c;
+	} else if (rk_IS_BAD_SOCKET(fd) && c->sslen == ai->ai_addrlen &&
+		   memcmp(&c->ss, ai->ai_addr, c->sslen) == 0) {
+	    *cp = c->next;
+	    fd = c->fd;
+	    free(c);
+	} else {
+	    cp = &c->next;
+	}
+    }
+    HEIMDAL_MUTEX_unlock(&context->mutex);
+
+    while ((c = stale) != NULL) {
+	stale = c->next;
+	rk_closesocket(c->fd);
+	free(c);
+    }
+    if (!rk_IS_BAD_SOCKET(fd) && !conn_alive(fd)) {
+	rk_closesocket(fd);
+	fd = rk_INVALID_SOCKET;
+    }
+    return fd;
+}
+
+static void
+conn_put(krb5_context context, struct host *host)
+{
+    struct kdc_conn **cp, *c;
+    size_t n = 0;
+
+    if (host->ai->ai_addrlen > sizeof(c->ss) ||
+	(c = calloc(1, sizeof(*c))) == NULL)
+	return;
+    memcpy(&c->ss, host->ai->ai_addr, host->ai->ai_addrlen);
+    c->sslen = host->ai->ai_addrlen;
+    c->fd = host->fd;
+    c->pid = getpid();
+    c->idle_until = time(NULL) + context->kdc_tcp_idle_timeout;
+    host->fd = rk_INVALID_SOCKET;
+
+    debug_host(context, 5, host, "keeping connection");
+
+    HEIMDAL_MUTEX_lock(&context->mutex);
+    c->next = context->kdc_conns;
+    context->kdc_conns = c;
+    for (cp = &context->kdc_conns; *cp && n < KDC_CONN_MAX; cp = &(*cp)->next)
+	n++;
+    c = *cp;
+    *cp = NULL;
+    HEIMDAL_MUTEX_unlock(&context->mutex);
+
+    /* Too many, drop the ones kept longest */
+    while (c) {
+	struct kdc_conn *next = c->next;
+
+	rk_closesocket(c->fd);
+	free(c);
+	c = next;
+    }
+}
+
+/**
+ * Close the connections to KDCs kept in `context'.
+ */
+
+KRB5_LIB_FUNCTION void KRB5_LIB_CALL
+_krb5_kdc_conns_free(krb5_context context)
+{
+    struct kdc_conn *c;
+
+    while ((c = context->kdc_conns) != NULL) {
+	context->kdc_conns = c->next;
+	rk_closesocket(c->fd);
+	free(c);
+    }
+}
+
 static krb5_error_code
 send_stream(krb5_context context, struct host *host)
 {
@@ -481,7 +627,12 @@ host_connect(krb5_context context, krb5_sendto_ctx ctx, struct host *host)
 
     debug_host(context, 5, host, "connecting to host");
 
-    if (connect(host->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+    gettimeofday(&host->start, NULL);
+
+    if (host->reused) {
+	debug_host(context, 5, host, "reusing connection");
+	host_connected(context, ctx, host);
+    } else if (connect(host->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
 #ifdef HAVE_WINSOCK
 	if (WSAGetLastError() == WSAEWOULDBLOCK)
 	    errno = EINPROGRESS;
@@ -490,7 +641,7 @@ host_connect(krb5_context context, krb5_sendto_ctx ctx, struct host *host)
 	    debug_host(context, 5, host, "connecting to %d", host->fd);
 	    host->state = CONNECTING;
 	} else {
-	    host_dead(context, host, "failed to connect");
+	    host_failed(context, host, "failed to connect");
 	}
     } else {
 	host_connected(context, ctx, host);
@@ -615,6 +766,7 @@ recv_tcp(krb5_context context, struct host *host, krb5_data *data)
     if (pktlen > host->data.length - 4)
 	return -1;
 
+    host->reusable = (pktlen == host->data.length - 4);
     memmove(host->data.data, ((uint8_t *)host->data.data) + 4, host->data.length - 4);
     host->data.length -= 4;
 
@@ -694,6 +846,65 @@ static struct host_fun udp_fun = {
 };
 
 
+/*
+ * Record the round trip time of a host that answered, unless the
+ * request was sent more than once: then we can't tell which one was
+ * answered.
+ */
+
+static void
+host_answered(krb5_context context, struct host *host)
+{
+    struct timeval now;
+    unsigned long rtt = 0;
+
+    host->answered = 1;
+    if (host->tries == host->fun->ntries) {
+	gettimeofday(&now, NULL);
+	timevalsub(&now, &host->start);
+	if (now.tv_sec >= 0)
+	    rtt = now.tv_sec * 1000000UL + now.tv_usec;
+    }
+    if (rtt)
+	_krb5_kdc_health_success(context, host->hi, rtt);
+}
+
+/*
+ * A kept connection that fails before the KDC said anything was most
+ * likely closed by the KDC as we picked it up: send the request again
+ * over a new one rather than give up on the KDC.
+ */
+
+static int
+host_reconnect(krb5_context context, krb5_sendto_ctx ctx, struct host *host)
+{
+    rk_socket_t fd;
+
+    if (!host->reused || (host->state != CONNECTED && host->data.length))
+	return 0;
+
+    fd = socket(host->ai->ai_family, host->ai->ai_socktype | SOCK_CLOEXEC,
+		host->ai->ai_protocol);
+    if (rk_IS_BAD_SOCKET(fd))
+	return 0;
+    rk_cloexec(fd);
+#ifndef NO_LIMIT_FD_SETSIZE
+    if (fd >= FD_SETSIZE) {
+	rk_closesocket(fd);
+	return 0;
+    }
+#endif
+    socket_set_nonblocking(fd, 1);
+
+    debug_host(context, 5, host, "kept connection was closed, reconnecting");
+    rk_closesocket(host->fd);
+    host->fd = fd;
+    host->reused = 0;
+    krb5_data_free(&host->data);
+    host_connect(context, ctx, host);
+    return 1;
+}
+
 /*
  * Host state machine
  */
@@ -726,9 +937,10 @@ eval_host_state(krb5_context context,
 	} else if (ret == 0) {
 	    /* if recv_foo function returns 0, we have a complete reply */
 	    debug_host(context, 5, host, "host completed");
+	    host_answered(context, host);
 	    return 1;
-	} else {
-	    host_dead(context, host, "host disconnected");
+	} else if (!host_reconnect(context, ctx, host)) {
+	    host_failed(context, host, "host disconnected");
 	}
     }
 
@@ -743,7 +955,8 @@ eval_host_state(krb5_context context,
 	if (ret == -1) {
 	    /* not done yet */
 	} else if (ret) {
-	    host_dead(context, host, "host dead, write failed");
+	    if (!host_reconnect(context, ctx, host))
+		host_failed(context, host, "host dead, write failed");
 	} else
 	    host->state = WAITING_REPLY;
     }
@@ -833,21 +1046,30 @@ submit_request(krb5_context context, krb5_sendto_ctx ctx, krb5_krbhst_info *hi)
     ctx->stats.num_hosts++;
 
     for (a = ai; a != NULL; a = a->ai_next) {
-	rk_socket_t fd;
+	rk_socket_t fd = rk_INVALID_SOCKET;
+	int reused;
 
-	fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
-	if (rk_IS_BAD_SOCKET(fd))
-	    continue;
-	rk_cloexec(fd);
+	if (hi->proto == KRB5_KRBHST_TCP && context->kdc_tcp_reuse &&
+	    ctx->prexmit_func == NULL)
+	    fd = conn_get(context, a);
+	reused = !rk_IS_BAD_SOCKET(fd);
+
+	if (!reused) {
+	    fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+			a->ai_protocol);
+	    if (rk_IS_BAD_SOCKET(fd))
+		continue;
+	    rk_cloexec(fd);
 
 #ifndef NO_LIMIT_FD_SETSIZE
-	if (fd >= FD_SETSIZE) {
-	    _krb5_debug(context, 0, "fd too large for select");
-	    rk_closesocket(fd);
-	    continue;
-	}
+	    if (fd >= FD_SETSIZE) {
+		_krb5_debug(context, 0, "fd too large for select");
+		rk_closesocket(fd);
+		continue;
+	    }
 #endif
-	socket_set_nonblocking(fd, 1);
+	    socket_set_nonblocking(fd, 1);
+	}
 
 	host = heim_alloc(sizeof(*host), "sendto-host", deallocate_host);
 	if (host == NULL) {
@@ -859,6 +1081,7 @@ submit_request(krb5_context context, krb5_sendto_ctx ctx, krb5_krbhst_info *hi)
 	host->hi = hi;
 	host->fd = fd;
 	host->ai = a;
+	host->reused = reused;
 	/* next version of stid */
 	host->tid = ctx->stid = (ctx->stid & 0xffff0000) | ((ctx->stid & 0xffff) + 1);
 
@@ -915,6 +1138,7 @@ struct wait_ctx {
     fd_set wfds;
     unsigned max_fd;
     int got_reply;
+    int events;
     time_t timenow;
 };
 
@@ -939,7 +1163,7 @@ wait_setup(heim_object_t obj, void *iter_ctx, int *stop)
 	heim_assert(h->tries != 0, "tries should not reach 0");
 	h->tries--;
 	if (h->tries == 0) {
-	    host_dead(wait_ctx->context, h, "host timed out");
+	    host_failed(wait_ctx->context, h, "host timed out");
 	    return;
 	} else {
 	    debug_host(wait_ctx->context, 5, h, "retrying sending to");
@@ -988,6 +1212,8 @@ wait_process(heim_object_t obj, void *ctx, int *stop)
     readable = FD_ISSET(h->fd, &wait_ctx->rfds);
     writeable = FD_ISSET(h->fd, &wait_ctx->wfds);
 
+    if (readable || writeable)
+	wait_ctx->events++;
     if (readable || writeable || h->state == CONNECT)
 	wait_ctx->got_reply |= eval_host_state(wait_ctx->context, wait_ctx->ctx, h, readable, writeable);
 
@@ -996,29 +1222,24 @@ wait_process(heim_object_t obj, void *ctx, int *stop)
 	*stop = 1;
 }
 
-static krb5_error_code
-wait_response(krb5_context context, int *action, krb5_sendto_ctx ctx)
-{
-    struct wait_ctx wait_ctx;
-    struct timeval tv;
-    int ret;
-
-    wait_ctx.context = context;
-    wait_ctx.ctx = ctx;
-    FD_ZERO(&wait_ctx.rfds);
-    FD_ZERO(&wait_ctx.wfds);
-    wait_ctx.max_fd = 0;
+/*
+ * Add the sockets of `ctx' to those to wait for.  Returns 0, with the
+ * next action in `*action', if there is nothing to wait for.
+ */
 
+static int
+wait_prepare(krb5_context context, krb5_sendto_ctx ctx,
+	     struct wait_ctx *wait_ctx, int *action)
+{
     /* oh, we have a reply, it must be a plugin that got it for us */
     if (ctx->response.length) {
 	*action = KRB5_SENDTO_FILTER;
 	return 0;
     }
 
-    wait_ctx.timenow = time(NULL);
-
-    heim_array_iterate_f(ctx->hosts, &wait_ctx, wait_setup);
-    heim_array_filter_f(ctx->hosts, &wait_ctx, wait_filter_dead);
+    wait_ctx->ctx = ctx;
+    heim_array_iterate_f(ctx->hosts, wait_ctx, wait_setup);
+    heim_array_filter_f(ctx->hosts, wait_ctx, wait_filter_dead);
 
     if (heim_array_get_length(ctx->hosts) == 0) {
 	if (ctx->stateflags & KRBHST_COMPLETED) {
@@ -1032,28 +1253,106 @@ wait_response(krb5_context context, int *action, krb5_sendto_ctx ctx)
 	}
 	return 0;
     }
+    return 1;
+}
 
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
+/*
+ * Process what select() found for `ctx'.  When waiting for several
+ * requests at once, select() may keep returning for the others: the
+ * request times out when its own hosts were quiet for a second.
+ */
 
-    ret = select(wait_ctx.max_fd + 1, &wait_ctx.rfds, &wait_ctx.wfds, NULL, &tv);
-    if (ret < 0)
-	return errno;
-    if (ret == 0) {
+static void
+wait_process_ctx(krb5_context context, krb5_sendto_ctx ctx,
+		 struct wait_ctx *wait_ctx, int nready, int *action)
+{
+    if (nready == 0) {
+	ctx->quiet_since = 0;
 	*action = KRB5_SENDTO_TIMEOUT;
-	return 0;
+	return;
     }
 
-    wait_ctx.got_reply = 0;
-    heim_array_iterate_f(ctx->hosts, &wait_ctx, wait_process);
-    if (wait_ctx.got_reply)
+    wait_ctx->ctx = ctx;
+    wait_ctx->got_reply = 0;
+    wait_ctx->events = 0;
+    heim_array_iterate_f(ctx->hosts, wait_ctx, wait_process);
+    if (wait_ctx->got_reply) {
 	*action = KRB5_SENDTO_FILTER;
-    else
+    } else if (wait_ctx->events == 0 && ctx->quiet_since == 0) {
+	ctx->quiet_since = wait_ctx->timenow;
+	*action = KRB5_SENDTO_CONTINUE;
+    } else if (wait_ctx->events == 0 &&
+	       wait_ctx->timenow - ctx->quiet_since >= 1) {
+	ctx->quiet_since = 0;
+	*action = KRB5_SENDTO_TIMEOUT;
+    } else {
+	if (wait_ctx->events)
+	    ctx->quiet_since = 0;
 	*action = KRB5_SENDTO_CONTINUE;
+    }
+}
+
+static krb5_error_code
+wait_response(krb5_context context, int *action, krb5_sendto_ctx ctx)
+{
+    struct wait_ctx wait_ctx;
+    struct timeval tv;
+    int ret;
 
+    wait_ctx.context = context;
+    FD_ZERO(&wait_ctx.rfds);
+    FD_ZERO(&wait_ctx.wfds);
+    wait_ctx.max_fd = 0;
+    wait_ctx.timenow = time(NULL);
+
+    if (!wait_prepare(context, ctx, &wait_ctx, action))
+	return 0;
+
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    ret = select(wait_ctx.max_fd + 1, &wait_ctx.rfds, &wait_ctx.wfds, NULL, &tv);
+    if (ret < 0)
+	return errno;
+
+    wait_process_ctx(context, ctx, &wait_ctx, ret, action);
     return 0;
 }
 
+/*
+ * Once we have an answer, hosts that are still silent although they got
+ * their request at least a second before are most likely dead; we won't
+ * wait for them to time out, so count them as failures now.  Hosts
+ * that were still queued were not tried at all.
+ */
+
+static void
+account_outrun(heim_object_t obj, void *ctx, int *stop)
+{
+    krb5_context context = ctx;
+    struct host *h = (struct host *)obj;
+    struct timeval now;
+
+    if (h->state == CONNECT || h->state == DEAD || h->answered)
+	return;
+    gettimeofday(&now, NULL);
+    timevalsub(&now, &h->start);
+    if (now.tv_sec >= 1)
+	_krb5_kdc_health_failure(context, h->hi);
+}
+
+/* Keep the connections that replies came in on for the next request */
+static void
+keep_connection(heim_object_t obj, void *ctx, int *stop)
+{
+    krb5_context context = ctx;
+    struct host *h = (struct host *)obj;
+
+    if (h->answered && h->reusable && h->hi->proto == KRB5_KRBHST_TCP &&
+	!rk_IS_BAD_SOCKET(h->fd))
+	conn_put(context, h);
+}
+
 static void
 reset_context(krb5_context context, krb5_sendto_ctx ctx)
 {
@@ -1065,84 +1364,84 @@ reset_context(krb5_context context, krb5_sendto_ctx ctx)
 
 
 /*
- *
+ * Set up `ctx' to send `send_data' to a KDC of `realm'.
  */
 
-KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
-krb5_sendto_context(krb5_context context,
-		    krb5_sendto_ctx ctx,
-		    const krb5_data *send_data,
-		    krb5_const_realm realm,
-		    krb5_data *receive)
+static void
+sendto_start(krb5_context context, krb5_sendto_ctx ctx,
+	     const krb5_data *send_data, krb5_const_realm realm)
 {
-    krb5_error_code ret = 0;
-    krb5_krbhst_handle handle = NULL;
-    struct timeval nrstart, nrstop, stop_time;
-    int type, freectx = 0;
-    int action;
-    int numreset = 0;
-
-    krb5_data_zero(receive);
-    
-    if (ctx == NULL) {
-	ret = krb5_sendto_ctx_alloc(context, &ctx);
-	if (ret)
-	    goto out;
-	freectx = 1;
-    }
-
     ctx->stid = (context->num_kdc_requests++) << 16;
 
     memset(&ctx->stats, 0, sizeof(ctx->stats));
     gettimeofday(&ctx->stats.start_time, NULL);
 
-    type = ctx->type;
-    if (type == 0) {
+    ctx->hsttype = ctx->type;
+    if (ctx->hsttype == 0) {
 	if ((ctx->flags & KRB5_KRBHST_FLAGS_MASTER) || context->use_admin_kdc)
-	    type = KRB5_KRBHST_ADMIN;
+	    ctx->hsttype = KRB5_KRBHST_ADMIN;
 	else
-	    type = KRB5_KRBHST_KDC;
+	    ctx->hsttype = KRB5_KRBHST_KDC;
     }
 
     ctx->send_data = send_data;
+    ctx->realm = realm;
+    ctx->handle = NULL;
+    ctx->numreset = 0;
+    ctx->quiet_since = 0;
 
     if ((int)send_data->length > context->large_msg_size)
 	ctx->flags |= KRB5_KRBHST_FLAGS_LARGE_MSG;
 
-    /* loop until we get back a appropriate response */
+    ctx->action = KRB5_SENDTO_INITIAL;
+}
 
-    action = KRB5_SENDTO_INITIAL;
+/*
+ * Run the state machine of `ctx' until it is done, or has to wait for
+ * the network (KRB5_SENDTO_CONTINUE).
+ */
 
-    while (action != KRB5_SENDTO_DONE && action != KRB5_SENDTO_FAILED) {
+static krb5_error_code
+sendto_advance(krb5_context context, krb5_sendto_ctx ctx)
+{
+    krb5_error_code ret;
+    struct timeval nrstart, nrstop;
+
+    /* loop until we get back a appropriate response */
+
+    while (ctx->action != KRB5_SENDTO_DONE &&
+	   ctx->action != KRB5_SENDTO_FAILED &&
+	   ctx->action != KRB5_SENDTO_CONTINUE) {
 	krb5_krbhst_info *hi;
 
-	switch (action) {
+	switch (ctx->action) {
 	case KRB5_SENDTO_INITIAL:
-	    ret = realm_via_plugin(context, realm, context->kdc_timeout,
-				   send_data, &ctx->response);
+	    ret = realm_via_plugin(context, ctx->realm, context->kdc_timeout,
+				   ctx->send_data, &ctx->response);
 	    if (ret == 0 || ret != KRB5_PLUGIN_NO_HANDLE) {
-		action = KRB5_SENDTO_DONE;
-		break;
+		ctx->action = KRB5_SENDTO_DONE;
+		return ret;
 	    }
-	    action = KRB5_SENDTO_KRBHST;
+	    ctx->action = KRB5_SENDTO_KRBHST;
 	    /* FALLTHOUGH */
 	case KRB5_SENDTO_KRBHST:
 	    if (ctx->krbhst == NULL) {
-		ret = krb5_krbhst_init_flags(context, realm, type,
-					     ctx->flags, &handle);
+		ret = krb5_krbhst_init_flags(context, ctx->realm, ctx->hsttype,
+					     ctx->flags, &ctx->handle);
 		if (ret)
-		    goto out;
+		    return ret;
 
 		if (ctx->hostname) {
-		    ret = krb5_krbhst_set_hostname(context, handle, ctx->hostname);
+		    ret = krb5_krbhst_set_hostname(context, ctx->handle,
+						   ctx->hostname);
 		    if (ret)
-			goto out;
+			return ret;
 		}
 
 	    } else {
-		handle = heim_retain(ctx->krbhst);
+		ctx->handle = heim_retain(ctx->krbhst);
 	    }
-	    action = KRB5_SENDTO_TIMEOUT;
+	    ctx->action = KRB5_SENDTO_TIMEOUT;
 	    /* FALLTHOUGH */
 	case KRB5_SENDTO_TIMEOUT:
 
@@ -1151,7 +1450,7 @@ krb5_sendto_context(krb5_context context,
 	     */
 
 	    if (ctx->stateflags & KRBHST_COMPLETED) {
-		action = KRB5_SENDTO_CONTINUE;
+		ctx->action = KRB5_SENDTO_CONTINUE;
 		break;
 	    }
 
@@ -1165,73 +1464,80 @@ krb5_sendto_context(krb5_context context,
 
 	    gettimeofday(&nrstart, NULL);
 
-	    ret = krb5_krbhst_next(context, handle, &hi);
+	    ret = krb5_krbhst_next(context, ctx->handle, &hi);
 
 	    gettimeofday(&nrstop, NULL);
 	    timevalsub(&nrstop, &nrstart);
 	    timevaladd(&ctx->stats.krbhst, &nrstop);
 
-	    action = KRB5_SENDTO_CONTINUE;
+	    ctx->action = KRB5_SENDTO_CONTINUE;
 	    if (ret == 0) {
 		_krb5_debug(context, 5, "submissing new requests to new host");
 		if (submit_request(context, ctx, hi) != 0)
-		    action = KRB5_SENDTO_TIMEOUT;
+		    ctx->action = KRB5_SENDTO_TIMEOUT;
 	    } else {
 		_krb5_debug(context, 5, "out of hosts, waiting for replies");
 		ctx->stateflags |= KRBHST_COMPLETED;
 	    }
 
-	    break;
-	case KRB5_SENDTO_CONTINUE:
-
-	    ret = wait_response(context, &action, ctx);
-	    if (ret)
-		goto out;
-
 	    break;
 	case KRB5_SENDTO_RESET:
 	    /* start over */
 	    _krb5_debug(context, 5,
 			"krb5_sendto trying over again (reset): %d",
-			numreset);
+			ctx->numreset);
 	    reset_context(context, ctx);
-	    if (handle) {
-		krb5_krbhst_free(context, handle);
-		handle = NULL;
+	    if (ctx->handle) {
+		krb5_krbhst_free(context, ctx->handle);
+		ctx->handle = NULL;
 	    }
-	    numreset++;
-	    if (numreset >= 3)
-		action = KRB5_SENDTO_FAILED;
+	    ctx->numreset++;
+	    if (ctx->numreset >= 3)
+		ctx->action = KRB5_SENDTO_FAILED;
 	    else
-		action = KRB5_SENDTO_KRBHST;
+		ctx->action = KRB5_SENDTO_KRBHST;
 
 	    break;
 	case KRB5_SENDTO_FILTER:
 	    /* default to next state, the filter function might modify this */
-	    action = KRB5_SENDTO_DONE;
+	    ctx->action = KRB5_SENDTO_DONE;
 
 	    if (ctx->func) {
 		ret = (*ctx->func)(context, ctx, ctx->data,
-				   &ctx->response, &action);
+				   &ctx->response, &ctx->action);
 		if (ret)
-		    goto out;
+		    return ret;
 	    }
-	    break;
-	case KRB5_SENDTO_FAILED:
-	    ret = KRB5_KDC_UNREACH;
-	    break;
-	case KRB5_SENDTO_DONE:
-	    ret = 0;
+	    /* the filter rejected the reply, wait for another one */
+	    if (ctx->action == KRB5_SENDTO_CONTINUE)
+		krb5_data_free(&ctx->response);
 	    break;
 	default:
 	    heim_abort("invalid krb5_sendto_context state");
 	}
     }
+    return 0;
+}
+
+/*
+ * Hand out the reply to the request of `ctx', if it got one, and make
+ * `ctx' ready for another request.
+ */
+
+static krb5_error_code
+sendto_finish(krb5_context context, krb5_sendto_ctx ctx,
+	      krb5_error_code ret, krb5_data *receive)
+{
+    struct timeval stop_time;
 
-out:
     gettimeofday(&stop_time, NULL);
     timevalsub(&stop_time, &ctx->stats.start_time);
-    if (ret == 0 && ctx->response.length) {
+    if (ret == 0 && ctx->action == KRB5_SENDTO_DONE && ctx->response.length) {
+	if (ctx->hosts) {
+	    heim_array_iterate_f(ctx->hosts, context, account_outrun);
+	    if (context->kdc_tcp_reuse && ctx->prexmit_func == NULL)
+		heim_array_iterate_f(ctx->hosts, context, keep_connection);
+	}
 	*receive = ctx->response;
 	krb5_data_zero(&ctx->response);
     } else {
@@ -1240,13 +1546,13 @@ out:
 	ret = KRB5_KDC_UNREACH;
 	krb5_set_error_message(context, ret,
 			       N_("unable to reach any KDC in realm %s", ""),
-			       realm);
+			       ctx->realm);
     }
 
     _krb5_debug(context, 1,
 		"%s %s done: %d hosts: %lu packets: %lu"
 		" wc: %lld.%06lu nr: %lld.%06lu kh: %lld.%06lu tid: %08x",
-		__func__, realm, ret,
+		"krb5_sendto_context", ctx->realm, ret,
 		ctx->stats.num_hosts, ctx->stats.sent_packets,
 		(long long)stop_time.tv_sec,
 		(unsigned long)stop_time.tv_usec,
@@ -1255,14 +1561,147 @@ out:
 		(long long)ctx->stats.krbhst.tv_sec,
 		(unsigned long)ctx->stats.krbhst.tv_usec, ctx->stid);
 
+    reset_context(context, ctx);
+    if (ctx->handle) {
+	krb5_krbhst_free(context, ctx->handle);
+	ctx->handle = NULL;
+    }
+    return ret;
+}
+
+/*
+ *
+ */
+
+KRB5_LIB_FUNCTION krb5_error_code KRB5_LIB_CALL
+krb5_sendto_context(krb5_context context,
+		    krb5_sendto_ctx ctx,
+		    const krb5_data *send_data,
+		    krb5_const_realm realm,
+		    krb5_data *receive)
+{
+    krb5_error_code ret;
+    int freectx = 0;
+
+    krb5_data_zero(receive);
+
+    if (ctx == NULL) {
+	ret = krb5_sendto_ctx_alloc(context, &ctx);
+	if (ret)
+	    return ret;
+	freectx = 1;
+    }
+
+    sendto_start(context, ctx, send_data, realm);
+
+    for (;;) {
+	ret = sendto_advance(context, ctx);
+	if (ret || ctx->action != KRB5_SENDTO_CONTINUE)
+	    break;
+	ret = wait_response(context, &ctx->action, ctx);
+	if (ret)
+	    break;
+    }
+
+    ret = sendto_finish(context, ctx, ret, receive);
 
     if (freectx)
 	krb5_sendto_ctx_free(context, ctx);
-    else
-	reset_context(context, ctx);
-
-    if (handle)
-	krb5_krbhst_free(context, handle);
 
     return ret;
 }
+
+/**
+ * Send `num' requests at once, each to a KDC of its realm, and wait for
+ * all the replies.  Each request has its own sendto context `ctxs[i]',
+ * and is otherwise handled as by krb5_sendto_context(): its reply is
+ * returned in `receive[i]', or the error in `rets[i]'.
+ */
+
+KRB5_LIB_FUNCTION void KRB5_LIB_CALL
+_krb5_sendto_many(krb5_context context,
+		  size_t num,
+		  krb5_sendto_ctx *ctxs,
+		  const krb5_data *send_data,
+		  krb5_const_realm *realms,
+		  krb5_data *receive,
+		  krb5_error_code *rets)
+{
+    struct wait_ctx wait_ctx;
+    struct timeval tv;
+    krb5_error_code ret;
+    unsigned char *state;
+    size_t i, running = num;
+    int nready, timeout;
+#define MANY_RUNNING	0
+#define MANY_WAITING	1
+#define MANY_DONE	2
+
+    if ((state = calloc(num ? num : 1, 1)) == NULL) {
+	for (i = 0; i < num; i++)
+	    rets[i] = krb5_sendto_context(context, ctxs[i], &send_data[i],
+					  realms[i], &receive[i]);
+	return;
+    }
+
+    for (i = 0; i < num; i++) {
+	krb5_data_zero(&receive[i]);
+	sendto_start(context, ctxs[i], &send_data[i], realms[i]);
+    }
+
+    wait_ctx.context = context;
+
+    while (running > 0) {
+	FD_ZERO(&wait_ctx.rfds);
+	FD_ZERO(&wait_ctx.wfds);
+	wait_ctx.max_fd = 0;
+	wait_ctx.timenow = time(NULL);
+	timeout = 1;
+
+	for (i = 0; i < num; i++) {
+	    if (state[i] == MANY_DONE)
+		continue;
+	    state[i] = MANY_RUNNING;
+	    ret = sendto_advance(context, ctxs[i]);
+	    if (ret || ctxs[i]->action != KRB5_SENDTO_CONTINUE) {
+		rets[i] = sendto_finish(context, ctxs[i], ret, &receive[i]);
+		state[i] = MANY_DONE;
+		running--;
+	    } else if (wait_prepare(context, ctxs[i], &wait_ctx,
+				    &ctxs[i]->action)) {
+		state[i] = MANY_WAITING;
+	    } else {
+		/* Something to do without waiting */
+		timeout = 0;
+	    }
+	}
+	if (running == 0)
+	    break;
+
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	nready = select(wait_ctx.max_fd + 1, &wait_ctx.rfds, &wait_ctx.wfds,
+			NULL, &tv);
+	if (nready < 0 && errno == EINTR)
+	    continue;
+
+	for (i = 0; i < num; i++) {
+	    if (state[i] != MANY_WAITING)
+		continue;
+	    if (nready < 0) {
+		rets[i] = sendto_finish(context, ctxs[i], errno, &receive[i]);
+		state[i] = MANY_DONE;
+		running--;
+		continue;
+	    }
+	    /* Quiet for a whole second only if select() itself timed out */
+	    wait_process_ctx(context, ctxs[i], &wait_ctx,
+			     timeout ? nready : nready + 1,
+			     &ctxs[i]->action);
+	}
+    }
+    free(state);
+#undef MANY_RUNNING
+#undef MANY_WAITING
+#undef MANY_DONE
+}
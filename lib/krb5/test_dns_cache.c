@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "krb5_locl.h"
+#include <resolve.h>
+#include <err.h>
+
+/*
+ * Check what _krb5_dns_lookup() caches, with a resolver that answers
+ * as told by `result'.
+ */
+
+enum result { FAKE_ANSWER, FAKE_NXDOMAIN, FAKE_NODATA, FAKE_SERVFAIL };
+
+static enum result result;
+static int lookups;
+
+static struct rk_dns_reply *
+fake_resolver(const char *domain, const char *type_name, int *negative)
+{
+    struct rk_dns_reply *r;
+    struct rk_resource_record *rr;
+    const char *target = "kdc.test.h5l.se";
+
+    lookups++;
+    *negative = (result == FAKE_NXDOMAIN || result == FAKE_NODATA);
+    if (result != FAKE_ANSWER)
+	return NULL;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL ||
+	(rr = calloc(1, sizeof(*rr))) == NULL ||
+	(r->q.domain = strdup(domain)) == NULL ||
+	(rr->domain = strdup(domain)) == NULL ||
+	(rr->u.srv = calloc(1, sizeof(*rr->u.srv) + strlen(target))) == NULL)
+	errx(1, "out of memory");
+    r->q.type = rk_ns_t_srv;
+    r->q.class = rk_ns_c_in;
+    r->head = rr;
+    rr->type = rk_ns_t_srv;
+    rr->class = rk_ns_c_in;
+    rr->ttl = 300;
+    rr->u.srv->port = 88;
+    strcpy(rr->u.srv->target, target);
+    return r;
+}
+
+/* Look up `domain' twice, checking that the resolver is asked `expect' times */
+static void
+check(krb5_context context, const char *name, enum result res, int expect)
+{
+    const char *domain = "_kerberos._udp.TEST.H5L.SE";
+    struct rk_dns_reply *r;
+    int i;
+
+    _krb5_dns_cache_set_resolver(fake_resolver);
+    result = res;
+    lookups = 0;
+    for (i = 0; i < 2; i++) {
+	r = _krb5_dns_lookup(context, domain, "SRV");
+	if ((r != NULL) != (res == FAKE_ANSWER))
+	    errx(1, "%s: lookup %d %s", name, i,
+		 r ? "answered" : "did not answer");
+	if (r) {
+	    if (r->head == NULL || r->head->u.srv->port != 88 ||
+		strcmp(r->head->u.srv->target, "kdc.test.h5l.se") != 0)
+		errx(1, "%s: wrong answer from lookup %d", name, i);
+	    rk_dns_free_data(r);
+	}
+    }
+    if (lookups != expect)
+	errx(1, "%s: %d lookups went to the resolver, expected %d",
+	     name, lookups, expect);
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_context context;
+    krb5_error_code ret;
+
+    ret = krb5_init_context(&context);
+    if (ret)
+	errx(1, "krb5_init_context %d", ret);
+
+    /* Answers and NXDOMAIN/NODATA are cached, resolver failures not */
+    check(context, "answer", FAKE_ANSWER, 1);
+    check(context, "NXDOMAIN", FAKE_NXDOMAIN, 1);
+    check(context, "NODATA", FAKE_NODATA, 1);
+    check(context, "SERVFAIL", FAKE_SERVFAIL, 2);
+
+    _krb5_dns_cache_set_resolver(NULL);
+    krb5_free_context(context);
+
+    return 0;
+}
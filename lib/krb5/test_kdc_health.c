@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Send to a KDC that refuses, and check that the krbhst code then hands
+ * it out after a live one: in this process, and in another one sharing
+ * the health file.
+ */
+
+#include "krb5_locl.h"
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+#include <err.h>
+
+static int
+closed_udp_port(void)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+	err(1, "socket");
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+	err(1, "bind");
+    close(fd);
+    return ntohs(sin.sin_port);
+}
+
+static void
+check_order(krb5_context context, int dead, int live)
+{
+    krb5_error_code ret;
+    krb5_krbhst_handle handle;
+    krb5_krbhst_info *hi;
+
+    ret = krb5_krbhst_init(context, "BOTH.TEST", KRB5_KRBHST_KDC, &handle);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_krbhst_init");
+    ret = krb5_krbhst_next(context, handle, &hi);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_krbhst_next");
+    if (hi->port != live)
+	krb5_errx(context, 1, "dead KDC on port %d was not moved last "
+		  "(got port %d first)", dead, hi->port);
+    ret = krb5_krbhst_next(context, handle, &hi);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_krbhst_next");
+    if (hi->port != dead)
+	krb5_errx(context, 1, "dead KDC on port %d missing", dead);
+    krb5_krbhst_free(context, handle);
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_error_code ret;
+    krb5_context context;
+    krb5_data send, recv;
+    char conf[] = "test_kdc_health.conf.XXXXXX";
+    char *health = NULL;
+    char *env = NULL;
+    FILE *f;
+    int dead, live, fd, status;
+    pid_t pid;
+
+    setprogname(argv[0]);
+
+    if (argc == 4 && strcmp(argv[1], "--check") == 0) {
+	/* In another process: only the health file knows of the dead KDC */
+	ret = krb5_init_context(&context);
+	if (ret)
+	    errx(1, "krb5_init_context");
+	check_order(context, atoi(argv[2]), atoi(argv[3]));
+	krb5_free_context(context);
+	return 0;
+    }
+
+    dead = closed_udp_port();
+    live = dead == 65535 ? dead - 1 : dead + 1;
+
+    if ((fd = mkstemp(conf)) < 0 || (f = fdopen(fd, "w")) == NULL)
+	err(1, "mkstemp");
+    if (asprintf(&health, "%s.health", conf) == -1 || health == NULL)
+	errx(1, "out of memory");
+    fprintf(f,
+	    "[libdefaults]\n"
+	    "\tkdc_timeout = 5\n"
+	    "\tkdc_health_file = %s\n"
+	    "[realms]\n"
+	    "\tDEAD.TEST = {\n"
+	    "\t\tkdc = udp/127.0.0.1:%d\n"
+	    "\t}\n"
+	    "\tBOTH.TEST = {\n"
+	    "\t\tkdc = udp/127.0.0.1:%d\n"
+	    "\t\tkdc = udp/127.0.0.1:%d\n"
+	    "\t}\n", health, dead, dead, live);
+    fclose(f);
+    if (asprintf(&env, "KRB5_CONFIG=%s", conf) == -1 || env == NULL)
+	errx(1, "out of memory");
+    putenv(env);
+
+    ret = krb5_init_context(&context);
+    if (ret)
+	errx(1, "krb5_init_context");
+
+    send.data = "hello";
+    send.length = 5;
+    ret = krb5_sendto_context(context, NULL, &send, "DEAD.TEST", &recv);
+    if (ret == 0)
+	krb5_errx(context, 1, "got an answer from a closed port");
+
+    check_order(context, dead, live);
+    krb5_free_context(context);
+
+    pid = fork();
+    if (pid < 0)
+	err(1, "fork");
+    if (pid == 0) {
+	char d[16], l[16];
+
+	snprintf(d, sizeof(d), "%d", dead);
+	snprintf(l, sizeof(l), "%d", live);
+	execl(argv[0], argv[0], "--check", d, l, (char *)NULL);
+	err(1, "exec %s", argv[0]);
+    }
+    if (waitpid(pid, &status, 0) != pid)
+	err(1, "waitpid");
+
+    unlink(conf);
+    unlink(health);
+    free(health);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	errx(1, "the health file was not shared");
+    return 0;
+}
@@ -37,31 +37,12 @@
 
 #include "errorlist_table.h"
 
-static int
-error_entry_cmp(const void *a, const void *b)
-{
-    const struct error_entry *ea = (const struct error_entry*)a;
-    const struct error_entry *eb = (const struct error_entry*)b;
-
-    if (ea->start >= eb->start && ea->start < eb->start + eb->len)
-	return 0;
-    return ea->start - eb->start;
-}
-
 int
 _wind_stringprep_error(const uint32_t cp, wind_profile_flags flags)
 {
-    struct error_entry ee = {cp, 0, 0};
-    const struct error_entry *s;
+    unsigned n = WIND_TWO_LEVEL(errorlist, WIND_ERRORLIST_PAGE_BITS, cp);
 
-    s = (const struct error_entry *)
-	bsearch(&ee, _wind_errorlist_table,
-		_wind_errorlist_table_size,
-		sizeof(_wind_errorlist_table[0]),
-		error_entry_cmp);
-    if (s == NULL)
-	return 0;
-    return (s->flags & flags);
+    return (_wind_errorlist_flags[n] & flags);
 }
 
 int
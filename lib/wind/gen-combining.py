@@ -40,6 +40,7 @@ import sys
 
 import generate
 import UnicodeData
+import util
 
 if len(sys.argv) != 3:
     print "usage: %s UnicodeData.txt out-dir" % sys.argv[0]
@@ -101,5 +102,12 @@ combining_c.file.write(
     "const size_t _wind_combining_table_size = %u;\n" % len(trans))
 
 
+combiningValues = [0] * (util.maxCodePoint + 1)
+for k in s:
+    combiningValues[k] = trans[k][0]
+
+util.writeTwoLevel(combining_h, combining_c, 'combining', 'unsigned char',
+                   combiningValues, 8)
+
 combining_h.close()
 combining_c.close()
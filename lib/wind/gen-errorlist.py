@@ -42,6 +42,7 @@ import generate
 import rfc3454
 import rfc4518
 import stringprep
+import util
 
 if len(sys.argv) != 3:
     print "usage: %s rfc3454.txt out-dir" % sys.argv[0]
@@ -117,5 +118,31 @@ errorlist_c.file.write(
 errorlist_c.file.write(
     "const size_t _wind_errorlist_table_size = %u;\n" % len(trans))
 
+errorFlags = ['0']
+errorValues = [0] * (util.maxCodePoint + 1)
+
+for x in trans:
+    (start, length, description, tables) = x
+    symbols = stringprep.symbols(error_list, tables)
+    if symbols not in errorFlags:
+        errorFlags.append(symbols)
+    for cp in range(start, start + length):
+        if errorValues[cp] != 0:
+            print "0x%x is in more than one range" % cp
+            sys.exit(1)
+        errorValues[cp] = errorFlags.index(symbols)
+
+errorlist_h.file.write(
+    "extern const wind_profile_flags _wind_errorlist_flags[];\n\n")
+
+errorlist_c.file.write(
+    "\nconst wind_profile_flags _wind_errorlist_flags[] = {\n")
+for x in errorFlags:
+    errorlist_c.file.write("  %s,\n" % x)
+errorlist_c.file.write("};\n\n")
+
+util.writeTwoLevel(errorlist_h, errorlist_c, 'errorlist', 'unsigned char',
+                   errorValues, 8)
+
 errorlist_h.close()
 errorlist_c.close()
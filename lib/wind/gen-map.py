@@ -154,5 +154,18 @@ for x in valTable:
 map_c.file.write(
     "};\n\n")
 
+mapValues = [0] * (util.maxCodePoint + 1)
+
+for i in range(len(trans)):
+    (key, value, description, tables) = trans[i]
+    v = [int(x, 0x10) for x in value.split()]
+    # wind_stringprep()'s ASCII fast path depends on this
+    if key < 0x80 and (len(v) > 1 or [x for x in v if x >= 0x80]):
+        print "0x%x maps to more than one ASCII character" % key
+        sys.exit(1)
+    mapValues[key] = i + 1
+
+util.writeTwoLevel(map_h, map_c, 'map', 'unsigned short', mapValues, 8)
+
 map_h.close()
 map_c.close()
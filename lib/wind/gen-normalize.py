@@ -207,5 +207,14 @@ for k in next_table:
 
 normalize_c.file.write("};\n\n")
 
+normalizeValues = [0] * (util.maxCodePoint + 1)
+i = 0
+for k in sortedKeys(trans):
+    i += 1
+    normalizeValues[k] = i
+
+util.writeTwoLevel(normalize_h, normalize_c, 'normalize', 'unsigned short',
+                   normalizeValues, 8)
+
 normalize_h.close()
 normalize_c.close()
@@ -40,15 +40,6 @@
 
 #include "map_table.h"
 
-static int
-translation_cmp(const void *key, const void *data)
-{
-    const struct translation *t1 = (const struct translation *)key;
-    const struct translation *t2 = (const struct translation *)data;
-
-    return t1->key - t2->key;
-}
-
 int
 _wind_stringprep_map(const uint32_t *in, size_t in_len,
 		     uint32_t *out, size_t *out_len,
@@ -58,13 +49,11 @@ _wind_stringprep_map(const uint32_t *in, size_t in_len,
     unsigned o = 0;
 
     for (i = 0; i < in_len; ++i) {
-	struct translation ts = {in[i], 0, 0, 0};
-	const struct translation *s;
+	unsigned n = WIND_TWO_LEVEL(map, WIND_MAP_PAGE_BITS, in[i]);
+	const struct translation *s = NULL;
 
-	s = (const struct translation *)
-	    bsearch(&ts, _wind_map_table, _wind_map_table_size,
-		    sizeof(_wind_map_table[0]),
-		    translation_cmp);
+	if (n != 0)
+	    s = &_wind_map_table[n - 1];
 	if (s != NULL && (s->flags & flags)) {
 	    unsigned j;
 
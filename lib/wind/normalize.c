@@ -45,15 +45,6 @@
 
 #include "normalize_table.h"
 
-static int
-translation_cmp(const void *key, const void *data)
-{
-    const struct translation *t1 = (const struct translation *)key;
-    const struct translation *t2 = (const struct translation *)data;
-
-    return t1->key - t2->key;
-}
-
 enum { s_base  = 0xAC00};
 enum { s_count = 11172};
 enum { l_base  = 0x1100};
@@ -127,7 +118,6 @@ compat_decomp(const uint32_t *in, size_t in_len,
     unsigned o = 0;
 
     for (i = 0; i < in_len; ++i) {
-	struct translation ts = {in[i], 0, 0};
 	size_t sub_len = *out_len - o;
 	int ret;
 
@@ -138,13 +128,11 @@ compat_decomp(const uint32_t *in, size_t in_len,
 		return ret;
 	    o += sub_len;
 	} else {
-	    void *s = bsearch(&ts,
-			      _wind_normalize_table,
-			      _wind_normalize_table_size,
-			      sizeof(_wind_normalize_table[0]),
-			      translation_cmp);
-	    if (s != NULL) {
-		const struct translation *t = (const struct translation *)s;
+	    unsigned n = WIND_TWO_LEVEL(normalize, WIND_NORMALIZE_PAGE_BITS,
+					in[i]);
+
+	    if (n != 0) {
+		const struct translation *t = &_wind_normalize_table[n - 1];
 
 		ret = compat_decomp(_wind_normalize_val_table + t->val_offset,
 				    t->val_len,
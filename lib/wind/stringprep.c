@@ -39,6 +39,45 @@
 #include <string.h>
 #include <errno.h>
 
+/*
+ * All-ASCII input is the common case (host names, principal names and
+ * most certificate names).  ASCII maps to at most one ASCII character
+ * (gen-map.py checks this), is left alone by NFKC normalization and has
+ * no right-to-left characters, so only the mapping and the prohibited
+ * character check apply.  The results and errors are the same as for
+ * the general case below.
+ */
+
+static int
+stringprep_ascii(const uint32_t *in, size_t in_len,
+		 uint32_t *out, size_t *out_len,
+		 wind_profile_flags flags)
+{
+    uint32_t *tmp;
+    size_t tmp_len = in_len;
+    int ret;
+
+    if ((flags & WIND_PROFILE_LDAP_CASE_EXACT_ATTRIBUTE) == 0) {
+	ret = _wind_stringprep_map(in, in_len, out, out_len, flags);
+	if (ret == 0)
+	    ret = _wind_stringprep_prohibited(out, *out_len, flags);
+	return ret;
+    }
+
+    tmp = malloc(tmp_len * sizeof(uint32_t));
+    if (tmp == NULL)
+	return ENOMEM;
+    ret = _wind_stringprep_map(in, in_len, tmp, &tmp_len, flags);
+    if (ret == 0 && tmp_len > *out_len)
+	ret = WIND_ERR_OVERRUN;
+    if (ret == 0)
+	ret = _wind_stringprep_prohibited(tmp, tmp_len, flags);
+    if (ret == 0)
+	ret = _wind_ldap_case_exact_attribute(tmp, tmp_len, out, out_len);
+    free(tmp);
+    return ret;
+}
+
 /**
  * Process a input UCS4 string according a string-prep profile.
  *
@@ -61,12 +100,18 @@ wind_stringprep(const uint32_t *in, size_t in_len,
     uint32_t *tmp;
     int ret;
     size_t olen;
+    size_t i;
 
     if (in_len == 0) {
 	*out_len = 0;
 	return 0;
     }
 
+    for (i = 0; i < in_len && in[i] < 0x80; i++)
+	;
+    if (i == in_len)
+	return stringprep_ascii(in, in_len, out, out_len, flags);
+
     tmp = malloc(tmp_len * sizeof(uint32_t));
     if (tmp == NULL)
 	return ENOMEM;
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2026 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Check that the two-level lookup tables give the same answers as a
+ * binary search of the sorted tables they were generated from, for
+ * every code point, and that the ASCII fast path of wind_stringprep()
+ * gives the same results as the general case, for random and for all
+ * two character ASCII strings.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "windlocl.h"
+#include "map_table.h"
+#include "errorlist_table.h"
+
+#define ALL_PROFILES (WIND_PROFILE_NAME | WIND_PROFILE_SASL | \
+		      WIND_PROFILE_LDAP | WIND_PROFILE_LDAP_CASE)
+
+#define MAX_LENGTH 24
+#define ITERATIONS 200000
+
+static const wind_profile_flags profiles[] = {
+    WIND_PROFILE_NAME,
+    WIND_PROFILE_SASL,
+    WIND_PROFILE_LDAP,
+    WIND_PROFILE_LDAP | WIND_PROFILE_LDAP_CASE,
+    WIND_PROFILE_LDAP | WIND_PROFILE_LDAP_CASE_EXACT_ATTRIBUTE
+};
+
+static const struct translation *
+ref_map(uint32_t cp)
+{
+    size_t lo = 0, hi = _wind_map_table_size;
+
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+
+	if (_wind_map_table[mid].key == cp)
+	    return &_wind_map_table[mid];
+	if (_wind_map_table[mid].key < cp)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return NULL;
+}
+
+static wind_profile_flags
+ref_error(uint32_t cp)
+{
+    size_t lo = 0, hi = _wind_errorlist_table_size;
+
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	const struct error_entry *e = &_wind_errorlist_table[mid];
+
+	if (cp >= e->start && cp - e->start < e->len)
+	    return e->flags;
+	if (e->start < cp)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return 0;
+}
+
+static unsigned
+check_code_point(uint32_t cp)
+{
+    const struct translation *t = ref_map(cp);
+    uint32_t out[MAX_LENGTH];
+    size_t out_len = MAX_LENGTH;
+    unsigned failures = 0;
+    int ret;
+
+    if (_wind_stringprep_error(cp, ALL_PROFILES) != (ref_error(cp) & ALL_PROFILES)) {
+	printf("code-point 0x%lx: wrong prohibited flags\n", (unsigned long)cp);
+	failures++;
+    }
+
+    ret = _wind_stringprep_map(&cp, 1, out, &out_len, ALL_PROFILES);
+    if (ret) {
+	printf("code-point 0x%lx: map failed: %d\n", (unsigned long)cp, ret);
+	return failures + 1;
+    }
+    if (t != NULL && (t->flags & ALL_PROFILES)) {
+	if (out_len != t->val_len ||
+	    memcmp(out, &_wind_map_table_val[t->val_offset],
+		   out_len * sizeof(out[0])) != 0) {
+	    printf("code-point 0x%lx: wrong mapping\n", (unsigned long)cp);
+	    failures++;
+	}
+    } else if (out_len != 1 || out[0] != cp) {
+	printf("code-point 0x%lx: mapped but should not be\n",
+	       (unsigned long)cp);
+	failures++;
+    }
+    return failures;
+}
+
+/* wind_stringprep() without the ASCII fast path */
+static int
+general_stringprep(const uint32_t *in, size_t in_len,
+		   uint32_t *out, size_t *out_len,
+		   wind_profile_flags flags)
+{
+    size_t tmp_len = in_len * 3;
+    uint32_t tmp[MAX_LENGTH * 3];
+    size_t olen;
+    int ret;
+
+    if (in_len == 0) {
+	*out_len = 0;
+	return 0;
+    }
+    ret = _wind_stringprep_map(in, in_len, tmp, &tmp_len, flags);
+    if (ret)
+	return ret;
+    olen = *out_len;
+    ret = _wind_stringprep_normalize(tmp, tmp_len, tmp, &olen);
+    if (ret)
+	return ret;
+    ret = _wind_stringprep_prohibited(tmp, olen, flags);
+    if (ret)
+	return ret;
+    ret = _wind_stringprep_testbidi(tmp, olen, flags);
+    if (ret)
+	return ret;
+    if (flags & WIND_PROFILE_LDAP_CASE_EXACT_ATTRIBUTE)
+	return _wind_ldap_case_exact_attribute(tmp, olen, out, out_len);
+    memcpy(out, tmp, sizeof(out[0]) * olen);
+    *out_len = olen;
+    return 0;
+}
+
+static unsigned
+check_string(const uint32_t *in, size_t in_len, size_t out_len,
+	     wind_profile_flags flags)
+{
+    uint32_t out1[MAX_LENGTH * 3], out2[MAX_LENGTH * 3];
+    size_t len1 = out_len, len2 = out_len;
+    int ret1, ret2;
+    size_t i;
+
+    ret1 = wind_stringprep(in, in_len, out1, &len1, flags);
+    ret2 = general_stringprep(in, in_len, out2, &len2, flags);
+    if (ret1 == ret2 &&
+	(ret1 != 0 ||
+	 (len1 == len2 && memcmp(out1, out2, len1 * sizeof(out1[0])) == 0)))
+	return 0;
+
+    printf("profile 0x%x, output space %lu: results differ (%d, %d) for",
+	   (unsigned)flags, (unsigned long)out_len, ret1, ret2);
+    for (i = 0; i < in_len; i++)
+	printf(" %02lx", (unsigned long)in[i]);
+    printf("\n");
+    return 1;
+}
+
+int
+main(void)
+{
+    uint32_t in[MAX_LENGTH];
+    unsigned failures = 0;
+    uint32_t cp;
+    size_t i, j, k, n;
+
+    for (cp = 0; cp <= 0x10FFFF; cp++)
+	failures += check_code_point(cp);
+    failures += check_code_point(0x110000);
+    failures += check_code_point(0xFFFFFFFF);
+
+    for (k = 0; k < sizeof(profiles)/sizeof(profiles[0]); k++) {
+	for (i = 0; i < 0x80; i++) {
+	    for (j = 0; j < 0x80; j++) {
+		in[0] = i;
+		in[1] = j;
+		failures += check_string(in, 2, MAX_LENGTH, profiles[k]);
+	    }
+	}
+    }
+
+    srand(4711);
+    for (n = 0; n < ITERATIONS && failures < 10; n++) {
+	size_t in_len = rand() % MAX_LENGTH;
+
+	for (i = 0; i < in_len; i++) {
+	    /* mostly letters and digits, some of everything else */
+	    switch (rand() % 4) {
+	    case 0:
+		in[i] = rand() % 0x80;
+		break;
+	    case 1:
+		in[i] = 'A' + rand() % 26;
+		break;
+	    case 2:
+		in[i] = 'a' + rand() % 26;
+		break;
+	    default:
+		in[i] = "0123456789 .-_@"[rand() % 15];
+		break;
+	    }
+	}
+	k = rand() % (sizeof(profiles)/sizeof(profiles[0]));
+	failures += check_string(in, in_len, rand() % (in_len + 3), profiles[k]);
+    }
+
+    return failures != 0;
+}
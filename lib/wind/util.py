@@ -46,3 +46,46 @@ def subList(l, sl) :
             return i
     return None
 
+
+maxCodePoint = 0x10FFFF
+
+def twoLevel(values, bits) :
+    """Split values, a list indexed by code point, into pages of
+    2**bits entries, sharing pages that are the same.  Return the
+    shared pages, concatenated, and for each page of code points the
+    number of its shared page."""
+    size  = 1 << bits
+    index = []
+    pages = []
+    seen  = {}
+    for start in range(0, maxCodePoint + 1, size):
+        page = tuple(values[start:start + size])
+        if page not in seen:
+            seen[page] = len(pages) >> bits
+            pages.extend(page)
+        index.append(seen[page])
+    for cp in range(0, maxCodePoint + 1):
+        if pages[(index[cp >> bits] << bits) | (cp & (size - 1))] != values[cp]:
+            raise Exception('bad two-level table at 0x%x' % cp)
+    return (index, pages)
+
+def writeArray(file, ctype, name, values) :
+    """Write the C array name of ctype, 16 values per line"""
+    file.write('const %s %s[] = {\n' % (ctype, name))
+    for i in range(0, len(values), 16):
+        file.write('  %s,\n' % ', '.join(['%u' % v for v in values[i:i + 16]]))
+    file.write('};\n\n')
+
+def writeTwoLevel(h, c, name, ctype, values, bits) :
+    """Write the two-level table of values (see twoLevel) as
+    _wind_<name>_index and _wind_<name>_page, for WIND_TWO_LEVEL()"""
+    if len(values) != maxCodePoint + 1:
+        raise Exception('%s: need a value for every code point' % name)
+    (index, pages) = twoLevel(values, bits)
+    if len(pages) >> bits > 0xffff:
+        raise Exception('%s: too many pages' % name)
+    h.file.write('#define WIND_%s_PAGE_BITS %u\n\n' % (name.upper(), bits))
+    h.file.write('extern const unsigned short _wind_%s_index[];\n\n' % name)
+    h.file.write('extern const %s _wind_%s_page[];\n\n' % (ctype, name))
+    writeArray(c.file, 'unsigned short', '_wind_%s_index' % name, index)
+    writeArray(c.file, ctype, '_wind_%s_page' % name, pages)
@@ -46,6 +46,16 @@
 #include "wind.h"
 #include "wind_err.h"
 
+/*
+ * Look up a code point in one of the two-level tables generated by
+ * util.writeTwoLevel(): the index gives the shared page for each run
+ * of 2^bits code points.  Code points beyond U+10FFFF look up as 0.
+ */
+#define WIND_TWO_LEVEL(name, bits, cp)					\
+    ((cp) > 0x10FFFF ? 0 :						\
+     _wind_##name##_page[((unsigned)_wind_##name##_index[(cp) >> (bits)]	\
+			  << (bits)) | ((cp) & ((1U << (bits)) - 1))])
+
 int _wind_combining_class(uint32_t);
 
 int _wind_stringprep_testbidi(const uint32_t *, size_t, wind_profile_flags);